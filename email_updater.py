@@ -7,10 +7,12 @@ from email.mime.text import MIMEText
 from email.mime.image import MIMEImage
 from pathlib import Path
 import sys
+import json
+import subprocess
 import pandas as pd
 from re import fullmatch
 from dotenv import load_dotenv # pip install python-dotenv
-from include.print_logs import logs_to_list
+from include.print_logs import logs_to_list, parse_timestamp, LOG_FILE_NAME
 import matplotlib.pyplot as plt
 import matplotlib.dates
 import datetime
@@ -22,6 +24,7 @@ from io import BytesIO
 PORT = 587
 EMAIL_SERVER = "smtp.gmail.com"
 DATE_FORMAT = "%a %b %d %H:%M:%S %Y"
+REPORT_AGGREGATOR = "./report_aggregator" # make report_aggregator, see tools/report_aggregator.cpp
 
 # load .env variables
 curr_dir = Path(__file__).resolve().parent if "__file__" in locals() else Path.cwd()
@@ -40,6 +43,10 @@ def is_valid_email(email):
     regex = r'[^@]+@[^@]+\.[^@]+'
     return True if fullmatch(regex, email) else False
 
+CHANNELS = ("T_interior", "H_interior", "P_interior", "T_exterior", "H_exterior", "P_exterior")
+TABLE_COLUMNS = (("Int. Temperature [°C]", "T_interior", 2), ("Int. Humidity [%]", "H_interior", 1), ("Int. Pressure [bar]", "P_interior", 3),
+                 ("Ext. Temperature [°C]", "T_exterior", 2), ("Ext. Humidity [%]", "H_exterior", 1), ("Ext. Pressure [bar]", "P_exterior", 3))
+
 def average(lst):
     length = len(lst)
     if length == 0:
@@ -87,39 +94,49 @@ class EmailSender:
             server.login(sender_email, sender_password)
             server.sendmail(sender_email, list(self.valid_emails), msg.as_string())
 
+def week_statistics(to_date, days=7):
+    # per-day min/max/mean/stddev of every channel, computed in one pass by the C++ aggregator
+    result = subprocess.run([REPORT_AGGREGATOR, "-log", LOG_FILE_NAME, "-to", to_date.strftime("%Y-%m-%d"), "-days", str(days)],
+                            capture_output=True, text=True, check=True)
+    return json.loads(result.stdout)
+
 class DataProcessor:
     def set_data(self, to_date):
         to_date = to_date.replace(hour=0, minute=0, second=0)
         self.days = [to_date + datetime.timedelta(days=i-7) for i in range(8)]
-        self.days_data = []
-        for i in range(len(self.days) - 1):
-            print(self.days[i].strftime(DATE_FORMAT))
-        
-            logs_list = logs_to_list(self.days[i], self.days[i + 1])
-            time_stamp_list = []
-            T_interior_list = []
-            H_interior_list = []
-            P_interior_list = []
-            Tint_list = []
-            T_exterior_list = []
-            H_exterior_list = []
-            P_exterior_list = []
-            for log in logs_list:
-                split_line = log.split('\t')
-                time_stamp_list.append(datetime.datetime.strptime(split_line[0], DATE_FORMAT))
-                T_interior_list.append(float(split_line[1]))
-                H_interior_list.append(float(split_line[2]))
-                P_interior_list.append(float(split_line[3]))
-                Tint_list.append(float(split_line[4]))
-                if len(split_line) > 6:
-                    T_exterior_list.append(float(split_line[6]))
-                    H_exterior_list.append(float(split_line[7]))
-                    P_exterior_list.append(float(split_line[8]))
-                else:
-                    T_exterior_list.append(float('nan'))
-                    H_exterior_list.append(float('nan'))
-                    P_exterior_list.append(float('nan'))
-            self.days_data.append((time_stamp_list, T_interior_list, H_interior_list, P_interior_list, Tint_list, T_exterior_list, H_exterior_list, P_exterior_list))
+        self.days_data = [tuple([] for _ in range(8)) for _ in range(len(self.days) - 1)]
+        # the whole week in one backwards walk, newest line first
+        day = len(self.days) - 2
+        for log in logs_to_list(self.days[0], self.days[-1]):
+            split_line = log.split('\t')
+            time_stamp = parse_timestamp(split_line[0])
+            while day > 0 and time_stamp < self.days[day]:
+                day -= 1
+            time_stamp_list, T_interior_list, H_interior_list, P_interior_list, Tint_list, T_exterior_list, H_exterior_list, P_exterior_list = self.days_data[day]
+            time_stamp_list.append(time_stamp)
+            T_interior_list.append(float(split_line[1]))
+            H_interior_list.append(float(split_line[2]))
+            P_interior_list.append(float(split_line[3]))
+            Tint_list.append(float(split_line[4]))
+            if len(split_line) > 6:
+                T_exterior_list.append(float(split_line[6]))
+                H_exterior_list.append(float(split_line[7]))
+                P_exterior_list.append(float(split_line[8]))
+            else:
+                T_exterior_list.append(float('nan'))
+                H_exterior_list.append(float('nan'))
+                P_exterior_list.append(float('nan'))
+        try:
+            self.statistics = week_statistics(to_date)
+        except (OSError, subprocess.CalledProcessError, ValueError) as e:
+            print(f"report_aggregator failed, averaging in Python: {e}")
+            self.statistics = None
+
+    def day_means(self, i):
+        # channel name -> mean of day i, from the aggregator when it ran
+        if self.statistics is not None:
+            return {channel: self.statistics["days"][i][channel]["mean"] for channel in CHANNELS}
+        return {channel: average(self.days_data[i][column]) for channel, column in zip(CHANNELS, (1, 2, 3, 5, 6, 7))}
 
     def produce_weather_report(self):
         fig, ax = plt.subplots(len(self.days_data), 3, figsize=(25, 40))
@@ -169,16 +186,11 @@ class DataProcessor:
 
     def produce_email_message(self):
         # produce table data
-        table_data = [
-            {
-                "Int. Temperature [°C]": round(average(day_data[1]), 2),
-                "Int. Humidity [%]": round(average(day_data[2]), 1),
-                "Int. Pressure [bar]": round(average(day_data[3]), 3),
-                "Ext. Temperature [°C]": round(average(day_data[5]), 2),
-                "Ext. Humidity [%]": round(average(day_data[6]), 1),
-                "Ext. Pressure [bar]": round(average(day_data[7]), 3),
-            } for day_data in self.days_data
-        ]
+        table_data = []
+        for i in range(len(self.days_data)):
+            means = self.day_means(i)
+            table_data.append({header: round(means[channel], digits) if means[channel] is not None else float("NaN")
+                               for header, channel, digits in TABLE_COLUMNS})
         # Custom serial numbers
         table_days = [day.strftime("%a, %d-%m-%Y") for day in self.days[0:-1]]
         table = tabulate(table_data, headers="keys", showindex=table_days, tablefmt="html")
@@ -0,0 +1,137 @@
+#ifndef _ADAPTIVE_SAMPLER_
+#define _ADAPTIVE_SAMPLER_
+
+#include <cmath>
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <linux/types.h>
+#include "log_record.cpp"
+
+#define ADAPTIVE_SAMPLE_MIN_S 0.5f   // poll period while a channel moves
+#define ADAPTIVE_SAMPLE_MAX_S 10.0f  // poll period of a quiet night
+#define ADAPTIVE_RECORD_MIN_S 15.0f  // log period while a channel moves
+#define ADAPTIVE_RECORD_MAX_S 300.0f // log period of a quiet night
+#define ADAPTIVE_WINDOW_S 30.0f      // time constant of the short-term mean, slope and variance of a channel
+#define ADAPTIVE_HALF_LIFE_S 600.0f  // the activity level halves every 10 quiet minutes
+#define ADAPTIVE_NOISE 0.25f         // activity up to a quarter of the thresholds is sensor noise
+
+// A channel is active when the slope of its short-term mean or its short-term standard deviation reaches these
+struct ActivityThreshold
+{
+    float slope_per_min;
+    float deviation;
+};
+
+static const ActivityThreshold ACTIVITY_THRESHOLDS[LOG_CHANNELS] = {
+    {0.05f, 0.1f},      // T_interior, degC: 3 degC an hour, a window opened
+    {0.5f, 0.5f},       // H_interior, %: a shower, cooking
+    {0.00005f, 0.0001f}, // P_interior, bar: 3 hPa an hour, a storm front
+    {FLT_MAX, FLT_MAX}, // T_analog is too noisy to tell anything
+    {0.05f, 0.1f},      // T_exterior
+    {0.5f, 0.5f},       // H_exterior
+    {0.00005f, 0.0001f}, // P_exterior
+};
+
+// lower and upper bound of a period in seconds, equal bounds make it fixed
+struct RateBounds
+{
+    float min_s, max_s;
+
+    // "MIN:MAX" or a single value for a fixed period
+    static RateBounds parse(const char* text)
+    {
+        char* end;
+        RateBounds bounds;
+        bounds.min_s = strtof(text, &end);
+        bounds.max_s = *end == ':' ? strtof(end + 1, &end) : bounds.min_s;
+        if (*end != '\0' || !(bounds.min_s > 0.0f) || !(bounds.max_s >= bounds.min_s))
+            throw std::runtime_error(std::string("Invalid period bounds ") + text + ", expected MIN:MAX seconds with 0 < MIN <= MAX");
+        return bounds;
+    }
+};
+
+// Chooses the sample and the record period from the activity of the signal. Every sample updates
+// per channel an exponentially weighted short-term mean, the slope of that mean and the variance
+// around it; the activity is the largest ratio of these to the channel thresholds. An active
+// signal raises the level at once, a quiet one lets it decay with ADAPTIVE_HALF_LIFE_S, and the
+// periods follow the level geometrically from their upper bound (level 0) to their lower bound
+// (level 1). Times are monotonic ns, so a replay can drive it with its own clock.
+class AdaptiveSampler
+{
+public:
+    AdaptiveSampler(RateBounds sample_period = {ADAPTIVE_SAMPLE_MIN_S, ADAPTIVE_SAMPLE_MAX_S}, RateBounds record_period = {ADAPTIVE_RECORD_MIN_S, ADAPTIVE_RECORD_MAX_S})
+        : _sample_period(sample_period), _record_period(record_period) {}
+
+    // a sample taken at now_ns; missing channels are skipped and restart their statistics when back
+    void observe(const LogRecord& sample, __u64 now_ns)
+    {
+        float activity = 0.0f;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            float value = sample.values[ch];
+            Channel& channel = _channels[ch];
+            if (is_missing(value))
+                continue;
+            float dt = (now_ns - channel.time_ns) * 1e-9f;
+            if (channel.time_ns == 0 || dt > 10.0f * ADAPTIVE_WINDOW_S)
+            {
+                channel = {value, 0.0f, 0.0f, now_ns};
+                continue;
+            }
+            if (dt <= 0.0f)
+                continue;
+            float alpha = 1.0f - expf(-dt / ADAPTIVE_WINDOW_S);
+            float delta = value - channel.mean, previous_mean = channel.mean;
+            channel.mean += alpha * delta;
+            channel.variance = (1.0f - alpha) * (channel.variance + alpha * delta * delta);
+            channel.slope += alpha * ((channel.mean - previous_mean) * 60.0f / dt - channel.slope);
+            channel.time_ns = now_ns;
+            const ActivityThreshold& threshold = ACTIVITY_THRESHOLDS[ch];
+            activity = std::max(activity, std::max(fabsf(channel.slope) / threshold.slope_per_min, sqrtf(channel.variance) / threshold.deviation));
+        }
+        if (_time_ns != 0 && now_ns > _time_ns)
+            _level *= exp2f((now_ns - _time_ns) * -1e-9f / ADAPTIVE_HALF_LIFE_S);
+        _time_ns = now_ns;
+        _level = std::max(_level, std::min(1.0f, (activity - ADAPTIVE_NOISE) / (1.0f - ADAPTIVE_NOISE)));
+    }
+
+    // 0 quiet .. 1 active
+    float level() const
+    {
+        return _level;
+    }
+
+    __u64 sample_period_ns() const
+    {
+        return period_ns(_sample_period);
+    }
+
+    // a record closes once it is this old, so a record of a quiet stretch closes early when the signal starts to move
+    __u64 record_period_ns() const
+    {
+        return period_ns(_record_period);
+    }
+
+private:
+    struct Channel
+    {
+        float mean, variance, slope; // slope per minute
+        __u64 time_ns;               // of the latest sample, 0 before the first one
+    };
+
+    __u64 period_ns(const RateBounds& bounds) const
+    {
+        return static_cast<__u64>(bounds.max_s * powf(bounds.min_s / bounds.max_s, _level) * 1e9f);
+    }
+
+    RateBounds _sample_period, _record_period;
+    Channel _channels[LOG_CHANNELS] = {};
+    float _level = 1.0f; // fast until the statistics have settled
+    __u64 _time_ns = 0;
+};
+
+#endif // _ADAPTIVE_SAMPLER_
@@ -12,11 +12,12 @@ public:
     {
         _i2c_bus = i2c_bus;
         _device_address = device_address;
-        set_config(0);
+        _i2c_bus->name_device(_device_address, "ads1115");
     }
 
     void set_config(__u8 analog_input, __u8 fs_mode = 2)
     {
+        auto lock = _i2c_bus->lock();
         if (analog_input >= 4 || analog_input < 0)
             throw std::runtime_error("analog_input is incorrect.\n");
 
@@ -38,6 +39,7 @@ public:
 
     float read_voltage()
     {
+        auto lock = _i2c_bus->lock();
         _i2c_bus->set_device_address(_device_address);
         _i2c_bus->read_from_device(_buffer, 2);
         return _conversion_factor * static_cast<__s16>(_buffer[0] << 8 | _buffer[1]);
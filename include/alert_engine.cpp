@@ -0,0 +1,477 @@
+#ifndef _ALERT_ENGINE_
+#define _ALERT_ENGINE_
+
+// Threshold, rate of change and missing data alerts evaluated on every raw sample. Rules and sinks
+// come from a config file, one per line, # starts a comment:
+//   rule NAME CHANNEL above|below|rate|missing THRESHOLD [hysteresis H] [for S]
+//   sink file PATH | sink socket PATH | sink exec COMMAND...
+// CHANNEL is a log.txt channel (T_interior, ...) or a derived one (dew_interior, ...). rate compares
+// the absolute change per minute, missing the seconds without a valid value. An alert fires once its
+// condition held for S seconds and clears once the value is back H past the threshold.
+//
+// evaluate() is a flat pass over the rules with a fixed amount of work each (see ./benchmark alerts);
+// the events are handed to the sink thread, a slow hook or a full disk never holds up the sampling loop.
+// Every sink gets one line per event: timestamp, FIRING or CLEARED, rule, channel, value, condition.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <memory>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "log_record.cpp"
+#include "derived_metrics.cpp"
+#include "dumper.cpp"
+#include "ring_queue.cpp"
+
+#define ALERT_CHANNELS (LOG_CHANNELS + DERIVED_CHANNELS)
+#define ALERT_RATE_WINDOW_S 30.0f // time constant of the smoothed rate of change of a channel
+#define ALERT_QUEUE_EVENTS 256    // events waiting for the sinks, more are dropped and counted
+
+extern char** environ;
+
+enum alert_condition
+{
+    ALERT_ABOVE = 0,
+    ALERT_BELOW,
+    ALERT_RATE,   // absolute change per minute above the threshold
+    ALERT_MISSING // no valid value for threshold seconds
+};
+
+static const char* const ALERT_CONDITION_NAMES[] = {"above", "below", "rate", "missing"};
+
+enum alert_sink_type
+{
+    SINK_FILE = 0,
+    SINK_SOCKET, // unix datagram socket, sent to whoever is bound there
+    SINK_EXEC    // run with /bin/sh -c, the event in ALERT_* environment variables
+};
+
+struct AlertRule
+{
+    std::string name;
+    __u8 channel; // a log_channel, or LOG_CHANNELS + a derived_channel
+    alert_condition condition;
+    float threshold;
+    float hysteresis = 0.0f;
+    float hold_s = 0.0f;
+
+    const char* channel_name() const
+    {
+        return channel < LOG_CHANNELS ? CHANNEL_NAMES[channel] : DERIVED_NAMES[channel - LOG_CHANNELS];
+    }
+
+    // "NAME CHANNEL CONDITION THRESHOLD [hysteresis H] [for S]", the part after "rule"
+    static AlertRule parse(const std::string& text)
+    {
+        std::istringstream in(text);
+        std::string channel, condition, option;
+        AlertRule rule;
+        if (!(in >> rule.name >> channel >> condition >> rule.threshold))
+            throw std::runtime_error("Alert rule \"" + text + "\": expected NAME CHANNEL above|below|rate|missing THRESHOLD");
+        rule.channel = ALERT_CHANNELS;
+        for (__u8 ch = 0; ch < ALERT_CHANNELS; ch++)
+            if (channel == (ch < LOG_CHANNELS ? CHANNEL_NAMES[ch] : DERIVED_NAMES[ch - LOG_CHANNELS]))
+                rule.channel = ch;
+        if (rule.channel == ALERT_CHANNELS)
+            throw std::runtime_error("Alert rule \"" + text + "\": unknown channel " + channel);
+        auto found = std::find(std::begin(ALERT_CONDITION_NAMES), std::end(ALERT_CONDITION_NAMES), condition);
+        if (found == std::end(ALERT_CONDITION_NAMES))
+            throw std::runtime_error("Alert rule \"" + text + "\": unknown condition " + condition);
+        rule.condition = alert_condition(found - std::begin(ALERT_CONDITION_NAMES));
+        while (in >> option)
+        {
+            float* value = option == "hysteresis" ? &rule.hysteresis : (option == "for" ? &rule.hold_s : nullptr);
+            if (value == nullptr || !(in >> *value) || *value < 0.0f)
+                throw std::runtime_error("Alert rule \"" + text + "\": expected hysteresis H or for S with H, S >= 0");
+        }
+        return rule;
+    }
+};
+
+struct AlertSink
+{
+    alert_sink_type type;
+    std::string target; // the path, or the command
+
+    // "file PATH", "socket PATH" or "exec COMMAND...", the part after "sink"
+    static AlertSink parse(const std::string& text)
+    {
+        size_t space = text.find_first_of(" \t");
+        std::string type = text.substr(0, space);
+        size_t start = space == std::string::npos ? std::string::npos : text.find_first_not_of(" \t", space);
+        AlertSink sink;
+        sink.target = start == std::string::npos ? "" : text.substr(start);
+        if (type == "file")
+            sink.type = SINK_FILE;
+        else if (type == "socket")
+            sink.type = SINK_SOCKET;
+        else if (type == "exec")
+            sink.type = SINK_EXEC;
+        else
+            throw std::runtime_error("Alert sink \"" + text + "\": expected file, socket or exec");
+        if (sink.target.empty())
+            throw std::runtime_error("Alert sink \"" + text + "\": missing the path or command");
+        return sink;
+    }
+};
+
+struct AlertConfig
+{
+    std::vector<AlertRule> rules;
+    std::vector<AlertSink> sinks;
+
+    static AlertConfig load(const std::string& file_name)
+    {
+        std::ifstream file(file_name);
+        if (!file)
+            throw std::runtime_error("Cannot open the alert config " + file_name);
+        AlertConfig config;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = line.substr(0, line.find('#'));
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == std::string::npos)
+                continue;
+            line = line.substr(start, line.find_last_not_of(" \t\r") + 1 - start);
+            if (line.compare(0, 5, "rule ") == 0)
+                config.rules.push_back(AlertRule::parse(line.substr(5)));
+            else if (line.compare(0, 5, "sink ") == 0)
+                config.sinks.push_back(AlertSink::parse(line.substr(5)));
+            else
+                throw std::runtime_error(file_name + ": expected a rule or a sink line, got \"" + line + "\"");
+        }
+        return config;
+    }
+};
+
+struct AlertEvent
+{
+    __u32 rule;
+    bool firing; // false when it clears
+    __s64 time_ns;
+    float value; // what the condition looked at: the value, the rate per minute or the missing seconds
+};
+
+// Writes the events to the sinks on its own thread, in the order they were raised.
+class AlertSinks
+{
+public:
+    AlertSinks(const AlertConfig& config, timestamp_format format) : _rules(config.rules), _sinks(config.sinks), _formatter(format)
+    {
+        for (const AlertSink& sink : _sinks)
+            if (sink.type == SINK_FILE)
+                _files.push_back(std::make_unique<Dumper>(sink.target));
+        _socket = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        _thread = std::thread(&AlertSinks::run, this);
+    }
+
+    ~AlertSinks()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _running = false;
+        }
+        _wake_up.notify_one();
+        _thread.join();
+        while (_children > 0 && waitpid(-1, nullptr, 0) > 0)
+            _children--;
+        if (_socket >= 0)
+            close(_socket);
+    }
+
+    AlertSinks(const AlertSinks&) = delete;
+    AlertSinks& operator=(const AlertSinks&) = delete;
+
+    // never blocks on a sink, false if the queue was full and the event dropped
+    bool push(const AlertEvent& event)
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if (_queue.size() >= ALERT_QUEUE_EVENTS)
+                return false;
+            _queue.push_back(event);
+        }
+        _wake_up.notify_one();
+        return true;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _wake_up.wait(lock, [this]() { return !_queue.empty() || !_running; });
+            if (_queue.empty())
+                return;
+            AlertEvent event = _queue.front();
+            _queue.pop_front();
+            lock.unlock();
+            deliver(event);
+            lock.lock();
+        }
+    }
+
+    void deliver(const AlertEvent& event)
+    {
+        const AlertRule& rule = _rules[event.rule];
+        char timestamp[40], value[24], threshold[24];
+        std::string_view time_text(timestamp, _formatter.format_timestamp(timestamp, event.time_ns) - timestamp);
+        std::string_view value_text(value, std::to_chars(value, value + sizeof(value), event.value).ptr - value);
+        std::string_view threshold_text(threshold, std::to_chars(threshold, threshold + sizeof(threshold), rule.threshold).ptr - threshold);
+        std::string line = std::string(time_text) + '\t' + (event.firing ? "FIRING" : "CLEARED") + '\t' + rule.name + '\t' + rule.channel_name() + '\t' +
+                           std::string(value_text) + '\t' + ALERT_CONDITION_NAMES[rule.condition] + ' ' + std::string(threshold_text);
+
+        // reap the hooks that finished since the last event
+        while (_children > 0 && waitpid(-1, nullptr, WNOHANG) > 0)
+            _children--;
+
+        size_t file = 0;
+        for (const AlertSink& sink : _sinks)
+        {
+            try
+            {
+                if (sink.type == SINK_FILE)
+                    _files[file++]->dump(line);
+                else if (sink.type == SINK_SOCKET)
+                    send_datagram(sink.target, line);
+                else
+                    spawn(sink.target, event, rule, time_text, value_text, threshold_text);
+            }
+            catch (const std::runtime_error& e)
+            {
+                std::cerr << "Alerts: " << e.what() << "\n";
+            }
+        }
+    }
+
+    // nobody listening is not an error, the event is simply not seen there
+    void send_datagram(const std::string& path, const std::string& line)
+    {
+        sockaddr_un addr = {};
+        if (_socket < 0 || path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("cannot send to " + path);
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        sendto(_socket, line.data(), line.size(), MSG_NOSIGNAL, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+
+    void spawn(const std::string& command, const AlertEvent& event, const AlertRule& rule, std::string_view time_text, std::string_view value_text,
+               std::string_view threshold_text)
+    {
+        std::vector<std::string> variables = {std::string("ALERT_STATE=") + (event.firing ? "FIRING" : "CLEARED"), "ALERT_RULE=" + rule.name,
+                                              std::string("ALERT_CHANNEL=") + rule.channel_name(), "ALERT_VALUE=" + std::string(value_text),
+                                              std::string("ALERT_CONDITION=") + ALERT_CONDITION_NAMES[rule.condition],
+                                              "ALERT_THRESHOLD=" + std::string(threshold_text), "ALERT_TIME=" + std::string(time_text),
+                                              "ALERT_TIME_NS=" + std::to_string(event.time_ns)};
+        std::vector<char*> env;
+        for (char** e = environ; *e != nullptr; e++)
+            env.push_back(*e);
+        for (std::string& variable : variables)
+            env.push_back(&variable[0]);
+        env.push_back(nullptr);
+        const char* argv[] = {"/bin/sh", "-c", command.c_str(), nullptr};
+        pid_t pid;
+        if (posix_spawn(&pid, "/bin/sh", nullptr, nullptr, const_cast<char**>(argv), env.data()) != 0)
+            throw std::runtime_error("cannot run " + command);
+        _children++;
+    }
+
+    std::vector<AlertRule> _rules;
+    std::vector<AlertSink> _sinks;
+    std::vector<std::unique_ptr<Dumper>> _files; // one per file sink, in order
+    RecordFormatter _formatter;
+    int _socket;
+    size_t _children = 0;
+    RingQueue<AlertEvent> _queue{ALERT_QUEUE_EVENTS}; // under _mutex
+    bool _running = true;          // under _mutex
+    std::mutex _mutex;
+    std::condition_variable _wake_up;
+    std::thread _thread;
+};
+
+// The rules compiled to flat arrays: every condition becomes "sign * input > trip" to fire and
+// "sign * input < clear" to clear, over one input per channel and kind (value, rate, missing seconds).
+// Time is passed in by the caller (monotonic ns), so a replay can drive it with its own clock.
+class AlertEngine
+{
+public:
+    AlertEngine(const AlertConfig& config, timestamp_format format = TIMESTAMP_CTIME) : _rules(config.rules)
+    {
+        size_t n = _rules.size();
+        _input.resize(n);
+        _sign.resize(n);
+        _trip.resize(n);
+        _clear.resize(n);
+        _hold_ns.resize(n);
+        _since_ns.assign(n, 0);
+        _active.assign(n, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            const AlertRule& rule = _rules[i];
+            bool below = rule.condition == ALERT_BELOW;
+            _input[i] = rule.channel * 3 + (rule.condition == ALERT_RATE ? 1 : (rule.condition == ALERT_MISSING ? 2 : 0));
+            _sign[i] = below ? -1.0f : 1.0f;
+            _trip[i] = below ? -rule.threshold : rule.threshold;
+            _clear[i] = rule.condition == ALERT_MISSING ? FLT_MIN : _trip[i] - rule.hysteresis; // missing clears with the first valid value
+            if (rule.condition == ALERT_MISSING)
+                _trip[i] = std::nextafter(rule.threshold, 0.0f); // fires at threshold seconds, not one sample later
+            _hold_ns[i] = static_cast<__u64>(rule.hold_s * 1e9);
+            _uses_derived |= rule.channel >= LOG_CHANNELS;
+        }
+        _events.reserve(n);
+        if (!config.sinks.empty())
+            _sinks = std::make_unique<AlertSinks>(config, format);
+    }
+
+    // whether evaluate() needs the derived channels of the sample
+    bool uses_derived() const
+    {
+        return _uses_derived;
+    }
+
+    size_t rules() const
+    {
+        return _rules.size();
+    }
+
+    const AlertRule& rule(size_t i) const
+    {
+        return _rules[i];
+    }
+
+    size_t active() const
+    {
+        return _active_count;
+    }
+
+    __u64 dropped() const
+    {
+        return _dropped;
+    }
+
+    // the events raised by the last evaluate()
+    const std::vector<AlertEvent>& events() const
+    {
+        return _events;
+    }
+
+    // checks every rule against a sample taken at now_ns, returns the number of events raised and sent to the sinks
+    size_t evaluate(const LogRecord& sample, const DerivedRecord* derived, __u64 now_ns)
+    {
+        update_inputs(sample, derived, now_ns);
+        _events.clear();
+        const float* inputs = _inputs;
+        size_t n = _rules.size();
+        for (size_t i = 0; i < n; i++)
+        {
+            float input = inputs[_input[i]];
+            if (is_missing(input))
+                continue; // a missing value neither fires nor clears, the missing rules see it
+            float x = _sign[i] * input;
+            if (!_active[i])
+            {
+                if (!(x > _trip[i]))
+                    _since_ns[i] = 0;
+                else if (_since_ns[i] == 0 && _hold_ns[i] > 0)
+                    _since_ns[i] = now_ns;
+                else if (now_ns - _since_ns[i] >= _hold_ns[i])
+                    raise(i, true, sample.time_ns, input);
+            }
+            else if (x < _clear[i])
+                raise(i, false, sample.time_ns, input);
+        }
+        if (_sinks)
+            for (const AlertEvent& event : _events)
+                if (!_sinks->push(event))
+                    _dropped++;
+        return _events.size();
+    }
+
+private:
+    struct Channel
+    {
+        float mean, slope; // slope per minute
+        __u64 time_ns;     // of the latest valid value, 0 before the first one
+        __u64 valid_ns;    // since when the channel counts as missing, when it is
+    };
+
+    // value, absolute rate per minute and seconds without a value, per channel
+    void update_inputs(const LogRecord& sample, const DerivedRecord* derived, __u64 now_ns)
+    {
+        for (__u8 ch = 0; ch < ALERT_CHANNELS; ch++)
+        {
+            float value = ch < LOG_CHANNELS ? sample.values[ch] : (derived != nullptr ? derived->values[ch - LOG_CHANNELS] : NAN);
+            Channel& channel = _channels[ch];
+            float* input = _inputs + ch * 3;
+            input[0] = value;
+            if (is_missing(value))
+            {
+                if (channel.valid_ns == 0)
+                    channel.valid_ns = now_ns;
+                input[1] = NAN;
+                input[2] = (now_ns - channel.valid_ns) * 1e-9f;
+                continue;
+            }
+            channel.valid_ns = now_ns;
+            input[2] = 0.0f;
+            float dt = (now_ns - channel.time_ns) * 1e-9f;
+            if (channel.time_ns == 0 || dt > 10.0f * ALERT_RATE_WINDOW_S)
+            {
+                channel.mean = value;
+                channel.slope = 0.0f;
+                channel.time_ns = now_ns;
+                input[1] = NAN; // no rate until there are two values
+                continue;
+            }
+            if (dt > 0.0f)
+            {
+                float alpha = 1.0f - expf(-dt / ALERT_RATE_WINDOW_S), previous_mean = channel.mean;
+                channel.mean += alpha * (value - channel.mean);
+                channel.slope += alpha * ((channel.mean - previous_mean) * 60.0f / dt - channel.slope);
+                channel.time_ns = now_ns;
+            }
+            input[1] = fabsf(channel.slope);
+        }
+    }
+
+    void raise(size_t i, bool firing, __s64 time_ns, float value)
+    {
+        _active[i] = firing;
+        _since_ns[i] = 0;
+        if (firing)
+            _active_count++;
+        else
+            _active_count--;
+        _events.push_back({static_cast<__u32>(i), firing, time_ns, value});
+    }
+
+    std::vector<AlertRule> _rules;
+    std::vector<__u16> _input; // index into _inputs
+    std::vector<float> _sign, _trip, _clear;
+    std::vector<__u64> _hold_ns, _since_ns; // since when the condition holds, 0 when it does not
+    std::vector<__u8> _active;
+    float _inputs[ALERT_CHANNELS * 3];
+    Channel _channels[ALERT_CHANNELS] = {};
+    std::vector<AlertEvent> _events;
+    std::unique_ptr<AlertSinks> _sinks;
+    size_t _active_count = 0;
+    __u64 _dropped = 0;
+    bool _uses_derived = false;
+};
+
+#endif // _ALERT_ENGINE_
@@ -0,0 +1,97 @@
+#ifndef _ALLOC_COUNTER_
+#define _ALLOC_COUNTER_
+
+// Counts the heap allocations made by each thread by replacing the global operator new, so the sampling
+// loop can check it allocates nothing once it runs (see -alloc_check in main.cpp and ./benchmark alloc).
+// Replacing operator new is program wide: include this from the .cpp holding main(), and only there.
+// A thread local increment per allocation, the cost is lost in the malloc it goes with.
+
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <linux/types.h>
+
+static thread_local __u64 thread_allocations = 0;
+
+// heap allocations made by the calling thread since it started
+inline __u64 allocation_count()
+{
+    return thread_allocations;
+}
+
+// allocations of the calling thread between its construction and count()
+class AllocationScope
+{
+public:
+    AllocationScope() : _start(thread_allocations) {}
+
+    __u64 count() const
+    {
+        return thread_allocations - _start;
+    }
+
+    void restart()
+    {
+        _start = thread_allocations;
+    }
+
+private:
+    __u64 _start;
+};
+
+static inline void* counted_alloc(size_t size, size_t alignment = 0)
+{
+    thread_allocations++;
+    if (size == 0)
+        size = 1;
+    if (alignment <= alignof(std::max_align_t))
+        return malloc(size);
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* operator new(size_t size)
+{
+    void* p = counted_alloc(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    void* p = counted_alloc(size, static_cast<size_t>(alignment));
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
+
+#endif // _ALLOC_COUNTER_
@@ -0,0 +1,490 @@
+#ifndef _ARCHIVE_
+#define _ARCHIVE_
+
+// Tiered archive of the records moved out of log.txt by the compactor (include/compactor.cpp). One
+// directory, the older the coarser:
+//   raw-T.gorilla   raw records in gorilla blocks, T the time of the first one in ns; segments do not overlap
+//   hourly.rollup   hourly rollups of what is older than the raw segments
+//   daily.rollup    daily rollups of what is older than the hourly ones
+// Files are written under a .tmp name, synced and renamed into place, so a crash leaves the old or the new
+// version; data caught in two tiers by a crash is only read from the coarser one. Readers hold a shared
+// lock for the length of a read, the compactor (the only writer) an exclusive one to rename and swap the index.
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <shared_mutex>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "log_record.cpp"
+#include "log_file.cpp"
+#include "gorilla.cpp"
+#include "rollup.cpp"
+
+#define ARCHIVE_ROLLUP_MAGIC 0x4C4C4F52 // "ROLL"
+#define ARCHIVE_ROLLUP_VERSION 1
+#define ARCHIVE_HOUR_NS 3600000000000LL
+#define ARCHIVE_DAY_NS 86400000000000LL
+
+// start of the step_ns wide bucket holding time_ns, aligned to the epoch like compute_rollups()
+static inline __s64 floor_step(__s64 time_ns, __s64 step_ns)
+{
+    return time_ns - ((time_ns % step_ns) + step_ns) % step_ns;
+}
+
+// makes renames and new files in the directory durable
+static void sync_directory(const std::string& directory)
+{
+    int dir = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir < 0)
+        return;
+    fsync(dir);
+    close(dir);
+}
+
+struct ArchiveSegment
+{
+    std::string file_name; // in the archive directory
+    __s64 first_ns, last_ns;
+    size_t records;
+    __u64 bytes;
+};
+
+struct RollupFileHeader
+{
+    __u32 magic;
+    __u16 version;
+    __u16 rollup_size;
+    __s64 step_ns;
+    __u64 count;
+};
+
+class Archive
+{
+public:
+    Archive(const std::string& directory) : _directory(directory)
+    {
+        if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST)
+            throw std::runtime_error("Archive: cannot create " + directory);
+        load();
+    }
+
+    Archive(const Archive&) = delete;
+    Archive& operator=(const Archive&) = delete;
+
+    // appends the archived records with from_ns <= time_ns < to_ns to out, in time order; a rollup
+    // bucket reads as one record stamped at its start holding the means over its width; stops once out holds max_size,
+    // give or take a segment
+    void read_range(__s64 from_ns, __s64 to_ns, std::vector<LogRecord>& out, size_t max_size = SIZE_MAX)
+    {
+        std::shared_lock<std::shared_mutex> lock(_lock);
+        __s64 daily_end = rollups_end(_daily, ARCHIVE_DAY_NS), hourly_end = std::max(daily_end, rollups_end(_hourly, ARCHIVE_HOUR_NS));
+        append_rollups(_daily, ARCHIVE_DAY_NS, from_ns, to_ns, out);
+        append_rollups(_hourly, ARCHIVE_HOUR_NS, std::max(from_ns, daily_end), to_ns, out);
+        __s64 from_raw = std::max(from_ns, hourly_end);
+        for (const ArchiveSegment& segment : _segments)
+            if (segment.last_ns >= from_raw && segment.first_ns < to_ns && out.size() < max_size)
+                read_segment(segment, from_raw, to_ns, out);
+    }
+
+    // records at or after this time are not in the archive, INT64_MIN when it is empty
+    __s64 end_ns() const
+    {
+        return _end_ns.load(std::memory_order_acquire);
+    }
+
+    // bytes of every archive file
+    __u64 bytes()
+    {
+        std::shared_lock<std::shared_mutex> lock(_lock);
+        __u64 total = rollup_file_bytes(_hourly) + rollup_file_bytes(_daily);
+        for (const ArchiveSegment& segment : _segments)
+            total += segment.bytes;
+        return total;
+    }
+
+    std::vector<ArchiveSegment> segments()
+    {
+        std::shared_lock<std::shared_mutex> lock(_lock);
+        return _segments;
+    }
+
+    size_t hourly_rollups()
+    {
+        std::shared_lock<std::shared_mutex> lock(_lock);
+        return _hourly.size();
+    }
+
+    size_t daily_rollups()
+    {
+        std::shared_lock<std::shared_mutex> lock(_lock);
+        return _daily.size();
+    }
+
+    // start of the oldest hourly, or daily, rollup; INT64_MAX when there is none
+    __s64 first_hourly_ns()
+    {
+        std::shared_lock<std::shared_mutex> lock(_lock);
+        return _hourly.empty() ? INT64_MAX : _hourly.front().start_ns;
+    }
+
+    __s64 first_daily_ns()
+    {
+        std::shared_lock<std::shared_mutex> lock(_lock);
+        return _daily.empty() ? INT64_MAX : _daily.front().start_ns;
+    }
+
+    // The changes below are only made by the compactor thread, one at a time.
+
+    // a new segment of time ordered records, newer than end_ns()
+    void add_segment(const std::vector<LogRecord>& records)
+    {
+        if (records.empty())
+            return;
+        ArchiveSegment segment = write_segment(records.data(), records.size());
+        std::unique_lock<std::shared_mutex> lock(_lock);
+        install(segment.file_name);
+        _segments.push_back(segment);
+        update_end();
+    }
+
+    // merges count adjacent segments from first on into one, returns the bytes saved
+    __u64 merge_segments(size_t first, size_t count)
+    {
+        if (count < 2 || first + count > _segments.size())
+            return 0;
+        std::vector<LogRecord> records;
+        __u64 bytes = 0;
+        for (size_t i = first; i < first + count; i++)
+        {
+            read_segment(_segments[i], INT64_MIN, INT64_MAX, records);
+            bytes += _segments[i].bytes;
+        }
+        // the merged segment is named after its first record like the first input, so the rename replaces it
+        ArchiveSegment merged = write_segment(records.data(), records.size());
+        std::vector<std::string> removed;
+        {
+            std::unique_lock<std::shared_mutex> lock(_lock);
+            install(merged.file_name);
+            for (size_t i = first; i < first + count; i++)
+                if (_segments[i].file_name != merged.file_name)
+                    removed.push_back(_segments[i].file_name);
+            _segments.erase(_segments.begin() + first, _segments.begin() + first + count);
+            _segments.insert(_segments.begin() + first, merged);
+            update_end();
+        }
+        unlink_all(removed);
+        return bytes > merged.bytes ? bytes - merged.bytes : 0;
+    }
+
+    // replaces the raw records older than cutoff_ns (hour aligned) with hourly rollups, returns how many
+    size_t tier_raw(__s64 cutoff_ns)
+    {
+        __s64 rolled_until = std::max(rollups_end(_hourly, ARCHIVE_HOUR_NS), rollups_end(_daily, ARCHIVE_DAY_NS));
+        std::vector<LogRecord> records, older;
+        std::vector<Rollup> rollups;
+        std::vector<ArchiveSegment> remainders;
+        std::vector<std::string> removed;
+        size_t tiered = 0, replaced = 0;
+        for (; replaced < _segments.size() && _segments[replaced].first_ns < cutoff_ns; replaced++)
+        {
+            const ArchiveSegment& segment = _segments[replaced];
+            records.clear();
+            read_segment(segment, INT64_MIN, INT64_MAX, records);
+            auto split = std::lower_bound(records.begin(), records.end(), cutoff_ns, [](const LogRecord& r, __s64 t) { return r.time_ns < t; });
+            // records a crash left in both tiers are in the rollups already
+            auto first = std::lower_bound(records.begin(), split, rolled_until, [](const LogRecord& r, __s64 t) { return r.time_ns < t; });
+            older.assign(first, split);
+            compute_rollups(older, ARCHIVE_HOUR_NS, rollups);
+            tiered += older.size();
+            if (split != records.end())
+                remainders.push_back(write_segment(&*split, records.end() - split));
+            removed.push_back(segment.file_name);
+        }
+        if (replaced == 0)
+            return 0;
+        std::vector<Rollup> hourly = _hourly;
+        merge_rollups(hourly, rollups);
+        write_rollups("hourly.rollup", hourly, ARCHIVE_HOUR_NS);
+        {
+            std::unique_lock<std::shared_mutex> lock(_lock);
+            install("hourly.rollup");
+            for (const ArchiveSegment& remainder : remainders)
+                install(remainder.file_name);
+            _hourly.swap(hourly);
+            _segments.erase(_segments.begin(), _segments.begin() + replaced);
+            _segments.insert(_segments.begin(), remainders.begin(), remainders.end());
+            update_end();
+        }
+        unlink_all(removed);
+        return tiered;
+    }
+
+    // replaces the hourly rollups older than cutoff_ns (day aligned) with daily ones, returns how many
+    size_t tier_hourly(__s64 cutoff_ns)
+    {
+        __s64 rolled_until = rollups_end(_daily, ARCHIVE_DAY_NS);
+        std::vector<Rollup> days;
+        size_t replaced = 0;
+        for (; replaced < _hourly.size() && _hourly[replaced].start_ns < cutoff_ns; replaced++)
+        {
+            const Rollup& hour = _hourly[replaced];
+            if (hour.start_ns < rolled_until)
+                continue;
+            __s64 day = floor_step(hour.start_ns, ARCHIVE_DAY_NS);
+            if (days.empty() || days.back().start_ns != day)
+            {
+                days.emplace_back();
+                days.back().reset(day);
+            }
+            days.back().merge(hour);
+        }
+        if (replaced == 0)
+            return 0;
+        std::vector<Rollup> daily = _daily, hourly(_hourly.begin() + replaced, _hourly.end());
+        merge_rollups(daily, days);
+        write_rollups("daily.rollup", daily, ARCHIVE_DAY_NS);
+        write_rollups("hourly.rollup", hourly, ARCHIVE_HOUR_NS);
+        std::unique_lock<std::shared_mutex> lock(_lock);
+        install("daily.rollup");
+        install("hourly.rollup");
+        _daily.swap(daily);
+        _hourly.swap(hourly);
+        update_end();
+        return replaced;
+    }
+
+    // drops the count oldest daily rollups, the last resort of the disk budget
+    size_t drop_daily(size_t count)
+    {
+        count = std::min(count, _daily.size());
+        if (count == 0)
+            return 0;
+        std::vector<Rollup> daily(_daily.begin() + count, _daily.end());
+        write_rollups("daily.rollup", daily, ARCHIVE_DAY_NS);
+        std::unique_lock<std::shared_mutex> lock(_lock);
+        install("daily.rollup");
+        _daily.swap(daily);
+        update_end();
+        return count;
+    }
+
+private:
+    static __s64 rollups_end(const std::vector<Rollup>& rollups, __s64 step_ns)
+    {
+        return rollups.empty() ? INT64_MIN : rollups.back().start_ns + step_ns;
+    }
+
+    static __u64 rollup_file_bytes(const std::vector<Rollup>& rollups)
+    {
+        return rollups.empty() ? 0 : sizeof(RollupFileHeader) + rollups.size() * sizeof(Rollup);
+    }
+
+    static void append_rollups(const std::vector<Rollup>& rollups, __s64 step_ns, __s64 from_ns, __s64 to_ns, std::vector<LogRecord>& out)
+    {
+        auto first = std::lower_bound(rollups.begin(), rollups.end(), from_ns, [](const Rollup& r, __s64 t) { return r.start_ns < t; });
+        for (auto rollup = first; rollup != rollups.end() && rollup->start_ns < to_ns; ++rollup)
+        {
+            LogRecord record;
+            record.time_ns = rollup->start_ns;
+            for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+                record.values[ch] = rollup->mean(ch);
+            record.ret_code = 0;
+            record.period_s = step_ns / 1e9f;
+            out.push_back(record);
+        }
+    }
+
+    // sorted merge of rollups into into, buckets with the same start are combined
+    static void merge_rollups(std::vector<Rollup>& into, const std::vector<Rollup>& rollups)
+    {
+        into.insert(into.end(), rollups.begin(), rollups.end());
+        std::stable_sort(into.begin(), into.end(), [](const Rollup& a, const Rollup& b) { return a.start_ns < b.start_ns; });
+        size_t kept = 0;
+        for (size_t i = 0; i < into.size(); i++)
+        {
+            if (kept > 0 && into[kept - 1].start_ns == into[i].start_ns)
+                into[kept - 1].merge(into[i]);
+            else
+                into[kept++] = into[i];
+        }
+        into.resize(kept);
+    }
+
+    // appends the records of the segment with from_ns <= time_ns < to_ns, skipping blocks out of the range
+    void read_segment(const ArchiveSegment& segment, __s64 from_ns, __s64 to_ns, std::vector<LogRecord>& out) const
+    {
+        LogFile file(_directory + "/" + segment.file_name); // only for the read-only map
+        const __u8* data = reinterpret_cast<const __u8*>(file.data());
+        for (size_t offset = 0; offset < file.size();)
+        {
+            GorillaBlockHeader header = GorillaBlockDecoder::read_header(data + offset, file.size() - offset);
+            if (header.t_last_ns >= from_ns && header.t_first_ns < to_ns)
+            {
+                size_t first = out.size();
+                GorillaBlockDecoder::decode(data + offset, file.size() - offset, out);
+                if (header.t_first_ns < from_ns || header.t_last_ns >= to_ns)
+                    out.erase(std::remove_if(out.begin() + first, out.end(), [&](const LogRecord& r) { return r.time_ns < from_ns || r.time_ns >= to_ns; }), out.end());
+            }
+            offset += header.size;
+        }
+    }
+
+    // writes the time ordered records as a new segment file, to be installed
+    ArchiveSegment write_segment(const LogRecord* records, size_t count)
+    {
+        GorillaBlockEncoder encoder;
+        std::vector<__u8> data;
+        for (size_t i = 0; i < count; i++)
+        {
+            encoder.append(records[i]);
+            if (encoder.count() == GORILLA_BLOCK_RECORDS)
+                encoder.finish(data);
+        }
+        if (encoder.count() > 0)
+            encoder.finish(data);
+        ArchiveSegment segment = {"raw-" + std::to_string(records[0].time_ns) + ".gorilla", records[0].time_ns, records[count - 1].time_ns, count, data.size()};
+        write_file(segment.file_name, data.data(), data.size());
+        return segment;
+    }
+
+    void write_rollups(const char* file_name, const std::vector<Rollup>& rollups, __s64 step_ns)
+    {
+        RollupFileHeader header = {ARCHIVE_ROLLUP_MAGIC, ARCHIVE_ROLLUP_VERSION, sizeof(Rollup), step_ns, rollups.size()};
+        std::vector<__u8> data(sizeof(header) + rollups.size() * sizeof(Rollup));
+        memcpy(data.data(), &header, sizeof(header));
+        if (!rollups.empty())
+            memcpy(data.data() + sizeof(header), rollups.data(), rollups.size() * sizeof(Rollup));
+        write_file(file_name, data.data(), data.size());
+    }
+
+    // writes and syncs file_name.tmp, install() renames it into place
+    void write_file(const std::string& file_name, const __u8* data, size_t size)
+    {
+        std::string path = _directory + "/" + file_name + ".tmp";
+        int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file < 0)
+            throw std::runtime_error("Archive: cannot create " + path);
+        bool written = write(file, data, size) == static_cast<ssize_t>(size) && fdatasync(file) == 0;
+        close(file);
+        if (!written)
+        {
+            ::unlink(path.c_str());
+            throw std::runtime_error("Archive: error writing " + path);
+        }
+    }
+
+    void install(const std::string& file_name)
+    {
+        std::string path = _directory + "/" + file_name;
+        if (rename((path + ".tmp").c_str(), path.c_str()) < 0)
+            throw std::runtime_error("Archive: cannot rename " + path + ".tmp");
+        sync_directory(_directory);
+    }
+
+    void unlink_all(const std::vector<std::string>& file_names)
+    {
+        for (const std::string& file_name : file_names)
+            ::unlink((_directory + "/" + file_name).c_str());
+        sync_directory(_directory);
+    }
+
+    void update_end()
+    {
+        __s64 end = std::max(rollups_end(_daily, ARCHIVE_DAY_NS), rollups_end(_hourly, ARCHIVE_HOUR_NS));
+        if (!_segments.empty())
+            end = std::max(end, _segments.back().last_ns + 1);
+        _end_ns.store(end, std::memory_order_release);
+    }
+
+    bool load_rollups(const char* file_name, __s64 step_ns, std::vector<Rollup>& out)
+    {
+        std::string path = _directory + "/" + file_name;
+        struct stat status;
+        if (stat(path.c_str(), &status) < 0)
+            return true;
+        LogFile file(path);
+        RollupFileHeader header;
+        if (file.size() < sizeof(header))
+            return false;
+        memcpy(&header, file.data(), sizeof(header));
+        if (header.magic != ARCHIVE_ROLLUP_MAGIC || header.version != ARCHIVE_ROLLUP_VERSION || header.rollup_size != sizeof(Rollup) ||
+            header.step_ns != step_ns || file.size() != sizeof(header) + header.count * sizeof(Rollup))
+            return false;
+        out.resize(header.count);
+        if (header.count > 0)
+            memcpy(out.data(), file.data() + sizeof(header), header.count * sizeof(Rollup));
+        return true;
+    }
+
+    void load()
+    {
+        if (!load_rollups("hourly.rollup", ARCHIVE_HOUR_NS, _hourly) || !load_rollups("daily.rollup", ARCHIVE_DAY_NS, _daily))
+            throw std::runtime_error("Archive: unreadable rollups in " + _directory);
+
+        DIR* dir = opendir(_directory.c_str());
+        if (dir == nullptr)
+            throw std::runtime_error("Archive: cannot read " + _directory);
+        std::vector<std::string> names;
+        while (dirent* entry = readdir(dir))
+            names.push_back(entry->d_name);
+        closedir(dir);
+        for (const std::string& name : names)
+        {
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)
+                ::unlink((_directory + "/" + name).c_str()); // written before a crash, never installed
+            else if (name.compare(0, 4, "raw-") == 0 && name.size() > 12 && name.compare(name.size() - 8, 8, ".gorilla") == 0)
+            {
+                ArchiveSegment segment = {name, INT64_MAX, INT64_MIN, 0, 0};
+                LogFile file(_directory + "/" + name);
+                const __u8* data = reinterpret_cast<const __u8*>(file.data());
+                try
+                {
+                    for (size_t offset = 0; offset < file.size();)
+                    {
+                        GorillaBlockHeader header = GorillaBlockDecoder::read_header(data + offset, file.size() - offset);
+                        segment.first_ns = std::min(segment.first_ns, header.t_first_ns);
+                        segment.last_ns = std::max(segment.last_ns, header.t_last_ns);
+                        segment.records += header.count;
+                        offset += header.size;
+                    }
+                }
+                catch (const std::runtime_error& e)
+                {
+                    std::cout << "Archive: skipping " << name << ", " << e.what() << "\n";
+                    continue;
+                }
+                segment.bytes = file.size();
+                if (segment.records > 0)
+                    _segments.push_back(segment);
+            }
+        }
+        // a merge interrupted by a crash leaves inputs inside the merged segment
+        std::sort(_segments.begin(), _segments.end(), [](const ArchiveSegment& a, const ArchiveSegment& b) { return a.first_ns < b.first_ns || (a.first_ns == b.first_ns && a.last_ns > b.last_ns); });
+        std::vector<std::string> removed;
+        size_t kept = 0;
+        for (size_t i = 0; i < _segments.size(); i++)
+        {
+            if (kept > 0 && _segments[i].last_ns <= _segments[kept - 1].last_ns)
+                removed.push_back(_segments[i].file_name);
+            else
+                _segments[kept++] = _segments[i];
+        }
+        _segments.resize(kept);
+        unlink_all(removed);
+        update_end();
+    }
+
+    std::string _directory;
+    std::vector<ArchiveSegment> _segments; // oldest first
+    std::vector<Rollup> _hourly, _daily;   // oldest first
+    std::atomic<__s64> _end_ns{INT64_MIN};
+    std::shared_mutex _lock;
+};
+
+#endif // _ARCHIVE_
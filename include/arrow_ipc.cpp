@@ -0,0 +1,448 @@
+#ifndef _ARROW_IPC_
+#define _ARROW_IPC_
+
+// Writer of the Apache Arrow IPC format, as a stream or as a file (Feather v2), without the Arrow
+// libraries: pyarrow, polars, DuckDB or R read the output straight into columns, e.g.
+//   pyarrow.feather.read_table("log.arrow")  or  pyarrow.ipc.open_stream(urlopen(".../export")).read_all()
+// The column buffers are handed to the output as they are, only the small metadata messages are built, so
+// the cost is the copy by the output. Arrow's layout is little endian, like the Raspberry Pi and x86.
+//   stream: schema message, record batch messages, end of stream marker
+//   file:   "ARROW1\0\0", the stream, footer (schema and record batch index), footer size, "ARROW1"
+// Messages are a 0xFFFFFFFF marker, the size of the metadata, the metadata flatbuffer (Message.fbs) and the
+// body with the buffers of the batch, each one ARROW_ALIGN aligned from the start of the output.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <linux/types.h>
+#include "log_record.cpp"
+
+#define ARROW_ALIGN 64 // of the body and of each buffer in it, as the Arrow libraries do
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+#define ARROW_METADATA_V5 4
+
+enum arrow_format
+{
+    ARROW_STREAM,
+    ARROW_FILE
+};
+
+// the column types the logger has
+enum arrow_type
+{
+    ARROW_TIMESTAMP_NS, // s64, ns since the epoch, UTC
+    ARROW_FLOAT32,
+    ARROW_INT32
+};
+
+struct ArrowField
+{
+    std::string name;
+    arrow_type type;
+    bool nullable;
+};
+
+// a column of a record batch: the values, and the validity bitmap (bit i of byte i / 8 set when row i has a
+// value) when null_count is not 0
+struct ArrowArray
+{
+    const void* values;
+    const __u8* validity = nullptr;
+    size_t null_count = 0;
+};
+
+// the validity bitmap of a float column with nan for missing values, returns the null count
+static size_t arrow_validity(const float* values, size_t rows, std::vector<__u8>& bitmap)
+{
+    bitmap.resize((rows + 7) / 8);
+    size_t valid = 0;
+    for (size_t byte = 0; byte < bitmap.size(); byte++)
+    {
+        __u8 bits = 0;
+        for (size_t i = byte * 8, bit = 0; bit < 8 && i < rows; i++, bit++)
+            bits |= !is_missing(values[i]) << bit;
+        bitmap[byte] = bits;
+        valid += __builtin_popcount(bits);
+    }
+    return rows - valid;
+}
+
+// Just enough of a flatbuffer builder for the Arrow metadata. Builds back to front like the reference
+// implementation: children before their parents, so every offset points forward, and objects are
+// referred to by their distance from the end of the buffer.
+class FlatBufferBuilder
+{
+public:
+    typedef __u32 Ref;
+
+    FlatBufferBuilder() : _buffer(1024), _head(_buffer.size()) {}
+
+    void clear()
+    {
+        _head = _buffer.size();
+        _min_align = 1;
+        _fields.clear();
+    }
+
+    Ref size() const
+    {
+        return _buffer.size() - _head;
+    }
+
+    const __u8* data() const
+    {
+        return _buffer.data() + _head;
+    }
+
+    template <typename T>
+    void push(T value)
+    {
+        prep(sizeof(T), 0);
+        prepend(&value, sizeof(T));
+    }
+
+    // an offset to an object built before
+    void push_ref(Ref ref)
+    {
+        prep(sizeof(__u32), 0);
+        __u32 offset = size() + sizeof(__u32) - ref;
+        prepend(&offset, sizeof(offset));
+    }
+
+    Ref string(std::string_view text)
+    {
+        prep(sizeof(__u32), text.size() + 1);
+        __u8 terminator = 0;
+        prepend(&terminator, 1);
+        prepend(text.data(), text.size());
+        __u32 length = text.size();
+        prepend(&length, sizeof(length));
+        return size();
+    }
+
+    // a vector of structs (or scalars), count of them size bytes each
+    Ref struct_vector(const void* structs, size_t count, size_t struct_size, size_t struct_align)
+    {
+        prep(sizeof(__u32), count * struct_size);
+        prep(struct_align, count * struct_size);
+        if (count > 0)
+            prepend(structs, count * struct_size);
+        __u32 length = count;
+        prepend(&length, sizeof(length));
+        return size();
+    }
+
+    // a vector of tables
+    Ref ref_vector(const std::vector<Ref>& refs)
+    {
+        prep(sizeof(__u32), refs.size() * sizeof(__u32));
+        for (size_t i = refs.size(); i-- > 0;)
+            push_ref(refs[i]);
+        __u32 length = refs.size();
+        prepend(&length, sizeof(length));
+        return size();
+    }
+
+    // the fields of a table are added between start_table() and end_table(), after any object they refer to
+    void start_table()
+    {
+        _fields.clear();
+        _table_start = size();
+    }
+
+    template <typename T>
+    void add(size_t field, T value)
+    {
+        push(value);
+        field_ref(field) = size();
+    }
+
+    void add_ref(size_t field, Ref ref)
+    {
+        push_ref(ref);
+        field_ref(field) = size();
+    }
+
+    // writes the vtable of the table right before it
+    Ref end_table()
+    {
+        push<__s32>(0);
+        Ref table = size();
+        for (size_t i = _fields.size(); i-- > 0;)
+            push<__u16>(_fields[i] == 0 ? 0 : table - _fields[i]);
+        push<__u16>(table - _table_start);
+        push<__u16>((_fields.size() + 2) * sizeof(__u16));
+        __s32 vtable_offset = size() - table;
+        memcpy(_buffer.data() + _buffer.size() - table, &vtable_offset, sizeof(vtable_offset));
+        _fields.clear();
+        return table;
+    }
+
+    // the root offset; the size of the finished buffer is a multiple of its largest alignment
+    void finish(Ref root)
+    {
+        prep(std::max<size_t>(_min_align, sizeof(__u32)), sizeof(__u32));
+        push_ref(root);
+    }
+
+private:
+    // pads so that additional bytes after the padding end aligned to align
+    void prep(size_t align, size_t additional)
+    {
+        _min_align = std::max(_min_align, align);
+        size_t padding = (align - (size() + additional) % align) % align;
+        reserve(padding + additional);
+        _head -= padding;
+        memset(_buffer.data() + _head, 0, padding);
+    }
+
+    void prepend(const void* data, size_t length)
+    {
+        reserve(length);
+        _head -= length;
+        memcpy(_buffer.data() + _head, data, length);
+    }
+
+    void reserve(size_t length)
+    {
+        if (_head >= length)
+            return;
+        size_t used = size(), capacity = std::max(_buffer.size() * 2, used + length);
+        std::vector<__u8> grown(capacity);
+        memcpy(grown.data() + capacity - used, data(), used);
+        _buffer.swap(grown);
+        _head = capacity - used;
+    }
+
+    Ref& field_ref(size_t field)
+    {
+        if (field >= _fields.size())
+            _fields.resize(field + 1, 0);
+        return _fields[field];
+    }
+
+    std::vector<__u8> _buffer;
+    size_t _head;
+    size_t _min_align = 1;
+    std::vector<Ref> _fields; // of the table being built, 0 when absent
+    Ref _table_start = 0;
+};
+
+// Writes the schema on construction, then a record batch per write_batch(), and finish() ends the stream or
+// file. The output is called with consecutive pieces of it, from the caller's thread.
+class ArrowWriter
+{
+public:
+    typedef std::function<void(const void* data, size_t size)> Output;
+
+    ArrowWriter(arrow_format format, const std::vector<ArrowField>& fields, Output output) : _format(format), _fields(fields), _output(output)
+    {
+        if (_format == ARROW_FILE)
+            emit("ARROW1\0\0", 8);
+        _builder.clear();
+        write_message(MESSAGE_SCHEMA, schema(), 0);
+    }
+
+    ArrowWriter(const ArrowWriter&) = delete;
+    ArrowWriter& operator=(const ArrowWriter&) = delete;
+
+    // rows of every field, arrays in the order of the fields
+    void write_batch(size_t rows, const ArrowArray* arrays)
+    {
+        _nodes.clear();
+        _buffers.clear();
+        __s64 body = 0;
+        for (size_t f = 0; f < _fields.size(); f++)
+        {
+            _nodes.push_back({static_cast<__s64>(rows), static_cast<__s64>(arrays[f].null_count)});
+            __s64 validity = arrays[f].null_count > 0 ? (rows + 7) / 8 : 0, values = rows * value_size(_fields[f].type);
+            _buffers.push_back({body, validity});
+            body += padded(validity);
+            _buffers.push_back({body, values});
+            body += padded(values);
+        }
+        _builder.clear();
+        FlatBufferBuilder::Ref nodes = _builder.struct_vector(_nodes.data(), _nodes.size(), sizeof(FieldNode), alignof(FieldNode));
+        FlatBufferBuilder::Ref buffers = _builder.struct_vector(_buffers.data(), _buffers.size(), sizeof(BufferSpan), alignof(BufferSpan));
+        _builder.start_table(); // RecordBatch
+        _builder.add<__s64>(0, rows);
+        _builder.add_ref(1, nodes);
+        _builder.add_ref(2, buffers);
+        FlatBufferBuilder::Ref batch = _builder.end_table();
+
+        Block block = write_message(MESSAGE_RECORD_BATCH, batch, body);
+        for (size_t f = 0; f < _fields.size(); f++)
+        {
+            if (arrays[f].null_count > 0)
+                emit_padded(arrays[f].validity, _buffers[2 * f].length);
+            emit_padded(arrays[f].values, _buffers[2 * f + 1].length);
+        }
+        _blocks.push_back(block);
+    }
+
+    // end of stream marker, and for a file the footer
+    void finish()
+    {
+        __u32 end[2] = {ARROW_CONTINUATION, 0};
+        emit(end, sizeof(end));
+        if (_format != ARROW_FILE)
+            return;
+        _builder.clear();
+        FlatBufferBuilder::Ref batches = _builder.struct_vector(_blocks.data(), _blocks.size(), sizeof(Block), alignof(Block));
+        FlatBufferBuilder::Ref dictionaries = _builder.struct_vector(nullptr, 0, sizeof(Block), alignof(Block));
+        FlatBufferBuilder::Ref schema_ref = schema();
+        _builder.start_table(); // Footer
+        _builder.add<__s16>(0, ARROW_METADATA_V5);
+        _builder.add_ref(1, schema_ref);
+        _builder.add_ref(2, dictionaries);
+        _builder.add_ref(3, batches);
+        _builder.finish(_builder.end_table());
+        emit(_builder.data(), _builder.size());
+        __s32 footer_size = _builder.size();
+        emit(&footer_size, sizeof(footer_size));
+        emit("ARROW1", 6);
+    }
+
+    // written so far
+    __u64 bytes() const
+    {
+        return _offset;
+    }
+
+private:
+    enum message_header
+    {
+        MESSAGE_SCHEMA = 1,
+        MESSAGE_RECORD_BATCH = 3
+    };
+
+    // Schema.fbs and Message.fbs structs
+    struct FieldNode
+    {
+        __s64 length, null_count;
+    };
+    struct BufferSpan
+    {
+        __s64 offset, length;
+    };
+    struct Block
+    {
+        __s64 offset;
+        __s32 metadata_length;
+        __s32 padding;
+        __s64 body_length;
+    };
+
+    static size_t value_size(arrow_type type)
+    {
+        return type == ARROW_TIMESTAMP_NS ? sizeof(__s64) : sizeof(__s32);
+    }
+
+    static __s64 padded(__s64 size)
+    {
+        return (size + ARROW_ALIGN - 1) / ARROW_ALIGN * ARROW_ALIGN;
+    }
+
+    // the Schema table, in the builder
+    FlatBufferBuilder::Ref schema()
+    {
+        std::vector<FlatBufferBuilder::Ref> fields;
+        for (const ArrowField& field : _fields)
+        {
+            FlatBufferBuilder::Ref name = _builder.string(field.name);
+            FlatBufferBuilder::Ref children = _builder.ref_vector({});
+            FlatBufferBuilder::Ref type;
+            __u8 type_type;
+            if (field.type == ARROW_TIMESTAMP_NS)
+            {
+                FlatBufferBuilder::Ref timezone = _builder.string("UTC");
+                _builder.start_table();
+                _builder.add<__s16>(0, 3); // TimeUnit.NANOSECOND
+                _builder.add_ref(1, timezone);
+                type = _builder.end_table();
+                type_type = 10; // Type.Timestamp
+            }
+            else if (field.type == ARROW_FLOAT32)
+            {
+                _builder.start_table();
+                _builder.add<__s16>(0, 1); // Precision.SINGLE
+                type = _builder.end_table();
+                type_type = 3; // Type.FloatingPoint
+            }
+            else
+            {
+                _builder.start_table();
+                _builder.add<__s32>(0, 32);
+                _builder.add<__u8>(1, 1); // signed
+                type = _builder.end_table();
+                type_type = 2; // Type.Int
+            }
+            _builder.start_table(); // Field
+            _builder.add_ref(0, name);
+            _builder.add<__u8>(1, field.nullable);
+            _builder.add<__u8>(2, type_type);
+            _builder.add_ref(3, type);
+            _builder.add_ref(5, children);
+            fields.push_back(_builder.end_table());
+        }
+        FlatBufferBuilder::Ref field_vector = _builder.ref_vector(fields);
+        _builder.start_table(); // Schema
+        _builder.add<__s16>(0, 0); // Endianness.Little
+        _builder.add_ref(1, field_vector);
+        return _builder.end_table();
+    }
+
+    // the Message around header, its metadata padded so that the body starts ARROW_ALIGN aligned
+    Block write_message(message_header type, FlatBufferBuilder::Ref header, __s64 body_length)
+    {
+        _builder.start_table(); // Message
+        _builder.add<__s16>(0, ARROW_METADATA_V5);
+        _builder.add<__u8>(1, type);
+        _builder.add_ref(2, header);
+        _builder.add<__s64>(3, body_length);
+        _builder.finish(_builder.end_table());
+
+        Block block = {static_cast<__s64>(_offset), 0, 0, body_length};
+        __u32 prefix[2] = {ARROW_CONTINUATION, 0};
+        size_t metadata = padded(_offset + sizeof(prefix) + _builder.size()) - _offset - sizeof(prefix);
+        prefix[1] = metadata;
+        emit(prefix, sizeof(prefix));
+        emit_padded(_builder.data(), _builder.size(), metadata);
+        block.metadata_length = sizeof(prefix) + metadata;
+        return block;
+    }
+
+    void emit(const void* data, size_t size)
+    {
+        _output(data, size);
+        _offset += size;
+    }
+
+    // data and zeros up to to_size, or up to ARROW_ALIGN
+    void emit_padded(const void* data, size_t size, size_t to_size = 0)
+    {
+        static const __u8 zeros[ARROW_ALIGN] = {};
+        if (size > 0)
+            emit(data, size);
+        for (size_t padding = (to_size > 0 ? to_size : padded(size)) - size; padding > 0;)
+        {
+            size_t n = std::min<size_t>(padding, sizeof(zeros));
+            emit(zeros, n);
+            padding -= n;
+        }
+    }
+
+    arrow_format _format;
+    std::vector<ArrowField> _fields;
+    Output _output;
+    __u64 _offset = 0;
+    FlatBufferBuilder _builder;
+    std::vector<FieldNode> _nodes;
+    std::vector<BufferSpan> _buffers;
+    std::vector<Block> _blocks; // of the record batches, for the footer
+};
+
+#endif // _ARROW_IPC_
@@ -1,4 +1,6 @@
 #include "i2c_bus.cpp"
+#include <fstream>
+#include <string>
 
 #ifndef _BME280_
 #define _BME280_
@@ -75,40 +77,68 @@ typedef struct
 class BME280
 {
 public:
-    BME280(I2C_BUS* i2c_bus, __u16 device_address = 0x77)
+    BME280(I2C_BUS* i2c_bus, __u16 device_address = 0x77, std::string cal_cache_file_name = "")
     {
         _i2c_bus = i2c_bus;
         _device_address = device_address;
-        set_config();
+        _i2c_bus->name_device(_device_address, "bme280");
+        _cal_cache_file_name = cal_cache_file_name;
     }
 
     void set_config()
     {
-        _i2c_bus->set_device_address(_device_address);
-
-        // reset the device using soft-reset
-        write8(BME280_REGISTER_SOFTRESET, 0xB6);
-
-        while(is_reading_calibration())
+        // the bus is only held per transaction, so other devices can be initialized while this one waits
+        __u8 chip_id;
         {
-            usleep(10000);
-            std::cout << "BME280: reading calibration...\n";
+            auto lock = _i2c_bus->lock();
+            _i2c_bus->set_device_address(_device_address);
+            chip_id = read8(BME280_REGISTER_CHIPID);
         }
 
-    std::cout << "BME280: reading coeficients.\n";
-    read_coefficients();
-
-    std::cout << "BME280: setting sampling.\n";
-    set_sampling();
+        if (load_cal_cache(chip_id))
+        {
+            std::cout << "BME280: using cached coeficients.\n";
+        }
+        else
+        {
+            {
+                // reset the device using soft-reset
+                auto lock = _i2c_bus->lock();
+                _i2c_bus->set_device_address(_device_address);
+                write8(BME280_REGISTER_SOFTRESET, 0xB6);
+            }
+            usleep(2000); // start-up time after reset
+
+            while(is_reading_calibration())
+            {
+                usleep(10000);
+                std::cout << "BME280: reading calibration...\n";
+            }
+
+            std::cout << "BME280: reading coeficients.\n";
+            {
+                auto lock = _i2c_bus->lock();
+                _i2c_bus->set_device_address(_device_address);
+                read_coefficients();
+            }
+            save_cal_cache(chip_id);
+        }
 
-    std::cout << "BME280 setup complete!\n";
+        std::cout << "BME280: setting sampling.\n";
+        {
+            auto lock = _i2c_bus->lock();
+            _i2c_bus->set_device_address(_device_address);
+            set_sampling();
+        }
 
-    usleep(100000);
+        wait_for_first_measurement();
 
+        std::cout << "BME280 setup complete!\n";
     }
 
     __s8 read_all(float & T, float & P, float & H)
     {
+        auto lock = _i2c_bus->lock();
         _i2c_bus->set_device_address(_device_address);
 
         __s32 var1_T, var2_T;
@@ -186,12 +216,96 @@ public:
 private:
     bool is_reading_calibration()
     {
+        auto lock = _i2c_bus->lock();
+        _i2c_bus->set_device_address(_device_address);
+
         // BME280_REGISTER_STATUS
         __u8 out = read8(0XF3);
 
         return (out & (1 << 0)) != 0;
     }
 
+    void wait_for_first_measurement()
+    {
+        // the data registers hold their reset value until the first conversion is done (~30 ms),
+        // poll for it instead of sleeping a fixed amount
+        for (__u8 attempt = 0; attempt < 40; attempt++)
+        {
+            {
+                auto lock = _i2c_bus->lock();
+                _i2c_bus->set_device_address(_device_address);
+                if (read24(BME280_REGISTER_TEMPDATA) != 0x800000)
+                    return;
+            }
+            usleep(5000);
+        }
+    }
+
+    bool load_cal_cache(__u8 chip_id)
+    {
+        // the compensation coefficients are factory trimmed, so they only need to be read from the sensor once;
+        // the cache is keyed by chip id and dig_T1, which is cheap to read back and tells sensors apart
+        if (_cal_cache_file_name.empty())
+            return false;
+
+        std::ifstream file(_cal_cache_file_name);
+        if (!file)
+            return false;
+
+        int cached_chip_id;
+        int T1, T2, T3, P1, P2, P3, P4, P5, P6, P7, P8, P9, H1, H2, H3, H4, H5, H6;
+        file >> cached_chip_id >> T1 >> T2 >> T3 >> P1 >> P2 >> P3 >> P4 >> P5 >> P6 >> P7 >> P8 >> P9 >> H1 >> H2 >> H3 >> H4 >> H5 >> H6;
+        if (file.fail() || cached_chip_id != chip_id)
+            return false;
+
+        {
+            auto lock = _i2c_bus->lock();
+            _i2c_bus->set_device_address(_device_address);
+            if (read16_LE(BME280_REGISTER_DIG_T1) != T1)
+                return false;
+        }
+
+        _bme280_calib.dig_T1 = T1;
+        _bme280_calib.dig_T2 = T2;
+        _bme280_calib.dig_T3 = T3;
+        _bme280_calib.dig_P1 = P1;
+        _bme280_calib.dig_P2 = P2;
+        _bme280_calib.dig_P3 = P3;
+        _bme280_calib.dig_P4 = P4;
+        _bme280_calib.dig_P5 = P5;
+        _bme280_calib.dig_P6 = P6;
+        _bme280_calib.dig_P7 = P7;
+        _bme280_calib.dig_P8 = P8;
+        _bme280_calib.dig_P9 = P9;
+        _bme280_calib.dig_H1 = H1;
+        _bme280_calib.dig_H2 = H2;
+        _bme280_calib.dig_H3 = H3;
+        _bme280_calib.dig_H4 = H4;
+        _bme280_calib.dig_H5 = H5;
+        _bme280_calib.dig_H6 = H6;
+        return true;
+    }
+
+    void save_cal_cache(__u8 chip_id)
+    {
+        if (_cal_cache_file_name.empty())
+            return;
+
+        std::ofstream file(_cal_cache_file_name, std::ios::trunc);
+        if (!file)
+        {
+            std::cerr << "Error: Cannot write to file '" << _cal_cache_file_name << "'" << std::endl;
+            return;
+        }
+
+        const bme280_calib_data& c = _bme280_calib;
+        file << int(chip_id) << "\n"
+             << c.dig_T1 << " " << c.dig_T2 << " " << c.dig_T3 << "\n"
+             << c.dig_P1 << " " << c.dig_P2 << " " << c.dig_P3 << " " << c.dig_P4 << " " << c.dig_P5 << " "
+             << c.dig_P6 << " " << c.dig_P7 << " " << c.dig_P8 << " " << c.dig_P9 << "\n"
+             << int(c.dig_H1) << " " << c.dig_H2 << " " << int(c.dig_H3) << " " << c.dig_H4 << " " << c.dig_H5 << " " << int(c.dig_H6);
+    }
+
     void write8(__u8 reg, __u8 byte)
     {
         __u8 buffer[2];
@@ -237,33 +351,37 @@ private:
 
     void read_coefficients(void)
     {
-        _bme280_calib.dig_T1 = read16_LE(BME280_REGISTER_DIG_T1);
-        _bme280_calib.dig_T2 = readS16_LE(BME280_REGISTER_DIG_T2);
-        _bme280_calib.dig_T3 = readS16_LE(BME280_REGISTER_DIG_T3);
-
-        _bme280_calib.dig_P1 = read16_LE(BME280_REGISTER_DIG_P1);
-        _bme280_calib.dig_P2 = readS16_LE(BME280_REGISTER_DIG_P2);
-        _bme280_calib.dig_P3 = readS16_LE(BME280_REGISTER_DIG_P3);
-        _bme280_calib.dig_P4 = readS16_LE(BME280_REGISTER_DIG_P4);
-        _bme280_calib.dig_P5 = readS16_LE(BME280_REGISTER_DIG_P5);
-        _bme280_calib.dig_P6 = readS16_LE(BME280_REGISTER_DIG_P6);
-        _bme280_calib.dig_P7 = readS16_LE(BME280_REGISTER_DIG_P7);
-        _bme280_calib.dig_P8 = readS16_LE(BME280_REGISTER_DIG_P8);
-        _bme280_calib.dig_P9 = readS16_LE(BME280_REGISTER_DIG_P9);
-
-        _bme280_calib.dig_H1 = read8(BME280_REGISTER_DIG_H1);
-        _bme280_calib.dig_H2 = readS16_LE(BME280_REGISTER_DIG_H2);
-        _bme280_calib.dig_H3 = read8(BME280_REGISTER_DIG_H3);
-        _bme280_calib.dig_H4 = ((__s8)read8(BME280_REGISTER_DIG_H4) << 4) |
-                         (read8(BME280_REGISTER_DIG_H4 + 1) & 0xF);
-        _bme280_calib.dig_H5 = ((__s8)read8(BME280_REGISTER_DIG_H5 + 1) << 4) |
-                         (read8(BME280_REGISTER_DIG_H5) >> 4);
-        _bme280_calib.dig_H6 = (__s8)read8(BME280_REGISTER_DIG_H6);
-
-        //std::cout << "some values:" << std::endl;
-        //std::cout << _bme280_calib.dig_H6 << std::endl;
-        //std::cout << _bme280_calib.dig_H5 << std::endl;
-        //std::cout << _bme280_calib.dig_H1 << std::endl;
+        // two burst reads (0x88-0xA1 and 0xE1-0xE7) instead of one transaction per coefficient
+        __u8 tp[26], h[7];
+        __u8 reg = BME280_REGISTER_DIG_T1;
+        _i2c_bus->write_to_device(&reg, 1);
+        _i2c_bus->read_from_device(tp, 26);
+        reg = BME280_REGISTER_DIG_H2;
+        _i2c_bus->write_to_device(&reg, 1);
+        _i2c_bus->read_from_device(h, 7);
+
+        auto u16_le = [](const __u8* b) { return __u16(b[0]) | __u16(b[1]) << 8; };
+
+        _bme280_calib.dig_T1 = u16_le(tp + 0);
+        _bme280_calib.dig_T2 = (__s16)u16_le(tp + 2);
+        _bme280_calib.dig_T3 = (__s16)u16_le(tp + 4);
+
+        _bme280_calib.dig_P1 = u16_le(tp + 6);
+        _bme280_calib.dig_P2 = (__s16)u16_le(tp + 8);
+        _bme280_calib.dig_P3 = (__s16)u16_le(tp + 10);
+        _bme280_calib.dig_P4 = (__s16)u16_le(tp + 12);
+        _bme280_calib.dig_P5 = (__s16)u16_le(tp + 14);
+        _bme280_calib.dig_P6 = (__s16)u16_le(tp + 16);
+        _bme280_calib.dig_P7 = (__s16)u16_le(tp + 18);
+        _bme280_calib.dig_P8 = (__s16)u16_le(tp + 20);
+        _bme280_calib.dig_P9 = (__s16)u16_le(tp + 22);
+
+        _bme280_calib.dig_H1 = tp[25]; // 0xA1
+        _bme280_calib.dig_H2 = (__s16)u16_le(h + 0);
+        _bme280_calib.dig_H3 = h[2];
+        _bme280_calib.dig_H4 = ((__s8)h[3] << 4) | (h[4] & 0xF);
+        _bme280_calib.dig_H5 = ((__s8)h[5] << 4) | (h[4] >> 4);
+        _bme280_calib.dig_H6 = (__s8)h[6];
     }
 
     void set_sampling()
@@ -283,6 +401,7 @@ private:
     __u16 _device_address;
     I2C_BUS* _i2c_bus;
     bme280_calib_data _bme280_calib;
+    std::string _cal_cache_file_name;
 };
 
 #endif
\ No newline at end of file
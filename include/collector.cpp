@@ -0,0 +1,332 @@
+#ifndef _COLLECTOR_
+#define _COLLECTOR_
+
+// Central collector of the records pushed by many loggers (include/push_client.cpp), one gorilla store
+// per node in a directory: DIR/NODE.gorilla with its journal DIR/NODE.gorilla.wal. Every connection has
+// its own thread, nodes ingest concurrently and only contend on the lock of their own store. A batch is
+// acknowledged once it is synced to the store, unless syncing is turned off. Records resent after a lost
+// acknowledgement are recognized by their sequence number, the last one stored is kept in DIR/NODE.seq.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <stdexcept>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include "push_protocol.cpp"
+#include "gorilla.cpp"
+#include "archive.cpp"
+
+#define COLLECTOR_KEEPALIVE_S 60 // a node that vanished without closing is dropped after about two minutes
+#define COLLECTOR_SEQ_BYTES 65536 // the sequence journal of a node starts over past this
+
+class Collector
+{
+public:
+    Collector(const std::string& directory, __u16 port = PUSH_PORT, const char* address = "0.0.0.0", bool sync = true,
+              __u32 block_records = GORILLA_BLOCK_RECORDS)
+        : _directory(directory), _sync(sync), _block_records(block_records)
+    {
+        if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST)
+            throw std::runtime_error("Collector: cannot create " + directory);
+        _listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (_listener < 0)
+            throw std::runtime_error("Collector: cannot create socket.");
+        int yes = 1;
+        setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, address, &addr.sin_addr);
+        if (bind(_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(_listener, 128) < 0)
+        {
+            close(_listener);
+            throw std::runtime_error("Collector: cannot listen on port " + std::to_string(port) + ".");
+        }
+        _wake_up = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~Collector()
+    {
+        stop();
+        close(_wake_up);
+        close(_listener);
+    }
+
+    Collector(const Collector&) = delete;
+    Collector& operator=(const Collector&) = delete;
+
+    // port actually bound, useful when constructed with port 0
+    __u16 port() const
+    {
+        sockaddr_in addr = {};
+        socklen_t length = sizeof(addr);
+        getsockname(_listener, reinterpret_cast<sockaddr*>(&addr), &length);
+        return ntohs(addr.sin_port);
+    }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _thread = std::thread(&Collector::accept_all, this);
+    }
+
+    // closes every connection, the nodes keep spooling until the collector is back
+    void stop()
+    {
+        if (!_running)
+            return;
+        _running = false;
+        __u64 one = 1;
+        if (write(_wake_up, &one, sizeof(one)) < 0)
+            std::cerr << "Collector: cannot wake up the accept thread.\n";
+        _thread.join();
+        std::list<Connection> connections;
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            for (Connection& connection : _connections)
+                if (!connection.finished)
+                    shutdown(connection.fd, SHUT_RDWR);
+            connections.splice(connections.end(), _connections);
+        }
+        for (Connection& connection : connections)
+            connection.thread.join();
+    }
+
+    __u64 records() const
+    {
+        return _records.load(std::memory_order_relaxed);
+    }
+
+    // records received again after a lost acknowledgement, not stored twice
+    __u64 duplicates() const
+    {
+        return _duplicates.load(std::memory_order_relaxed);
+    }
+
+    __u64 batches() const
+    {
+        return _batches.load(std::memory_order_relaxed);
+    }
+
+    size_t nodes()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _nodes.size();
+    }
+
+private:
+    struct Node
+    {
+        std::mutex mutex; // one connection at a time writes the store
+        std::unique_ptr<GorillaStore> store;
+        std::unique_ptr<Journal> sequences; // the last stored sequence after every batch
+        std::string sequences_file;
+        __u64 last_seq = 0;
+    };
+
+    struct Connection
+    {
+        int fd;
+        std::thread thread;
+        bool finished = false; // under _mutex, joined by the accept thread
+    };
+
+    void accept_all()
+    {
+        pollfd fds[2] = {{_listener, POLLIN, 0}, {_wake_up, POLLIN, 0}};
+        while (_running)
+        {
+            if (poll(fds, 2, -1) < 0 || !(fds[0].revents & POLLIN))
+                continue;
+            int fd = accept4(_listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+                continue;
+            int yes = 1, idle = COLLECTOR_KEEPALIVE_S, interval = COLLECTOR_KEEPALIVE_S / 4;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+
+            std::lock_guard<std::mutex> guard(_mutex);
+            for (auto it = _connections.begin(); it != _connections.end();)
+            {
+                if (!it->finished)
+                {
+                    it++;
+                    continue;
+                }
+                it->thread.join();
+                it = _connections.erase(it);
+            }
+            _connections.push_back({fd, std::thread(), false});
+            Connection* connection = &_connections.back();
+            connection->thread = std::thread(&Collector::serve, this, connection);
+        }
+    }
+
+    void serve(Connection* connection)
+    {
+        int fd = connection->fd;
+        std::string node_id;
+        try
+        {
+            Node* node = hello(fd, node_id);
+            if (node != nullptr)
+            {
+                std::cout << "Collector: node " << node_id << " connected.\n";
+                while (ingest(fd, *node))
+                    ;
+                std::cout << "Collector: node " << node_id << " disconnected.\n";
+            }
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Collector: node " << node_id << ": " << e.what() << "\n";
+        }
+        std::lock_guard<std::mutex> guard(_mutex);
+        close(fd);
+        connection->finished = true;
+    }
+
+    // reads the hello of a node and opens its store, nullptr if the node is refused
+    Node* hello(int fd, std::string& node_id)
+    {
+        __u8 hello[PUSH_HELLO_SIZE];
+        if (!receive_all(fd, hello, sizeof(hello)))
+            return nullptr;
+        __u32 magic;
+        __u16 version;
+        memcpy(&magic, hello, 4);
+        memcpy(&version, hello + 4, 2);
+        node_id.resize(hello[7]);
+        if (!receive_all(fd, &node_id[0], node_id.size()))
+            return nullptr;
+        __u16 status = magic == PUSH_MAGIC && (version == PUSH_VERSION || version == 1) && hello[6] == LOG_CHANNELS && valid_node_id(node_id) ? PUSH_ACCEPTED : PUSH_REJECTED;
+        Node* node = status == PUSH_ACCEPTED ? find_node(node_id) : nullptr;
+        magic = PUSH_MAGIC;
+        version = PUSH_VERSION;
+        memcpy(hello, &magic, 4);
+        memcpy(hello + 4, &version, 2);
+        memcpy(hello + 6, &status, 2);
+        if (!send_all(fd, hello, sizeof(hello)))
+            return nullptr;
+        return node;
+    }
+
+    Node* find_node(const std::string& node_id)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto found = _nodes.find(node_id);
+        if (found != _nodes.end())
+            return found->second.get();
+        auto node = std::make_unique<Node>();
+        node->store = std::make_unique<GorillaStore>(_directory + "/" + node_id + ".gorilla", _block_records, SyncPolicy(SYNC_NONE));
+        node->sequences_file = _directory + "/" + node_id + ".seq";
+        node->sequences = std::make_unique<Journal>(node->sequences_file, SyncPolicy(SYNC_NONE));
+        node->sequences->for_each([&](const __u8* data, __u32 size) {
+            if (size == sizeof(node->last_seq))
+                memcpy(&node->last_seq, data, sizeof(node->last_seq));
+        });
+        return (_nodes[node_id] = std::move(node)).get();
+    }
+
+    // stores one batch and acknowledges it, false when the connection is done
+    bool ingest(int fd, Node& node)
+    {
+        __u32 header[2];
+        if (!receive_all(fd, header, sizeof(header)))
+            return false;
+        if (header[0] < PUSH_BATCH_HEADER || header[0] > PUSH_BATCH_HEADER + PUSH_BATCH_RECORDS * sizeof(LogRecord))
+            throw std::runtime_error("bad batch size " + std::to_string(header[0]));
+        thread_local std::vector<__u8> payload;
+        payload.resize(header[0]);
+        if (!receive_all(fd, payload.data(), payload.size()))
+            return false;
+        if (crc32c(payload.data(), payload.size()) != header[1])
+            throw std::runtime_error("batch checksum mismatch");
+        __u64 first_seq;
+        __u16 count, record_size;
+        memcpy(&first_seq, payload.data(), 8);
+        memcpy(&count, payload.data() + 8, 2);
+        memcpy(&record_size, payload.data() + 10, 2);
+        if ((record_size != sizeof(LogRecord) && record_size != LOG_RECORD_V1_SIZE) || PUSH_BATCH_HEADER + static_cast<size_t>(count) * record_size != payload.size() || count == 0)
+            throw std::runtime_error("bad batch layout");
+
+        size_t stored = 0;
+        {
+            std::lock_guard<std::mutex> guard(node.mutex);
+            for (__u16 i = 0; i < count; i++)
+            {
+                if (first_seq + i <= node.last_seq)
+                    continue;
+                LogRecord record;
+                read_record(payload.data() + PUSH_BATCH_HEADER + i * record_size, record_size, record);
+                node.store->append(record);
+                stored++;
+            }
+            if (stored > 0)
+            {
+                // the records before their sequence: a crash in between stores a batch twice rather than losing it
+                if (_sync)
+                    node.store->sync();
+                node.last_seq = first_seq + count - 1;
+                if (node.sequences->size() > COLLECTOR_SEQ_BYTES)
+                    rotate_sequences(node);
+                else
+                {
+                    node.sequences->append(&node.last_seq, sizeof(node.last_seq));
+                    if (_sync)
+                        node.sequences->sync();
+                }
+            }
+        }
+        _records.fetch_add(stored, std::memory_order_relaxed);
+        _duplicates.fetch_add(count - stored, std::memory_order_relaxed);
+        _batches.fetch_add(1, std::memory_order_relaxed);
+        __u64 ack = first_seq + count - 1;
+        return send_all(fd, &ack, sizeof(ack));
+    }
+
+    // starts the sequence journal over with just last_seq; written and synced aside, then renamed over
+    // the old one, so a crash leaves either journal whole and never one without a sequence
+    void rotate_sequences(Node& node)
+    {
+        std::string rotated = node.sequences_file + ".tmp";
+        {
+            Journal journal(rotated, SyncPolicy(SYNC_NONE));
+            journal.reset(); // left over from a crash during the last rotation
+            journal.append(&node.last_seq, sizeof(node.last_seq));
+            journal.sync();
+        }
+        if (rename(rotated.c_str(), node.sequences_file.c_str()) < 0)
+            throw std::runtime_error("cannot rename " + rotated);
+        sync_directory(_directory);
+        node.sequences = std::make_unique<Journal>(node.sequences_file, SyncPolicy(SYNC_NONE));
+    }
+
+    std::string _directory;
+    bool _sync;
+    __u32 _block_records;
+    int _listener, _wake_up;
+    std::unordered_map<std::string, std::unique_ptr<Node>> _nodes; // under _mutex, nodes are never removed
+    std::list<Connection> _connections;                           // under _mutex
+    std::mutex _mutex;
+    std::atomic<__u64> _records{0}, _duplicates{0}, _batches{0};
+    std::atomic<bool> _running{false};
+    std::thread _thread;
+};
+
+#endif // _COLLECTOR_
@@ -0,0 +1,383 @@
+#ifndef _COMPACTOR_
+#define _COMPACTOR_
+
+// Background retention of the logged data, so log.txt and the worst case of its readers stop growing
+// with the age of the logger. Every COMPACT_PERIOD_S, on a thread at idle CPU and I/O priority:
+//   1. the lines of log.txt older than the log age move to a raw gorilla segment of the archive
+//      (include/archive.cpp), the log itself is replaced through the Dumper's handoff;
+//   2. small segments are merged into ones of up to COMPACT_SEGMENT_RECORDS records;
+//   3. raw records older than the raw age are replaced with hourly rollups, those older than the hourly
+//      age with daily ones;
+//   4. while log.txt and the archive are over the disk budget the log is cut down to COMPACT_MIN_LOG_NS,
+//      then the oldest data goes down a tier, finally the oldest days are dropped.
+// Each run reports the bytes it reclaimed and how long reading the whole history took before and after.
+// The sampling loop only ever sees the handoff, picked up on its next line.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cctype>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "dumper.cpp"
+#include "archive.cpp"
+#include "metrics.cpp"
+
+#define COMPACT_PERIOD_S 3600               // between runs
+#define COMPACT_FIRST_RUN_S 60              // after the start, once the sampling loop is up
+#define COMPACT_SEGMENT_RECORDS (32 * 1440) // merged segments hold 8 days of 15 s records up to 5 months of 300 s ones
+#define COMPACT_MIN_TRIM_BYTES (256 * 1024) // log.txt is rewritten once this much of it is old enough
+#define COMPACT_MIN_LOG_NS (8 * ARCHIVE_DAY_NS) // what the disk budget leaves in log.txt, the weekly report reads 8 days
+#define COMPACT_READ_WINDOW_NS (30 * ARCHIVE_DAY_NS) // the history is read back a month at a time
+#define COMPACT_HANDOFF_POLL_US 20000
+#define RETENTION_MAX_AGE_S (100.0 * 31536000.0) // ages in ns stay well inside an __s64
+#define RETENTION_MAX_BYTES 1e15               // a petabyte, far past any disk of the logger
+#define IOPRIO_CLASS_IDLE 3                 // linux/ioprio.h, only served when the disk is otherwise idle
+#define IOPRIO_WHO_PROCESS 1
+
+// how long data stays in each tier, and the disk budget of log.txt and the archive together; the log age
+// covers what email_updater.py, report_aggregator and the webapp's fallback read straight from log.txt
+struct RetentionPolicy
+{
+    __s64 log_ns = 56 * ARCHIVE_DAY_NS;
+    __s64 raw_ns = 90 * ARCHIVE_DAY_NS;
+    __s64 hourly_ns = 730 * ARCHIVE_DAY_NS; // daily rollups after that
+    __u64 disk_budget = 0;                  // bytes, 0 for none
+
+    // "log=AGE,raw=AGE,hourly=AGE", any of them over policy, AGE a number with s, m, h, d, w or y
+    static RetentionPolicy parse(const std::string& text, RetentionPolicy policy)
+    {
+        for (size_t begin = 0; begin < text.size();)
+        {
+            size_t end = std::min(text.find(',', begin), text.size()), equals = text.find('=', begin);
+            if (equals >= end)
+                throw std::runtime_error("Retention \"" + text + "\": expected log=AGE,raw=AGE,hourly=AGE");
+            std::string tier = text.substr(begin, equals - begin);
+            __s64* age = tier == "log" ? &policy.log_ns : (tier == "raw" ? &policy.raw_ns : (tier == "hourly" ? &policy.hourly_ns : nullptr));
+            if (age == nullptr || !parse_age(text.substr(equals + 1, end - equals - 1), *age))
+                throw std::runtime_error("Retention \"" + text + "\": expected log=AGE,raw=AGE,hourly=AGE with AGE like 36h, 2d, 12w or 1y");
+            begin = end + 1;
+        }
+        if (policy.log_ns > policy.raw_ns || policy.raw_ns > policy.hourly_ns)
+            throw std::runtime_error("Retention \"" + text + "\": the ages have to grow from log to raw to hourly");
+        return policy;
+    }
+
+    // "500M" and the like, K, M and G in powers of 1024
+    static __u64 parse_size(const std::string& text)
+    {
+        double size;
+        std::string unit;
+        double scale = parse_number(text, size, unit) ? (unit == "" ? 1.0 : (unit == "K" ? 1024.0 : (unit == "M" ? 1048576.0 : (unit == "G" ? 1073741824.0 : 0.0)))) : 0.0;
+        if (scale == 0.0 || size * scale > RETENTION_MAX_BYTES)
+            throw std::runtime_error("Disk budget \"" + text + "\": expected a size like 64M or 2G");
+        return static_cast<__u64>(size * scale);
+    }
+
+private:
+    static bool parse_age(const std::string& text, __s64& age_ns)
+    {
+        double value;
+        std::string unit;
+        if (!parse_number(text, value, unit))
+            return false;
+        double seconds = unit == "s" ? 1.0 : (unit == "m" ? 60.0 : (unit == "h" ? 3600.0 : (unit == "d" ? 86400.0 : (unit == "w" ? 604800.0 : (unit == "y" ? 31536000.0 : 0.0)))));
+        if (seconds == 0.0 || value * seconds > RETENTION_MAX_AGE_S)
+            return false;
+        age_ns = static_cast<__s64>(value * seconds * 1e9);
+        return true;
+    }
+
+    // a plain non-negative number followed by its unit; strtod's inf, nan and overflows are refused,
+    // -Ofast would not compare them reliably
+    static bool parse_number(const std::string& text, double& value, std::string& unit)
+    {
+        if (text.empty() || (!isdigit(static_cast<unsigned char>(text[0])) && text[0] != '.'))
+            return false;
+        char* end;
+        errno = 0;
+        value = strtod(text.c_str(), &end);
+        unit = end;
+        return end != text.c_str() && errno != ERANGE;
+    }
+};
+
+struct CompactionReport
+{
+    size_t log_records = 0;      // moved out of log.txt
+    size_t merged_segments = 0;  // small segments merged into bigger ones
+    size_t raw_records = 0;      // replaced with hourly rollups
+    size_t hourly_rollups = 0;   // replaced with daily ones
+    size_t dropped_days = 0;     // daily rollups dropped for the disk budget
+    __u64 bytes_before = 0, bytes_after = 0; // of log.txt and the archive
+    size_t records_read = 0;     // reading the whole history after the run
+    double read_before_s = 0.0, read_after_s = 0.0;
+    double seconds = 0.0;
+};
+
+class Compactor
+{
+public:
+    Compactor(const std::string& log_file_name, Archive& archive, RetentionPolicy policy = RetentionPolicy())
+        : _log_file_name(log_file_name), _archive(archive), _policy(policy)
+    {
+        ::unlink((log_file_name + ".compact").c_str()); // a copy never handed over before a crash
+    }
+
+    ~Compactor()
+    {
+        stop();
+    }
+
+    Compactor(const Compactor&) = delete;
+    Compactor& operator=(const Compactor&) = delete;
+
+    // to pass to the Dumper of the log file
+    DumperHandoff* handoff()
+    {
+        return &_handoff;
+    }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _thread = std::thread(&Compactor::run, this);
+    }
+
+    void stop()
+    {
+        _stopping = true; // cancels a handoff the sampling loop did not pick up
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if (!_running)
+                return;
+            _running = false;
+        }
+        _wake_up.notify_one();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    // one pass over the log and the archive as of now_ns (unix time), called by the compactor thread
+    CompactionReport run_once(__s64 now_ns)
+    {
+        CompactionReport report;
+        auto t_start = std::chrono::steady_clock::now();
+        report.bytes_before = storage_bytes();
+        report.read_before_s = read_history(report.records_read);
+
+        report.log_records = trim_log(now_ns - _policy.log_ns, COMPACT_MIN_TRIM_BYTES);
+        report.merged_segments = merge_segments();
+        report.raw_records = _archive.tier_raw(floor_step(now_ns - _policy.raw_ns, ARCHIVE_HOUR_NS));
+        report.hourly_rollups = _archive.tier_hourly(floor_step(now_ns - _policy.hourly_ns, ARCHIVE_DAY_NS));
+        enforce_budget(now_ns, report);
+
+        report.bytes_after = storage_bytes();
+        report.read_after_s = read_history(report.records_read);
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+        return report;
+    }
+
+    // log.txt and the archive
+    __u64 storage_bytes()
+    {
+        struct stat status;
+        return _archive.bytes() + (stat(_log_file_name.c_str(), &status) == 0 ? status.st_size : 0);
+    }
+
+private:
+    void run()
+    {
+        // nice 19 and the idle I/O class, per thread: the sampling loop and the queries come first
+        pid_t tid = syscall(SYS_gettid);
+        setpriority(PRIO_PROCESS, tid, 19);
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << 13);
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake_up.wait_for(lock, std::chrono::seconds(COMPACT_FIRST_RUN_S), [this]() { return !_running; });
+        while (_running)
+        {
+            lock.unlock();
+            try
+            {
+                __s64 now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                CompactionReport report = run_once(now_ns);
+                __u64 reclaimed = report.bytes_before > report.bytes_after ? report.bytes_before - report.bytes_after : 0;
+                metrics.compactions.add();
+                metrics.compaction_reclaimed_bytes.add(reclaimed);
+                metrics.storage_bytes.set(report.bytes_after);
+                metrics.history_read_seconds.set(report.read_after_s);
+                if (report.log_records + report.merged_segments + report.raw_records + report.hourly_rollups + report.dropped_days > 0)
+                    std::cout << "Compaction: " << report.log_records << " log records archived, " << report.merged_segments << " segments merged, "
+                              << report.raw_records << " raw records and " << report.hourly_rollups << " hourly rollups tiered down, "
+                              << report.dropped_days << " days dropped; " << reclaimed << " bytes reclaimed (" << report.bytes_after << " left), history read in "
+                              << report.read_before_s << " s before, " << report.read_after_s << " s after" << std::endl;
+            }
+            catch (const std::runtime_error& e)
+            {
+                std::cerr << "Compaction: " << e.what() << std::endl;
+            }
+            lock.lock();
+            _wake_up.wait_for(lock, std::chrono::seconds(COMPACT_PERIOD_S), [this]() { return !_running; });
+        }
+    }
+
+    // moves the lines older than cutoff_ns to the archive once there are min_bytes of them, returns how many
+    size_t trim_log(__s64 cutoff_ns, size_t min_bytes)
+    {
+        std::string copy_name = _log_file_name + ".compact";
+        size_t records_moved = 0;
+        {
+            struct stat status;
+            if (stat(_log_file_name.c_str(), &status) < 0)
+                return 0;
+            LogFile log(_log_file_name);
+            size_t cut = log.find_time(cutoff_ns);
+            if (cut == 0 || cut < min_bytes)
+                return 0;
+            std::vector<LogRecord> records;
+            LogRecord record;
+            __s64 archived = _archive.end_ns(); // lines archived by a run whose handoff failed are there already
+            for (size_t begin = 0; begin < cut;)
+            {
+                size_t end = log.line_start(begin + 1);
+                if (log.parse_line(begin, end, record) && record.time_ns >= archived && (records.empty() || record.time_ns > records.back().time_ns))
+                    records.push_back(record);
+                begin = end;
+            }
+            _archive.add_segment(records);
+            records_moved = records.size();
+
+            int copy = open(copy_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (copy < 0)
+                throw std::runtime_error("cannot create " + copy_name);
+            bool written = write(copy, log.data() + cut, log.size() - cut) == static_cast<ssize_t>(log.size() - cut) && fdatasync(copy) == 0;
+            close(copy);
+            if (!written)
+            {
+                ::unlink(copy_name.c_str());
+                throw std::runtime_error("error writing " + copy_name);
+            }
+            _handoff.copy_name = copy_name;
+            _handoff.copied_size = log.size();
+        }
+
+        // the sampling loop picks the copy up with its next line; holding the old log open leaves freeing
+        // its blocks, once replaced, to the close() here instead of the Dumper's
+        int old_log = open(_log_file_name.c_str(), O_RDONLY | O_CLOEXEC);
+        _handoff.state.store(HANDOFF_PENDING, std::memory_order_release);
+        int state;
+        while ((state = _handoff.state.load(std::memory_order_acquire)) == HANDOFF_PENDING || state == HANDOFF_ADOPTING)
+        {
+            if (state == HANDOFF_PENDING && _stopping && _handoff.state.compare_exchange_strong(state, HANDOFF_IDLE))
+                break;
+            usleep(COMPACT_HANDOFF_POLL_US);
+        }
+        if (state == HANDOFF_ADOPTED)
+        {
+            size_t slash = _log_file_name.rfind('/');
+            sync_directory(slash == std::string::npos ? "." : _log_file_name.substr(0, slash));
+        }
+        else
+            ::unlink(copy_name.c_str()); // the log stays as it was, the archived lines are skipped by the readers
+        if (old_log >= 0)
+            close(old_log);
+        _handoff.state.store(HANDOFF_IDLE, std::memory_order_release);
+        return records_moved;
+    }
+
+    // merges runs of adjacent segments that fit in COMPACT_SEGMENT_RECORDS together, returns how many were merged
+    size_t merge_segments()
+    {
+        size_t merged = 0;
+        std::vector<ArchiveSegment> segments = _archive.segments();
+        for (size_t first = 0, i = 0; first < segments.size(); first = i)
+        {
+            size_t records = 0;
+            for (i = first; i < segments.size() && records + segments[i].records <= COMPACT_SEGMENT_RECORDS; i++)
+                records += segments[i].records;
+            i = std::max(i, first + 1);
+            if (i - first > 1)
+            {
+                // the segments before first were merged in place already, the index shifted by what they lost
+                _archive.merge_segments(first - merged, i - first);
+                merged += i - first - 1;
+            }
+        }
+        return merged;
+    }
+
+    void enforce_budget(__s64 now_ns, CompactionReport& report)
+    {
+        auto over = [&]() { return _policy.disk_budget > 0 && storage_bytes() > _policy.disk_budget; };
+        if (!over())
+            return;
+        report.log_records += trim_log(now_ns - std::min(_policy.log_ns, COMPACT_MIN_LOG_NS), 1);
+        report.merged_segments += merge_segments();
+        // the oldest segment at a time, then the oldest day of hourly rollups
+        std::vector<ArchiveSegment> segments;
+        while (over() && !(segments = _archive.segments()).empty())
+            report.raw_records += _archive.tier_raw(floor_step(segments.front().last_ns, ARCHIVE_HOUR_NS) + ARCHIVE_HOUR_NS);
+        while (over() && _archive.hourly_rollups() > 0)
+            report.hourly_rollups += _archive.tier_hourly(floor_step(_archive.first_hourly_ns(), ARCHIVE_DAY_NS) + ARCHIVE_DAY_NS);
+        if (over())
+        {
+            __u64 excess = storage_bytes() - _policy.disk_budget;
+            report.dropped_days += _archive.drop_daily(excess / sizeof(Rollup) + 1);
+        }
+    }
+
+    // reads the whole history, the archive a window at a time and then log.txt, like the query API would; returns the seconds
+    double read_history(size_t& records)
+    {
+        auto t_start = std::chrono::steady_clock::now();
+        records = 0;
+        std::vector<LogRecord> window;
+        __s64 archived = _archive.end_ns();
+        __s64 first_ns = std::min(_archive.first_daily_ns(), _archive.first_hourly_ns());
+        std::vector<ArchiveSegment> segments = _archive.segments();
+        if (!segments.empty())
+            first_ns = std::min(first_ns, segments.front().first_ns);
+        for (__s64 from_ns = first_ns; first_ns != INT64_MAX && from_ns < archived; from_ns += COMPACT_READ_WINDOW_NS)
+        {
+            window.clear();
+            _archive.read_range(from_ns, std::min(archived, from_ns + COMPACT_READ_WINDOW_NS), window);
+            records += window.size();
+        }
+        try
+        {
+            LogFile log(_log_file_name);
+            LogRecord record;
+            size_t begin = archived == INT64_MIN ? 0 : log.find_time(archived);
+            for (; begin < log.size();)
+            {
+                size_t end = log.line_start(begin + 1);
+                records += log.parse_line(begin, end, record);
+                begin = end;
+            }
+        }
+        catch (const std::runtime_error& e)
+        {
+            // no log yet
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    }
+
+    std::string _log_file_name;
+    Archive& _archive;
+    RetentionPolicy _policy;
+    DumperHandoff _handoff;
+    bool _running = false; // under _mutex
+    std::atomic<bool> _stopping{false};
+    std::mutex _mutex;
+    std::condition_variable _wake_up;
+    std::thread _thread;
+};
+
+#endif // _COMPACTOR_
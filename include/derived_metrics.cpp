@@ -0,0 +1,136 @@
+#ifndef _DERIVED_METRICS_
+#define _DERIVED_METRICS_
+
+// Humidity and pressure quantities derived from T, H and P, computed once when a record is made and
+// stored next to the measured channels. The formulas are the ones webapp.py used (Magnus saturation
+// pressure with 17.27 / 237.3); exp and log are polynomial approximations written so that the batch
+// kernel below auto-vectorizes, accurate to a few float ulp (see ./benchmark derived).
+
+#include <cstring>
+#include <cmath>
+#include <linux/types.h>
+#include "log_record.cpp"
+
+enum derived_channel
+{
+    DV_Q_INTERIOR = 0,          // specific humidity, g of water per kg of humid air
+    DV_Q_EXTERIOR,
+    DV_DEW_POINT_INTERIOR,      // degC
+    DV_DEW_POINT_EXTERIOR,
+    DV_ABS_HUMIDITY_INTERIOR,   // g of water per m3
+    DV_ABS_HUMIDITY_EXTERIOR,
+    DV_P_SEA_LEVEL_INTERIOR,    // bar, reduced to sea level with the barometric formula
+    DV_P_SEA_LEVEL_EXTERIOR,
+    DERIVED_CHANNELS
+};
+
+static_assert(DERIVED_CHANNELS == LOG_DERIVED_COLUMNS, "log.txt has the period right after the derived channels");
+
+// at most 15 characters, the column names of tools/log_converter.cpp
+
+static const char* const DERIVED_NAMES[DERIVED_CHANNELS] = {"q_interior", "q_exterior", "dew_interior", "dew_exterior",
+                                                            "abs_h_interior", "abs_h_exterior", "P_sea_interior", "P_sea_exterior"};
+
+struct DerivedRecord
+{
+    float values[DERIVED_CHANNELS];
+};
+
+static inline float bits_to_float(__u32 bits)
+{
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+static inline __u32 float_to_bits(float value)
+{
+    __u32 bits;
+    memcpy(&bits, &value, 4);
+    return bits;
+}
+
+// e^x for |x| < 87, Cephes expf: x = n ln2 + r with |r| <= ln2 / 2, polynomial for e^r, 2^n in the exponent bits
+static inline float fast_exp(float x)
+{
+    x = x < -87.0f ? -87.0f : (x > 87.0f ? 87.0f : x);
+    float scaled = x * 1.44269504088896341f;
+    __s32 n = static_cast<__s32>(scaled + (scaled >= 0.0f ? 0.5f : -0.5f));
+    float fn = static_cast<float>(n);
+    float r = x - fn * 0.693359375f + fn * 2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p * r + 1.3981999507e-3f;
+    p = p * r + 8.3334519073e-3f;
+    p = p * r + 4.1665795894e-2f;
+    p = p * r + 1.6666665459e-1f;
+    p = p * r + 5.0000001201e-1f;
+    p = p * r * r + r + 1.0f;
+    return p * bits_to_float(static_cast<__u32>(n + 127) << 23);
+}
+
+// natural log for normal x > 0, Cephes logf: x = m 2^e with m in [sqrt(1/2), sqrt(2)), polynomial for log(m)
+static inline float fast_log(float x)
+{
+    __u32 bits = float_to_bits(x);
+    __s32 e = static_cast<__s32>((bits >> 23) & 0xFF) - 126;
+    float m = bits_to_float((bits & 0x807FFFFF) | 0x3F000000); // [0.5, 1)
+    bool low = m < 0.707106781186547524f;
+    e -= low;
+    m = (low ? m + m : m) - 1.0f;
+    float z = m * m;
+    float y = 7.0376836292e-2f;
+    y = y * m - 1.1514610310e-1f;
+    y = y * m + 1.1676998740e-1f;
+    y = y * m - 1.2420140846e-1f;
+    y = y * m + 1.4249322787e-1f;
+    y = y * m - 1.6668057665e-1f;
+    y = y * m + 2.0000714765e-1f;
+    y = y * m - 2.4999993993e-1f;
+    y = y * m + 3.3333331174e-1f;
+    float fe = static_cast<float>(e);
+    y = y * m * z - fe * 2.12194440e-4f - 0.5f * z;
+    return m + y + fe * 0.693359375f;
+}
+
+// Batch kernel over arrays: T in degC, H in %, P in bar, altitude of the sensors in m.
+// Outputs are nan where an input is missing (or H is 0 for the dew point). No branches, no calls,
+// so the loop is vectorized by the compiler.
+static void derive_humidity(const float* __restrict T, const float* __restrict H, const float* __restrict P, size_t n, float altitude_m,
+                            float* __restrict q, float* __restrict dew_point, float* __restrict abs_humidity, float* __restrict p_sea_level)
+{
+    const float nan = bits_to_float(0x7FC00000);
+    const float lapse = 0.0065f * altitude_m; // K per m of the standard atmosphere
+    for (size_t i = 0; i < n; i++)
+    {
+        float t = T[i], h = H[i], p = P[i];
+        __u32 t_bits = float_to_bits(t), h_bits = float_to_bits(h), p_bits = float_to_bits(p);
+        bool missing_th = ((t_bits & 0x7FFFFFFF) > 0x7F800000) | ((h_bits & 0x7FFFFFFF) > 0x7F800000);
+        bool missing_p = (p_bits & 0x7FFFFFFF) > 0x7F800000;
+
+        float magnus = 17.27f * t / (t + 237.3f);
+        float saturation = 0.0061078f * fast_exp(magnus); // bar
+        float vapor = h * 0.01f * saturation;
+        float specific = 1000.0f * vapor / (1.6078f * p - 0.6078f * vapor);
+        float gamma = fast_log((h > 0.0f ? h : 1.0f) * 0.01f) + magnus;
+        float dew = 237.3f * gamma / (17.27f - gamma);
+        float absolute = 216.7f * 1000.0f * vapor / (t + 273.15f); // e in hPa over T in K
+        float sea = p * fast_exp(-5.257f * fast_log(1.0f - lapse / (t + lapse + 273.15f)));
+
+        q[i] = missing_th | missing_p ? nan : specific;
+        dew_point[i] = missing_th | (h <= 0.0f) ? nan : dew;
+        abs_humidity[i] = missing_th ? nan : absolute;
+        p_sea_level[i] = missing_p | ((t_bits & 0x7FFFFFFF) > 0x7F800000) ? nan : sea;
+    }
+}
+
+// the derived channels of one record, interior and exterior in one pass of the kernel
+static inline void derive(const LogRecord& record, float altitude_m, DerivedRecord& out)
+{
+    float T[2] = {record.values[CH_T_INTERIOR], record.values[CH_T_EXTERIOR]};
+    float H[2] = {record.values[CH_H_INTERIOR], record.values[CH_H_EXTERIOR]};
+    float P[2] = {record.values[CH_P_INTERIOR], record.values[CH_P_EXTERIOR]};
+    derive_humidity(T, H, P, 2, altitude_m, out.values + DV_Q_INTERIOR, out.values + DV_DEW_POINT_INTERIOR, out.values + DV_ABS_HUMIDITY_INTERIOR,
+                    out.values + DV_P_SEA_LEVEL_INTERIOR);
+}
+
+#endif // _DERIVED_METRICS_
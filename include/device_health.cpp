@@ -0,0 +1,157 @@
+#ifndef _DEVICE_HEALTH_
+#define _DEVICE_HEALTH_
+
+#include <iostream>
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <linux/types.h>
+
+#define DEVICE_RETRIES 2                 // extra attempts of a failed operation before the device is taken down
+#define DEVICE_BACKOFF_MIN_NS 1000000000ULL  // first re-initialization attempt after 1 s
+#define DEVICE_BACKOFF_MAX_NS 32000000000ULL // then doubling up to 32 s, a sensor is back within half a minute of its fault
+
+enum device_state
+{
+    DEVICE_UP = 0,
+    DEVICE_DOWN // operations are skipped until the re-initialization succeeds
+};
+
+// Keeps one misbehaving device from taking the others down with it. Operations on the device go
+// through run(): a failure is retried a couple of times, then the device is marked down and
+// re-initialized with exponential backoff while the rest of the logger carries on without it.
+// Time is passed in by the caller (monotonic ns), so the fault harness can run on a virtual clock.
+class DeviceHealth
+{
+public:
+    typedef std::function<void()> Init;
+    typedef std::function<void(const std::string&)> Reporter;
+
+    DeviceHealth(const char* name, Init init, Reporter reporter = nullptr, __u8 retries = DEVICE_RETRIES,
+                 __u64 backoff_min_ns = DEVICE_BACKOFF_MIN_NS, __u64 backoff_max_ns = DEVICE_BACKOFF_MAX_NS)
+        : _name(name), _init(init), _reporter(reporter), _retries(retries), _backoff_min_ns(backoff_min_ns), _backoff_max_ns(backoff_max_ns), _backoff_ns(backoff_min_ns) {}
+
+    // runs op, returns false if the device is down or op kept failing
+    template <typename Op>
+    bool run(__u64 now_ns, Op op)
+    {
+        if (_state == DEVICE_DOWN && !try_reinit(now_ns))
+            return false;
+        for (__u8 attempt = 0; attempt <= _retries; attempt++)
+        {
+            try
+            {
+                op();
+                return true;
+            }
+            catch (const std::runtime_error& e)
+            {
+                _errors++;
+                _last_error = e.what();
+            }
+        }
+        take_down(now_ns);
+        return false;
+    }
+
+    // brings the device up for the first time; a failure leaves it down and retried by run()
+    bool init(__u64 now_ns)
+    {
+        try
+        {
+            _init();
+            _state = DEVICE_UP;
+            return true;
+        }
+        catch (const std::runtime_error& e)
+        {
+            _errors++;
+            _last_error = e.what();
+            take_down(now_ns);
+            return false;
+        }
+    }
+
+    device_state state() const
+    {
+        return _state;
+    }
+
+    const char* name() const
+    {
+        return _name;
+    }
+
+    __u32 faults() const
+    {
+        return _faults;
+    }
+
+    __u32 errors() const
+    {
+        return _errors;
+    }
+
+    __u32 reinits() const
+    {
+        return _reinits;
+    }
+
+    const std::string& last_error() const
+    {
+        return _last_error;
+    }
+
+private:
+    void take_down(__u64 now_ns)
+    {
+        if (_state == DEVICE_UP)
+        {
+            _faults++;
+            _backoff_ns = _backoff_min_ns;
+            report(std::string(_name) + " is down, re-initializing in " + std::to_string(_backoff_ns / 1000000) + " ms: " + _last_error);
+        }
+        _state = DEVICE_DOWN;
+        _next_attempt_ns = now_ns + _backoff_ns;
+    }
+
+    bool try_reinit(__u64 now_ns)
+    {
+        if (now_ns < _next_attempt_ns)
+            return false;
+        try
+        {
+            _init();
+        }
+        catch (const std::runtime_error& e)
+        {
+            _errors++;
+            _last_error = e.what();
+            _backoff_ns = std::min(_backoff_ns * 2, _backoff_max_ns);
+            _next_attempt_ns = now_ns + _backoff_ns;
+            return false;
+        }
+        _state = DEVICE_UP;
+        _reinits++;
+        report(std::string(_name) + " is back up.");
+        return true;
+    }
+
+    void report(const std::string& message)
+    {
+        if (_reporter)
+            _reporter(message);
+    }
+
+    const char* _name;
+    Init _init;
+    Reporter _reporter;
+    __u8 _retries;
+    __u64 _backoff_min_ns, _backoff_max_ns, _backoff_ns;
+    __u64 _next_attempt_ns = 0;
+    device_state _state = DEVICE_UP;
+    __u32 _faults = 0, _errors = 0, _reinits = 0;
+    std::string _last_error;
+};
+
+#endif // _DEVICE_HEALTH_
@@ -0,0 +1,102 @@
+#ifndef _DISPLAY_VIEWS_
+#define _DISPLAY_VIEWS_
+
+#include <vector>
+#include "framebuffer.cpp"
+#include "sparkline.cpp"
+#include "sample_history.cpp"
+
+#define DISPLAY_VIEW_NS 5000000000ULL // each view stays up for 5 s
+#define DISPLAY_SPARKLINE_HOURS 6.0f
+
+enum display_view
+{
+    VIEW_INTERIOR = 0,
+    VIEW_EXTERIOR,
+    VIEW_PRESSURE,
+    DISPLAY_VIEWS
+};
+
+// The OLED pages: the latest sample in 16 pixel high text over two 24 pixel high sparklines of the last
+// hours of records. Views take turns every DISPLAY_VIEW_NS; a view that stays up only redraws its
+// text and the newest sparkline columns, and the framebuffer flush sends only what changed.
+class DisplayViews
+{
+public:
+    DisplayViews(float hours = DISPLAY_SPARKLINE_HOURS) : _hours(hours)
+    {
+        for (display_view view = VIEW_INTERIOR; view < DISPLAY_VIEWS; view = display_view(view + 1))
+        {
+            _sparklines.emplace_back(0, 16, FB_WIDTH, 24, hours);
+            _sparklines.emplace_back(0, 40, FB_WIDTH, 24, hours);
+        }
+    }
+
+    // the records of the last hours still held in memory, e.g. after a restart of the measurement loop
+    void seed(SampleHistory& history, __s64 now_ns)
+    {
+        std::vector<LogRecord> records;
+        history.copy_range(now_ns - static_cast<__s64>(_hours * 3600e9), INT64_MAX, records);
+        for (const LogRecord& record : records)
+            add_record(record);
+    }
+
+    // feeds the sparklines with a new sample or record
+    void add_record(const LogRecord& record)
+    {
+        for (display_view view = VIEW_INTERIOR; view < DISPLAY_VIEWS; view = display_view(view + 1))
+        {
+            _sparklines[2 * view].add(record.time_ns, record.values[PLOTTED[view][0]]);
+            _sparklines[2 * view + 1].add(record.time_ns, record.values[PLOTTED[view][1]]);
+        }
+    }
+
+    // renders the view due at now_ns with the latest sample into the framebuffer
+    void render(const LogRecord& sample, __u64 now_ns)
+    {
+        display_view view = display_view((now_ns / DISPLAY_VIEW_NS) % DISPLAY_VIEWS);
+        bool full = view != _view;
+        if (full)
+            _framebuffer.clear();
+        _view = view;
+
+        char line[32];
+        _framebuffer.fill_rect(0, 0, FB_WIDTH, 16, false);
+        if (view == VIEW_PRESSURE)
+        {
+            _framebuffer.text(0, 0, "P in");
+            put_fixed(line, line + sizeof(line), sample.values[CH_P_INTERIOR] * 1000.0f, 1, "hPa");
+            _framebuffer.text_right(FB_WIDTH, 0, line);
+            _framebuffer.text(0, 1, "P ex");
+            put_fixed(line, line + sizeof(line), sample.values[CH_P_EXTERIOR] * 1000.0f, 1, "hPa");
+            _framebuffer.text_right(FB_WIDTH, 1, line);
+        }
+        else
+        {
+            __u8 T = view == VIEW_INTERIOR ? CH_T_INTERIOR : CH_T_EXTERIOR, H = view == VIEW_INTERIOR ? CH_H_INTERIOR : CH_H_EXTERIOR;
+            put_fixed(line, line + sizeof(line), sample.values[T], 2, "C");
+            _framebuffer.text(0, 0, line, 2, true); // readable from across the room
+            _framebuffer.text_right(FB_WIDTH, 0, view == VIEW_INTERIOR ? "In" : "Ex");
+            put_fixed(line, line + sizeof(line), sample.values[H], 1, "%");
+            _framebuffer.text_right(FB_WIDTH, 1, line);
+        }
+        _sparklines[2 * view].draw(_framebuffer, full);
+        _sparklines[2 * view + 1].draw(_framebuffer, full);
+    }
+
+    Framebuffer& framebuffer()
+    {
+        return _framebuffer;
+    }
+
+private:
+    // the channels of the upper and lower sparkline of each view
+    static constexpr __u8 PLOTTED[DISPLAY_VIEWS][2] = {{CH_T_INTERIOR, CH_H_INTERIOR}, {CH_T_EXTERIOR, CH_H_EXTERIOR}, {CH_P_INTERIOR, CH_P_EXTERIOR}};
+
+    float _hours;
+    Framebuffer _framebuffer;
+    std::vector<Sparkline> _sparklines; // two per view
+    display_view _view = DISPLAY_VIEWS;
+};
+
+#endif // _DISPLAY_VIEWS_
@@ -0,0 +1,165 @@
+#ifndef _DOWNSAMPLE_
+#define _DOWNSAMPLE_
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include "log_record.cpp"
+
+#define DOWNSAMPLE_MIN_POINTS 3
+#define DOWNSAMPLE_MAX_POINTS 20000
+
+enum downsample_method
+{
+    DOWNSAMPLE_LTTB = 0, // Largest-Triangle-Three-Buckets, keeps the shape of the line
+    DOWNSAMPLE_MINMAX    // the lowest and the highest point of every bucket, keeps every peak
+};
+
+// A downsampled series, the kept points in time order.
+struct Series
+{
+    std::vector<__s64> time_ns;
+    std::vector<float> values;
+
+    void clear()
+    {
+        time_ns.clear();
+        values.clear();
+    }
+
+    void add(__s64 time, float value)
+    {
+        time_ns.push_back(time);
+        values.push_back(value);
+    }
+};
+
+// Largest-Triangle-Three-Buckets (Steinarsson, 2013): the first and the last point are kept, the
+// others are split in points - 2 buckets and from each bucket the point making the largest
+// triangle with the point kept before it and the average of the next bucket is kept. One pass,
+// exactly points points when n >= points. No value may be missing.
+static void lttb(const __s64* time_ns, const float* values, size_t n, size_t points, Series& out)
+{
+    out.clear();
+    if (n <= points || points < DOWNSAMPLE_MIN_POINTS)
+    {
+        for (size_t i = 0; i < n; i++)
+            out.add(time_ns[i], values[i]);
+        return;
+    }
+    // times in seconds from the first point, ns squared would lose the areas in rounding
+    auto x = [time_ns](size_t i) { return (time_ns[i] - time_ns[0]) * 1e-9; };
+    double every = static_cast<double>(n - 2) / (points - 2);
+    size_t a = 0;
+    out.add(time_ns[0], values[0]);
+    for (size_t bucket = 0; bucket < points - 2; bucket++)
+    {
+        size_t next_begin = static_cast<size_t>((bucket + 1) * every) + 1;
+        size_t next_end = std::min(static_cast<size_t>((bucket + 2) * every) + 1, n);
+        double avg_x = 0.0, avg_y = 0.0;
+        for (size_t i = next_begin; i < next_end; i++)
+        {
+            avg_x += x(i);
+            avg_y += values[i];
+        }
+        size_t next_count = next_end - next_begin;
+        avg_x /= next_count;
+        avg_y /= next_count;
+
+        size_t begin = static_cast<size_t>(bucket * every) + 1, end = next_begin;
+        double a_x = x(a), a_y = values[a];
+        double max_area = -1.0;
+        size_t chosen = begin;
+        for (size_t i = begin; i < end; i++)
+        {
+            double area = fabs((a_x - avg_x) * (values[i] - a_y) - (a_x - x(i)) * (avg_y - a_y));
+            if (area > max_area)
+            {
+                max_area = area;
+                chosen = i;
+            }
+        }
+        out.add(time_ns[chosen], values[chosen]);
+        a = chosen;
+    }
+    out.add(time_ns[n - 1], values[n - 1]);
+}
+
+// Min/max per bucket: the points are split in points / 2 buckets of equal count and the lowest
+// and highest point of each are kept in time order, so no peak is lost. An odd point goes to the
+// first point of the series. Exactly points points when n >= points. No value may be missing.
+static void minmax(const __s64* time_ns, const float* values, size_t n, size_t points, Series& out)
+{
+    out.clear();
+    if (n <= points || points < 2)
+    {
+        for (size_t i = 0; i < n; i++)
+            out.add(time_ns[i], values[i]);
+        return;
+    }
+    size_t first = 0;
+    if (points % 2 == 1)
+    {
+        out.add(time_ns[0], values[0]);
+        first = 1;
+    }
+    size_t buckets = points / 2, rest = n - first;
+    for (size_t bucket = 0; bucket < buckets; bucket++)
+    {
+        size_t begin = first + rest * bucket / buckets, end = first + rest * (bucket + 1) / buckets;
+        size_t low = begin, high = begin;
+        for (size_t i = begin + 1; i < end; i++)
+        {
+            low = values[i] < values[low] ? i : low;
+            high = values[i] > values[high] ? i : high;
+        }
+        if (low == high) // a flat bucket, keep its ends
+            high = end - 1;
+        size_t earlier = std::min(low, high), later = std::max(low, high);
+        out.add(time_ns[earlier], values[earlier]);
+        out.add(time_ns[later], values[later]);
+    }
+}
+
+// Downsamples every column (values at time_ns, nan when missing) to at most points points,
+// columns spread over up to threads threads. Missing values are dropped before downsampling.
+static void downsample_columns(const std::vector<__s64>& time_ns, const std::vector<const float*>& columns, size_t points, downsample_method method,
+                               unsigned threads, std::vector<Series>& out)
+{
+    out.resize(columns.size());
+    std::atomic<size_t> next_column(0);
+    auto work = [&]() {
+        std::vector<__s64> times;
+        std::vector<float> values;
+        times.reserve(time_ns.size());
+        values.reserve(time_ns.size());
+        for (size_t c = next_column++; c < columns.size(); c = next_column++)
+        {
+            times.clear();
+            values.clear();
+            const float* column = columns[c];
+            for (size_t i = 0; i < time_ns.size(); i++)
+            {
+                if (is_missing(column[i]))
+                    continue;
+                times.push_back(time_ns[i]);
+                values.push_back(column[i]);
+            }
+            if (method == DOWNSAMPLE_LTTB)
+                lttb(times.data(), values.data(), times.size(), points, out[c]);
+            else
+                minmax(times.data(), values.data(), times.size(), points, out[c]);
+        }
+    };
+    threads = std::max(1u, std::min<unsigned>(threads, columns.size()));
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++)
+        workers.emplace_back(work);
+    work();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+#endif // _DOWNSAMPLE_
@@ -3,32 +3,134 @@
 
 // basic file operations
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <string_view>
+#include <cstring>
+#include <stdexcept>
+#include <atomic>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 using namespace std;
 
+enum handoff_state
+{
+    HANDOFF_IDLE = 0,
+    HANDOFF_PENDING,  // offered, picked up by the next dump()
+    HANDOFF_ADOPTING, // being picked up, no longer cancelable
+    HANDOFF_ADOPTED,
+    HANDOFF_FAILED
+};
+
+// A rewritten copy of a Dumper's file, offered by another thread (the compactor, include/compactor.cpp).
+// The next dump() appends to the copy what was written after it was taken, renames it over the file and
+// carries on with it: a single atomic load per line otherwise, and neither side ever waits for the other.
+struct DumperHandoff
+{
+    std::atomic<int> state{HANDOFF_IDLE};
+    std::string copy_name; // set before the state goes to HANDOFF_PENDING
+    off_t copied_size = 0; // bytes of the file the copy was made from, whole lines
+};
+
 class Dumper
 {
 public:
-    Dumper(const string file_name) : _file_name(file_name) {}
+    // the file is only written by whole lines; a partial last line left by a power cut is dropped on open
+    Dumper(const string file_name, DumperHandoff* handoff = nullptr) : _file_name(file_name), _handoff(handoff) {}
 
-    void dump(const string line)
+    ~Dumper()
     {
-        fstream file(_file_name, std::ios::out | std::ios::app);
-        if (file.is_open())
+        if (_file >= 0)
+            close(_file);
+    }
+
+    Dumper(const Dumper&) = delete;
+    Dumper& operator=(const Dumper&) = delete;
+
+    // appends the line and a newline in one write, opening the file on first use
+    void dump(std::string_view line)
+    {
+        if (_file < 0)
         {
-            file << line << endl;
+            _file = open(_file_name.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+            if (_file < 0)
+                throw std::runtime_error("Error opening file!");
+            repair_tail();
         }
-        else
+        if (_handoff != nullptr && _handoff->state.load(std::memory_order_acquire) == HANDOFF_PENDING)
+            adopt();
+        char newline = '\n';
+        iovec parts[2] = {{const_cast<char*>(line.data()), line.size()}, {&newline, 1}};
+        if (writev(_file, parts, 2) != static_cast<ssize_t>(line.size() + 1))
+            throw std::runtime_error("Error writing to " + _file_name);
+    }
+
+    // flushes the appended lines to storage
+    void sync()
+    {
+        if (_file >= 0 && fdatasync(_file) < 0)
+            throw std::runtime_error("Error syncing " + _file_name);
+    }
+
+private:
+    // switches to the copy offered by the handoff, unless another thread canceled it first
+    void adopt()
+    {
+        int pending = HANDOFF_PENDING;
+        if (!_handoff->state.compare_exchange_strong(pending, HANDOFF_ADOPTING, std::memory_order_acq_rel))
+            return;
+        int copy = open(_handoff->copy_name.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+        off_t end = lseek(_file, 0, SEEK_END);
+        bool moved = copy >= 0 && end >= _handoff->copied_size;
+        char chunk[4096];
+        for (off_t offset = _handoff->copied_size; moved && offset < end;)
+        {
+            ssize_t n = pread(_file, chunk, std::min<off_t>(sizeof(chunk), end - offset), offset);
+            moved = n > 0 && write(copy, chunk, n) == n;
+            offset += n;
+        }
+        if (!moved || rename(_handoff->copy_name.c_str(), _file_name.c_str()) < 0)
         {
-            file.close();
-            throw std::runtime_error("Error opening file!");
+            if (copy >= 0)
+                close(copy);
+            _handoff->state.store(HANDOFF_FAILED, std::memory_order_release);
+            return;
         }
-        file.close();
+        close(_file);
+        _file = copy;
+        _handoff->state.store(HANDOFF_ADOPTED, std::memory_order_release);
+    }
+
+    // cuts off a line torn by a power cut, reading back from the end until the last newline
+    void repair_tail()
+    {
+        off_t end = lseek(_file, 0, SEEK_END);
+        off_t cut = end;
+        char chunk[4096];
+        while (cut > 0)
+        {
+            off_t begin = cut > static_cast<off_t>(sizeof(chunk)) ? cut - sizeof(chunk) : 0;
+            if (pread(_file, chunk, cut - begin, begin) != cut - begin)
+                return;
+            const char* newline = static_cast<const char*>(memrchr(chunk, '\n', cut - begin));
+            if (newline != nullptr)
+            {
+                cut = begin + (newline - chunk) + 1;
+                break;
+            }
+            cut = begin;
+        }
+        if (cut == end)
+            return;
+        std::cout << "Dumper: dropping " << end - cut << " bytes of a torn line at the end of " << _file_name << "\n";
+        if (ftruncate(_file, cut) < 0)
+            throw std::runtime_error("Error repairing " + _file_name);
     }
 
-private:
     string _file_name;
+    DumperHandoff* _handoff;
+    int _file = -1;
 };
 
-#endif //_DUMPER_
\ No newline at end of file
+#endif //_DUMPER_
@@ -1,10 +1,12 @@
 #ifndef _FONTS_
 #define _FONTS_
 
+#include <linux/types.h>
+
 // 8x8 Font ASCII 32 - 127 Implemented
 // Users can modify this to support more characters (glyphs)
 
-unsigned char font8x8[] =
+static constexpr unsigned char font8x8[] =
 {
     0x08,                                     // width
     0x08,                                     // height
@@ -111,4 +113,70 @@ unsigned char font8x8[] =
     0x00,0x00,0x04,0x02,0x04,0x02,0x00,0x00,  // ~
 };
 
+#define FONT_FIRST_CHAR 32
+#define FONT_GLYPHS 95     // ' ' to '~'
+#define FONT_SPACE_WIDTH 3 // columns of a space in proportional text, before scaling
+
+static constexpr int font_glyph(char ch)
+{
+    return ch < FONT_FIRST_CHAR || ch >= FONT_FIRST_CHAR + FONT_GLYPHS ? 0 : ch - FONT_FIRST_CHAR;
+}
+
+// font8x8 scaled by S at compile time, in the SSD1306 memory layout: S pages of 8 S column bytes
+// per glyph, so drawing a glyph is one memcpy per page. first and width are the inked columns, for
+// proportional text.
+template <int S>
+struct ScaledFont
+{
+    __u8 columns[FONT_GLYPHS][S][8 * S];
+    __u8 first[FONT_GLYPHS];
+    __u8 width[FONT_GLYPHS];
+};
+
+template <int S>
+constexpr ScaledFont<S> scale_font()
+{
+    ScaledFont<S> font = {};
+    for (int g = 0; g < FONT_GLYPHS; g++)
+    {
+        const unsigned char* glyph = font8x8 + 2 + g * font8x8[0];
+        for (int page = 0; page < S; page++)
+        {
+            for (int x = 0; x < 8 * S; x++)
+            {
+                __u8 byte = 0;
+                for (int bit = 0; bit < 8; bit++)
+                    byte |= ((glyph[x / S] >> ((page * 8 + bit) / S)) & 1) << bit;
+                font.columns[g][page][x] = byte;
+            }
+        }
+        int left = 8, right = -1;
+        for (int x = 0; x < 8; x++)
+        {
+            if (glyph[x] == 0)
+                continue;
+            left = left == 8 ? x : left;
+            right = x;
+        }
+        font.first[g] = right < 0 ? 0 : left * S;
+        font.width[g] = right < 0 ? FONT_SPACE_WIDTH * S : (right - left + 1) * S;
+    }
+    return font;
+}
+
+static constexpr ScaledFont<1> FONT_1X = scale_font<1>();
+static constexpr ScaledFont<2> FONT_2X = scale_font<2>();
+static constexpr ScaledFont<3> FONT_3X = scale_font<3>();
+
+constexpr bool unscaled_font_matches()
+{
+    for (int g = 0; g < FONT_GLYPHS; g++)
+        for (int x = 0; x < 8; x++)
+            if (FONT_1X.columns[g][0][x] != font8x8[2 + g * 8 + x])
+                return false;
+    return true;
+}
+static_assert(unscaled_font_matches(), "1x glyphs differ from font8x8");
+static_assert(FONT_2X.columns[font_glyph('|')][0][6] == 0xFC && FONT_2X.columns[font_glyph('|')][1][7] == 0x3F, "2x glyphs are not scaled");
+
 #endif
\ No newline at end of file
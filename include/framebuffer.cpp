@@ -0,0 +1,222 @@
+#ifndef _FRAMEBUFFER_
+#define _FRAMEBUFFER_
+
+#include <cstring>
+#include <charconv>
+#include <algorithm>
+#include <linux/types.h>
+#include "fonts.hpp"
+#include "log_record.cpp"
+
+#define FB_WIDTH 128
+#define FB_HEIGHT 64
+#define FB_PAGES (FB_HEIGHT / 8)
+#define FB_RUN_GAP 6 // unchanged bytes cheaper to resend than the three cursor commands of a new run
+
+// 128x64 monochrome image in the SSD1306 memory layout: 8 pages of 128 column bytes, bit 0 on top.
+// Drawing only touches memory; flush() compares with what the panel was last sent and writes only
+// the changed runs of each page, so a view that changes a few digits costs a few bytes on the bus.
+class Framebuffer
+{
+public:
+    void clear()
+    {
+        memset(_pixels, 0, sizeof(_pixels));
+    }
+
+    // the panel content is unknown (re-initialized display), the next flush sends everything
+    void invalidate()
+    {
+        _valid = false;
+    }
+
+    inline void pixel(int x, int y, bool on = true)
+    {
+        if (x < 0 || x >= FB_WIDTH || y < 0 || y >= FB_HEIGHT)
+            return;
+        __u8 bit = 1 << (y & 7);
+        _pixels[y >> 3][x] = on ? _pixels[y >> 3][x] | bit : _pixels[y >> 3][x] & ~bit;
+    }
+
+    inline bool get(int x, int y) const
+    {
+        return x >= 0 && x < FB_WIDTH && y >= 0 && y < FB_HEIGHT && (_pixels[y >> 3][x] >> (y & 7)) & 1;
+    }
+
+    void hline(int x0, int x1, int y, bool on = true)
+    {
+        for (int x = std::min(x0, x1); x <= std::max(x0, x1); x++)
+            pixel(x, y, on);
+    }
+
+    // a whole byte at a time inside the pages the line crosses
+    void vline(int x, int y0, int y1, bool on = true)
+    {
+        if (x < 0 || x >= FB_WIDTH)
+            return;
+        int top = std::max(std::min(y0, y1), 0), bottom = std::min(std::max(y0, y1), FB_HEIGHT - 1);
+        for (int y = top; y <= bottom;)
+        {
+            int last = std::min(bottom, y | 7);
+            __u8 mask = static_cast<__u8>((0xFF << (y & 7)) & (0xFF >> (7 - (last & 7))));
+            _pixels[y >> 3][x] = on ? _pixels[y >> 3][x] | mask : _pixels[y >> 3][x] & ~mask;
+            y = last + 1;
+        }
+    }
+
+    // Bresenham
+    void line(int x0, int y0, int x1, int y1, bool on = true)
+    {
+        int dx = abs(x1 - x0), dy = -abs(y1 - y0);
+        int sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+        int error = dx + dy;
+        while (true)
+        {
+            pixel(x0, y0, on);
+            if (x0 == x1 && y0 == y1)
+                return;
+            int e2 = 2 * error;
+            if (e2 >= dy)
+            {
+                error += dy;
+                x0 += sx;
+            }
+            if (e2 <= dx)
+            {
+                error += dx;
+                y0 += sy;
+            }
+        }
+    }
+
+    void rect(int x, int y, int width, int height, bool on = true)
+    {
+        hline(x, x + width - 1, y, on);
+        hline(x, x + width - 1, y + height - 1, on);
+        vline(x, y, y + height - 1, on);
+        vline(x + width - 1, y, y + height - 1, on);
+    }
+
+    void fill_rect(int x, int y, int width, int height, bool on = true)
+    {
+        for (int column = std::max(x, 0); column < std::min(x + width, FB_WIDTH); column++)
+            vline(column, y, y + height - 1, on);
+    }
+
+    // text 8 scale pixels high on pages [page, page + scale), clipped at the right edge; returns the
+    // column after it. Proportional text is set with the inked columns of each glyph and a blank
+    // column (scaled) between glyphs instead of 8 column cells.
+    int text(int x, __u8 page, const char* str, __u8 scale = 1, bool proportional = false)
+    {
+        if (scale == 3)
+            return draw_text(FONT_3X, x, page, str, proportional);
+        if (scale == 2)
+            return draw_text(FONT_2X, x, page, str, proportional);
+        return draw_text(FONT_1X, x, page, str, proportional);
+    }
+
+    // text ending at column x_end
+    int text_right(int x_end, __u8 page, const char* str, __u8 scale = 1, bool proportional = false)
+    {
+        return text(x_end - text_width(str, scale, proportional), page, str, scale, proportional);
+    }
+
+    static int text_width(const char* str, __u8 scale = 1, bool proportional = false)
+    {
+        scale = scale < 1 ? 1 : (scale > 3 ? 3 : scale);
+        int width = 0;
+        for (; *str != '\0'; str++)
+            width += proportional ? FONT_1X.width[font_glyph(*str)] + 1 : 8;
+        return width * scale;
+    }
+
+    // moves the columns [x, x + width) of pages [page, page + pages) left by n, the n columns freed on the right are cleared
+    void scroll_left(int x, int width, __u8 page, __u8 pages, int n)
+    {
+        n = std::min(n, width);
+        for (__u8 p = page; p < page + pages && p < FB_PAGES; p++)
+        {
+            memmove(_pixels[p] + x, _pixels[p] + x + n, width - n);
+            memset(_pixels[p] + x + width - n, 0, n);
+        }
+    }
+
+    // sends every changed run as write(x, page, data, count), returns the bytes sent
+    template <typename Write>
+    size_t flush(Write write)
+    {
+        size_t sent = 0;
+        for (__u8 page = 0; page < FB_PAGES; page++)
+        {
+            int x = 0;
+            while (x < FB_WIDTH)
+            {
+                while (x < FB_WIDTH && _valid && _pixels[page][x] == _shown[page][x])
+                    x++;
+                if (x == FB_WIDTH)
+                    break;
+                int end = x + 1, last_changed = x;
+                while (end < FB_WIDTH && end - last_changed <= FB_RUN_GAP)
+                {
+                    if (!_valid || _pixels[page][end] != _shown[page][end])
+                        last_changed = end;
+                    end++;
+                }
+                int count = last_changed + 1 - x;
+                write(static_cast<__u8>(x), page, _pixels[page] + x, static_cast<__u8>(count));
+                memcpy(_shown[page] + x, _pixels[page] + x, count);
+                sent += count;
+                x = last_changed + 1;
+            }
+        }
+        _valid = true;
+        return sent;
+    }
+
+    const __u8* page(__u8 page) const
+    {
+        return _pixels[page];
+    }
+
+private:
+    template <int S>
+    int draw_text(const ScaledFont<S>& font, int x, __u8 page, const char* str, bool proportional)
+    {
+        x = std::max(x, 0);
+        for (; *str != '\0' && x < FB_WIDTH; str++)
+        {
+            int g = font_glyph(*str);
+            int first = proportional ? font.first[g] : 0;
+            int width = std::min(proportional ? font.width[g] + S : 8 * S, FB_WIDTH - x);
+            for (int p = 0; p < S && page + p < FB_PAGES; p++)
+                memcpy(_pixels[page + p] + x, font.columns[g][p] + first, std::min(width, 8 * S - first));
+            if (proportional && width > 8 * S - first) // the spacing after a glyph inked up to its last column
+                for (int p = 0; p < S && page + p < FB_PAGES; p++)
+                    memset(_pixels[page + p] + x + 8 * S - first, 0, width - (8 * S - first));
+            x += width;
+        }
+        return x;
+    }
+
+    __u8 _pixels[FB_PAGES][FB_WIDTH] = {};
+    __u8 _shown[FB_PAGES][FB_WIDTH] = {}; // what the panel was sent last
+    bool _valid = false;                  // _shown matches the panel
+};
+
+// value with a fixed number of decimals followed by unit, "--" when missing; returns the end of the text
+static char* put_fixed(char* p, char* end, float value, int precision, const char* unit = "")
+{
+    if (is_missing(value))
+    {
+        *p++ = '-';
+        *p++ = '-';
+    }
+    else
+        p = std::to_chars(p, end - 8, value, std::chars_format::fixed, precision).ptr;
+    while (*unit != '\0' && p < end - 1)
+        *p++ = *unit++;
+    *p = '\0';
+    return p;
+}
+
+#endif // _FRAMEBUFFER_
@@ -0,0 +1,635 @@
+#ifndef _GORILLA_
+#define _GORILLA_
+
+// Gorilla style compression of LogRecord series (Pelkonen et al., "Gorilla: A Fast, Scalable,
+// In-Memory Time Series Database"): delta-of-delta timestamps and XOR encoded values,
+// bit-packed per channel into self-contained blocks.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "log_record.cpp"
+#include "journal.cpp"
+
+#define GORILLA_MAGIC 0x42524F47 // "GORB"
+#define GORILLA_VERSION 2
+#define GORILLA_BLOCK_RECORDS 1440 // records per block, 6 hours of 15 s records up to 5 days of 300 s ones
+#define GORILLA_TIME_UNIT_NS 1000000 // timestamps are stored with millisecond resolution
+#define GORILLA_CHANNELS (LOG_CHANNELS + 3) // time, values, ret_code, period
+#define GORILLA_V1_CHANNELS (LOG_CHANNELS + 2) // version 1 blocks have no period, it reads as 0
+
+class BitWriter
+{
+public:
+    void write(__u64 bits, __u8 count)
+    {
+        // appends the lowest count bits, most significant first
+        if (count > 32)
+        {
+            write(bits >> 32, count - 32);
+            count = 32;
+        }
+        bits &= (1ULL << count) - 1;
+        _pending = (_pending << count) | bits;
+        _pending_bits += count;
+        while (_pending_bits >= 8)
+        {
+            _pending_bits -= 8;
+            _bytes.push_back(static_cast<__u8>(_pending >> _pending_bits));
+        }
+    }
+
+    size_t size() const
+    {
+        return _bytes.size() + (_pending_bits > 0);
+    }
+
+    // pads the last byte with zeros and returns the packed bits
+    const std::vector<__u8>& finish()
+    {
+        if (_pending_bits > 0)
+            _bytes.push_back(static_cast<__u8>(_pending << (8 - _pending_bits)));
+        _pending_bits = 0;
+        return _bytes;
+    }
+
+    // room for count bytes, so the writes up to there do not allocate
+    void reserve(size_t count)
+    {
+        _bytes.reserve(count);
+    }
+
+    void clear()
+    {
+        _bytes.clear();
+        _pending = 0;
+        _pending_bits = 0;
+    }
+
+private:
+    std::vector<__u8> _bytes;
+    __u64 _pending = 0;
+    __u8 _pending_bits = 0;
+};
+
+class BitReader
+{
+public:
+    BitReader(const __u8* data, size_t size) : _data(data), _size_bits(size * 8) {}
+
+    __u64 read(__u8 count)
+    {
+        if (_position + count > _size_bits)
+            throw std::runtime_error("Gorilla: block data is truncated.");
+        __u64 bits = 0;
+        while (count > 0)
+        {
+            // take as many bits as are left in the current byte in one go
+            __u8 offset = _position & 7;
+            __u8 take = std::min<__u8>(count, 8 - offset);
+            __u8 byte = _data[_position >> 3];
+            bits = (bits << take) | ((byte >> (8 - offset - take)) & ((1 << take) - 1));
+            _position += take;
+            count -= take;
+        }
+        return bits;
+    }
+
+    bool read_bit()
+    {
+        return read(1) != 0;
+    }
+
+private:
+    const __u8* _data;
+    size_t _size_bits, _position = 0;
+};
+
+class TimestampEncoder
+{
+public:
+    void append(BitWriter& out, __s64 t)
+    {
+        if (_count == 0)
+            out.write(t, 64);
+        else
+        {
+            __s64 delta = t - _previous;
+            __s64 dod = delta - _previous_delta;
+            if (dod == 0)
+                out.write(0b0, 1);
+            else if (dod >= -64 && dod <= 63) // the two's complement range of the bucket
+                write_bucket(out, 0b10, 2, dod, 7);
+            else if (dod >= -256 && dod <= 255)
+                write_bucket(out, 0b110, 3, dod, 9);
+            else if (dod >= -2048 && dod <= 2047)
+                write_bucket(out, 0b1110, 4, dod, 12);
+            else
+                write_bucket(out, 0b1111, 4, dod, 64); // gaps after restarts do not fit in 32 bits
+            _previous_delta = delta;
+        }
+        _previous = t;
+        _count++;
+    }
+
+    __s64 read(BitReader& in)
+    {
+        if (_count++ == 0)
+            return _previous = static_cast<__s64>(in.read(64));
+
+        __s64 dod = 0;
+        if (!in.read_bit())
+            dod = 0;
+        else if (!in.read_bit())
+            dod = read_bucket(in, 7);
+        else if (!in.read_bit())
+            dod = read_bucket(in, 9);
+        else if (!in.read_bit())
+            dod = read_bucket(in, 12);
+        else
+            dod = static_cast<__s64>(in.read(64));
+        _previous_delta += dod;
+        return _previous += _previous_delta;
+    }
+
+    void reset()
+    {
+        _previous = _previous_delta = 0;
+        _count = 0;
+    }
+
+private:
+    static void write_bucket(BitWriter& out, __u8 prefix, __u8 prefix_bits, __s64 dod, __u8 bits)
+    {
+        out.write(prefix, prefix_bits);
+        out.write(static_cast<__u64>(dod), bits);
+    }
+
+    static __s64 read_bucket(BitReader& in, __u8 bits)
+    {
+        __u64 raw = in.read(bits);
+        // sign extend the two's complement value
+        __u64 sign = 1ULL << (bits - 1);
+        return static_cast<__s64>((raw ^ sign) - sign);
+    }
+
+    __s64 _previous = 0, _previous_delta = 0;
+    size_t _count = 0;
+};
+
+class ValueEncoder
+{
+public:
+    // values are encoded by their 32 bit pattern, so floats (including nan) and ints round trip exactly
+    void append(BitWriter& out, __u32 value)
+    {
+        if (_count++ == 0)
+        {
+            out.write(value, 32);
+            _previous = value;
+            return;
+        }
+
+        __u32 x = value ^ _previous;
+        _previous = value;
+        if (x == 0)
+        {
+            out.write(0b0, 1);
+            return;
+        }
+
+        __u8 leading = std::min(__builtin_clz(x), 31), trailing = __builtin_ctz(x);
+        if (_leading != 0xFF && leading >= _leading && trailing >= _trailing)
+        {
+            // meaningful bits fit in the previous window
+            out.write(0b10, 2);
+            out.write(x >> _trailing, 32 - _leading - _trailing);
+        }
+        else
+        {
+            __u8 length = 32 - leading - trailing;
+            out.write(0b11, 2);
+            out.write(leading, 5);
+            out.write(length - 1, 5);
+            out.write(x >> trailing, length);
+            _leading = leading;
+            _trailing = trailing;
+        }
+    }
+
+    __u32 read(BitReader& in)
+    {
+        if (_count++ == 0)
+            return _previous = static_cast<__u32>(in.read(32));
+
+        if (!in.read_bit())
+            return _previous;
+
+        if (in.read_bit())
+        {
+            _leading = in.read(5);
+            __u8 length = in.read(5) + 1;
+            _trailing = 32 - _leading - length;
+        }
+        __u32 x = static_cast<__u32>(in.read(32 - _leading - _trailing)) << _trailing;
+        return _previous ^= x;
+    }
+
+    void reset()
+    {
+        _previous = 0;
+        _leading = _trailing = 0xFF;
+        _count = 0;
+    }
+
+private:
+    __u32 _previous = 0;
+    __u8 _leading = 0xFF, _trailing = 0xFF;
+    size_t _count = 0;
+};
+
+static inline __u32 float_bits(float value)
+{
+    __u32 bits;
+    memcpy(&bits, &value, 4);
+    return bits;
+}
+
+static inline float bits_float(__u32 bits)
+{
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+// Streaming encoder of one block: records are bit-packed per channel as they are appended.
+// Block layout (little endian):
+//   u32 magic, u16 version, u16 channels, u32 count, s64 t_first_ns, s64 t_last_ns, u32 time_unit_ns,
+//   then per channel (time, LOG_CHANNELS values, ret_code, period_s): u32 byte length followed by the bits;
+//   version 1 blocks end after ret_code
+class GorillaBlockEncoder
+{
+public:
+    void append(const LogRecord& record)
+    {
+        if (_count == 0)
+            _t_first = record.time_ns;
+        _t_last = record.time_ns;
+        _time.append(_streams[0], record.time_ns / GORILLA_TIME_UNIT_NS);
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            _values[ch].append(_streams[ch + 1], float_bits(record.values[ch]));
+        _values[LOG_CHANNELS].append(_streams[LOG_CHANNELS + 1], static_cast<__u32>(record.ret_code));
+        _values[LOG_CHANNELS + 1].append(_streams[LOG_CHANNELS + 2], float_bits(record.period_s));
+        _count++;
+    }
+
+    __u32 count() const
+    {
+        return _count;
+    }
+
+    size_t size_bytes() const
+    {
+        size_t size = HEADER_SIZE;
+        for (const BitWriter& stream : _streams)
+            size += 4 + stream.size();
+        return size;
+    }
+
+    // worst case of a block of count records: a 64 bit dod after its 4 bit prefix, a 32 bit xor after
+    // its 12 bits of window for each value
+    static size_t max_size_bytes(__u32 count)
+    {
+        return HEADER_SIZE + 4 * GORILLA_CHANNELS + (count * 68 + 7) / 8 + (GORILLA_CHANNELS - 1) * ((count * 44 + 7) / 8);
+    }
+
+    // sizes the streams for blocks of up to count records, appending then never allocates
+    void reserve(__u32 count)
+    {
+        _streams[0].reserve((count * 68 + 7) / 8);
+        for (__u8 ch = 1; ch < GORILLA_CHANNELS; ch++)
+            _streams[ch].reserve((count * 44 + 7) / 8);
+    }
+
+    // appends the serialized block to out and starts a new block
+    void finish(std::vector<__u8>& out)
+    {
+        put(out, __u32(GORILLA_MAGIC));
+        put(out, __u16(GORILLA_VERSION));
+        put(out, __u16(GORILLA_CHANNELS));
+        put(out, _count);
+        put(out, _t_first);
+        put(out, _t_last);
+        put(out, __u32(GORILLA_TIME_UNIT_NS));
+        for (BitWriter& stream : _streams)
+        {
+            const std::vector<__u8>& bytes = stream.finish();
+            put(out, __u32(bytes.size()));
+            out.insert(out.end(), bytes.begin(), bytes.end());
+            stream.clear();
+        }
+        _time.reset();
+        for (ValueEncoder& value : _values)
+            value.reset();
+        _count = 0;
+    }
+
+    static constexpr size_t HEADER_SIZE = 4 + 2 + 2 + 4 + 8 + 8 + 4;
+
+private:
+    template <typename T>
+    static void put(std::vector<__u8>& out, T value)
+    {
+        __u8 bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    BitWriter _streams[GORILLA_CHANNELS];
+    TimestampEncoder _time;
+    ValueEncoder _values[GORILLA_CHANNELS - 1];
+    __u32 _count = 0;
+    __s64 _t_first = 0, _t_last = 0;
+};
+
+struct GorillaBlockHeader
+{
+    __u16 channels = GORILLA_CHANNELS;
+    __u32 count = 0;
+    __s64 t_first_ns = INT64_MIN, t_last_ns = INT64_MIN;
+    size_t size; // of the whole block in bytes
+};
+
+class GorillaBlockDecoder
+{
+public:
+    // the channel count of blocks of the version, 0 for an unknown version
+    static __u16 channels(__u16 version)
+    {
+        return version == GORILLA_VERSION ? GORILLA_CHANNELS : (version == 1 ? GORILLA_V1_CHANNELS : 0);
+    }
+
+    // reads the header of the block at data, without decoding it
+    static GorillaBlockHeader read_header(const __u8* data, size_t size)
+    {
+        if (size < GorillaBlockEncoder::HEADER_SIZE || get<__u32>(data) != GORILLA_MAGIC || channels(get<__u16>(data + 4)) == 0)
+            throw std::runtime_error("Gorilla: not a block.");
+        if (get<__u16>(data + 6) != channels(get<__u16>(data + 4)))
+            throw std::runtime_error("Gorilla: unexpected channel count.");
+
+        GorillaBlockHeader header;
+        header.channels = get<__u16>(data + 6);
+        header.count = get<__u32>(data + 8);
+        header.t_first_ns = get<__s64>(data + 12);
+        header.t_last_ns = get<__s64>(data + 20);
+        header.size = GorillaBlockEncoder::HEADER_SIZE;
+        for (__u16 ch = 0; ch < header.channels; ch++)
+        {
+            if (header.size + 4 > size)
+                throw std::runtime_error("Gorilla: block data is truncated.");
+            header.size += 4 + get<__u32>(data + header.size);
+        }
+        if (header.size > size)
+            throw std::runtime_error("Gorilla: block data is truncated.");
+        return header;
+    }
+
+    // decodes the block at data and appends its records to out, returns the block size
+    static size_t decode(const __u8* data, size_t size, std::vector<LogRecord>& out)
+    {
+        GorillaBlockHeader header = read_header(data, size);
+        __u32 time_unit = get<__u32>(data + 28);
+        size_t first = out.size();
+        out.resize(first + header.count);
+
+        // channels are decoded one after the other, which keeps each inner loop tight
+        size_t offset = GorillaBlockEncoder::HEADER_SIZE;
+        for (__u16 ch = 0; ch < header.channels; ch++)
+        {
+            __u32 length = get<__u32>(data + offset);
+            BitReader in(data + offset + 4, length);
+            offset += 4 + length;
+            if (ch == 0)
+            {
+                TimestampEncoder time;
+                for (__u32 i = 0; i < header.count; i++)
+                    out[first + i].time_ns = time.read(in) * time_unit;
+            }
+            else
+            {
+                ValueEncoder value;
+                for (__u32 i = 0; i < header.count; i++)
+                {
+                    __u32 bits = value.read(in);
+                    if (ch <= LOG_CHANNELS)
+                        out[first + i].values[ch - 1] = bits_float(bits);
+                    else if (ch == LOG_CHANNELS + 1)
+                        out[first + i].ret_code = static_cast<__s32>(bits);
+                    else
+                        out[first + i].period_s = bits_float(bits);
+                }
+            }
+        }
+        return header.size;
+    }
+
+private:
+    template <typename T>
+    static T get(const __u8* data)
+    {
+        T value;
+        memcpy(&value, data, sizeof(T));
+        return value;
+    }
+};
+
+// Append-only file of gorilla blocks. The block being filled lives in memory and in a write-ahead
+// journal next to the store (FILE.wal), so a crash or a power cut loses nothing that was synced: on
+// open a torn last block is cut off and the journal is replayed into the open block.
+class GorillaStore
+{
+public:
+    GorillaStore(const std::string file_name, __u32 block_records = GORILLA_BLOCK_RECORDS, SyncPolicy policy = SyncPolicy())
+        : _file_name(file_name), _block_records(block_records), _journal(file_name + ".wal", policy)
+    {
+        _file = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (_file < 0)
+            throw std::runtime_error("Error opening file!");
+        _encoder.reserve(block_records);
+        _block.reserve(GorillaBlockEncoder::max_size_bytes(block_records));
+        try
+        {
+            recover();
+        }
+        catch (...)
+        {
+            close(_file);
+            throw;
+        }
+    }
+
+    ~GorillaStore()
+    {
+        // the open block stays in the journal and is picked up by the next open
+        close(_file);
+    }
+
+    GorillaStore(const GorillaStore&) = delete;
+    GorillaStore& operator=(const GorillaStore&) = delete;
+
+    void append(const LogRecord& record)
+    {
+        _journal.append(&record, sizeof(record));
+        _encoder.append(record);
+        _last_ns = std::max(_last_ns, record.time_ns);
+        if (_encoder.count() >= _block_records)
+            flush();
+    }
+
+    // makes the appended records durable, for stores opened with a policy that leaves syncing to the caller
+    void sync()
+    {
+        _journal.sync();
+    }
+
+    // time of the newest record in the store, INT64_MIN when empty
+    __s64 last_time_ns() const
+    {
+        return _last_ns;
+    }
+
+    // writes the open block to the store, then drops it from the journal
+    void flush()
+    {
+        if (_encoder.count() == 0)
+            return;
+        _block.clear();
+        _encoder.finish(_block);
+        if (pwrite(_file, _block.data(), _block.size(), _end) != static_cast<ssize_t>(_block.size()) || fdatasync(_file) < 0)
+        {
+            if (ftruncate(_file, _end) < 0)
+                std::cerr << "GorillaStore: cannot truncate " << _file_name << "\n";
+            throw std::runtime_error("Error writing to " + _file_name);
+        }
+        _end += _block.size();
+        _journal.reset();
+    }
+
+    // the flushed blocks followed by the open block from the journal
+    static void read_all(const std::string& file_name, std::vector<LogRecord>& out)
+    {
+        std::ifstream file(file_name, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("Error opening file!");
+        std::vector<__u8> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        size_t offset = 0;
+        GorillaBlockHeader last; // times in full resolution, unlike the decoded timestamps
+        while (offset < data.size())
+        {
+            last = GorillaBlockDecoder::read_header(data.data() + offset, data.size() - offset);
+            offset += GorillaBlockDecoder::decode(data.data() + offset, data.size() - offset, out);
+        }
+        read_open_block(file_name, last, out);
+    }
+
+    // appends the journaled records, the ones of the block being filled after the last one of the store
+    static void read_open_block(const std::string& file_name, const GorillaBlockHeader& last, std::vector<LogRecord>& out)
+    {
+        size_t first = out.size();
+        Journal::read(file_name + ".wal", [&](const __u8* data, __u32 size) {
+            LogRecord record;
+            if (read_record(data, size, record))
+                out.push_back(record);
+        });
+        if (flushed(out.data() + first, out.size() - first, last))
+            out.resize(first);
+    }
+
+    // whether the journaled records are those of the last block, flushed just before a crash that kept the
+    // journal from being reset; told by their count and end times, as records need not be in time order
+    static bool flushed(const LogRecord* journaled, size_t count, const GorillaBlockHeader& last)
+    {
+        return count > 0 && count == last.count && journaled[0].time_ns == last.t_first_ns && journaled[count - 1].time_ns == last.t_last_ns;
+    }
+
+private:
+    void recover()
+    {
+        // walks the block headers, a few small reads per day of data
+        struct stat status;
+        if (fstat(_file, &status) < 0)
+            throw std::runtime_error("Error opening file!");
+        GorillaBlockHeader last;
+        __u8 header[GorillaBlockEncoder::HEADER_SIZE];
+        while (_end + sizeof(header) <= static_cast<__u64>(status.st_size))
+        {
+            if (pread(_file, header, sizeof(header), _end) != sizeof(header) || get<__u32>(header) != GORILLA_MAGIC ||
+                GorillaBlockDecoder::channels(get<__u16>(header + 4)) == 0 || get<__u16>(header + 6) != GorillaBlockDecoder::channels(get<__u16>(header + 4)))
+                break;
+            __u64 size = sizeof(header);
+            for (__u16 ch = 0; ch < get<__u16>(header + 6) && _end + size + 4 <= static_cast<__u64>(status.st_size); ch++)
+            {
+                __u32 length;
+                if (pread(_file, &length, 4, _end + size) != 4)
+                    break;
+                size += 4 + length;
+            }
+            if (_end + size > static_cast<__u64>(status.st_size))
+                break;
+            _end += size;
+            last.count = get<__u32>(header + 8);
+            last.t_first_ns = get<__s64>(header + 12);
+            last.t_last_ns = get<__s64>(header + 20);
+        }
+        _last_ns = last.t_last_ns;
+        if (_end < static_cast<__u64>(status.st_size))
+        {
+            std::cout << "GorillaStore: dropping " << status.st_size - _end << " bytes of a torn block at the end of " << _file_name << "\n";
+            if (ftruncate(_file, _end) < 0 || fdatasync(_file) < 0)
+                throw std::runtime_error("Error writing to " + _file_name);
+        }
+
+        // records of the open block, unless they are the last block already
+        std::vector<LogRecord> journaled;
+        _journal.for_each([&](const __u8* data, __u32 size) {
+            LogRecord record;
+            if (!read_record(data, size, record))
+                return;
+            journaled.push_back(record);
+            _last_ns = std::max(_last_ns, record.time_ns);
+        });
+        if (!flushed(journaled.data(), journaled.size(), last))
+            for (const LogRecord& record : journaled)
+                _encoder.append(record);
+        if (_journal.truncated_bytes() > 0)
+            std::cout << "GorillaStore: dropped " << _journal.truncated_bytes() << " bytes of a torn record at the end of " << _file_name << ".wal\n";
+        if (_encoder.count() >= _block_records)
+            flush();
+    }
+
+    template <typename T>
+    static T get(const __u8* data)
+    {
+        T value;
+        memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    std::string _file_name;
+    __u32 _block_records;
+    Journal _journal;
+    int _file = -1;
+    __u64 _end = 0;
+    __s64 _last_ns = INT64_MIN;
+    GorillaBlockEncoder _encoder;
+    std::vector<__u8> _block;
+};
+
+#endif // _GORILLA_
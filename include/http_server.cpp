@@ -0,0 +1,325 @@
+#ifndef _HTTP_SERVER_
+#define _HTTP_SERVER_
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/types.h>
+
+#define HTTP_MAX_REQUEST_SIZE 8192
+#define HTTP_MAX_EVENTS 64
+
+struct HttpRequest
+{
+    std::string_view method, path, query;
+
+    // value of a query string parameter, empty when not present
+    std::string_view param(std::string_view name) const
+    {
+        size_t p = 0;
+        while (p < query.size())
+        {
+            size_t end = query.find('&', p);
+            if (end == std::string_view::npos)
+                end = query.size();
+            std::string_view pair = query.substr(p, end - p);
+            size_t equals = pair.find('=');
+            if (pair.substr(0, equals) == name)
+                return equals == std::string_view::npos ? std::string_view() : pair.substr(equals + 1);
+            p = end + 1;
+        }
+        return std::string_view();
+    }
+};
+
+struct HttpResponse
+{
+    int status = 200;
+    const char* content_type = "application/json";
+    std::string body;
+};
+
+// Minimal HTTP/1.1 GET server on its own epoll thread. Connections are non-blocking and kept alive,
+// the handler runs on the server thread and fills in the response.
+class HttpServer
+{
+public:
+    typedef std::function<void(const HttpRequest&, HttpResponse&)> Handler;
+
+    HttpServer(__u16 port, Handler handler, const char* address = "127.0.0.1") : _handler(handler)
+    {
+        _listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_listener < 0)
+            throw std::runtime_error("HTTP: cannot create socket.");
+        int yes = 1;
+        setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, address, &addr.sin_addr);
+        if (bind(_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(_listener, 128) < 0)
+        {
+            close(_listener);
+            throw std::runtime_error("HTTP: cannot listen on port " + std::to_string(port) + ".");
+        }
+
+        _epoll = epoll_create1(EPOLL_CLOEXEC);
+        _wake_up = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        watch(_listener, EPOLLIN);
+        watch(_wake_up, EPOLLIN);
+    }
+
+    ~HttpServer()
+    {
+        stop();
+        for (auto& connection : _connections)
+            close(connection.first);
+        close(_wake_up);
+        close(_epoll);
+        close(_listener);
+    }
+
+    // port actually bound, useful when constructed with port 0
+    __u16 port() const
+    {
+        sockaddr_in addr = {};
+        socklen_t length = sizeof(addr);
+        getsockname(_listener, reinterpret_cast<sockaddr*>(&addr), &length);
+        return ntohs(addr.sin_port);
+    }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _thread = std::thread(&HttpServer::run, this);
+    }
+
+    void stop()
+    {
+        if (!_running)
+            return;
+        _running = false;
+        __u64 one = 1;
+        if (write(_wake_up, &one, sizeof(one)) < 0)
+            std::cerr << "HTTP: cannot wake up the server thread.\n";
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+private:
+    struct Connection
+    {
+        std::string in, out;
+        size_t out_offset = 0;
+        bool close_after_write = false;
+        bool watching_out = false; // EPOLLOUT is only armed while a response is stuck in the socket buffer
+    };
+
+    void watch(int fd, __u32 events)
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void rewatch(int fd, __u32 events)
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &event);
+    }
+
+    void drop(int fd)
+    {
+        epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        _connections.erase(fd);
+    }
+
+    void run()
+    {
+        epoll_event events[HTTP_MAX_EVENTS];
+        while (_running)
+        {
+            int n = epoll_wait(_epoll, events, HTTP_MAX_EVENTS, -1);
+            for (int i = 0; i < n; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == _wake_up)
+                    continue;
+                if (fd == _listener)
+                {
+                    accept_all();
+                    continue;
+                }
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                {
+                    drop(fd);
+                    continue;
+                }
+                if ((events[i].events & EPOLLIN) && !receive(fd))
+                    continue;
+                if (events[i].events & EPOLLOUT)
+                    send_pending(fd);
+            }
+        }
+    }
+
+    void accept_all()
+    {
+        while (true)
+        {
+            int fd = accept4(_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            _connections[fd];
+            watch(fd, EPOLLIN);
+        }
+    }
+
+    // reads what is available and answers every complete request, returns false if the connection was dropped
+    bool receive(int fd)
+    {
+        Connection& connection = _connections[fd];
+        char buffer[4096];
+        while (true)
+        {
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n > 0)
+            {
+                connection.in.append(buffer, n);
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                drop(fd);
+                return false;
+            }
+            break;
+        }
+
+        size_t header_end;
+        while ((header_end = connection.in.find("\r\n\r\n")) != std::string::npos)
+        {
+            respond(connection, std::string_view(connection.in.data(), header_end));
+            connection.in.erase(0, header_end + 4);
+        }
+        if (connection.in.size() > HTTP_MAX_REQUEST_SIZE)
+        {
+            drop(fd);
+            return false;
+        }
+        return send_pending(fd);
+    }
+
+    void respond(Connection& connection, std::string_view header)
+    {
+        HttpRequest request;
+        HttpResponse response;
+        size_t line_end = header.find("\r\n");
+        std::string_view line = header.substr(0, line_end);
+        size_t first_space = line.find(' '), second_space = line.rfind(' ');
+        if (first_space == std::string_view::npos || second_space <= first_space)
+        {
+            response.status = 400;
+            response.body = "{\"error\":\"bad request\"}";
+            connection.close_after_write = true;
+        }
+        else
+        {
+            request.method = line.substr(0, first_space);
+            std::string_view target = line.substr(first_space + 1, second_space - first_space - 1);
+            size_t question = target.find('?');
+            request.path = target.substr(0, question);
+            if (question != std::string_view::npos)
+                request.query = target.substr(question + 1);
+            if (line.substr(second_space + 1) == "HTTP/1.0" || header.find("Connection: close") != std::string_view::npos)
+                connection.close_after_write = true;
+
+            if (request.method != "GET")
+            {
+                response.status = 405;
+                response.body = "{\"error\":\"only GET is supported\"}";
+            }
+            else
+            {
+                try
+                {
+                    _handler(request, response);
+                }
+                catch (const std::exception& e)
+                {
+                    response.status = 500;
+                    response.body = std::string("{\"error\":\"") + e.what() + "\"}";
+                }
+            }
+        }
+
+        const char* reason = response.status == 200 ? "OK" : response.status == 400 ? "Bad Request" : response.status == 404 ? "Not Found" : response.status == 405 ? "Method Not Allowed" : "Internal Server Error";
+        connection.out += "HTTP/1.1 " + std::to_string(response.status) + " " + reason + "\r\nContent-Type: " + response.content_type +
+                          "\r\nContent-Length: " + std::to_string(response.body.size()) + (connection.close_after_write ? "\r\nConnection: close\r\n\r\n" : "\r\n\r\n");
+        connection.out += response.body;
+    }
+
+    // writes as much of the pending output as the socket takes, returns false if the connection was dropped
+    bool send_pending(int fd)
+    {
+        Connection& connection = _connections[fd];
+        while (connection.out_offset < connection.out.size())
+        {
+            ssize_t n = send(fd, connection.out.data() + connection.out_offset, connection.out.size() - connection.out_offset, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if (!connection.watching_out)
+                        rewatch(fd, EPOLLIN | EPOLLOUT);
+                    connection.watching_out = true;
+                    return true;
+                }
+                drop(fd);
+                return false;
+            }
+            connection.out_offset += n;
+        }
+        connection.out.clear();
+        connection.out_offset = 0;
+        if (connection.close_after_write)
+        {
+            drop(fd);
+            return false;
+        }
+        if (connection.watching_out)
+            rewatch(fd, EPOLLIN);
+        connection.watching_out = false;
+        return true;
+    }
+
+    Handler _handler;
+    int _listener, _epoll, _wake_up;
+    std::unordered_map<int, Connection> _connections;
+    std::thread _thread;
+    std::atomic<bool> _running{false};
+};
+
+#endif // _HTTP_SERVER_
@@ -3,6 +3,9 @@
 #include <unistd.h> /* For open(), creat() */
 #include <sys/ioctl.h>
 #include <string.h>
+#include <mutex>
+#include "metrics.cpp"
+#include "i2c_tracer.cpp"
 extern "C"
 {
     #include <linux/i2c-dev.h>
@@ -24,6 +27,13 @@ public:
             throw std::runtime_error("Error opening the i2c device. Does the device exist? Run as Sudo?\n");
     }
     
+    std::unique_lock<std::recursive_mutex> lock()
+    {
+        // devices hold this for the duration of a transaction, so that threads sharing the bus
+        // (e.g. the motion planner and the sampling loop) cannot interleave address changes
+        return std::unique_lock<std::recursive_mutex>(_mutex);
+    }
+
     void set_device_address(__u16 new_device_address)
     {
         if (_device_address == new_device_address && _first_address_was_set)
@@ -31,18 +41,37 @@ public:
         
         _device_address = new_device_address;
         
-        if (ioctl(file, I2C_SLAVE, _device_address) < 0)
+        __u64 t_start = i2c_trace_enabled.load(std::memory_order_relaxed) ? monotonic_ns() : 0;
+        bool ok = ioctl(file, I2C_SLAVE, _device_address) >= 0;
+        if (t_start != 0)
+            I2cTracer::record(TRACE_ADDRESS, _device_address, 0, t_start, monotonic_ns(), ok);
+        if (!ok)
             throw std::runtime_error("Error setting board address.\n");
         
         if (!_first_address_was_set)
             _first_address_was_set = true;
     }
 
+    // label for the device's metrics, called by the drivers
+    void name_device(__u16 device_address, const char* name)
+    {
+        metrics.i2c[device_address & 0x7F].name = name;
+    }
+
     template <typename T>
     void write_to_device(__u8* buffer, T num_bytes)
     {
-        if (write(file, buffer, num_bytes) != num_bytes)
+        I2cDeviceMetrics& device = metrics.i2c[_device_address & 0x7F];
+        __u64 t_start = monotonic_ns();
+        bool ok = write(file, buffer, num_bytes) == num_bytes;
+        __u64 t_end = monotonic_ns();
+        device.write_latency.observe_ns(t_end - t_start);
+        if (i2c_trace_enabled.load(std::memory_order_relaxed))
+            I2cTracer::record(TRACE_WRITE, _device_address, num_bytes, t_start, t_end, ok);
+        device.write_bytes.add(num_bytes);
+        if (!ok)
         {
+            device.write_errors.add();
             std::string error = std::string("Writting ") + std::to_string(num_bytes) + std::string(" bytes to device ") + std::to_string(_device_address) + std::string(" failed!");
             throw std::runtime_error(error);
         }
@@ -51,8 +80,17 @@ public:
     template <typename T>
     void read_from_device(__u8* buffer, T num_bytes)
     {
-        if (read(file, buffer, num_bytes) != num_bytes)
+        I2cDeviceMetrics& device = metrics.i2c[_device_address & 0x7F];
+        __u64 t_start = monotonic_ns();
+        bool ok = read(file, buffer, num_bytes) == num_bytes;
+        __u64 t_end = monotonic_ns();
+        device.read_latency.observe_ns(t_end - t_start);
+        if (i2c_trace_enabled.load(std::memory_order_relaxed))
+            I2cTracer::record(TRACE_READ, _device_address, num_bytes, t_start, t_end, ok);
+        device.read_bytes.add(num_bytes);
+        if (!ok)
         {
+            device.read_errors.add();
             std::string error = std::string("Reading ") + std::to_string(num_bytes) + std::string(" bytes from device ") + std::to_string(_device_address) + std::string(" failed!");
             throw std::runtime_error(error);
         }
@@ -66,8 +104,9 @@ public:
     int file;
     
 private:
-    __u16 _device_address;
+    __u16 _device_address = 0;
     bool _first_address_was_set = false;
+    std::recursive_mutex _mutex;
 };
 
 #endif
@@ -0,0 +1,262 @@
+#ifndef _I2C_TRACER_
+#define _I2C_TRACER_
+
+// Opt-in trace of every I2C bus operation, kept in a preallocated ring per thread and written out as
+// Chrome Trace Event JSON (load it in chrome://tracing or ui.perfetto.dev).
+//
+// Disabled it costs one relaxed load and a branch per operation. Enabled, an operation is one store
+// into the calling thread's ring, no locks and no allocation after the ring exists. The JSON writer
+// only uses write(2) on a pre-opened descriptor and a stack buffer, so it can also run from a fatal
+// signal handler.
+
+#include <atomic>
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/types.h>
+
+#define TRACE_RING_EVENTS 16384 // per thread, the sampling loop does about 20 operations per second
+#define TRACE_MAX_THREADS 16
+
+enum trace_op
+{
+    TRACE_READ = 0,
+    TRACE_WRITE,
+    TRACE_ADDRESS // device address change (ioctl I2C_SLAVE)
+};
+
+struct TraceEvent
+{
+    __u64 start_ns, end_ns; // CLOCK_MONOTONIC
+    __u16 address;
+    __u16 length;
+    __u8 op;
+    __u8 ok;
+};
+
+struct TraceRing
+{
+    TraceEvent events[TRACE_RING_EVENTS];
+    std::atomic<__u64> written{0};
+    __u32 tid;
+};
+
+static std::atomic<bool> i2c_trace_enabled{false};
+
+class I2cTracer
+{
+public:
+    // the calling thread's ring, allocated and registered on first use
+    static TraceRing* ring()
+    {
+        thread_local TraceRing* ring = nullptr;
+        if (ring == nullptr)
+        {
+            __u32 slot = _ring_count.fetch_add(1);
+            if (slot >= TRACE_MAX_THREADS)
+            {
+                _ring_count--;
+                return nullptr;
+            }
+            ring = new TraceRing;
+            ring->tid = static_cast<__u32>(syscall(SYS_gettid));
+            _rings[slot].store(ring, std::memory_order_release);
+        }
+        return ring;
+    }
+
+    static inline void record(trace_op op, __u16 address, __u16 length, __u64 start_ns, __u64 end_ns, bool ok)
+    {
+        TraceRing* r = ring();
+        if (r == nullptr)
+            return;
+        __u64 n = r->written.load(std::memory_order_relaxed);
+        TraceEvent& event = r->events[n % TRACE_RING_EVENTS];
+        event.start_ns = start_ns;
+        event.end_ns = end_ns;
+        event.address = address;
+        event.length = length;
+        event.op = op;
+        event.ok = ok;
+        r->written.store(n + 1, std::memory_order_release);
+    }
+
+    // enables tracing; dumps go to file_name on SIGUSR1, on dump_now() and when the process crashes
+    static void enable(const std::string& file_name)
+    {
+        _file_name = file_name;
+        _crash_file = open(file_name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (_crash_file < 0)
+            throw std::runtime_error("Tracer: cannot open " + file_name);
+        _request = eventfd(0, EFD_CLOEXEC);
+        std::thread(dump_on_request).detach();
+
+        struct sigaction action = {};
+        action.sa_handler = on_dump_signal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, nullptr);
+        action.sa_handler = on_crash_signal;
+        action.sa_flags = SA_RESETHAND;
+        for (int signal_number : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
+            sigaction(signal_number, &action, nullptr);
+        ring(); // preallocate the calling thread's ring
+        i2c_trace_enabled = true;
+    }
+
+    // writes the rings to the trace file, overwriting the previous dump
+    static void dump_now()
+    {
+        int file = open(_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file < 0)
+            return;
+        write_json(file);
+        close(file);
+    }
+
+    // async-signal-safe: only write(2), atomics and the stack
+    static void write_json(int file)
+    {
+        JsonOut out(file);
+        out.put("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        bool first = true;
+        __u32 rings = std::min<__u32>(_ring_count.load(), TRACE_MAX_THREADS);
+        for (__u32 slot = 0; slot < rings; slot++)
+        {
+            const TraceRing* r = _rings[slot].load(std::memory_order_acquire);
+            if (r == nullptr)
+                continue;
+            __u64 end = r->written.load(std::memory_order_acquire);
+            __u64 begin = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+            for (__u64 i = begin; i < end; i++)
+            {
+                TraceEvent event = r->events[i % TRACE_RING_EVENTS];
+                // the owner keeps writing while we read, drop what it may have overwritten meanwhile
+                if (r->written.load(std::memory_order_acquire) >= i + TRACE_RING_EVENTS)
+                    continue;
+                static const char* const ops[] = {"read", "write", "address"};
+                out.put(first ? "\n{\"name\":\"" : ",\n{\"name\":\"");
+                first = false;
+                out.put(ops[event.op]);
+                out.put(" 0x");
+                out.hex(event.address);
+                out.put("\",\"cat\":\"i2c\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+                out.number(r->tid);
+                out.put(",\"ts\":");
+                out.micros(event.start_ns);
+                out.put(",\"dur\":");
+                out.micros(event.end_ns - event.start_ns);
+                out.put(",\"args\":{\"address\":\"0x");
+                out.hex(event.address);
+                out.put("\",\"bytes\":");
+                out.number(event.length);
+                out.put(event.ok ? ",\"ok\":true}}" : ",\"ok\":false}}");
+            }
+        }
+        out.put("\n]}\n");
+        out.flush();
+    }
+
+private:
+    // small buffered writer without allocation or locale
+    class JsonOut
+    {
+    public:
+        JsonOut(int file) : _file(file) {}
+
+        void put(const char* text)
+        {
+            while (*text)
+            {
+                if (_size == sizeof(_buffer))
+                    flush();
+                _buffer[_size++] = *text++;
+            }
+        }
+
+        void number(__u64 value)
+        {
+            char digits[24];
+            int n = 0;
+            do
+            {
+                digits[n++] = '0' + value % 10;
+                value /= 10;
+            } while (value > 0);
+            char text[24];
+            for (int i = 0; i < n; i++)
+                text[i] = digits[n - 1 - i];
+            text[n] = '\0';
+            put(text);
+        }
+
+        // nanoseconds as microseconds with three decimals, the unit of the trace format
+        void micros(__u64 ns)
+        {
+            number(ns / 1000);
+            char fraction[6] = {'.', static_cast<char>('0' + ns / 100 % 10), static_cast<char>('0' + ns / 10 % 10), static_cast<char>('0' + ns % 10), '\0'};
+            put(fraction);
+        }
+
+        void hex(__u16 value)
+        {
+            static const char digits[] = "0123456789abcdef";
+            char text[3] = {digits[(value >> 4) & 0xF], digits[value & 0xF], '\0'};
+            put(text);
+        }
+
+        void flush()
+        {
+            size_t done = 0;
+            while (done < _size)
+            {
+                ssize_t n = write(_file, _buffer + done, _size - done);
+                if (n <= 0)
+                    break;
+                done += n;
+            }
+            _size = 0;
+        }
+
+    private:
+        int _file;
+        char _buffer[4096];
+        size_t _size = 0;
+    };
+
+    static void on_dump_signal(int)
+    {
+        __u64 one = 1;
+        if (write(_request, &one, sizeof(one)) < 0)
+            return;
+    }
+
+    static void on_crash_signal(int signal_number)
+    {
+        if (ftruncate(_crash_file, 0) == 0)
+            write_json(_crash_file);
+        raise(signal_number); // the handler was reset, so this ends the process as before
+    }
+
+    static void dump_on_request()
+    {
+        __u64 count;
+        while (read(_request, &count, sizeof(count)) == sizeof(count))
+            dump_now();
+    }
+
+    static inline std::atomic<TraceRing*> _rings[TRACE_MAX_THREADS] = {};
+    static inline std::atomic<__u32> _ring_count{0};
+    static inline std::string _file_name;
+    static inline int _crash_file = -1;
+    static inline int _request = -1;
+};
+
+#endif // _I2C_TRACER_
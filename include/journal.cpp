@@ -0,0 +1,407 @@
+#ifndef _JOURNAL_
+#define _JOURNAL_
+
+// Append-only write-ahead journal of binary records that survives power loss at any point.
+// File layout (native endian, like the shared memory segment):
+//   64 byte header: u32 magic, u16 version, u16 header size, u64 synced end, u32 crc32c of the previous 16 bytes
+//   then frames: u32 payload length, u32 crc32c of the length and the payload, payload
+// The synced end in the header is only rewritten after an fdatasync covered it, so everything before it is
+// known good. Opening the journal scans frames from there on and truncates at the first frame that is short,
+// zero length or fails its checksum: recovery costs the unsynced tail, not the whole file.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/types.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define JOURNAL_MAGIC 0x4A574C54 // "TLWJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 64
+#define JOURNAL_FRAME_HEADER 8
+#define JOURNAL_MAX_RECORD 65536
+#define JOURNAL_SCAN_CHUNK 65536
+#define JOURNAL_BATCH_RECORDS 16                // batch mode syncs after this many records...
+#define JOURNAL_BATCH_INTERVAL_NS 300000000000ULL // ...or when the oldest unsynced one is 5 min old
+
+// CRC-32C (Castagnoli), slicing by 8 with the tables built at compile time. Builds with -msse4.2 or
+// an ARMv8 CRC target (-march=native on a Pi 4 or any recent x86) use the crc32 instructions instead.
+struct Crc32cTables
+{
+    __u32 t[8][256];
+
+    constexpr Crc32cTables() : t()
+    {
+        for (__u32 i = 0; i < 256; i++)
+        {
+            __u32 crc = i;
+            for (__u8 bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (__u32 i = 0; i < 256; i++)
+            for (__u8 k = 1; k < 8; k++)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+    }
+};
+
+static constexpr Crc32cTables CRC32C_TABLES;
+
+// continues crc over size bytes, start with crc = 0
+static inline __u32 crc32c(const void* data, size_t size, __u32 crc = 0)
+{
+    const __u8* p = static_cast<const __u8*>(data);
+    crc = ~crc;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        __u64 word;
+        memcpy(&word, p, 8);
+        crc = static_cast<__u32>(_mm_crc32_u64(crc, word));
+    }
+    for (; size > 0; size--)
+        crc = _mm_crc32_u8(crc, *p++);
+#elif defined(__ARM_FEATURE_CRC32)
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        __u64 word;
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; size--)
+        crc = __crc32cb(crc, *p++);
+#else
+    const auto& t = CRC32C_TABLES.t;
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        __u32 low, high;
+        memcpy(&low, p, 4);
+        memcpy(&high, p + 4, 4);
+        low ^= crc; // little endian, as on every target of the logger
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+    }
+    for (; size > 0; size--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+#endif
+    return ~crc;
+}
+
+enum sync_mode
+{
+    SYNC_ALWAYS = 0, // fdatasync after every record, nothing acknowledged is ever lost
+    SYNC_BATCH,      // fdatasync after a number of records or an interval, loses at most one batch
+    SYNC_NONE        // leave it to the kernel writeback (about 30 s), fastest
+};
+
+// Decides when appended data is due for an fdatasync. The interval is checked when writing, there is
+// no timer: at one record per minute a batch closes on the first record after the interval.
+class SyncPolicy
+{
+public:
+    SyncPolicy(sync_mode mode = SYNC_ALWAYS, __u32 batch_records = JOURNAL_BATCH_RECORDS, __u64 batch_interval_ns = JOURNAL_BATCH_INTERVAL_NS)
+        : _mode(mode), _batch_records(batch_records), _batch_interval_ns(batch_interval_ns) {}
+
+    // notes one more unsynced write, returns true if it is time to sync
+    bool wrote(__u64 now_ns)
+    {
+        if (_pending++ == 0)
+            _pending_since_ns = now_ns;
+        switch (_mode)
+        {
+        case SYNC_ALWAYS:
+            return true;
+        case SYNC_BATCH:
+            return _pending >= _batch_records || now_ns - _pending_since_ns >= _batch_interval_ns;
+        default:
+            return false;
+        }
+    }
+
+    void synced()
+    {
+        _pending = 0;
+    }
+
+    sync_mode mode() const
+    {
+        return _mode;
+    }
+
+    static sync_mode parse(const char* name)
+    {
+        if (strcmp(name, "batch") == 0)
+            return SYNC_BATCH;
+        if (strcmp(name, "none") == 0)
+            return SYNC_NONE;
+        return SYNC_ALWAYS;
+    }
+
+private:
+    sync_mode _mode;
+    __u32 _batch_records;
+    __u64 _batch_interval_ns;
+    __u32 _pending = 0;
+    __u64 _pending_since_ns = 0;
+};
+
+class Journal
+{
+public:
+    Journal(const std::string& file_name, SyncPolicy policy = SyncPolicy()) : _file_name(file_name), _policy(policy)
+    {
+        _file = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (_file < 0)
+            throw std::runtime_error("Journal: cannot open " + file_name);
+        try
+        {
+            recover();
+        }
+        catch (...)
+        {
+            close(_file);
+            throw;
+        }
+    }
+
+    ~Journal()
+    {
+        try
+        {
+            if (_policy.mode() != SYNC_NONE)
+                sync();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Journal: " << e.what() << "\n";
+        }
+        close(_file);
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // appends one record as a single write, then syncs if the policy says so
+    void append(const void* data, __u32 size)
+    {
+        if (size == 0 || size > JOURNAL_MAX_RECORD)
+            throw std::runtime_error("Journal: bad record size.");
+        _frame.resize(JOURNAL_FRAME_HEADER + size);
+        memcpy(_frame.data(), &size, 4);
+        memcpy(_frame.data() + JOURNAL_FRAME_HEADER, data, size);
+        __u32 crc = crc32c(_frame.data() + JOURNAL_FRAME_HEADER, size, crc32c(&size, 4));
+        memcpy(_frame.data() + 4, &crc, 4);
+        if (pwrite(_file, _frame.data(), _frame.size(), _end) != static_cast<ssize_t>(_frame.size()))
+        {
+            // a partial frame would be dropped by the next recovery anyway, keep the file clean now
+            if (ftruncate(_file, _end) < 0)
+                std::cerr << "Journal: cannot truncate " << _file_name << "\n";
+            throw std::runtime_error("Journal: error writing to " + _file_name);
+        }
+        _end += _frame.size();
+        if (_policy.wrote(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()))
+            sync();
+    }
+
+    // makes all appended records durable
+    void sync()
+    {
+        _policy.synced();
+        if (_synced_end == _end)
+            return;
+        if (fdatasync(_file) < 0)
+            throw std::runtime_error("Journal: error syncing " + _file_name);
+        _synced_end = _end;
+        write_header(); // durable with the next sync, until then recovery just scans a little more
+    }
+
+    // calls on_record(const __u8* data, __u32 size) for every record, oldest first
+    template <typename F>
+    void for_each(F on_record)
+    {
+        _buffer.clear();
+        scan(JOURNAL_HEADER_SIZE, _end, on_record);
+    }
+
+    // drops all records, once they are safely stored elsewhere
+    void reset()
+    {
+        if (ftruncate(_file, JOURNAL_HEADER_SIZE) < 0)
+            throw std::runtime_error("Journal: cannot truncate " + _file_name);
+        _end = _synced_end = JOURNAL_HEADER_SIZE;
+        write_header();
+        if (fdatasync(_file) < 0)
+            throw std::runtime_error("Journal: error syncing " + _file_name);
+        _policy.synced();
+    }
+
+    __u64 size() const
+    {
+        return _end;
+    }
+
+    // bytes checked by the recovery scan on open, and bytes of a torn tail it cut off
+    __u64 recovered_bytes() const
+    {
+        return _recovered_bytes;
+    }
+
+    __u64 truncated_bytes() const
+    {
+        return _truncated_bytes;
+    }
+
+    // reads the intact records of a journal that another process may be appending to, without repairing it
+    template <typename F>
+    static void read(const std::string& file_name, F on_record)
+    {
+        std::ifstream file(file_name, std::ios::binary);
+        if (!file)
+            return;
+        std::vector<__u8> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (data.size() < JOURNAL_HEADER_SIZE || get<__u32>(data.data()) != JOURNAL_MAGIC)
+            throw std::runtime_error("Journal: " + file_name + " is not a journal.");
+        for (size_t offset = JOURNAL_HEADER_SIZE; offset + JOURNAL_FRAME_HEADER <= data.size();)
+        {
+            const __u8* frame = data.data() + offset;
+            __u32 size = get<__u32>(frame);
+            if (size == 0 || size > JOURNAL_MAX_RECORD || offset + JOURNAL_FRAME_HEADER + size > data.size() ||
+                get<__u32>(frame + 4) != crc32c(frame + JOURNAL_FRAME_HEADER, size, crc32c(frame, 4)))
+                break;
+            on_record(frame + JOURNAL_FRAME_HEADER, size);
+            offset += JOURNAL_FRAME_HEADER + size;
+        }
+    }
+
+private:
+    void recover()
+    {
+        struct stat status;
+        if (fstat(_file, &status) < 0)
+            throw std::runtime_error("Journal: cannot stat " + _file_name);
+        __u64 size = status.st_size;
+
+        __u8 header[JOURNAL_HEADER_SIZE] = {};
+        if (size < JOURNAL_HEADER_SIZE)
+        {
+            // new file, or the power went during its creation
+            if (size > 0 && pread(_file, header, size, 0) >= 4 && get<__u32>(header) != JOURNAL_MAGIC)
+                throw std::runtime_error("Journal: " + _file_name + " is not a journal.");
+            if (ftruncate(_file, 0) < 0)
+                throw std::runtime_error("Journal: cannot truncate " + _file_name);
+            _end = _synced_end = JOURNAL_HEADER_SIZE;
+            write_header();
+            if (fdatasync(_file) < 0)
+                throw std::runtime_error("Journal: error syncing " + _file_name);
+            return;
+        }
+
+        if (pread(_file, header, JOURNAL_HEADER_SIZE, 0) != JOURNAL_HEADER_SIZE || get<__u32>(header) != JOURNAL_MAGIC)
+            throw std::runtime_error("Journal: " + _file_name + " is not a journal.");
+        if (get<__u16>(header + 4) != JOURNAL_VERSION || get<__u16>(header + 6) != JOURNAL_HEADER_SIZE)
+            throw std::runtime_error("Journal: unsupported version of " + _file_name);
+        __u64 start = JOURNAL_HEADER_SIZE;
+        if (get<__u32>(header + 16) == crc32c(header, 16))
+            start = std::min(std::max(get<__u64>(header + 8), start), size);
+
+        _end = scan(start, size, [](const __u8*, __u32) {});
+        _recovered_bytes = _end - start;
+        _truncated_bytes = size - _end;
+        if (_truncated_bytes > 0 && ftruncate(_file, _end) < 0)
+            throw std::runtime_error("Journal: cannot truncate " + _file_name);
+        if (_end != start || _truncated_bytes > 0)
+        {
+            if (fdatasync(_file) < 0)
+                throw std::runtime_error("Journal: error syncing " + _file_name);
+            _synced_end = _end;
+            write_header();
+        }
+        else
+            _synced_end = _end;
+    }
+
+    // walks the frames in [offset, end), returns the end of the last intact one
+    template <typename F>
+    __u64 scan(__u64 offset, __u64 end, F on_record)
+    {
+        while (offset + JOURNAL_FRAME_HEADER <= end)
+        {
+            const __u8* frame = fetch(offset, JOURNAL_FRAME_HEADER, end);
+            if (frame == nullptr)
+                break;
+            __u32 size = get<__u32>(frame);
+            if (size == 0 || size > JOURNAL_MAX_RECORD || offset + JOURNAL_FRAME_HEADER + size > end)
+                break; // zeros are what a crash usually leaves behind in unwritten blocks
+            frame = fetch(offset, JOURNAL_FRAME_HEADER + size, end);
+            if (frame == nullptr || get<__u32>(frame + 4) != crc32c(frame + JOURNAL_FRAME_HEADER, size, crc32c(frame, 4)))
+                break;
+            on_record(frame + JOURNAL_FRAME_HEADER, size);
+            offset += JOURNAL_FRAME_HEADER + size;
+        }
+        return offset;
+    }
+
+    // returns size bytes at offset, reading ahead in chunks
+    const __u8* fetch(__u64 offset, __u32 size, __u64 end)
+    {
+        if (offset < _buffer_offset || offset + size > _buffer_offset + _buffer.size())
+        {
+            _buffer.resize(std::min<__u64>(std::max<__u64>(size, JOURNAL_SCAN_CHUNK), end - offset));
+            ssize_t n = pread(_file, _buffer.data(), _buffer.size(), offset);
+            _buffer.resize(n > 0 ? n : 0);
+            _buffer_offset = offset;
+            if (_buffer.size() < size)
+                return nullptr;
+        }
+        return _buffer.data() + (offset - _buffer_offset);
+    }
+
+    void write_header()
+    {
+        __u8 header[JOURNAL_HEADER_SIZE] = {};
+        put(header, __u32(JOURNAL_MAGIC));
+        put(header + 4, __u16(JOURNAL_VERSION));
+        put(header + 6, __u16(JOURNAL_HEADER_SIZE));
+        put(header + 8, _synced_end);
+        put(header + 16, crc32c(header, 16));
+        if (pwrite(_file, header, JOURNAL_HEADER_SIZE, 0) != JOURNAL_HEADER_SIZE)
+            throw std::runtime_error("Journal: error writing to " + _file_name);
+        _buffer.clear(); // the read-ahead may hold the old header or a truncated tail
+    }
+
+    template <typename T>
+    static T get(const __u8* data)
+    {
+        T value;
+        memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    static void put(__u8* data, T value)
+    {
+        memcpy(data, &value, sizeof(T));
+    }
+
+    std::string _file_name;
+    SyncPolicy _policy;
+    int _file = -1;
+    __u64 _end = 0, _synced_end = 0;
+    __u64 _recovered_bytes = 0, _truncated_bytes = 0;
+    std::vector<__u8> _frame, _buffer;
+    __u64 _buffer_offset = 0;
+};
+
+#endif // _JOURNAL_
@@ -5,15 +5,24 @@
 #include <cmath>
 #include <fstream>
 #include <string.h>
+#include <vector>
 #include "pca9685.cpp"
 
 #define MAX_SERVO 600
 #define MIN_SERVO 100
 
+#define CAL_GRID_SIZE 3 // calibration points per axis for new calibrations
+#define LUT_CELLS 32    // lookup table cells per axis over X,Y in [-1, 1]
+#define LUT_FRAC_BITS 12 // fractional bits of the cell coordinates
+#define LUT_VALUE_BITS 4 // fractional bits of the servo values stored in the table
+
 class InvKin
 {
 public:
-    InvKin(PCA9685 * pwm, uint8_t phi_channel, uint8_t theta_channel, std::string cal_file_name) : _pwm(pwm), _phi_channel(phi_channel), _theta_channel(theta_channel), _cal_file_name(cal_file_name) {}
+    InvKin(PCA9685 * pwm, uint8_t phi_channel, uint8_t theta_channel, std::string cal_file_name) : _pwm(pwm), _phi_channel(phi_channel), _theta_channel(theta_channel), _cal_file_name(cal_file_name)
+    {
+        compile_lut(); // uncalibrated default spans the full servo range
+    }
 
     void servo_range_sweep()
     {
@@ -29,79 +38,91 @@ public:
         }
     }
 
-    void make_xy_square()
-    {
-        std::cout << "Making square.\n";
-        float X, Y = -1.0, step = 0.01;
-        for (X = -1.0; X <= 1.0; X += step)
-        {
-            move_xy(X, Y);
-            usleep(20000);
-        }
-        for (Y = -1.0; Y <= 1.0; Y += step)
-        {
-            move_xy(X, Y);
-            usleep(20000);
-        }
-        for (X = 1.0; X >= -1.0; X -= step)
-        {
-            move_xy(X, Y);
-            usleep(20000);
-        }
-        for (Y = 1.0; Y >= -1.0; Y -= step)
-        {
-            move_xy(X, Y);
-            usleep(20000);
-        }
-    }
-
-    void perform_calibration()
+    void perform_calibration(uint8_t grid_x = CAL_GRID_SIZE, uint8_t grid_y = CAL_GRID_SIZE)
     {
-        // calibrates the values for a11, a12, a21, a22, b1, b2;
-        // such that [phi; theta] = A * [X; Y] + b --> inverse kinematics
+        // records (phi, theta) on a grid_x by grid_y grid over X,Y in [-1, 1],
+        // the grid is interpolated bicubically to capture the nonlinear servo geometry --> inverse kinematics
+        if (grid_x < 2 || grid_y < 2)
+            throw std::runtime_error("Calibration grid needs at least 2x2 points.\n");
 
         // go to startup position
         int16_t phi = (MAX_SERVO + MIN_SERVO) / 2, theta = (MAX_SERVO + MIN_SERVO) / 2;
         _pwm->set_PWM(_phi_channel, 0, phi);
         _pwm->set_PWM(_theta_channel, 0, theta);
 
-        uint16_t phi1, phi2, phi3, phi4, theta1, theta2, theta3, theta4;
-        // find phi and theta that match (X,Y) -> (1,1)
-        menu_selection(1, 1, phi, theta);
-        phi1 = phi;
-        theta1 = theta;
-        // find phi and theta that match (X,Y) -> (-1,1)
-        menu_selection(-1, 1, phi, theta);
-        phi2 = phi;
-        theta2 = theta;
-        // find phi and theta that match (X,Y) -> (-1,-1)
-        menu_selection(-1, -1, phi, theta);
-        phi3 = phi;
-        theta3 = theta;
-        // find phi and theta that match (X,Y) -> (1,-1)
-        menu_selection(1, -1, phi, theta);
-        phi4 = phi;
-        theta4 = theta;
-
-        compute_least_squares_solution(phi1, phi2, phi3, phi4, theta1, theta2, theta3, theta4);
+        _grid_x = grid_x;
+        _grid_y = grid_y;
+        _grid_phi.assign(grid_x * grid_y, 0);
+        _grid_theta.assign(grid_x * grid_y, 0);
+        for (uint8_t j = 0; j < grid_y; j++)
+        {
+            for (uint8_t k = 0; k < grid_x; k++)
+            {
+                // snake through the grid so the laser only moves to a neighbouring point
+                uint8_t i = (j % 2 == 0) ? k : grid_x - 1 - k;
+                // find phi and theta that match (X,Y) -> grid point
+                menu_selection(grid_coordinate(i, grid_x), grid_coordinate(j, grid_y), phi, theta);
+                _grid_phi[j * grid_x + i] = phi;
+                _grid_theta[j * grid_x + i] = theta;
+            }
+        }
+
+        compile_lut();
+        forget_position(); // servos were moved by hand
 
         std::cout << "Finished calibration.\n";
     }
 
+    // the next move_xy writes both servos, e.g. after the servo controller was reset
+    void forget_position()
+    {
+        _last_phi = _last_theta = 0xFFFF;
+    }
+
     void move_xy(float X, float Y)
     {
-        _pwm->set_PWM(_phi_channel, 0, compute_phi(X, Y));
-        _pwm->set_PWM(_theta_channel, 0, compute_theta(X, Y));
+        // only talk to the servo controller when the quantized position actually changes,
+        // small trajectory steps often map to the same servo tick
+        uint16_t phi, theta;
+        compute_servos(X, Y, phi, theta);
+        if (phi != _last_phi)
+        {
+            _pwm->set_PWM(_phi_channel, 0, phi);
+            _last_phi = phi;
+        }
+        if (theta != _last_theta)
+        {
+            _pwm->set_PWM(_theta_channel, 0, theta);
+            _last_theta = theta;
+        }
+    }
+
+    inline void compute_servos(float X, float Y, uint16_t & phi, uint16_t & theta) const
+    {
+        // fixed point bilinear lookup: locate the cell, then three integer multiply-adds per servo;
+        // points outside [-1, 1] extrapolate linearly from the border cells
+        int32_t xq = static_cast<int32_t>((X + 1.0f) * (0.5f * LUT_CELLS * (1 << LUT_FRAC_BITS)));
+        int32_t yq = static_cast<int32_t>((Y + 1.0f) * (0.5f * LUT_CELLS * (1 << LUT_FRAC_BITS)));
+        int32_t i = clamp_cell(xq >> LUT_FRAC_BITS), j = clamp_cell(yq >> LUT_FRAC_BITS);
+        int32_t fx = xq - (i << LUT_FRAC_BITS), fy = yq - (j << LUT_FRAC_BITS);
+
+        const LutCell& cell = _lut[j * LUT_CELLS + i];
+        phi = to_servo(cell.phi, fx, fy);
+        theta = to_servo(cell.theta, fx, fy);
     }
 
     inline uint16_t compute_phi(float X, float Y) const
     {
-        return static_cast<uint16_t>(round(a11*X + a12*Y + b1));
+        uint16_t phi, theta;
+        compute_servos(X, Y, phi, theta);
+        return phi;
     }
 
     inline uint16_t compute_theta(float X, float Y) const
     {
-        return static_cast<uint16_t>(round(a21*X + a22*Y + b2));
+        uint16_t phi, theta;
+        compute_servos(X, Y, phi, theta);
+        return theta;
     }
 
     void save_cal()
@@ -110,7 +131,10 @@ public:
         if (!file)
             std::cerr << "Error: Cannot write to file '" << _cal_file_name << "'" << std::endl;
 
-        file << a11 << "\n" << a12 << "\n" << a21 << "\n" << a22 << "\n" << b1 << "\n" << b2;
+        // grid format: "grid", grid_x, grid_y, then one "phi theta" pair per point, row by row from (X,Y) -> (-1,-1)
+        file << "grid\n" << static_cast<int>(_grid_x) << " " << static_cast<int>(_grid_y);
+        for (size_t n = 0; n < _grid_phi.size(); n++)
+            file << "\n" << _grid_phi[n] << " " << _grid_theta[n];
     }
 
     bool load_cal()
@@ -119,27 +143,148 @@ public:
         if (!file)
             return false; // File does not exist: return false
 
-        file >> a11 >> a12 >> a21 >> a22 >> b1 >> b2;
+        std::string header;
+        file >> header;
+        if (header == "grid")
+        {
+            int grid_x = 0, grid_y = 0;
+            file >> grid_x >> grid_y;
+            if (file.fail() || grid_x < 2 || grid_y < 2 || grid_x > 255 || grid_y > 255)
+            {
+                std::cerr << "Failed to read inverse kinematics calibration grid.\n";
+                return true;
+            }
+            _grid_x = grid_x;
+            _grid_y = grid_y;
+            _grid_phi.assign(grid_x * grid_y, 0);
+            _grid_theta.assign(grid_x * grid_y, 0);
+            for (size_t n = 0; n < _grid_phi.size(); n++)
+                file >> _grid_phi[n] >> _grid_theta[n];
+        }
+        else
+        {
+            // legacy affine calibration: [phi; theta] = A * [X; Y] + b, which is exactly a 2x2 grid
+            float a11, a12, a21, a22, b1, b2;
+            a11 = std::strtof(header.c_str(), nullptr);
+            file >> a12 >> a21 >> a22 >> b1 >> b2;
+            _grid_x = _grid_y = 2;
+            _grid_phi.assign(4, 0);
+            _grid_theta.assign(4, 0);
+            for (uint8_t n = 0; n < 4; n++)
+            {
+                float X = grid_coordinate(n % 2, 2), Y = grid_coordinate(n / 2, 2);
+                _grid_phi[n] = a11*X + a12*Y + b1;
+                _grid_theta[n] = a21*X + a22*Y + b2;
+            }
+        }
 
         if (file.fail())
             std::cerr << "Failed to read inverse kinematics calibration values.\n";
 
+        compile_lut();
         return true;
     }
 
 private:
-    void compute_least_squares_solution(uint16_t phi1, uint16_t phi2, uint16_t phi3, uint16_t phi4,
-        uint16_t theta1, uint16_t theta2, uint16_t theta3, uint16_t theta4)
+    struct LutCoefficients
+    {
+        // value(fx, fy) = c0 + cx*fx + cy*fy + cxy*fx*fy, with c0 in LUT_VALUE_BITS fixed point
+        int32_t c0, cx, cy, cxy;
+    };
+
+    struct LutCell
+    {
+        LutCoefficients phi, theta;
+    };
+
+    static inline int32_t clamp_cell(int32_t cell)
+    {
+        return cell < 0 ? 0 : (cell >= LUT_CELLS ? LUT_CELLS - 1 : cell);
+    }
+
+    static inline uint16_t to_servo(const LutCoefficients& c, int32_t fx, int32_t fy)
+    {
+        int32_t value = c.c0 + ((c.cx * fx + c.cy * fy + ((c.cxy * fx) >> LUT_FRAC_BITS) * fy) >> LUT_FRAC_BITS);
+        value = (value + (1 << (LUT_VALUE_BITS - 1))) >> LUT_VALUE_BITS;
+        return static_cast<uint16_t>(value < 0 ? 0 : value);
+    }
+
+    static inline float grid_coordinate(uint8_t index, uint8_t size)
+    {
+        return -1.0f + 2.0f * index / (size - 1);
+    }
+
+    static float cubic(float p0, float p1, float p2, float p3, float t)
+    {
+        // Catmull-Rom spline through p1 (t = 0) and p2 (t = 1)
+        return p1 + 0.5f * t * (p2 - p0 + t * (2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3 + t * (3.0f*(p1 - p2) + p3 - p0)));
+    }
+
+    float grid_value(const std::vector<float>& grid, int i, int j) const
     {
-        a11 = phi1/4.0-phi2/4.0-phi3/4.0+phi4/4.0;
-        a12 = phi1/4.0+phi2/4.0-phi3/4.0-phi4/4.0;
-        a21 = theta1/4.0-theta2/4.0-theta3/4.0+theta4/4.0;
-        a22 = theta1/4.0+theta2/4.0-theta3/4.0-theta4/4.0;
-        b1 = phi1/4.0+phi2/4.0+phi3/4.0+phi4/4.0;
-        b2 = theta1/4.0+theta2/4.0+theta3/4.0+theta4/4.0;
+        // beyond the border the grid is extended linearly, so a 2 point axis reduces to linear interpolation
+        if (i < 0)
+            return 2.0f * grid_value(grid, 0, j) - grid_value(grid, 1, j);
+        if (i >= _grid_x)
+            return 2.0f * grid_value(grid, _grid_x - 1, j) - grid_value(grid, _grid_x - 2, j);
+        if (j < 0)
+            return 2.0f * grid_value(grid, i, 0) - grid_value(grid, i, 1);
+        if (j >= _grid_y)
+            return 2.0f * grid_value(grid, i, _grid_y - 1) - grid_value(grid, i, _grid_y - 2);
+        return grid[j * _grid_x + i];
+    }
+
+    float interpolate(const std::vector<float>& grid, float X, float Y) const
+    {
+        // bicubic interpolation of the calibration grid at (X,Y) in [-1, 1]
+        float gx = (X + 1.0f) * 0.5f * (_grid_x - 1), gy = (Y + 1.0f) * 0.5f * (_grid_y - 1);
+        int i = std::min(static_cast<int>(gx), _grid_x - 2), j = std::min(static_cast<int>(gy), _grid_y - 2);
+        float tx = gx - i, ty = gy - j;
+        float rows[4];
+        for (int r = 0; r < 4; r++)
+            rows[r] = cubic(grid_value(grid, i - 1, j - 1 + r), grid_value(grid, i, j - 1 + r), grid_value(grid, i + 1, j - 1 + r), grid_value(grid, i + 2, j - 1 + r), tx);
+        return cubic(rows[0], rows[1], rows[2], rows[3], ty);
+    }
+
+    LutCoefficients cell_coefficients(float v00, float v10, float v01, float v11) const
+    {
+        const float scale = 1 << LUT_VALUE_BITS;
+        LutCoefficients c;
+        c.c0 = static_cast<int32_t>(round(v00 * scale));
+        c.cx = static_cast<int32_t>(round((v10 - v00) * scale));
+        c.cy = static_cast<int32_t>(round((v01 - v00) * scale));
+        c.cxy = static_cast<int32_t>(round((v11 - v10 - v01 + v00) * scale));
+        return c;
+    }
+
+    void compile_lut()
+    {
+        // samples the bicubic surface on a (LUT_CELLS + 1)^2 node grid and stores per cell bilinear
+        // coefficients, so move_xy never touches floating point interpolation
+        std::vector<float> phi_nodes((LUT_CELLS + 1) * (LUT_CELLS + 1)), theta_nodes(phi_nodes.size());
+        for (int j = 0; j <= LUT_CELLS; j++)
+        {
+            for (int i = 0; i <= LUT_CELLS; i++)
+            {
+                float X = -1.0f + 2.0f * i / LUT_CELLS, Y = -1.0f + 2.0f * j / LUT_CELLS;
+                phi_nodes[j * (LUT_CELLS + 1) + i] = interpolate(_grid_phi, X, Y);
+                theta_nodes[j * (LUT_CELLS + 1) + i] = interpolate(_grid_theta, X, Y);
+            }
+        }
+
+        _lut.resize(LUT_CELLS * LUT_CELLS);
+        for (int j = 0; j < LUT_CELLS; j++)
+        {
+            for (int i = 0; i < LUT_CELLS; i++)
+            {
+                size_t n = j * (LUT_CELLS + 1) + i;
+                _lut[j * LUT_CELLS + i].phi = cell_coefficients(phi_nodes[n], phi_nodes[n + 1], phi_nodes[n + LUT_CELLS + 1], phi_nodes[n + LUT_CELLS + 2]);
+                _lut[j * LUT_CELLS + i].theta = cell_coefficients(theta_nodes[n], theta_nodes[n + 1], theta_nodes[n + LUT_CELLS + 1], theta_nodes[n + LUT_CELLS + 2]);
+            }
+        }
     }
 
-    void menu_selection(int8_t X, int8_t Y, int16_t & phi, int16_t & theta)
+    void menu_selection(float X, float Y, int16_t & phi, int16_t & theta)
     {
         char choice;
         uint8_t step_size = 5, delete_n_lines;
@@ -147,7 +292,7 @@ private:
         while (menu_alive)
         {
             delete_n_lines = 10;
-            std::cout << "Set laser pointer to coordinates (X,Y) -> (" << static_cast<int>(X) << "," << static_cast<int>(Y) << ") : (phi,theta) -> (" << phi << "," << theta << ")\n";
+            std::cout << "Set laser pointer to coordinates (X,Y) -> (" << X << "," << Y << ") : (phi,theta) -> (" << phi << "," << theta << ")\n";
             std::cout << "Current step size: " << static_cast<int>(step_size) << "\n";
             std::cout << "Menu:\n";
             std::cout << " - W: +theta step\n";
@@ -200,7 +345,7 @@ private:
             }
             else if (choice == 'f' || choice == 'F')
             {
-                std::cout << "Finished for (X,Y) -> (" << static_cast<int>(X) << "," << static_cast<int>(Y) << ") : (phi,theta) -> (" << phi << "," << theta << ")\n";
+                std::cout << "Finished for (X,Y) -> (" << X << "," << Y << ") : (phi,theta) -> (" << phi << "," << theta << ")\n";
                 menu_alive = false;
             }
             //else
@@ -215,7 +360,10 @@ private:
             }
         }
     }
-    float a11, a12, a21, a22, b1, b2;
+    int _grid_x = 2, _grid_y = 2;
+    std::vector<float> _grid_phi = {MIN_SERVO, MAX_SERVO, MIN_SERVO, MAX_SERVO}, _grid_theta = {MIN_SERVO, MIN_SERVO, MAX_SERVO, MAX_SERVO};
+    std::vector<LutCell> _lut;
+    uint16_t _last_phi = 0xFFFF, _last_theta = 0xFFFF; // 0xFFFF forces the first write
     PCA9685 * _pwm;
     uint8_t _phi_channel, _theta_channel;
     std::string _cal_file_name;
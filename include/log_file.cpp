@@ -0,0 +1,119 @@
+#ifndef _LOG_FILE_
+#define _LOG_FILE_
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log_record.cpp"
+
+// Read-only memory map of a log.txt style file. Lines are in time order, so a time range is found
+// by bisecting on line boundaries instead of scanning the file from one end.
+class LogFile
+{
+public:
+    LogFile(const std::string& file_name)
+    {
+        _file = open(file_name.c_str(), O_RDONLY);
+        if (_file < 0)
+            throw std::runtime_error("Error opening " + file_name);
+        struct stat info;
+        fstat(_file, &info);
+        _size = info.st_size;
+        if (_size > 0)
+        {
+            _data = static_cast<const char*>(mmap(nullptr, _size, PROT_READ, MAP_SHARED, _file, 0));
+            if (_data == MAP_FAILED)
+            {
+                close(_file);
+                throw std::runtime_error("Error mapping " + file_name);
+            }
+        }
+    }
+
+    ~LogFile()
+    {
+        if (_data != nullptr && _data != MAP_FAILED)
+            munmap(const_cast<char*>(_data), _size);
+        close(_file);
+    }
+
+    LogFile(const LogFile&) = delete;
+    LogFile& operator=(const LogFile&) = delete;
+
+    const char* data() const
+    {
+        return _data;
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    // start of the first line at or after offset
+    size_t line_start(size_t offset) const
+    {
+        if (offset == 0)
+            return 0;
+        const void* newline = memchr(_data + offset - 1, '\n', _size - offset + 1);
+        return newline == nullptr ? _size : static_cast<const char*>(newline) - _data + 1;
+    }
+
+    // offset of the first line stamped at or after time_ns, lines that do not parse are skipped
+    size_t find_time(__s64 time_ns)
+    {
+        size_t lo = 0, hi = _size;
+        while (lo < hi)
+        {
+            size_t mid = line_start(lo + (hi - lo) / 2);
+            if (mid >= hi)
+            {
+                hi = lo + (hi - lo) / 2; // no line starts in the upper half, look below
+                continue;
+            }
+            LogRecord record;
+            size_t next = line_start(mid + 1);
+            if (!parse_line(mid, next, record) || record.time_ns < time_ns)
+                lo = next;
+            else
+                hi = mid;
+        }
+        return line_start(lo);
+    }
+
+    // appends the records with from_ns <= time_ns < to_ns to out, stopping once out holds max_size
+    void read_range(__s64 from_ns, __s64 to_ns, std::vector<LogRecord>& out, size_t max_size = SIZE_MAX)
+    {
+        LogRecord record;
+        for (size_t begin = find_time(from_ns); begin < _size && out.size() < max_size;)
+        {
+            size_t end = line_start(begin + 1);
+            if (parse_line(begin, end, record))
+            {
+                if (record.time_ns >= to_ns)
+                    break;
+                out.push_back(record);
+            }
+            begin = end;
+        }
+    }
+
+    bool parse_line(size_t begin, size_t end, LogRecord& record)
+    {
+        if (end > begin && _data[end - 1] == '\n')
+            end--;
+        return _parser.parse(std::string_view(_data + begin, end - begin), record);
+    }
+
+private:
+    int _file;
+    const char* _data = nullptr;
+    size_t _size = 0;
+    LogLineParser _parser;
+};
+
+#endif // _LOG_FILE_
@@ -0,0 +1,363 @@
+#ifndef _LOG_RECORD_
+#define _LOG_RECORD_
+
+#include <charconv>
+#include <string_view>
+#include <ctime>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <linux/types.h>
+
+// columns of a log.txt line, after the timestamp
+enum log_channel
+{
+    CH_T_INTERIOR = 0,
+    CH_H_INTERIOR,
+    CH_P_INTERIOR,
+    CH_T_ANALOG,
+    CH_T_EXTERIOR,
+    CH_H_EXTERIOR,
+    CH_P_EXTERIOR,
+    LOG_CHANNELS
+};
+
+#define LOG_DERIVED_COLUMNS 8 // DERIVED_CHANNELS of include/derived_metrics.cpp, logged between the channels and the period
+#define LOG_RECORD_V1_SIZE 40 // records journaled, spooled or captured before they carried their period
+
+static const char* const CHANNEL_NAMES[LOG_CHANNELS] = {"T_interior", "H_interior", "P_interior", "T_analog", "T_exterior", "H_exterior", "P_exterior"};
+
+// nan marks a missing value; checked on the bit pattern because -Ofast assumes finite math
+static inline bool is_missing(float value)
+{
+    __u32 bits;
+    memcpy(&bits, &value, 4);
+    return (bits & 0x7FFFFFFF) > 0x7F800000;
+}
+
+enum timestamp_format
+{
+    TIMESTAMP_CTIME = 0, // legacy "Sun Oct 18 14:03:00 2026", local time, second resolution
+    TIMESTAMP_ISO8601,   // "2026-10-18T14:03:00.123456789+02:00", local time with offset
+    TIMESTAMP_EPOCH_NS   // nanoseconds since the unix epoch
+};
+
+struct LogRecord
+{
+    __s64 time_ns; // unix epoch
+    float values[LOG_CHANNELS];
+    __s32 ret_code;
+    float period_s = 0.0f; // seconds the record averages over, 0 for a raw sample or when not known
+    __u32 reserved = 0;    // no padding, records are copied byte for byte into files and sockets
+};
+
+// a record as written by memcpy, or one of LOG_RECORD_V1_SIZE bytes without its period; false for other sizes
+static inline bool read_record(const void* data, size_t size, LogRecord& record)
+{
+    if (size != sizeof(LogRecord) && size != LOG_RECORD_V1_SIZE)
+        return false;
+    record = LogRecord();
+    memcpy(&record, data, size);
+    return true;
+}
+
+class RecordFormatter
+{
+public:
+    RecordFormatter(timestamp_format format = TIMESTAMP_CTIME) : _format(format) {}
+
+    // formats the record into the internal buffer, the view is valid until the next call;
+    // extra values (the derived channels) are appended as further columns
+    std::string_view format(const LogRecord& record, const float* extra = nullptr, __u8 extra_count = 0)
+    {
+        char* p = _buffer;
+        char* end = _buffer + sizeof(_buffer);
+        p = format_timestamp(p, record.time_ns);
+        for (__u8 ch = CH_T_INTERIOR; ch <= CH_T_ANALOG; ch++)
+            p = put_float(p, end, record.values[ch]);
+        *p++ = '\t';
+        p = std::to_chars(p, end, record.ret_code).ptr;
+        for (__u8 ch = CH_T_EXTERIOR; ch <= CH_P_EXTERIOR; ch++)
+            p = put_float(p, end, record.values[ch]);
+        for (__u8 i = 0; i < extra_count; i++)
+            p = put_float(p, end, extra[i]);
+        return std::string_view(_buffer, p - _buffer);
+    }
+
+    // writes the timestamp column in the configured format and returns the new end,
+    // out needs room for 40 characters
+    char* format_timestamp(char* out, __s64 time_ns)
+    {
+        if (_format == TIMESTAMP_EPOCH_NS)
+            return std::to_chars(out, out + 20, time_ns).ptr;
+
+        __s64 seconds = time_ns >= 0 ? time_ns / 1000000000 : (time_ns - 999999999) / 1000000000;
+        const LocalTime& local = local_time(seconds);
+        __s32 second_of_window = static_cast<__s32>(seconds - local.window_start);
+        __u8 minute = local.minute + second_of_window / 60, second = second_of_window % 60;
+
+        if (_format == TIMESTAMP_CTIME)
+        {
+            // same layout as ctime(), but without the locale, the static buffer and the trailing newline
+            static const char days[] = "SunMonTueWedThuFriSat";
+            static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+            memcpy(out, days + 3 * local.weekday, 3);
+            out[3] = ' ';
+            memcpy(out + 4, months + 3 * local.month, 3);
+            out[7] = ' ';
+            out[8] = local.day < 10 ? ' ' : '0' + local.day / 10;
+            out[9] = '0' + local.day % 10;
+            out[10] = ' ';
+            put2(out + 11, local.hour);
+            out[13] = ':';
+            put2(out + 14, minute);
+            out[16] = ':';
+            put2(out + 17, second);
+            out[19] = ' ';
+            return std::to_chars(out + 20, out + 26, local.year).ptr;
+        }
+
+        char* p = std::to_chars(out, out + 6, local.year).ptr;
+        *p++ = '-';
+        put2(p, local.month + 1);
+        p[2] = '-';
+        put2(p + 3, local.day);
+        p[5] = 'T';
+        put2(p + 6, local.hour);
+        p[8] = ':';
+        put2(p + 9, minute);
+        p[11] = ':';
+        put2(p + 12, second);
+        p[14] = '.';
+        __u32 fraction = static_cast<__u32>(time_ns - seconds * 1000000000);
+        for (__s8 i = 8; i >= 0; i--)
+        {
+            p[15 + i] = '0' + fraction % 10;
+            fraction /= 10;
+        }
+        p += 24;
+        __s32 offset_minutes = local.utc_offset / 60;
+        *p++ = offset_minutes < 0 ? '-' : '+';
+        if (offset_minutes < 0)
+            offset_minutes = -offset_minutes;
+        put2(p, offset_minutes / 60);
+        p[2] = ':';
+        put2(p + 3, offset_minutes % 60);
+        return p + 5;
+    }
+
+private:
+    struct LocalTime
+    {
+        __s64 window_start = -1; // local calendar fields below are valid from here for LOCAL_TIME_WINDOW seconds
+        __s32 year, utc_offset;
+        __u8 month, day, weekday, hour, minute;
+    };
+
+    // DST and zone changes fall on quarter hours, so the broken down time only has to be recomputed
+    // once per window, everything within a window is plain arithmetic
+    static constexpr __s64 LOCAL_TIME_WINDOW = 900;
+
+    const LocalTime& local_time(__s64 seconds)
+    {
+        __s64 window_start = seconds - ((seconds % LOCAL_TIME_WINDOW) + LOCAL_TIME_WINDOW) % LOCAL_TIME_WINDOW;
+        if (window_start != _local.window_start)
+        {
+            time_t t = window_start;
+            tm broken_down;
+            localtime_r(&t, &broken_down);
+            _local.window_start = window_start;
+            _local.year = broken_down.tm_year + 1900;
+            _local.utc_offset = broken_down.tm_gmtoff;
+            _local.month = broken_down.tm_mon;
+            _local.day = broken_down.tm_mday;
+            _local.weekday = broken_down.tm_wday;
+            _local.hour = broken_down.tm_hour;
+            _local.minute = broken_down.tm_min;
+        }
+        return _local;
+    }
+
+    static inline void put2(char* out, __u8 value)
+    {
+        out[0] = '0' + value / 10;
+        out[1] = '0' + value % 10;
+    }
+
+    static inline char* put_float(char* p, char* end, float value)
+    {
+        // %g with 6 significant digits, the same as the default ostream formatting used so far
+        *p++ = '\t';
+        return std::to_chars(p, end, value, std::chars_format::general, 6).ptr;
+    }
+
+    timestamp_format _format;
+    LocalTime _local;
+    char _buffer[384];
+};
+
+// Parses log.txt lines back into records without allocating. Both the legacy 5 column rows
+// (timestamp, T, H, P, analog T) and the current 9 column rows are accepted, missing values are nan.
+// Of the columns after the ninth, the derived channels are skipped (they are recomputed from the record)
+// and the last one, the seconds the record averages over, goes to period_s when the row has it.
+class LogLineParser
+{
+public:
+    bool parse(std::string_view line, LogRecord& record)
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+
+        size_t tab = line.find('\t');
+        if (tab == std::string_view::npos || !parse_timestamp(line.substr(0, tab), record.time_ns))
+            return false;
+
+        const char* p = line.data() + tab;
+        const char* end = line.data() + line.size();
+        __u8 column = 0;
+        record.ret_code = 0;
+        record.period_s = 0.0f;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            record.values[ch] = NAN;
+        while (p < end && column < 8)
+        {
+            p++; // skip the tab
+            std::from_chars_result result;
+            if (column == 4)
+                result = std::from_chars(p, end, record.ret_code);
+            else
+                result = std::from_chars(p, end, record.values[column < 4 ? column : column - 1]);
+            if (result.ec != std::errc() || (result.ptr < end && *result.ptr != '\t'))
+                return false;
+            p = result.ptr;
+            column++;
+        }
+        _columns = column;
+        if (p < end && std::count(p, end, '\t') == LOG_DERIVED_COLUMNS + 1)
+        {
+            const char* period = p + std::string_view(p, end - p).rfind('\t') + 1;
+            if (std::from_chars(period, end, record.period_s).ec != std::errc())
+                record.period_s = 0.0f;
+        }
+        return column >= 4;
+    }
+
+    // value columns of the last parsed line, ret_code included: 4 for legacy rows, 8 for current ones
+    __u8 columns() const
+    {
+        return _columns;
+    }
+
+    bool parse_timestamp(std::string_view field, __s64& time_ns)
+    {
+        if (field.empty())
+            return false;
+        if (field[0] >= '0' && field[0] <= '9')
+        {
+            if (field.size() > 10 && field[10] == 'T')
+                return parse_iso8601(field, time_ns);
+            return std::from_chars(field.data(), field.data() + field.size(), time_ns).ec == std::errc();
+        }
+        return parse_ctime(field, time_ns);
+    }
+
+private:
+    static bool parse_number(std::string_view field, size_t position, size_t digits, __s32& value)
+    {
+        if (position + digits > field.size())
+            return false;
+        value = 0;
+        for (size_t i = position; i < position + digits; i++)
+        {
+            if (field[i] < '0' || field[i] > '9')
+                return false;
+            value = value * 10 + (field[i] - '0');
+        }
+        return true;
+    }
+
+    static __s64 days_from_civil(__s32 y, __s32 m, __s32 d)
+    {
+        // days since 1970-01-01 of a proleptic gregorian date (H. Hinnant's algorithm)
+        y -= m <= 2;
+        __s32 era = (y >= 0 ? y : y - 399) / 400;
+        __s32 yoe = y - era * 400;
+        __s32 doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        __s32 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return static_cast<__s64>(era) * 146097 + doe - 719468;
+    }
+
+    bool parse_iso8601(std::string_view field, __s64& time_ns)
+    {
+        // yyyy-mm-ddThh:mm:ss[.fraction][Z|+hh:mm|-hh:mm]
+        __s32 year, month, day, hour, minute, second;
+        if (!parse_number(field, 0, 4, year) || !parse_number(field, 5, 2, month) || !parse_number(field, 8, 2, day) ||
+            !parse_number(field, 11, 2, hour) || !parse_number(field, 14, 2, minute) || !parse_number(field, 17, 2, second))
+            return false;
+        size_t p = 19;
+        __s64 fraction = 0, scale = 1000000000;
+        if (p < field.size() && field[p] == '.')
+        {
+            for (p++; p < field.size() && field[p] >= '0' && field[p] <= '9'; p++)
+            {
+                scale /= 10;
+                fraction += (field[p] - '0') * scale;
+            }
+        }
+        __s32 offset = 0;
+        if (p < field.size() && (field[p] == '+' || field[p] == '-'))
+        {
+            __s32 offset_hours, offset_minutes;
+            if (!parse_number(field, p + 1, 2, offset_hours) || !parse_number(field, p + 4, 2, offset_minutes))
+                return false;
+            offset = (offset_hours * 60 + offset_minutes) * 60 * (field[p] == '-' ? -1 : 1);
+        }
+        __s64 seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset;
+        time_ns = seconds * 1000000000 + fraction;
+        return true;
+    }
+
+    bool parse_ctime(std::string_view field, __s64& time_ns)
+    {
+        // "Www Mmm dd hh:mm:ss yyyy" in local time, the day is padded with a space
+        static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        if (field.size() < 24)
+            return false;
+        __s32 month = -1;
+        for (__s32 m = 0; m < 12; m++)
+            if (memcmp(field.data() + 4, months + 3 * m, 3) == 0)
+                month = m;
+        __s32 day, hour, minute, second, year;
+        if (month < 0 || !parse_number(field, 9, 1, day) || !parse_number(field, 11, 2, hour) || !parse_number(field, 14, 2, minute) ||
+            !parse_number(field, 17, 2, second) || !parse_number(field, 20, 4, year))
+            return false;
+        if (field[8] != ' ')
+        {
+            __s32 tens;
+            if (!parse_number(field, 8, 1, tens))
+                return false;
+            day += 10 * tens;
+        }
+
+        // mktime is slow and zone aware, so it is only asked once per local hour
+        __s64 key = ((static_cast<__s64>(year) * 12 + month) * 32 + day) * 24 + hour;
+        if (key != _hour_key)
+        {
+            tm broken_down = {};
+            broken_down.tm_year = year - 1900;
+            broken_down.tm_mon = month;
+            broken_down.tm_mday = day;
+            broken_down.tm_hour = hour;
+            broken_down.tm_isdst = -1;
+            _hour_start = mktime(&broken_down);
+            _hour_key = key;
+        }
+        time_ns = (_hour_start + minute * 60 + second) * 1000000000LL;
+        return true;
+    }
+
+    __s64 _hour_key = -1, _hour_start = 0;
+    __u8 _columns = 0;
+};
+
+#endif // _LOG_RECORD_
@@ -0,0 +1,277 @@
+#ifndef _METRICS_
+#define _METRICS_
+
+// Counters, gauges and histograms of the logger, exported in the Prometheus text format on /metrics.
+// Everything is a relaxed atomic: recording is a handful of uncontended atomic adds and never takes a
+// lock, exporting reads a snapshot that may be a few observations apart between series.
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <charconv>
+#include "log_record.cpp"
+
+#define METRICS_I2C_ADDRESSES 128
+#define HISTOGRAM_BUCKETS 15
+
+// upper bounds in nanoseconds, 50 us to 1 s, the last bucket is +Inf
+static const __u64 HISTOGRAM_BOUNDS_NS[HISTOGRAM_BUCKETS - 1] = {50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000, 500000000, 1000000000};
+
+static inline __u64 monotonic_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Counter
+{
+public:
+    inline void add(__u64 n = 1)
+    {
+        _value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    __u64 value() const
+    {
+        return _value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<__u64> _value{0};
+};
+
+class Gauge
+{
+public:
+    inline void set(double value)
+    {
+        __u64 bits;
+        memcpy(&bits, &value, 8);
+        _bits.store(bits, std::memory_order_relaxed);
+    }
+
+    double value() const
+    {
+        __u64 bits = _bits.load(std::memory_order_relaxed);
+        double value;
+        memcpy(&value, &bits, 8);
+        return value;
+    }
+
+private:
+    std::atomic<__u64> _bits{0x7FF8000000000000ULL}; // nan until first set
+};
+
+class Histogram
+{
+public:
+    inline void observe_ns(__u64 ns)
+    {
+        __u8 bucket = 0;
+        while (bucket < HISTOGRAM_BUCKETS - 1 && ns > HISTOGRAM_BOUNDS_NS[bucket])
+            bucket++;
+        _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        _sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    // observes the time since start_ns, from monotonic_ns()
+    inline void observe_since(__u64 start_ns)
+    {
+        observe_ns(monotonic_ns() - start_ns);
+    }
+
+    __u64 bucket(__u8 i) const
+    {
+        return _buckets[i].load(std::memory_order_relaxed);
+    }
+
+    __u64 sum_ns() const
+    {
+        return _sum_ns.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<__u64> _buckets[HISTOGRAM_BUCKETS] = {};
+    std::atomic<__u64> _sum_ns{0};
+};
+
+struct I2cDeviceMetrics
+{
+    std::atomic<const char*> name{nullptr}; // set by the device driver
+    Histogram read_latency, write_latency;
+    Counter read_bytes, write_bytes, read_errors, write_errors;
+
+    bool used() const
+    {
+        return read_bytes.value() + write_bytes.value() + read_errors.value() + write_errors.value() > 0;
+    }
+};
+
+class LoggerMetrics
+{
+public:
+    I2cDeviceMetrics i2c[METRICS_I2C_ADDRESSES]; // indexed by 7 bit address
+    Histogram loop_lateness;  // how late the sampling loop woke up for a sample
+    Histogram display_flush;  // drawing one screen on the SSD1306
+    Histogram log_write, log_fsync;
+    Histogram alert_eval;     // checking every alert rule against a sample
+    Counter samples, records, restarts;
+    Counter loop_allocations; // heap allocations of the sampling loop after its first record, see include/alloc_counter.cpp
+    Counter alerts_raised, alerts_dropped;
+    Gauge sensor[LOG_CHANNELS]; // latest raw sample
+    Gauge last_sample_time;   // unix seconds
+    Gauge sample_period, record_period, activity_level; // chosen by the adaptive sampler
+    Gauge alerts_active;
+    Counter compactions, compaction_reclaimed_bytes; // see include/compactor.cpp
+    Gauge storage_bytes, history_read_seconds;       // as of the last compaction
+
+    // Prometheus text exposition format 0.0.4
+    void write_text(std::string& out) const
+    {
+        out.clear();
+        out.reserve(16384);
+        header(out, "logger_i2c_transaction_seconds", "I2C transfer latency per device and direction.", "histogram");
+        for (__u16 address = 0; address < METRICS_I2C_ADDRESSES; address++)
+        {
+            const I2cDeviceMetrics& device = i2c[address];
+            if (!device.used())
+                continue;
+            std::string labels = device_labels(address);
+            histogram(out, "logger_i2c_transaction_seconds", labels + ",op=\"read\"", device.read_latency);
+            histogram(out, "logger_i2c_transaction_seconds", labels + ",op=\"write\"", device.write_latency);
+        }
+        header(out, "logger_i2c_bytes_total", "Bytes moved over I2C per device and direction.", "counter");
+        for_each_device(out, "logger_i2c_bytes_total", &I2cDeviceMetrics::read_bytes, &I2cDeviceMetrics::write_bytes);
+        header(out, "logger_i2c_errors_total", "Failed I2C transfers per device and direction.", "counter");
+        for_each_device(out, "logger_i2c_errors_total", &I2cDeviceMetrics::read_errors, &I2cDeviceMetrics::write_errors);
+
+        header(out, "logger_loop_lateness_seconds", "Delay between the scheduled and the actual start of a sample.", "histogram");
+        histogram(out, "logger_loop_lateness_seconds", "", loop_lateness);
+        header(out, "logger_display_flush_seconds", "Time to draw one screen on the display.", "histogram");
+        histogram(out, "logger_display_flush_seconds", "", display_flush);
+        header(out, "logger_log_write_seconds", "Time to append one record to the log file.", "histogram");
+        histogram(out, "logger_log_write_seconds", "", log_write);
+        header(out, "logger_log_fsync_seconds", "Time to sync the log file to storage.", "histogram");
+        histogram(out, "logger_log_fsync_seconds", "", log_fsync);
+        header(out, "logger_alert_eval_seconds", "Time to check every alert rule against one sample.", "histogram");
+        histogram(out, "logger_alert_eval_seconds", "", alert_eval);
+
+        header(out, "logger_samples_total", "Raw sensor samples taken.", "counter");
+        sample(out, "logger_samples_total", "", samples.value());
+        header(out, "logger_records_total", "Averaged records logged.", "counter");
+        sample(out, "logger_records_total", "", records.value());
+        header(out, "logger_restarts_total", "Restarts of the measurement loop after an error.", "counter");
+        sample(out, "logger_restarts_total", "", restarts.value());
+        header(out, "logger_loop_allocations_total", "Heap allocations of the sampling loop after its first record, cycles with device errors left out.", "counter");
+        sample(out, "logger_loop_allocations_total", "", loop_allocations.value());
+        header(out, "logger_alerts_total", "Alert events raised, firing and cleared.", "counter");
+        sample(out, "logger_alerts_total", "", alerts_raised.value());
+        header(out, "logger_alerts_dropped_total", "Alert events dropped because the sinks fell behind.", "counter");
+        sample(out, "logger_alerts_dropped_total", "", alerts_dropped.value());
+
+        header(out, "logger_sensor_value", "Latest raw sample per channel.", "gauge");
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            sample(out, "logger_sensor_value", std::string("{channel=\"") + CHANNEL_NAMES[ch] + "\"}", sensor[ch].value());
+        header(out, "logger_last_sample_timestamp_seconds", "Unix time of the latest raw sample.", "gauge");
+        sample(out, "logger_last_sample_timestamp_seconds", "", last_sample_time.value());
+        header(out, "logger_sample_period_seconds", "Current period between raw samples.", "gauge");
+        sample(out, "logger_sample_period_seconds", "", sample_period.value());
+        header(out, "logger_record_period_seconds", "Current period between logged records.", "gauge");
+        sample(out, "logger_record_period_seconds", "", record_period.value());
+        header(out, "logger_activity_level", "Signal activity driving the periods, 0 quiet to 1 active.", "gauge");
+        sample(out, "logger_activity_level", "", activity_level.value());
+        header(out, "logger_alerts_active", "Alert rules currently firing.", "gauge");
+        sample(out, "logger_alerts_active", "", alerts_active.value());
+        header(out, "logger_compactions_total", "Runs of the background compaction.", "counter");
+        sample(out, "logger_compactions_total", "", compactions.value());
+        header(out, "logger_compaction_reclaimed_bytes_total", "Bytes of log.txt and the archive reclaimed by compaction.", "counter");
+        sample(out, "logger_compaction_reclaimed_bytes_total", "", compaction_reclaimed_bytes.value());
+        header(out, "logger_storage_bytes", "Bytes of log.txt and the archive after the last compaction.", "gauge");
+        sample(out, "logger_storage_bytes", "", storage_bytes.value());
+        header(out, "logger_history_read_seconds", "Time to read the whole history after the last compaction.", "gauge");
+        sample(out, "logger_history_read_seconds", "", history_read_seconds.value());
+    }
+
+private:
+    static void header(std::string& out, const char* name, const char* help, const char* type)
+    {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+
+    std::string device_labels(__u16 address) const
+    {
+        char hex[8];
+        snprintf(hex, sizeof(hex), "0x%02x", address);
+        return std::string("address=\"") + hex + "\",device=\"" + (i2c[address].name.load() != nullptr ? i2c[address].name.load() : "unknown") + "\"";
+    }
+
+    void for_each_device(std::string& out, const char* name, Counter I2cDeviceMetrics::*read, Counter I2cDeviceMetrics::*write) const
+    {
+        for (__u16 address = 0; address < METRICS_I2C_ADDRESSES; address++)
+        {
+            const I2cDeviceMetrics& device = i2c[address];
+            if (!device.used())
+                continue;
+            std::string labels = device_labels(address);
+            sample(out, name, "{" + labels + ",op=\"read\"}", (device.*read).value());
+            sample(out, name, "{" + labels + ",op=\"write\"}", (device.*write).value());
+        }
+    }
+
+    static void sample(std::string& out, const char* name, const std::string& labels, double value)
+    {
+        out += name;
+        out += labels;
+        out += ' ';
+        if (is_missing(static_cast<float>(value)))
+            out += "NaN";
+        else
+        {
+            char buffer[32];
+            out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+        }
+        out += '\n';
+    }
+
+    static void sample(std::string& out, const char* name, const std::string& labels, __u64 value)
+    {
+        char buffer[24];
+        out += name;
+        out += labels;
+        out += ' ';
+        out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+        out += '\n';
+    }
+
+    static void histogram(std::string& out, const char* name, const std::string& labels, const Histogram& h)
+    {
+        std::string bucket_name = std::string(name) + "_bucket";
+        std::string prefix = labels.empty() ? "{le=\"" : "{" + labels + ",le=\"";
+        __u64 cumulative = 0;
+        for (__u8 i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            cumulative += h.bucket(i);
+            char bound[24] = "+Inf";
+            if (i < HISTOGRAM_BUCKETS - 1)
+                *std::to_chars(bound, bound + sizeof(bound) - 1, HISTOGRAM_BOUNDS_NS[i] / 1e9).ptr = '\0';
+            sample(out, bucket_name.c_str(), prefix + bound + "\"}", cumulative);
+        }
+        std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+        sample(out, (std::string(name) + "_sum").c_str(), suffix, h.sum_ns() / 1e9);
+        sample(out, (std::string(name) + "_count").c_str(), suffix, cumulative);
+    }
+};
+
+// one set per process, shared by the bus, the sampling loop and the HTTP server
+static LoggerMetrics metrics;
+
+#endif // _METRICS_
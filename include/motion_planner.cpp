@@ -0,0 +1,309 @@
+#ifndef _MOTION_PLANNER_
+#define _MOTION_PLANNER_
+
+#include <iostream>
+#include <cmath>
+#include <ctime>
+#include <vector>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <condition_variable>
+#include "laser_pointer_inverse_kinematics.cpp"
+#include "ring_queue.cpp"
+
+#define MOTION_UPDATE_RATE 50.0     // Hz, servo refresh rate while a laser is moving
+#define MOTION_MAX_VELOCITY 2.0     // (X,Y) units per second
+#define MOTION_MAX_ACCELERATION 8.0 // (X,Y) units per second^2
+#define MOTION_BLEND_COS 0.985      // corners flatter than ~10 deg are taken without stopping
+#define MOTION_PATH_POINTS 16       // way points queued per laser without allocating
+
+struct XY
+{
+    float X, Y;
+};
+
+class MotionPlanner
+{
+public:
+    MotionPlanner(float update_rate = MOTION_UPDATE_RATE, float max_velocity = MOTION_MAX_VELOCITY, float max_acceleration = MOTION_MAX_ACCELERATION)
+        : _dt(1.0 / update_rate), _max_velocity(max_velocity), _max_acceleration(max_acceleration) {}
+
+    ~MotionPlanner()
+    {
+        stop();
+    }
+
+    // registers a laser and returns the handle used by the motion requests,
+    // lasers have to be added before start()
+    size_t add_laser(InvKin* inv_kin, float X = 0.0, float Y = 0.0)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        Laser laser;
+        laser.inv_kin = inv_kin;
+        laser.position = {X, Y};
+        _lasers.push_back(laser);
+        return _lasers.size() - 1;
+    }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _thread = std::thread(&MotionPlanner::run, this);
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _running = false;
+        }
+        _wake_up.notify_all();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    // drops whatever the laser was doing and heads to (X,Y), never blocks on the servos
+    void move_to(size_t laser, float X, float Y)
+    {
+        queue_path(laser, {{X, Y}}, true);
+    }
+
+    // appends the way points to the laser's path, or replaces the path when replace is set; a moving laser
+    // first brakes to a stop on its current line (or blends on if the new path carries on in that direction),
+    // so a reversal keeps to the acceleration limit
+    void queue_path(size_t laser, std::initializer_list<XY> path, bool replace = false)
+    {
+        rethrow_pending_error();
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            Laser& l = _lasers.at(laser);
+            if (replace)
+            {
+                l.path.clear();
+                if (l.speed > 0.0)
+                {
+                    // what step() covers slowing down by _max_acceleration * _dt per tick, a bit short of v^2 / 2a
+                    float braking = 0.0;
+                    for (float speed = l.speed - _max_acceleration * _dt; speed > 0.0; speed -= _max_acceleration * _dt)
+                        braking += speed * _dt;
+                    l.path.push_back({l.position.X + l.direction.X * braking, l.position.Y + l.direction.Y * braking});
+                }
+            }
+            for (const XY& point : path)
+                l.path.push_back(point);
+        }
+        _wake_up.notify_all();
+    }
+
+    // traces the border of the [-half_size, half_size] square, used as a visual self-test
+    void queue_square(size_t laser, float half_size = 1.0)
+    {
+        queue_path(laser, {{-half_size, -half_size}, {half_size, -half_size}, {half_size, half_size}, {-half_size, half_size}, {-half_size, -half_size}});
+    }
+
+    // rewrites every servo on the next tick, for after the servo controller was re-initialized
+    void resync()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            for (Laser& laser : _lasers)
+            {
+                laser.servo_synced = false;
+                laser.forget_position = true;
+            }
+        }
+        _wake_up.notify_all();
+    }
+
+    bool is_idle(size_t laser)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _lasers.at(laser).path.empty();
+    }
+
+    XY get_position(size_t laser)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _lasers.at(laser).position;
+    }
+
+private:
+    struct Laser
+    {
+        InvKin* inv_kin;
+        XY position;
+        float speed = 0.0; // along the current segment
+        XY direction = {0.0, 0.0}; // unit vector of the motion, while speed is not 0
+        RingQueue<XY> path{MOTION_PATH_POINTS};
+        bool servo_synced = false;
+        bool forget_position = false; // set by resync(), handled on the planner thread that owns the servo writes
+    };
+
+    void rethrow_pending_error()
+    {
+        // servo errors happen on the planner thread, hand them to the caller so the usual restart logic kicks in
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_error)
+        {
+            std::exception_ptr error = _error;
+            _error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    void run()
+    {
+        timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::vector<XY> targets(_lasers.size()); // lasers are fixed once the planner runs
+        std::vector<bool> forget(_lasers.size());
+        while (_running)
+        {
+            bool any_moving = false;
+            for (Laser& laser : _lasers)
+                any_moving |= !laser.path.empty() || !laser.servo_synced;
+
+            if (!any_moving)
+            {
+                // nothing to do: sleep until a new request comes in and restart the timer from there
+                _wake_up.wait(lock, [this] { return !_running || has_pending_motion(); });
+                clock_gettime(CLOCK_MONOTONIC, &next);
+                continue;
+            }
+
+            for (size_t i = 0; i < _lasers.size(); i++)
+            {
+                step(_lasers[i]);
+                targets[i] = _lasers[i].position;
+                forget[i] = _lasers[i].forget_position;
+                _lasers[i].forget_position = false;
+            }
+
+            // absolute deadlines keep the update rate fixed regardless of how long the bus writes take
+            next.tv_nsec += static_cast<long>(_dt * 1e9);
+            while (next.tv_nsec >= 1000000000)
+            {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+
+            // the servo writes go out without holding the planner lock, so callers never wait on the bus
+            lock.unlock();
+            try
+            {
+                for (size_t i = 0; i < _lasers.size(); i++)
+                {
+                    if (forget[i])
+                        _lasers[i].inv_kin->forget_position();
+                    _lasers[i].inv_kin->move_xy(targets[i].X, targets[i].Y);
+                }
+            }
+            catch (const std::exception& e)
+            {
+                lock.lock();
+                _error = std::current_exception();
+                for (Laser& laser : _lasers)
+                    laser.path.clear();
+                continue;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+            lock.lock();
+        }
+    }
+
+    bool has_pending_motion() const
+    {
+        for (const Laser& laser : _lasers)
+            if (!laser.path.empty() || !laser.servo_synced)
+                return true;
+        return false;
+    }
+
+    void step(Laser& laser)
+    {
+        float budget = 0.0; // distance the laser may still travel in this tick
+        bool first_segment = true;
+        while (!laser.path.empty())
+        {
+            XY target = laser.path.front();
+            float dX = target.X - laser.position.X, dY = target.Y - laser.position.Y;
+            float distance = std::sqrt(dX * dX + dY * dY);
+
+            if (first_segment)
+            {
+                // trapezoidal profile: brake when the remaining distance to a stop equals the braking distance
+                float stop_distance = distance_to_stop(laser);
+                if (laser.speed * laser.speed >= 2.0 * _max_acceleration * stop_distance)
+                    laser.speed = std::max(laser.speed - _max_acceleration * _dt, _max_acceleration * _dt);
+                else
+                    laser.speed = std::min(laser.speed + _max_acceleration * _dt, _max_velocity);
+                budget = laser.speed * _dt;
+                first_segment = false;
+            }
+
+            if (distance > 0.0)
+                laser.direction = {dX / distance, dY / distance};
+            if (distance > budget)
+            {
+                laser.position.X += dX / distance * budget;
+                laser.position.Y += dY / distance * budget;
+                break;
+            }
+
+            // reached the way point, continue on the next segment with what is left of this tick
+            laser.position = target;
+            budget -= distance;
+            laser.path.pop_front();
+            if (laser.path.empty() || !is_blended(laser.position, dX, dY, distance, laser.path.front()))
+            {
+                laser.speed = 0.0;
+                break;
+            }
+        }
+        laser.servo_synced = true;
+    }
+
+    float distance_to_stop(const Laser& laser) const
+    {
+        // path length until the next way point where the laser has to stand still
+        XY from = laser.position;
+        float length = 0.0, prev_dX = 0.0, prev_dY = 0.0, prev_distance = 0.0;
+        for (size_t i = 0; i < laser.path.size(); i++)
+        {
+            const XY& point = laser.path[i];
+            if (prev_distance > 0.0 && !is_blended(from, prev_dX, prev_dY, prev_distance, point))
+                break;
+            prev_dX = point.X - from.X;
+            prev_dY = point.Y - from.Y;
+            prev_distance = std::sqrt(prev_dX * prev_dX + prev_dY * prev_dY);
+            length += prev_distance;
+            from = point;
+        }
+        return length;
+    }
+
+    static bool is_blended(const XY& corner, float dX, float dY, float distance, const XY& next)
+    {
+        float nX = next.X - corner.X, nY = next.Y - corner.Y;
+        float next_distance = std::sqrt(nX * nX + nY * nY);
+        if (distance <= 0.0 || next_distance <= 0.0)
+            return true;
+        return (dX * nX + dY * nY) / (distance * next_distance) >= MOTION_BLEND_COS;
+    }
+
+    float _dt, _max_velocity, _max_acceleration;
+    std::vector<Laser> _lasers;
+    std::mutex _mutex;
+    std::condition_variable _wake_up;
+    std::thread _thread;
+    std::atomic<bool> _running{false};
+    std::exception_ptr _error;
+};
+
+#endif // _MOTION_PLANNER_
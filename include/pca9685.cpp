@@ -23,11 +23,13 @@ public:
 	{
 		_i2c_bus = i2c_bus;
 		_device_address = device_address;
+		_i2c_bus->name_device(_device_address, "pca9685");
         _oscillator_frequency = oscillator_frequency;
 	}
 
     void set_PWM_freq(float freq)
     {
+        auto lock = _i2c_bus->lock();
         _i2c_bus->set_device_address(_device_address); // point towards correct device for future read/writes
 
         float pre_scale_val = ((_oscillator_frequency / (freq * 4096.0)) + 0.5) - 1;
@@ -57,6 +59,7 @@ public:
 
     void set_PWM(__u8 num, __u16 on, __u16 off)
     {
+        auto lock = _i2c_bus->lock();
         _i2c_bus->set_device_address(_device_address); // point towards correct device for future read/writes
 
         __u8 buffer[5];
@@ -71,6 +74,8 @@ public:
     
     void wake_up()
     {
+        auto lock = _i2c_bus->lock();
+        _i2c_bus->set_device_address(_device_address);
         __u8 cur_mode = read8(PCA9685_MODE1);
         __u8 wake_up = cur_mode & ~MODE1_SLEEP; // set sleep bit low
         write8(PCA9685_MODE1, wake_up);
@@ -78,6 +83,7 @@ public:
 
     void turn_off()
     {
+        auto lock = _i2c_bus->lock();
         for (__u8 i = 0; i < 16; i++)
             set_PWM(i, 0, 0);
     }
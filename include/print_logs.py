@@ -5,11 +5,24 @@ from file_read_backwards import FileReadBackwards # can be installed via pip, al
 DATE_FORMAT = "%a %b %d %H:%M:%S %Y"
 LOG_FILE_NAME = "log.txt"
 
+def parse_timestamp(field):
+    # the logger writes ctime (legacy default), ISO-8601 or epoch nanoseconds, see -timestamp
+    if field[0].isdigit():
+        if 'T' in field:
+            # the logger writes nanoseconds, datetime stops at microseconds (and before Python 3.11 wants exactly 3 or 6 digits)
+            date, dot, rest = field.partition('.')
+            if dot:
+                digits = len(rest) - len(rest.lstrip("0123456789"))
+                field = date + dot + rest[:min(digits, 6)].ljust(6, "0") + rest[digits:]
+            return datetime.datetime.fromisoformat(field).replace(tzinfo=None) # local time, offset dropped
+        return datetime.datetime.fromtimestamp(int(field) / 1e9)
+    return datetime.datetime.strptime(field, DATE_FORMAT)
+
 def print_logs(from_date, path=LOG_FILE_NAME):
     ref_date = datetime.datetime.strptime(from_date, DATE_FORMAT)
     with FileReadBackwards(path) as log_file:
         for line in log_file:
-            line_date = datetime.datetime.strptime(line.split("\t")[0], DATE_FORMAT)
+            line_date = parse_timestamp(line.split("\t")[0])
             if line_date > ref_date:
                 print(line, end="\n")
             else:
@@ -21,11 +34,12 @@ def logs_to_list(from_date, to_date, path=LOG_FILE_NAME, subsample=1):
         for i, line in enumerate(log_file):
             if (i % subsample != 0):
                 continue
-            line_date = datetime.datetime.strptime(line.split("\t")[0], DATE_FORMAT)
+            line_date = parse_timestamp(line.split("\t")[0])
             if line_date < from_date:
                 return lines_list
             if line_date < to_date:
                 lines_list.append(line)
+    return lines_list # the log starts inside the range
 
 if __name__ == '__main__':
     print_logs(sys.argv[1])
@@ -0,0 +1,269 @@
+#ifndef _PUSH_CLIENT_
+#define _PUSH_CLIENT_
+
+// Pushes the logged records to a central collector (tools/collector.cpp). Every record is first
+// appended to a local spool journal, then sent in batches by the client thread; records leave the spool
+// only once the collector acknowledged them as stored. While the collector is unreachable the spool
+// grows and the thread reconnects with backoff, after a restart of the logger the spool is replayed.
+// Sequence numbers never go back for a node, the collector drops what it already stored by them: an
+// emptied spool keeps the next one, a new spool starts at the wall clock in nanoseconds.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <stdexcept>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#include "push_protocol.cpp"
+#include "ring_queue.cpp"
+
+#define PUSH_SPOOL_FILE "push_spool.wal"
+#define PUSH_TIMEOUT_S 10                      // connect, send and acknowledgement timeout
+#define PUSH_BACKOFF_MIN_NS 100000000ULL       // first reconnect after 100 ms
+#define PUSH_BACKOFF_MAX_NS 30000000000ULL     // then doubling up to 30 s
+#define PUSH_QUEUE_RECORDS 4096                // pending records held without allocating, 17 hours of an outage at 15 s records
+
+// one record of the spool
+struct SpooledRecord
+{
+    __u64 seq;
+    LogRecord record;
+};
+
+class PushClient
+{
+public:
+    PushClient(const std::string& host, __u16 port, const std::string& node, const std::string& spool_file = PUSH_SPOOL_FILE, SyncPolicy policy = SyncPolicy())
+        : _host(host), _port(port), _node(node), _spool(spool_file, policy), _pending(PUSH_QUEUE_RECORDS)
+    {
+        if (!valid_node_id(node))
+            throw std::runtime_error("Push: invalid node id \"" + node + "\", use up to 64 letters, digits, '-', '_' or '.'");
+        _spool.for_each([&](const __u8* data, __u32 size) {
+            if (size == sizeof(_next_seq))
+            {
+                memcpy(&_next_seq, data, sizeof(_next_seq)); // left when the spool was emptied
+                return;
+            }
+            SpooledRecord spooled;
+            if (size < sizeof(spooled.seq) || !read_record(data + sizeof(spooled.seq), size - sizeof(spooled.seq), spooled.record))
+                return; // spools from before period_s hold shorter records
+            memcpy(&spooled.seq, data, sizeof(spooled.seq));
+            _pending.push_back(spooled);
+            _next_seq = spooled.seq + 1;
+        });
+        if (_next_seq == 0)
+            _next_seq = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        if (!_pending.empty())
+            std::cout << "Push: replaying " << _pending.size() << " spooled records to " << host << ":" << port << "\n";
+    }
+
+    ~PushClient()
+    {
+        stop();
+    }
+
+    PushClient(const PushClient&) = delete;
+    PushClient& operator=(const PushClient&) = delete;
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _thread = std::thread(&PushClient::run, this);
+    }
+
+    void stop()
+    {
+        if (!_running)
+            return;
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _running = false;
+            if (_socket >= 0)
+                shutdown(_socket, SHUT_RDWR); // unblocks a send or a wait for an acknowledgement
+        }
+        _wake_up.notify_one();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    // spools the record and queues it for the client thread, never waits for the network
+    void push(const LogRecord& record)
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            SpooledRecord spooled = {_next_seq++, record};
+            _spool.append(&spooled, sizeof(spooled));
+            _pending.push_back(spooled);
+        }
+        _wake_up.notify_one();
+    }
+
+    // records spooled and not acknowledged yet
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _pending.size();
+    }
+
+    __u64 acked() const
+    {
+        return _acked.load(std::memory_order_relaxed);
+    }
+
+    __u64 reconnects() const
+    {
+        return _reconnects.load(std::memory_order_relaxed);
+    }
+
+    bool connected() const
+    {
+        return _connected.load(std::memory_order_relaxed);
+    }
+
+private:
+    void run()
+    {
+        __u64 backoff_ns = PUSH_BACKOFF_MIN_NS;
+        while (_running)
+        {
+            int fd = connect_to_collector();
+            if (fd < 0)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake_up.wait_for(lock, std::chrono::nanoseconds(backoff_ns), [this]() { return !_running; });
+                backoff_ns = std::min(backoff_ns * 2, PUSH_BACKOFF_MAX_NS);
+                continue;
+            }
+            backoff_ns = PUSH_BACKOFF_MIN_NS;
+            _connected = true;
+            send_batches(fd);
+            _connected = false;
+            _reconnects++;
+            std::lock_guard<std::mutex> guard(_mutex);
+            _socket = -1;
+            close(fd);
+        }
+    }
+
+    // connects and says hello, -1 if the collector is unreachable or refused the node
+    int connect_to_collector()
+    {
+        addrinfo hints = {}, *addresses;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(_host.c_str(), std::to_string(_port).c_str(), &hints, &addresses) != 0)
+            return -1;
+        int fd = -1;
+        for (addrinfo* address = addresses; address != nullptr && fd < 0; address = address->ai_next)
+        {
+            fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd < 0)
+                continue;
+            timeval timeout = {PUSH_TIMEOUT_S, 0}; // the send timeout also bounds connect()
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            if (connect(fd, address->ai_addr, address->ai_addrlen) < 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (fd < 0)
+            return -1;
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if (!_running)
+            {
+                close(fd);
+                return -1;
+            }
+            _socket = fd;
+        }
+
+        __u8 hello[PUSH_HELLO_SIZE + PUSH_MAX_NODE_ID];
+        __u32 magic = PUSH_MAGIC;
+        __u16 version = PUSH_VERSION;
+        memcpy(hello, &magic, 4);
+        memcpy(hello + 4, &version, 2);
+        hello[6] = LOG_CHANNELS;
+        hello[7] = _node.size();
+        memcpy(hello + PUSH_HELLO_SIZE, _node.data(), _node.size());
+        __u8 reply[PUSH_HELLO_SIZE];
+        __u16 status = PUSH_REJECTED;
+        if (send_all(fd, hello, PUSH_HELLO_SIZE + _node.size()) && receive_all(fd, reply, sizeof(reply)))
+            memcpy(&status, reply + 6, 2);
+        if (status != PUSH_ACCEPTED || memcmp(reply, &magic, 4) != 0)
+        {
+            std::cerr << "Push: " << _host << ":" << _port << " did not accept node " << _node << "\n";
+            std::lock_guard<std::mutex> guard(_mutex);
+            _socket = -1;
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // sends the oldest pending records and waits for their acknowledgement, until the connection fails
+    void send_batches(int fd)
+    {
+        while (true)
+        {
+            __u64 first_seq;
+            size_t count;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake_up.wait(lock, [this]() { return !_pending.empty() || !_running; });
+                if (!_running)
+                    return;
+                count = std::min<size_t>(_pending.size(), PUSH_BATCH_RECORDS);
+                first_seq = _pending.front().seq;
+                _records.resize(count);
+                for (size_t i = 0; i < count; i++)
+                    _records[i] = _pending[i].record;
+            }
+            encode_batch(first_seq, _records.data(), count, _frame);
+            __u64 ack;
+            if (!send_all(fd, _frame.data(), _frame.size()) || !receive_all(fd, &ack, sizeof(ack)))
+                return;
+
+            std::lock_guard<std::mutex> guard(_mutex);
+            while (!_pending.empty() && _pending.front().seq <= ack)
+                _pending.pop_front();
+            _acked.store(ack, std::memory_order_relaxed);
+            if (_pending.empty())
+            {
+                _spool.reset(); // everything is stored at the collector
+                _spool.append(&_next_seq, sizeof(_next_seq));
+            }
+        }
+    }
+
+    std::string _host;
+    __u16 _port;
+    std::string _node;
+    Journal _spool;                      // under _mutex
+    RingQueue<SpooledRecord> _pending;   // under _mutex, the spool contents that were not acknowledged
+    __u64 _next_seq = 0;                 // under _mutex
+    int _socket = -1;                    // under _mutex
+    std::vector<LogRecord> _records;
+    std::vector<__u8> _frame;
+    std::atomic<__u64> _acked{0}, _reconnects{0};
+    std::atomic<bool> _connected{false}, _running{false};
+    std::mutex _mutex;
+    std::condition_variable _wake_up;
+    std::thread _thread;
+};
+
+#endif // _PUSH_CLIENT_
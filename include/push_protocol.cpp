@@ -0,0 +1,101 @@
+#ifndef _PUSH_PROTOCOL_
+#define _PUSH_PROTOCOL_
+
+// Wire format between the loggers (include/push_client.cpp) and the collector (include/collector.cpp),
+// over TCP, little endian like the stream frames:
+//   hello   node to collector: u32 magic, u16 version, u8 channels, u8 node id length, node id
+//           collector to node: u32 magic, u16 version, u16 status (0 accepted)
+//   batch   node to collector: u32 payload length, u32 crc32c of the payload,
+//           payload: u64 sequence of the first record, u16 count, u16 record size, count records;
+//           version 1 nodes send LOG_RECORD_V1_SIZE byte records, without period_s
+//   ack     collector to node: u64 sequence of the last record of the batch, sent once it is stored
+// Sequence numbers count the records of one node and never go back, the collector drops records whose
+// sequence is not above the last one it stored for the node, so a batch replayed after a lost ack is harmless.
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/types.h>
+#include "log_record.cpp"
+#include "journal.cpp"
+
+#define PUSH_MAGIC 0x4E504C54 // "TLPN"
+#define PUSH_VERSION 2
+#define PUSH_PORT 7071
+#define PUSH_HELLO_SIZE 8
+#define PUSH_FRAME_HEADER 8
+#define PUSH_BATCH_HEADER 12
+#define PUSH_BATCH_RECORDS 512 // a replay after a long outage goes out in batches of this many records
+#define PUSH_MAX_NODE_ID 64
+
+enum push_status
+{
+    PUSH_ACCEPTED = 0,
+    PUSH_REJECTED // bad node id, version or record layout
+};
+
+// node ids name the store files of the collector
+static inline bool valid_node_id(const std::string& node)
+{
+    if (node.empty() || node.size() > PUSH_MAX_NODE_ID || node[0] == '.')
+        return false;
+    for (char c : node)
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_' && c != '.')
+            return false;
+    return true;
+}
+
+// blocking send and receive of exactly size bytes, false on error, timeout or hang up
+static inline bool send_all(int fd, const void* data, size_t size)
+{
+    const __u8* p = static_cast<const __u8*>(data);
+    while (size > 0)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static inline bool receive_all(int fd, void* data, size_t size)
+{
+    __u8* p = static_cast<__u8*>(data);
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// frames a batch of records in out, ready to send
+static inline void encode_batch(__u64 first_seq, const LogRecord* records, __u16 count, std::vector<__u8>& out)
+{
+    __u32 payload = PUSH_BATCH_HEADER + count * sizeof(LogRecord);
+    __u16 record_size = sizeof(LogRecord);
+    out.resize(PUSH_FRAME_HEADER + payload);
+    __u8* p = out.data() + PUSH_FRAME_HEADER;
+    memcpy(p, &first_seq, 8);
+    memcpy(p + 8, &count, 2);
+    memcpy(p + 10, &record_size, 2);
+    memcpy(p + PUSH_BATCH_HEADER, records, count * sizeof(LogRecord));
+    __u32 crc = crc32c(p, payload);
+    memcpy(out.data(), &payload, 4);
+    memcpy(out.data() + 4, &crc, 4);
+}
+
+#endif // _PUSH_PROTOCOL_
@@ -0,0 +1,554 @@
+#ifndef _QUERY_API_
+#define _QUERY_API_
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <charconv>
+#include "http_server.cpp"
+#include "sample_history.cpp"
+#include "log_file.cpp"
+#include "archive.cpp"
+#include "rollup.cpp"
+#include "derived_metrics.cpp"
+#include "downsample.cpp"
+#include "arrow_ipc.cpp"
+
+#define QUERY_DEFAULT_RANGE_S 86400
+#define QUERY_DEFAULT_STEP_S 3600
+#define QUERY_MAX_ROLLUPS 100000
+#define QUERY_DEFAULT_POINTS 1000
+#define QUERY_MAX_RANGE_RECORDS 20000    // returned as JSON by /range, longer ranges go through /downsample or /export
+#define QUERY_MAX_RECORDS (1 << 20)      // read for one request, about 48 MB: six months of 15 s records at worst
+#define QUERY_KEEP_RECORDS HISTORY_CAPACITY // buffers grown past this by a request are released after it
+#define QUERY_MAX_TIME_S 4102444800.0    // 2100-01-01, times and steps are in [0, this]
+#define QUERY_SERIES (LOG_CHANNELS + DERIVED_CHANNELS)
+
+// JSON endpoints of the logger, answered from the in-memory history and, for older data, from log.txt and
+// the compactor's archive (include/archive.cpp), where old enough data reads as hourly or daily means:
+//   GET /latest                          most recent record
+//   GET /range?from=S&to=S               records in [from, to), epoch seconds, defaults to the last day, with the
+//                                        seconds each one averages over (period, 0 when unknown); at most
+//                                        QUERY_MAX_RANGE_RECORDS of them, a longer range is a 400
+//   GET /rollup?from=S&to=S&step=S       min/max/mean/stddev per channel and step wide bucket
+//   GET /downsample?from=S&to=S&points=N&method=lttb|minmax[&step=S][&channels=A,B]
+//                                        at most N plot-ready points per channel and derived channel, of the
+//                                        records or of the means of step wide buckets
+//   GET /export?from=S&to=S[&step=S][&channels=A,B][&format=stream|file]
+//                                        Arrow IPC stream (or Feather v2 file) of the records or bucket means:
+//                                        time (ns, UTC) and the channels and derived channels, nulls when missing
+// The other endpoints read at most QUERY_MAX_RECORDS records per request.
+class QueryApi
+{
+public:
+    QueryApi(SampleHistory* history, std::string log_file_name, float altitude_m = 0.0f, Archive* archive = nullptr)
+        : _history(history), _log_file_name(log_file_name), _altitude_m(altitude_m), _archive(archive), _threads(std::max(1u, std::thread::hardware_concurrency())) {}
+
+    void handle(const HttpRequest& request, HttpResponse& response)
+    {
+        if (request.path == "/latest")
+            latest(response);
+        else if (request.path == "/range")
+            range(request, response);
+        else if (request.path == "/rollup")
+            rollup(request, response);
+        else if (request.path == "/downsample")
+            downsample(request, response);
+        else if (request.path == "/export")
+            export_arrow(request, response);
+        else
+        {
+            response.status = 404;
+            response.body = "{\"error\":\"unknown endpoint, use /latest, /range, /rollup, /downsample or /export\"}";
+        }
+        release_buffers();
+    }
+
+    // records in [from_ns, to_ns): the part older than the history comes from the log file, and the part
+    // older than the log from the archive; false, with records cut short, when there are more than limit
+    bool collect(__s64 from_ns, __s64 to_ns, std::vector<LogRecord>& records, size_t limit = SIZE_MAX - 1)
+    {
+        __s64 oldest = _history->oldest_time_ns();
+        __s64 archived = _archive != nullptr ? _archive->end_ns() : INT64_MIN;
+        if (from_ns < std::min(archived, oldest))
+            _archive->read_range(from_ns, std::min(to_ns, std::min(archived, oldest)), records, limit + 1);
+        if (records.size() > limit)
+            return false;
+        if (std::max(from_ns, archived) < oldest)
+        {
+            try
+            {
+                LogFile log_file(_log_file_name);
+                log_file.read_range(std::max(from_ns, archived), std::min(to_ns, oldest), records, limit + 1);
+            }
+            catch (const std::runtime_error& e)
+            {
+                // no log file yet, the history is all there is
+            }
+        }
+        if (records.size() > limit)
+            return false;
+        _history->copy_range(std::max(from_ns, std::min(oldest, to_ns)), to_ns, records);
+        return records.size() <= limit;
+    }
+
+private:
+    void latest(HttpResponse& response)
+    {
+        LogRecord record;
+        if (!_history->latest(record))
+        {
+            response.status = 404;
+            response.body = "{\"error\":\"no samples yet\"}";
+            return;
+        }
+        std::string& out = response.body;
+        out = "{\"time\":";
+        append(out, record.time_ns / 1000000);
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            out += ",\"";
+            out += CHANNEL_NAMES[ch];
+            out += "\":";
+            append(out, record.values[ch]);
+        }
+        out += ",\"ret_code\":";
+        append(out, record.ret_code);
+        out += ",\"period\":";
+        append(out, record.period_s);
+        out += "}";
+    }
+
+    void range(const HttpRequest& request, HttpResponse& response)
+    {
+        __s64 from_ns, to_ns;
+        if (!time_range(request, from_ns, to_ns, response))
+            return;
+        _records.clear();
+        if (!collect(from_ns, to_ns, _records, QUERY_MAX_RANGE_RECORDS))
+        {
+            bad_request(response, "more than 20000 records in the range, use /downsample or /export for long ranges");
+            return;
+        }
+
+        // columnar, times in epoch milliseconds
+        std::string& out = response.body;
+        out.reserve(_records.size() * 80);
+        out = "{\"count\":";
+        append(out, static_cast<__s64>(_records.size()));
+        out += ",\"time\":[";
+        for (size_t i = 0; i < _records.size(); i++)
+        {
+            if (i > 0)
+                out += ',';
+            append(out, _records[i].time_ns / 1000000);
+        }
+        out += ']';
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            out += ",\"";
+            out += CHANNEL_NAMES[ch];
+            out += "\":[";
+            for (size_t i = 0; i < _records.size(); i++)
+            {
+                if (i > 0)
+                    out += ',';
+                append(out, _records[i].values[ch]);
+            }
+            out += ']';
+        }
+        out += ",\"period\":[";
+        for (size_t i = 0; i < _records.size(); i++)
+        {
+            if (i > 0)
+                out += ',';
+            append(out, _records[i].period_s);
+        }
+        out += "]}";
+    }
+
+    void rollup(const HttpRequest& request, HttpResponse& response)
+    {
+        __s64 from_ns, to_ns;
+        if (!time_range(request, from_ns, to_ns, response))
+            return;
+        double step_s = QUERY_DEFAULT_STEP_S;
+        if (!parse_param(request.param("step"), step_s) || !valid_step(step_s, from_ns, to_ns))
+        {
+            bad_request(response, "step must be at least 1 s and give at most 100000 buckets");
+            return;
+        }
+        _records.clear();
+        if (!collect(from_ns, to_ns, _records, QUERY_MAX_RECORDS))
+        {
+            too_many_records(response);
+            return;
+        }
+        _rollups.clear();
+        compute_rollups(_records, static_cast<__s64>(step_s * 1e9), _rollups);
+
+        std::string& out = response.body;
+        out = "{\"step\":";
+        append(out, step_s);
+        out += ",\"start\":[";
+        for (size_t i = 0; i < _rollups.size(); i++)
+        {
+            if (i > 0)
+                out += ',';
+            append(out, _rollups[i].start_ns / 1000000);
+        }
+        out += "],\"records\":[";
+        for (size_t i = 0; i < _rollups.size(); i++)
+        {
+            if (i > 0)
+                out += ',';
+            append(out, static_cast<__s64>(_rollups[i].records));
+        }
+        out += ']';
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            out += ",\"";
+            out += CHANNEL_NAMES[ch];
+            out += "\":{";
+            const char* stats[] = {"min", "max", "mean", "stddev"};
+            for (__u8 stat = 0; stat < 4; stat++)
+            {
+                if (stat > 0)
+                    out += ',';
+                out += '"';
+                out += stats[stat];
+                out += "\":[";
+                for (size_t i = 0; i < _rollups.size(); i++)
+                {
+                    if (i > 0)
+                        out += ',';
+                    const Rollup& r = _rollups[i];
+                    if (r.count[ch] == 0)
+                        out += "null";
+                    else if (stat == 0)
+                        append(out, r.min[ch]);
+                    else if (stat == 1)
+                        append(out, r.max[ch]);
+                    else if (stat == 2)
+                        append(out, static_cast<float>(r.mean(ch)));
+                    else
+                        append(out, static_cast<float>(r.stddev(ch)));
+                }
+                out += ']';
+            }
+            out += '}';
+        }
+        out += '}';
+    }
+
+    void downsample(const HttpRequest& request, HttpResponse& response)
+    {
+        __s64 from_ns, to_ns;
+        if (!time_range(request, from_ns, to_ns, response))
+            return;
+        double points = QUERY_DEFAULT_POINTS;
+        if (!parse_param(request.param("points"), points) || points < DOWNSAMPLE_MIN_POINTS || points > DOWNSAMPLE_MAX_POINTS)
+        {
+            bad_request(response, "points must be 3 to 20000");
+            return;
+        }
+        std::string_view method_name = request.param("method");
+        downsample_method method = DOWNSAMPLE_LTTB;
+        if (method_name == "minmax")
+            method = DOWNSAMPLE_MINMAX;
+        else if (!method_name.empty() && method_name != "lttb")
+        {
+            bad_request(response, "method must be lttb or minmax");
+            return;
+        }
+        double step_s = 0.0;
+        if (!parse_param(request.param("step"), step_s) || (step_s != 0.0 && !valid_step(step_s, from_ns, to_ns)))
+        {
+            bad_request(response, "step must be at least 1 s and give at most 100000 buckets");
+            return;
+        }
+        std::vector<__u8> selected;
+        if (!select_series(request.param("channels"), selected))
+        {
+            bad_request(response, "channels must be a comma separated list of channel and derived channel names");
+            return;
+        }
+
+        size_t rows;
+        if (!fill_columns(from_ns, to_ns, step_s, rows))
+        {
+            too_many_records(response);
+            return;
+        }
+        std::vector<const float*> columns;
+        for (__u8 s : selected)
+            columns.push_back(_columns[s].data());
+        downsample_columns(_times, columns, static_cast<size_t>(points), method, _threads, _series);
+
+        // every series has its own times, in epoch milliseconds
+        std::string& out = response.body;
+        out = "{\"method\":\"";
+        out += method == DOWNSAMPLE_LTTB ? "lttb" : "minmax";
+        out += "\",\"points\":";
+        append(out, static_cast<__s64>(points));
+        out += ",\"count\":";
+        append(out, static_cast<__s64>(rows));
+        out += ",\"series\":{";
+        for (size_t c = 0; c < selected.size(); c++)
+        {
+            const Series& series = _series[c];
+            if (c > 0)
+                out += ',';
+            out += '"';
+            out += series_name(selected[c]);
+            out += "\":{\"time\":[";
+            for (size_t i = 0; i < series.time_ns.size(); i++)
+            {
+                if (i > 0)
+                    out += ',';
+                append(out, series.time_ns[i] / 1000000);
+            }
+            out += "],\"values\":[";
+            for (size_t i = 0; i < series.values.size(); i++)
+            {
+                if (i > 0)
+                    out += ',';
+                append(out, series.values[i]);
+            }
+            out += "]}";
+        }
+        out += "}}";
+    }
+
+    void export_arrow(const HttpRequest& request, HttpResponse& response)
+    {
+        __s64 from_ns, to_ns;
+        if (!time_range(request, from_ns, to_ns, response))
+            return;
+        double step_s = 0.0;
+        if (!parse_param(request.param("step"), step_s) || (step_s != 0.0 && !valid_step(step_s, from_ns, to_ns)))
+        {
+            bad_request(response, "step must be at least 1 s and give at most 100000 buckets");
+            return;
+        }
+        std::vector<__u8> selected;
+        if (!select_series(request.param("channels"), selected))
+        {
+            bad_request(response, "channels must be a comma separated list of channel and derived channel names");
+            return;
+        }
+        std::string_view format_name = request.param("format");
+        arrow_format format = format_name == "file" ? ARROW_FILE : ARROW_STREAM;
+        if (!format_name.empty() && format_name != "file" && format_name != "stream")
+        {
+            bad_request(response, "format must be stream or file");
+            return;
+        }
+
+        size_t rows;
+        if (!fill_columns(from_ns, to_ns, step_s, rows))
+        {
+            too_many_records(response);
+            return;
+        }
+        std::vector<ArrowField> fields = {{"time", ARROW_TIMESTAMP_NS, false}};
+        std::vector<ArrowArray> arrays = {{_times.data()}};
+        for (__u8 s : selected)
+        {
+            fields.push_back({series_name(s), ARROW_FLOAT32, true});
+            size_t null_count = arrow_validity(_columns[s].data(), rows, _validity[s]);
+            arrays.push_back({_columns[s].data(), _validity[s].data(), null_count});
+        }
+        std::string& out = response.body;
+        out.clear();
+        out.reserve(ARROW_ALIGN * 8 * (fields.size() + 1) + rows * (sizeof(__s64) + selected.size() * (sizeof(float) + 1)));
+        ArrowWriter writer(format, fields, [&out](const void* data, size_t size) { out.append(static_cast<const char*>(data), size); });
+        writer.write_batch(rows, arrays.data());
+        writer.finish();
+        response.content_type = format == ARROW_FILE ? "application/vnd.apache.arrow.file" : "application/vnd.apache.arrow.stream";
+    }
+
+    // _times and _columns of the records in [from_ns, to_ns), or of the means of step_s wide buckets, with
+    // the derived channels, and their count in rows; false when the range holds too many records
+    bool fill_columns(__s64 from_ns, __s64 to_ns, double step_s, size_t& rows)
+    {
+        _records.clear();
+        if (!collect(from_ns, to_ns, _records, QUERY_MAX_RECORDS))
+            return false;
+        _times.clear();
+        for (std::vector<float>& column : _columns)
+            column.clear();
+        if (step_s == 0.0)
+        {
+            for (const LogRecord& record : _records)
+            {
+                _times.push_back(record.time_ns);
+                for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+                    _columns[ch].push_back(record.values[ch]);
+            }
+        }
+        else
+        {
+            _rollups.clear();
+            compute_rollups(_records, static_cast<__s64>(step_s * 1e9), _rollups);
+            for (const Rollup& rollup : _rollups)
+            {
+                _times.push_back(rollup.start_ns);
+                for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+                    _columns[ch].push_back(static_cast<float>(rollup.mean(ch)));
+            }
+        }
+        rows = _times.size();
+        for (__u8 d = 0; d < DERIVED_CHANNELS; d++)
+            _columns[LOG_CHANNELS + d].resize(rows);
+        derive_humidity(_columns[CH_T_INTERIOR].data(), _columns[CH_H_INTERIOR].data(), _columns[CH_P_INTERIOR].data(), rows, _altitude_m,
+                        _columns[LOG_CHANNELS + DV_Q_INTERIOR].data(), _columns[LOG_CHANNELS + DV_DEW_POINT_INTERIOR].data(),
+                        _columns[LOG_CHANNELS + DV_ABS_HUMIDITY_INTERIOR].data(), _columns[LOG_CHANNELS + DV_P_SEA_LEVEL_INTERIOR].data());
+        derive_humidity(_columns[CH_T_EXTERIOR].data(), _columns[CH_H_EXTERIOR].data(), _columns[CH_P_EXTERIOR].data(), rows, _altitude_m,
+                        _columns[LOG_CHANNELS + DV_Q_EXTERIOR].data(), _columns[LOG_CHANNELS + DV_DEW_POINT_EXTERIOR].data(),
+                        _columns[LOG_CHANNELS + DV_ABS_HUMIDITY_EXTERIOR].data(), _columns[LOG_CHANNELS + DV_P_SEA_LEVEL_EXTERIOR].data());
+        return true;
+    }
+
+    static const char* series_name(__u8 s)
+    {
+        return s < LOG_CHANNELS ? CHANNEL_NAMES[s] : DERIVED_NAMES[s - LOG_CHANNELS];
+    }
+
+    // the series named in a comma separated list, all of them when the list is empty
+    static bool select_series(std::string_view list, std::vector<__u8>& selected)
+    {
+        if (list.empty())
+        {
+            for (__u8 s = 0; s < QUERY_SERIES; s++)
+                selected.push_back(s);
+            return true;
+        }
+        while (!list.empty())
+        {
+            size_t comma = list.find(',');
+            std::string_view name = list.substr(0, comma);
+            __u8 s = 0;
+            while (s < QUERY_SERIES && name != series_name(s))
+                s++;
+            if (s == QUERY_SERIES)
+                return false;
+            selected.push_back(s);
+            list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        }
+        return true;
+    }
+
+    bool time_range(const HttpRequest& request, __s64& from_ns, __s64& to_ns, HttpResponse& response)
+    {
+        double now_s = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+        double to_s = now_s + 1.0, from_s;
+        if (!parse_param(request.param("to"), to_s) || to_s < 0.0 || to_s > QUERY_MAX_TIME_S)
+        {
+            bad_request(response, "to must be epoch seconds before 2100");
+            return false;
+        }
+        from_s = std::max(0.0, to_s - QUERY_DEFAULT_RANGE_S);
+        if (!parse_param(request.param("from"), from_s) || from_s < 0.0 || from_s > to_s)
+        {
+            bad_request(response, "from must be epoch seconds before to");
+            return false;
+        }
+        from_ns = static_cast<__s64>(from_s * 1e9);
+        to_ns = static_cast<__s64>(to_s * 1e9);
+        return true;
+    }
+
+    // leaves value untouched when the parameter is absent; the whole of it has to be a finite number
+    static bool parse_param(std::string_view text, double& value)
+    {
+        if (text.empty())
+            return true;
+        double parsed;
+        std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), parsed);
+        if (result.ec != std::errc() || result.ptr != text.data() + text.size() || !is_finite(parsed))
+            return false;
+        value = parsed;
+        return true;
+    }
+
+    // on the bit pattern, -Ofast assumes finite math
+    static bool is_finite(double value)
+    {
+        __u64 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return ((bits >> 52) & 0x7FF) != 0x7FF;
+    }
+
+    static bool valid_step(double step_s, __s64 from_ns, __s64 to_ns)
+    {
+        return step_s >= 1.0 && step_s <= QUERY_MAX_TIME_S && (to_ns - from_ns) / (step_s * 1e9) <= QUERY_MAX_ROLLUPS;
+    }
+
+    static void too_many_records(HttpResponse& response)
+    {
+        bad_request(response, "more than 1048576 records in the range, ask for a shorter one");
+    }
+
+    // buffers grown by a request over a long range go back to the system instead of staying that big
+    void release_buffers()
+    {
+        auto release = [](auto& buffer) {
+            if (buffer.capacity() > QUERY_KEEP_RECORDS)
+                std::remove_reference_t<decltype(buffer)>().swap(buffer);
+        };
+        release(_records);
+        release(_rollups);
+        release(_times);
+        for (size_t s = 0; s < QUERY_SERIES; s++)
+        {
+            release(_columns[s]);
+            release(_validity[s]);
+        }
+    }
+
+    static void bad_request(HttpResponse& response, const char* message)
+    {
+        response.status = 400;
+        response.body = std::string("{\"error\":\"") + message + "\"}";
+    }
+
+    static void append(std::string& out, float value)
+    {
+        if (is_missing(value))
+        {
+            out += "null";
+            return;
+        }
+        char buffer[32];
+        out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    }
+
+    static void append(std::string& out, double value)
+    {
+        char buffer[32];
+        out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    }
+
+    template <typename T>
+    static void append(std::string& out, T value)
+    {
+        char buffer[24];
+        out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    }
+
+    SampleHistory* _history;
+    std::string _log_file_name;
+    std::vector<LogRecord> _records; // reused between requests, only touched by the server thread
+    std::vector<Rollup> _rollups;
+    float _altitude_m;
+    Archive* _archive;
+    unsigned _threads;
+    std::vector<__s64> _times;
+    std::vector<float> _columns[QUERY_SERIES];
+    std::vector<__u8> _validity[QUERY_SERIES];
+    std::vector<Series> _series;
+};
+
+#endif // _QUERY_API_
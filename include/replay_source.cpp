@@ -0,0 +1,92 @@
+#ifndef _REPLAY_SOURCE_
+#define _REPLAY_SOURCE_
+
+// Recorded samples for the replay mode (-replay FILE), in time order. Three kinds of recordings are
+// recognized by their first bytes:
+//   a gorilla store (-store FILE), with the open block of its journal;
+//   a capture of the live stream (python include/sample_stream.py SOCKET FILE), its raw samples, or its
+//   averages when it holds no raw samples;
+//   anything else is read as log.txt lines, legacy and current rows mixed.
+// Samples that do not advance the time (a clock stepped back) are dropped, the replay clock only moves forward.
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "log_record.cpp"
+#include "log_file.cpp"
+#include "gorilla.cpp"
+#include "sample_stream.cpp"
+
+enum replay_format
+{
+    REPLAY_LOG = 0,
+    REPLAY_STORE,
+    REPLAY_CAPTURE
+};
+
+static const char* const REPLAY_FORMAT_NAMES[] = {"log", "gorilla store", "stream capture"};
+
+static replay_format detect_replay_format(const std::string& file_name)
+{
+    int file = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        throw std::runtime_error("Cannot open " + file_name);
+    __u8 head[4] = {};
+    ssize_t n = read(file, head, sizeof(head));
+    close(file);
+    __u32 magic;
+    memcpy(&magic, head, 4);
+    if (n == 4 && magic == GORILLA_MAGIC)
+        return REPLAY_STORE;
+    size_t record_size = head[2] + (head[3] << 8);
+    if (n == 4 && (head[0] == FRAME_RAW || head[0] == FRAME_AVERAGE) && head[1] == LOG_CHANNELS && (record_size == sizeof(LogRecord) || record_size == LOG_RECORD_V1_SIZE))
+        return REPLAY_CAPTURE;
+    return REPLAY_LOG;
+}
+
+// appends the samples of the recording to out, returns its format
+static replay_format load_replay_samples(const std::string& file_name, std::vector<LogRecord>& out)
+{
+    replay_format format = detect_replay_format(file_name);
+    size_t first = out.size();
+    if (format == REPLAY_STORE)
+        GorillaStore::read_all(file_name, out);
+    else if (format == REPLAY_CAPTURE)
+    {
+        LogFile capture(file_name);
+        std::vector<LogRecord> averages;
+        size_t record_size = static_cast<__u8>(capture.data()[2]) + (static_cast<__u8>(capture.data()[3]) << 8); // older captures lack period_s
+        for (size_t offset = 0; offset + 4 + record_size <= capture.size(); offset += 4 + record_size)
+        {
+            LogRecord record;
+            read_record(capture.data() + offset + 4, record_size, record);
+            (capture.data()[offset] == FRAME_RAW ? out : averages).push_back(record);
+        }
+        if (out.size() == first)
+            out.insert(out.end(), averages.begin(), averages.end());
+    }
+    else
+    {
+        LogFile log(file_name);
+        LogRecord record;
+        for (size_t begin = 0; begin < log.size();)
+        {
+            size_t end = log.line_start(begin + 1);
+            if (log.parse_line(begin, end, record))
+                out.push_back(record);
+            begin = end;
+        }
+    }
+
+    size_t kept = first;
+    for (size_t i = first; i < out.size(); i++)
+        if (kept == first || out[i].time_ns > out[kept - 1].time_ns)
+            out[kept++] = out[i];
+    out.resize(kept);
+    return format;
+}
+
+#endif // _REPLAY_SOURCE_
@@ -0,0 +1,66 @@
+#ifndef _RING_QUEUE_
+#define _RING_QUEUE_
+
+#include <vector>
+#include <cstddef>
+
+// FIFO on a ring allocated up front, for the queues the sampling loop feeds: a std::deque allocates and
+// frees a chunk every few elements as they go through. The ring only grows (doubling) when pushed full.
+// No locking, the owner guards it.
+template <typename T>
+class RingQueue
+{
+public:
+    RingQueue(size_t capacity) : _items(capacity > 0 ? capacity : 1) {}
+
+    void push_back(const T& item)
+    {
+        if (_count == _items.size())
+        {
+            std::vector<T> grown(2 * _items.size());
+            for (size_t i = 0; i < _count; i++)
+                grown[i] = (*this)[i];
+            _items.swap(grown);
+            _first = 0;
+        }
+        _items[(_first + _count) % _items.size()] = item;
+        _count++;
+    }
+
+    void pop_front()
+    {
+        _first = (_first + 1) % _items.size();
+        _count--;
+    }
+
+    void clear()
+    {
+        _first = _count = 0;
+    }
+
+    const T& operator[](size_t i) const
+    {
+        return _items[(_first + i) % _items.size()];
+    }
+
+    const T& front() const
+    {
+        return _items[_first];
+    }
+
+    size_t size() const
+    {
+        return _count;
+    }
+
+    bool empty() const
+    {
+        return _count == 0;
+    }
+
+private:
+    std::vector<T> _items;
+    size_t _first = 0, _count = 0;
+};
+
+#endif // _RING_QUEUE_
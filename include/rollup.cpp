@@ -0,0 +1,96 @@
+#ifndef _ROLLUP_
+#define _ROLLUP_
+
+#include <vector>
+#include <cfloat>
+#include "log_record.cpp"
+
+// Aggregate of the records that fall in [start_ns, start_ns + step), per channel.
+// Missing (nan) values are left out of the channel statistics.
+struct Rollup
+{
+    __s64 start_ns;
+    __u32 records;
+    __u32 count[LOG_CHANNELS];
+    float min[LOG_CHANNELS], max[LOG_CHANNELS];
+    double sum[LOG_CHANNELS], sum_squares[LOG_CHANNELS];
+
+    void reset(__s64 start)
+    {
+        start_ns = start;
+        records = 0;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            count[ch] = 0;
+            min[ch] = FLT_MAX;
+            max[ch] = -FLT_MAX;
+            sum[ch] = sum_squares[ch] = 0.0;
+        }
+    }
+
+    void add(const LogRecord& record)
+    {
+        records++;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            float value = record.values[ch];
+            if (is_missing(value))
+                continue;
+            count[ch]++;
+            min[ch] = value < min[ch] ? value : min[ch];
+            max[ch] = value > max[ch] ? value : max[ch];
+            sum[ch] += value;
+            sum_squares[ch] += static_cast<double>(value) * value;
+        }
+    }
+
+    void merge(const Rollup& other)
+    {
+        records += other.records;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            count[ch] += other.count[ch];
+            min[ch] = other.min[ch] < min[ch] ? other.min[ch] : min[ch];
+            max[ch] = other.max[ch] > max[ch] ? other.max[ch] : max[ch];
+            sum[ch] += other.sum[ch];
+            sum_squares[ch] += other.sum_squares[ch];
+        }
+    }
+
+    double mean(__u8 ch) const
+    {
+        return count[ch] == 0 ? NAN : sum[ch] / count[ch];
+    }
+
+    double stddev(__u8 ch) const
+    {
+        if (count[ch] == 0)
+            return NAN;
+        double m = sum[ch] / count[ch];
+        double variance = sum_squares[ch] / count[ch] - m * m;
+        return variance > 0.0 ? sqrt(variance) : 0.0;
+    }
+};
+
+// groups time ordered records into step_ns wide buckets aligned to the epoch, empty buckets are skipped
+static void compute_rollups(const std::vector<LogRecord>& records, __s64 step_ns, std::vector<Rollup>& out)
+{
+    Rollup rollup;
+    bool open = false;
+    for (const LogRecord& record : records)
+    {
+        __s64 start = record.time_ns - ((record.time_ns % step_ns) + step_ns) % step_ns;
+        if (!open || start != rollup.start_ns)
+        {
+            if (open)
+                out.push_back(rollup);
+            rollup.reset(start);
+            open = true;
+        }
+        rollup.add(record);
+    }
+    if (open)
+        out.push_back(rollup);
+}
+
+#endif // _ROLLUP_
@@ -0,0 +1,85 @@
+#ifndef _SAMPLE_HISTORY_
+#define _SAMPLE_HISTORY_
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "log_record.cpp"
+#include "adaptive_sampler.cpp"
+
+#define HISTORY_CAPACITY static_cast<size_t>(14 * 86400 / ADAPTIVE_RECORD_MIN_S) // two weeks of records at the default shortest period, 80640
+
+// Ring of the most recent records, shared between the sampling loop and the query threads.
+// The lock is only held to copy records in or out, so the sampling loop never waits on a query.
+class SampleHistory
+{
+public:
+    SampleHistory(size_t capacity = HISTORY_CAPACITY) : _records(capacity) {}
+
+    void push(const LogRecord& record)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _records[(_first + _count) % _records.size()] = record;
+        if (_count < _records.size())
+            _count++;
+        else
+            _first = (_first + 1) % _records.size();
+    }
+
+    bool latest(LogRecord& record)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_count == 0)
+            return false;
+        record = at(_count - 1);
+        return true;
+    }
+
+    // time of the oldest record held, or INT64_MAX when empty
+    __s64 oldest_time_ns()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _count == 0 ? INT64_MAX : at(0).time_ns;
+    }
+
+    // appends the records with from_ns <= time_ns < to_ns to out
+    void copy_range(__s64 from_ns, __s64 to_ns, std::vector<LogRecord>& out)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        size_t begin = lower_bound(from_ns), end = lower_bound(to_ns);
+        for (size_t i = begin; i < end; i++)
+            out.push_back(at(i));
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _count;
+    }
+
+private:
+    inline const LogRecord& at(size_t i) const
+    {
+        return _records[(_first + i) % _records.size()];
+    }
+
+    size_t lower_bound(__s64 time_ns) const
+    {
+        size_t lo = 0, hi = _count;
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (at(mid).time_ns < time_ns)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    std::vector<LogRecord> _records;
+    size_t _first = 0, _count = 0;
+    std::mutex _mutex;
+};
+
+#endif // _SAMPLE_HISTORY_
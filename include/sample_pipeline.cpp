@@ -0,0 +1,196 @@
+#ifndef _SAMPLE_PIPELINE_
+#define _SAMPLE_PIPELINE_
+
+// Everything that happens to a sample once it is taken: averaging into records, the log file, the
+// compressed store, the display views and the sinks. The sensors (start_measuring() in main.cpp) and the
+// replay of recorded data (replay_measuring()) both drive it, the times are passed in by the caller, so
+// a replay runs the same code on its virtual clock.
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstring>
+#include <cmath>
+#include "log_record.cpp"
+#include "dumper.cpp"
+#include "journal.cpp"
+#include "gorilla.cpp"
+#include "sample_history.cpp"
+#include "shared_samples.cpp"
+#include "sample_stream.cpp"
+#include "metrics.cpp"
+#include "derived_metrics.cpp"
+#include "display_views.cpp"
+#include "adaptive_sampler.cpp"
+#include "alert_engine.cpp"
+#include "push_client.cpp"
+
+// where the samples and the records go besides the log file, any of them may be left out
+struct PipelineSinks
+{
+    SampleHistory* history = nullptr;
+    SharedSamplesWriter* shared_samples = nullptr;
+    SampleStream* stream = nullptr;
+    AlertEngine* alerts = nullptr;
+    PushClient* push = nullptr;
+    DisplayViews* display_views = nullptr;   // rendered on every sample...
+    std::function<void()> flush_display;     // ...then flushed by this
+};
+
+struct PipelineOptions
+{
+    std::string log_file_name;
+    std::string store_file_name; // empty for no compressed store
+    sync_mode sync = SYNC_ALWAYS;
+    timestamp_format format = TIMESTAMP_CTIME;
+    float altitude_m = 0.0f;
+    RateBounds sample_period = {ADAPTIVE_SAMPLE_MIN_S, ADAPTIVE_SAMPLE_MAX_S};
+    RateBounds record_period = {ADAPTIVE_RECORD_MIN_S, ADAPTIVE_RECORD_MAX_S};
+    bool log_to_console = false;
+    DumperHandoff* log_handoff = nullptr; // the compactor's, when it trims the log file
+};
+
+class SamplePipeline
+{
+public:
+    SamplePipeline(const PipelineOptions& options, const PipelineSinks& sinks)
+        : _options(options), _sinks(sinks), _dumper(options.log_file_name, options.log_handoff), _log_sync(options.sync), _formatter(options.format),
+          _sampler(options.sample_period, options.record_period)
+    {
+        // optional compressed copy of the log, see include/gorilla.cpp
+        if (!options.store_file_name.empty())
+            _store = std::make_unique<GorillaStore>(options.store_file_name, GORILLA_BLOCK_RECORDS, SyncPolicy(options.sync));
+    }
+
+    // starts averaging a new record at now_ns (monotonic or virtual)
+    void begin_record(__u64 now_ns)
+    {
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            _sums[ch] = 0.0f;
+            _counts[ch] = 0;
+        }
+        _ret_code_sum = 0;
+        _record_start_ns = now_ns;
+    }
+
+    // a sample taken at now_ns, its time_ns and ret_code set by the caller; returns the period until the next one
+    __u64 add_sample(const LogRecord& sample, __u64 now_ns)
+    {
+        // channels of a device that is down are left out of the average, all missing makes the record nan
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            if (is_missing(sample.values[ch]))
+                continue;
+            _sums[ch] += sample.values[ch];
+            _counts[ch]++;
+        }
+        _ret_code_sum += sample.ret_code;
+        metrics.samples.add();
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            metrics.sensor[ch].set(sample.values[ch]);
+        metrics.last_sample_time.set(sample.time_ns / 1e9);
+        _sampler.observe(sample, now_ns);
+        metrics.sample_period.set(_sampler.sample_period_ns() / 1e9);
+        metrics.record_period.set(_sampler.record_period_ns() / 1e9);
+        metrics.activity_level.set(_sampler.level());
+        if (_sinks.shared_samples != nullptr || (_sinks.alerts != nullptr && _sinks.alerts->uses_derived()))
+            derive(sample, _options.altitude_m, _sample_derived);
+        if (_sinks.alerts != nullptr)
+        {
+            __u64 t_alerts = monotonic_ns();
+            size_t raised = _sinks.alerts->evaluate(sample, &_sample_derived, now_ns);
+            metrics.alert_eval.observe_since(t_alerts);
+            if (raised > 0)
+            {
+                metrics.alerts_raised.add(raised);
+                metrics.alerts_active.set(_sinks.alerts->active());
+                metrics.alerts_dropped.add(_sinks.alerts->dropped() - metrics.alerts_dropped.value());
+            }
+        }
+        if (_sinks.shared_samples != nullptr)
+            _sinks.shared_samples->publish_latest(sample, &_sample_derived);
+        if (_sinks.stream != nullptr)
+            _sinks.stream->publish(FRAME_RAW, sample);
+        if (_sinks.display_views != nullptr)
+        {
+            __u64 t_display = monotonic_ns();
+            _sinks.display_views->add_record(sample); // quiet records are longer than a sparkline column
+            _sinks.display_views->render(sample, now_ns);
+            if (_sinks.flush_display)
+                _sinks.flush_display();
+            metrics.display_flush.observe_since(t_display);
+        }
+        return _sampler.sample_period_ns();
+    }
+
+    // whether the record begun at begin_record() is as long as the sampler wants it at now_ns
+    bool record_due(__u64 now_ns) const
+    {
+        return now_ns - _record_start_ns >= _sampler.record_period_ns();
+    }
+
+    // averages the record, stamped time_ns, closed at now_ns, and hands it to the log, the store and the sinks
+    const LogRecord& finish_record(__s64 time_ns, __u64 now_ns)
+    {
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            _record.values[ch] = _counts[ch] > 0 ? _sums[ch] / _counts[ch] : NAN;
+        _record.time_ns = time_ns;
+        _record.ret_code = _ret_code_sum;
+        _record.period_s = roundf((now_ns - _record_start_ns) / 1e8f) / 10.0f;
+        derive(_record, _options.altitude_m, _derived);
+        memcpy(_extra, _derived.values, sizeof(_derived.values));
+        _extra[DERIVED_CHANNELS] = _record.period_s;
+        std::string_view info = _formatter.format(_record, _extra, DERIVED_CHANNELS + 1);
+        if (_options.log_to_console)
+            std::cout << info << std::endl;
+
+        __u64 t_write = monotonic_ns();
+        _dumper.dump(info);
+        metrics.log_write.observe_since(t_write);
+        __u64 t_sync = monotonic_ns();
+        if (_log_sync.wrote(t_sync))
+        {
+            _dumper.sync();
+            _log_sync.synced();
+            metrics.log_fsync.observe_since(t_sync);
+        }
+        metrics.records.add();
+        if (_store)
+            _store->append(_record);
+        if (_sinks.history != nullptr)
+            _sinks.history->push(_record);
+        if (_sinks.shared_samples != nullptr)
+            _sinks.shared_samples->push(_record, &_derived);
+        if (_sinks.stream != nullptr)
+            _sinks.stream->publish(FRAME_AVERAGE, _record);
+        if (_sinks.push != nullptr)
+            _sinks.push->push(_record);
+        return _record;
+    }
+
+    // whether the channel had a value in the last record
+    bool has_value(__u8 ch) const
+    {
+        return _counts[ch] > 0;
+    }
+
+private:
+    PipelineOptions _options;
+    PipelineSinks _sinks;
+    Dumper _dumper;
+    SyncPolicy _log_sync;
+    RecordFormatter _formatter;
+    AdaptiveSampler _sampler; // how often to sample and to log, from the activity of the signal
+    std::unique_ptr<GorillaStore> _store;
+    float _sums[LOG_CHANNELS] = {};
+    __u16 _counts[LOG_CHANNELS] = {};
+    int _ret_code_sum = 0;
+    __u64 _record_start_ns = 0;
+    LogRecord _record;
+    DerivedRecord _derived, _sample_derived;
+    float _extra[DERIVED_CHANNELS + 1]; // the derived channels and the seconds the record averages over
+};
+
+#endif // _SAMPLE_PIPELINE_
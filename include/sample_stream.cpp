@@ -0,0 +1,342 @@
+#ifndef _SAMPLE_STREAM_
+#define _SAMPLE_STREAM_
+
+// Live stream of samples over a Unix domain socket. Every subscriber gets a copy of each frame:
+//   u8 type (1 raw sample, 2 window average), u8 channels, u16 record size, then the record
+//   (s64 time_ns, float values[channels], s32 ret_code, float period_s, u32 reserved), little endian,
+//   52 bytes in total; captures from before period_s have 40 byte records.
+// A subscriber may send one byte with a mask of the frame types it wants (bit 0 raw, bit 1 average).
+//
+// publish() only copies the frame into a bounded queue per subscriber, the sockets are written by
+// the stream thread. A subscriber whose queue fills up is evicted, it can never hold up the publisher.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "log_record.cpp"
+
+#define STREAM_SOCKET_PATH "/tmp/temperature_logger.sock"
+#define STREAM_QUEUE_FRAMES 256 // two minutes of raw samples at 0.5 s, the shortest default period
+#define STREAM_MAX_EVENTS 64
+#define STREAM_FRAME_SIZE (4 + sizeof(LogRecord))
+
+enum frame_type
+{
+    FRAME_RAW = 1,
+    FRAME_AVERAGE = 2
+};
+
+class SampleStream
+{
+public:
+    SampleStream(std::string path = STREAM_SOCKET_PATH, size_t queue_frames = STREAM_QUEUE_FRAMES) : _path(path), _queue_frames(queue_frames)
+    {
+        sockaddr_un addr = {};
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("Stream: socket path too long: " + path);
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        _listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_listener < 0)
+            throw std::runtime_error("Stream: cannot create socket.");
+        unlink(path.c_str()); // left over from a previous run
+        if (bind(_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(_listener, 64) < 0)
+        {
+            close(_listener);
+            throw std::runtime_error("Stream: cannot listen on " + path);
+        }
+        chmod(path.c_str(), 0666); // the logger runs as root, subscribers usually do not
+
+        _epoll = epoll_create1(EPOLL_CLOEXEC);
+        _wake_up = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        watch(_listener, EPOLLIN, EPOLL_CTL_ADD);
+        watch(_wake_up, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    ~SampleStream()
+    {
+        stop();
+        for (auto& subscriber : _subscribers)
+            close(subscriber.first);
+        close(_wake_up);
+        close(_epoll);
+        close(_listener);
+        unlink(_path.c_str());
+    }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _thread = std::thread(&SampleStream::run, this);
+    }
+
+    void stop()
+    {
+        if (!_running)
+            return;
+        _running = false;
+        wake_up();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    // queues the record for every subscriber that wants this type, never blocks on a socket
+    void publish(frame_type type, const LogRecord& record)
+    {
+        __u8 frame[STREAM_FRAME_SIZE];
+        frame[0] = type;
+        frame[1] = LOG_CHANNELS;
+        frame[2] = sizeof(LogRecord) & 0xFF;
+        frame[3] = sizeof(LogRecord) >> 8;
+        memcpy(frame + 4, &record, sizeof(LogRecord));
+
+        bool queued = false;
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            for (auto& entry : _subscribers)
+            {
+                Queue& queue = entry.second->queue;
+                if (queue.evicted || !(queue.mask & (1 << (type - 1))))
+                    continue;
+                if (queue.count == _queue_frames)
+                {
+                    queue.evicted = true;
+                    _evictions++;
+                    queued = true; // the stream thread closes it
+                    continue;
+                }
+                memcpy(&queue.frames[((queue.first + queue.count) % _queue_frames) * STREAM_FRAME_SIZE], frame, STREAM_FRAME_SIZE);
+                queue.count++;
+                queued = true;
+            }
+            _published++;
+        }
+        if (queued)
+            wake_up();
+    }
+
+    size_t subscribers()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _subscribers.size();
+    }
+
+    __u64 published()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _published;
+    }
+
+    __u64 evictions()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _evictions;
+    }
+
+private:
+    // shared between publish() and the stream thread, under _mutex
+    struct Queue
+    {
+        std::vector<__u8> frames;
+        size_t first = 0, count = 0;
+        __u8 mask = 0xFF;
+        bool evicted = false;
+    };
+
+    // everything else only touched by the stream thread
+    struct Subscriber
+    {
+        Queue queue;
+        std::vector<__u8> out;
+        size_t out_offset = 0;
+        bool watching_out = false;
+    };
+
+    void wake_up()
+    {
+        __u64 one = 1;
+        if (write(_wake_up, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            std::cerr << "Stream: cannot wake up the stream thread.\n";
+    }
+
+    void watch(int fd, __u32 events, int operation)
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(_epoll, operation, fd, &event);
+    }
+
+    void run()
+    {
+        epoll_event events[STREAM_MAX_EVENTS];
+        while (_running)
+        {
+            int n = epoll_wait(_epoll, events, STREAM_MAX_EVENTS, -1);
+            for (int i = 0; i < n; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == _wake_up)
+                {
+                    __u64 count;
+                    if (read(_wake_up, &count, sizeof(count)) < 0)
+                        continue;
+                    flush_all();
+                }
+                else if (fd == _listener)
+                    accept_all();
+                else if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    drop(fd);
+                else
+                {
+                    if ((events[i].events & EPOLLIN) && !receive(fd))
+                        continue;
+                    if (events[i].events & EPOLLOUT)
+                        flush(fd);
+                }
+            }
+        }
+    }
+
+    void accept_all()
+    {
+        while (true)
+        {
+            int fd = accept4(_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;
+            auto subscriber = std::make_unique<Subscriber>();
+            subscriber->queue.frames.resize(_queue_frames * STREAM_FRAME_SIZE);
+            {
+                std::lock_guard<std::mutex> guard(_mutex);
+                _subscribers[fd] = std::move(subscriber);
+            }
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    void drop(int fd)
+    {
+        epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        std::lock_guard<std::mutex> guard(_mutex);
+        _subscribers.erase(fd);
+    }
+
+    // a subscriber only ever sends its type mask, false if it hung up
+    bool receive(int fd)
+    {
+        __u8 buffer[64];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            drop(fd);
+            return false;
+        }
+        if (n > 0)
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _subscribers[fd]->queue.mask = buffer[n - 1];
+        }
+        return true;
+    }
+
+    void flush_all()
+    {
+        _ready.clear();
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            for (auto& entry : _subscribers)
+                _ready.push_back(entry.first);
+        }
+        for (int fd : _ready)
+            flush(fd);
+    }
+
+    // moves the queued frames into the socket until both are drained or the socket is full; a subscriber
+    // is only refilled once its previous batch is fully sent, so a slow one backs up into its queue and gets evicted
+    void flush(int fd)
+    {
+        while (true)
+        {
+            Subscriber* subscriber;
+            {
+                std::lock_guard<std::mutex> guard(_mutex);
+                auto it = _subscribers.find(fd);
+                if (it == _subscribers.end())
+                    return;
+                subscriber = it->second.get();
+                Queue& queue = subscriber->queue;
+                if (queue.evicted)
+                    subscriber = nullptr;
+                else if (subscriber->out_offset == subscriber->out.size())
+                {
+                    if (queue.count == 0)
+                        break;
+                    subscriber->out.clear();
+                    subscriber->out_offset = 0;
+                    size_t first_run = std::min(queue.count, _queue_frames - queue.first);
+                    const __u8* frames = queue.frames.data();
+                    subscriber->out.insert(subscriber->out.end(), frames + queue.first * STREAM_FRAME_SIZE, frames + (queue.first + first_run) * STREAM_FRAME_SIZE);
+                    subscriber->out.insert(subscriber->out.end(), frames, frames + (queue.count - first_run) * STREAM_FRAME_SIZE);
+                    queue.first = (queue.first + queue.count) % _queue_frames;
+                    queue.count = 0;
+                }
+            }
+            if (subscriber == nullptr)
+            {
+                drop(fd);
+                return;
+            }
+
+            while (subscriber->out_offset < subscriber->out.size())
+            {
+                ssize_t n = send(fd, subscriber->out.data() + subscriber->out_offset, subscriber->out.size() - subscriber->out_offset, MSG_NOSIGNAL);
+                if (n < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        if (!subscriber->watching_out)
+                            watch(fd, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+                        subscriber->watching_out = true;
+                        return;
+                    }
+                    drop(fd);
+                    return;
+                }
+                subscriber->out_offset += n;
+            }
+            if (subscriber->watching_out)
+                watch(fd, EPOLLIN, EPOLL_CTL_MOD);
+            subscriber->watching_out = false;
+        }
+    }
+
+    std::string _path;
+    size_t _queue_frames;
+    int _listener, _epoll, _wake_up;
+    std::unordered_map<int, std::unique_ptr<Subscriber>> _subscribers; // map under _mutex, Subscriber::queue too
+    std::vector<int> _ready;
+    __u64 _published = 0, _evictions = 0;
+    std::mutex _mutex;
+    std::thread _thread;
+    std::atomic<bool> _running{false};
+};
+
+#endif // _SAMPLE_STREAM_
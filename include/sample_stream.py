@@ -0,0 +1,50 @@
+import socket
+import struct
+import sys
+import datetime
+
+# subscriber for the logger's live stream (-stream SOCKET), see include/sample_stream.cpp
+SOCKET_PATH = "/tmp/temperature_logger.sock"
+FRAME = struct.Struct("<BBHq7fifI") # type, channels, record size, time_ns, 7 values, ret_code, period_s, reserved
+FRAME_RAW = 1
+FRAME_AVERAGE = 2
+
+def subscribe(path=SOCKET_PATH, types=(FRAME_RAW, FRAME_AVERAGE)):
+    # yields (type, time, values, ret_code, period_s) until the logger goes away, period_s is 0 for raw samples
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(path)
+        sock.sendall(bytes([sum(1 << (t - 1) for t in types)]))
+        buffer = b""
+        while True:
+            data = sock.recv(4096)
+            if not data:
+                return
+            buffer += data
+            while len(buffer) >= FRAME.size:
+                frame_type, _, _, time_ns, *values, ret_code, period_s, _ = FRAME.unpack_from(buffer)
+                buffer = buffer[FRAME.size:]
+                yield frame_type, datetime.datetime.fromtimestamp(time_ns / 1e9), values, ret_code, period_s
+
+def capture(file_name, path=SOCKET_PATH):
+    # appends the raw frames as they come to file_name, replayable with ./logger -replay file_name
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock, open(file_name, "ab") as out:
+        sock.connect(path)
+        sock.sendall(bytes([1 << (FRAME_RAW - 1)]))
+        buffer = b""
+        while True:
+            data = sock.recv(4096)
+            if not data:
+                return
+            buffer += data
+            whole = len(buffer) - len(buffer) % FRAME.size
+            out.write(buffer[:whole])
+            out.flush()
+            buffer = buffer[whole:]
+
+if __name__ == '__main__':
+    # sample_stream.py [SOCKET] prints the frames, sample_stream.py SOCKET FILE captures the raw samples
+    if len(sys.argv) > 2:
+        capture(sys.argv[2], sys.argv[1])
+    else:
+        for frame_type, time, values, ret_code, period_s in subscribe(*sys.argv[1:2]):
+            print("raw" if frame_type == FRAME_RAW else "avg", time, *(f"{v:.3f}" for v in values), ret_code, period_s, sep="\t")
@@ -0,0 +1,315 @@
+#ifndef _SHARED_SAMPLES_
+#define _SHARED_SAMPLES_
+
+// POSIX shared memory segment with the latest sample and a ring of the recent logged records,
+// so local readers (webapp.py, tools) get them without touching log.txt, syscalls or locks.
+//
+// Layout, little endian, see also include/shared_samples.py:
+//   0    u32 magic "SAMP", u16 version, u16 channels, u32 capacity, u32 slot size
+//   16   u64 records pushed to the ring so far
+//   64   latest slot: u64 sequence, record, derived
+//   192  ring of capacity slots: u64 sequence, record, derived
+// A record is s64 time_ns, float values[channels], s32 ret_code (40 bytes), followed by the
+// DERIVED_CHANNELS floats of include/derived_metrics.cpp (32 bytes).
+//
+// Every slot is a seqlock: the sequence is odd while the writer is inside it. Ring slots also
+// encode which record they hold (2 * index + 2 once written), so a reader can tell a slot that
+// was overwritten while it was being copied from the one it asked for.
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log_record.cpp"
+#include "derived_metrics.cpp"
+#include "adaptive_sampler.cpp"
+
+#define SHARED_SAMPLES_MAGIC 0x504D4153 // "SAMP"
+#define SHARED_SAMPLES_VERSION 3
+#define SHARED_SAMPLES_NAME "/temperature_logger"
+#define SHARED_SAMPLES_CAPACITY static_cast<__u32>(14 * 86400 / ADAPTIVE_RECORD_MIN_S) // two weeks of records at the default shortest period, about 7 MB
+#define SHARED_SAMPLES_RECORD_WORDS (sizeof(LogRecord) / 8)
+#define SHARED_SAMPLES_WORDS ((sizeof(LogRecord) + sizeof(DerivedRecord)) / 8)
+#define SHARED_SAMPLES_MAX_SPINS 1000000 // a slot mid-write for longer has lost its writer
+
+static_assert(sizeof(LogRecord) == 48 && sizeof(DerivedRecord) == 32, "LogRecord and DerivedRecord layouts are part of the shared memory format");
+
+struct SharedSlot
+{
+    std::atomic<__u64> sequence;
+    std::atomic<__u64> words[SHARED_SAMPLES_WORDS]; // record and derived, copied word by word so readers never race on plain memory
+};
+
+struct SharedSamplesHeader
+{
+    __u32 magic;
+    __u16 version;
+    __u16 channels;
+    __u32 capacity;
+    __u32 slot_size;
+    std::atomic<__u64> written;
+    __u8 reserved[40];
+    SharedSlot latest;
+    __u8 reserved_latest[128 - sizeof(SharedSlot)];
+};
+
+static_assert(sizeof(SharedSlot) == 88 && sizeof(SharedSamplesHeader) == 192, "shared memory layout changed");
+static_assert(std::atomic<__u64>::is_always_lock_free, "seqlock needs lock free 64 bit atomics");
+
+// without derived values the derived channels are published as nan
+static inline void store_record(SharedSlot& slot, const LogRecord& record, const DerivedRecord* derived)
+{
+    __u64 words[SHARED_SAMPLES_WORDS];
+    memcpy(words, &record, sizeof(record));
+    if (derived != nullptr)
+        memcpy(reinterpret_cast<__u8*>(words) + sizeof(record), derived, sizeof(DerivedRecord));
+    else
+        memset(reinterpret_cast<__u8*>(words) + sizeof(record), 0xFF, sizeof(DerivedRecord));
+    for (size_t i = 0; i < SHARED_SAMPLES_WORDS; i++)
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+}
+
+static inline void load_record(const SharedSlot& slot, LogRecord& record)
+{
+    __u64 words[SHARED_SAMPLES_RECORD_WORDS];
+    for (size_t i = 0; i < SHARED_SAMPLES_RECORD_WORDS; i++)
+        words[i] = slot.words[i].load(std::memory_order_relaxed);
+    memcpy(&record, words, sizeof(record));
+}
+
+// Single writer, owned by the logger. An existing segment with the same layout is kept, so the ring
+// survives restarts of the logger; anything else is reinitialised.
+class SharedSamplesWriter
+{
+public:
+    SharedSamplesWriter(std::string name = SHARED_SAMPLES_NAME, __u32 capacity = SHARED_SAMPLES_CAPACITY) : _name(name), _capacity(capacity)
+    {
+        _size = sizeof(SharedSamplesHeader) + static_cast<size_t>(capacity) * sizeof(SharedSlot);
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Shared memory: cannot open " + name);
+        struct stat info;
+        fstat(fd, &info);
+        bool fresh = static_cast<size_t>(info.st_size) != _size;
+        if (fresh && ftruncate(fd, _size) < 0)
+        {
+            close(fd);
+            throw std::runtime_error("Shared memory: cannot resize " + name);
+        }
+        void* data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Shared memory: cannot map " + name);
+        _header = static_cast<SharedSamplesHeader*>(data);
+        _slots = reinterpret_cast<SharedSlot*>(_header + 1);
+
+        if (fresh || _header->magic != SHARED_SAMPLES_MAGIC || _header->version != SHARED_SAMPLES_VERSION || _header->channels != LOG_CHANNELS ||
+            _header->capacity != capacity || _header->slot_size != sizeof(SharedSlot))
+        {
+            memset(data, 0, _size);
+            _header->version = SHARED_SAMPLES_VERSION;
+            _header->channels = LOG_CHANNELS;
+            _header->capacity = capacity;
+            _header->slot_size = sizeof(SharedSlot);
+            std::atomic_thread_fence(std::memory_order_release);
+            _header->magic = SHARED_SAMPLES_MAGIC;
+        }
+        else
+        {
+            // a logger killed inside publish_latest() left the sequence odd, readers would wait on it forever
+            __u64 sequence = _header->latest.sequence.load(std::memory_order_relaxed);
+            _header->latest.sequence.store((sequence + 1) & ~1ULL, std::memory_order_release);
+        }
+        _written = _header->written.load(std::memory_order_relaxed);
+    }
+
+    ~SharedSamplesWriter()
+    {
+        munmap(_header, _size);
+    }
+
+    SharedSamplesWriter(const SharedSamplesWriter&) = delete;
+    SharedSamplesWriter& operator=(const SharedSamplesWriter&) = delete;
+
+    // newest raw sample, overwritten on every call
+    void publish_latest(const LogRecord& record, const DerivedRecord* derived = nullptr)
+    {
+        write_slot(_header->latest, (_header->latest.sequence.load(std::memory_order_relaxed) & ~1ULL) + 2, record, derived);
+    }
+
+    // appends an aggregated record to the ring, overwriting the oldest once full
+    void push(const LogRecord& record, const DerivedRecord* derived = nullptr)
+    {
+        write_slot(_slots[_written % _capacity], 2 * _written + 2, record, derived);
+        _written++;
+        _header->written.store(_written, std::memory_order_release);
+    }
+
+    // removes the segment name, mapped readers keep their view
+    void unlink()
+    {
+        shm_unlink(_name.c_str());
+    }
+
+private:
+    static inline void write_slot(SharedSlot& slot, __u64 sequence, const LogRecord& record, const DerivedRecord* derived)
+    {
+        slot.sequence.store(sequence - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        store_record(slot, record, derived);
+        slot.sequence.store(sequence, std::memory_order_release);
+    }
+
+    std::string _name;
+    __u32 _capacity;
+    size_t _size;
+    SharedSamplesHeader* _header;
+    SharedSlot* _slots;
+    __u64 _written;
+};
+
+// Read-only view of the segment, any number of readers in any process.
+class SharedSamplesReader
+{
+public:
+    SharedSamplesReader(std::string name = SHARED_SAMPLES_NAME)
+    {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            throw std::runtime_error("Shared memory: " + name + " does not exist, is the logger running?");
+        struct stat info;
+        fstat(fd, &info);
+        _size = info.st_size;
+        void* data = _size >= sizeof(SharedSamplesHeader) ? mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Shared memory: cannot map " + name);
+        _header = static_cast<const SharedSamplesHeader*>(data);
+        _slots = reinterpret_cast<const SharedSlot*>(_header + 1);
+        if (_header->magic != SHARED_SAMPLES_MAGIC || _header->version != SHARED_SAMPLES_VERSION || _header->channels != LOG_CHANNELS ||
+            _header->slot_size != sizeof(SharedSlot) || _size < sizeof(SharedSamplesHeader) + static_cast<size_t>(_header->capacity) * sizeof(SharedSlot))
+        {
+            munmap(data, _size);
+            throw std::runtime_error("Shared memory: " + name + " has an unknown layout");
+        }
+        _capacity = _header->capacity;
+    }
+
+    ~SharedSamplesReader()
+    {
+        munmap(const_cast<SharedSamplesHeader*>(_header), _size);
+    }
+
+    SharedSamplesReader(const SharedSamplesReader&) = delete;
+    SharedSamplesReader& operator=(const SharedSamplesReader&) = delete;
+
+    // false until the logger published its first sample, or while the slot stays mid-write
+    bool latest(LogRecord& record)
+    {
+        for (size_t spins = 0;; spins++)
+        {
+            __u64 before = _header->latest.sequence.load(std::memory_order_acquire);
+            if (before == 0 || spins == SHARED_SAMPLES_MAX_SPINS)
+                return false;
+            if (before & 1)
+            {
+                _retries++;
+                continue;
+            }
+            load_record(_header->latest, record);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_header->latest.sequence.load(std::memory_order_relaxed) == before)
+                return true;
+            _retries++;
+        }
+    }
+
+    // appends the ring records stamped at or after from_ns, oldest first, and returns how many
+    size_t copy_since(__s64 from_ns, std::vector<LogRecord>& out)
+    {
+        __u64 written = _header->written.load(std::memory_order_acquire);
+        __u64 first = written > _capacity ? written - _capacity : 0;
+
+        // the ring is in time order, find the first record at or after from_ns
+        __u64 lo = first, hi = written;
+        LogRecord record;
+        while (lo < hi)
+        {
+            __u64 mid = lo + (hi - lo) / 2;
+            if (!read_slot(mid, record))
+            {
+                lo = mid + 1; // overwritten meanwhile, so older than anything still in the ring
+                continue;
+            }
+            if (record.time_ns < from_ns)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        size_t count = 0;
+        for (__u64 index = lo; index < written; index++)
+        {
+            if (read_slot(index, record))
+            {
+                out.push_back(record);
+                count++;
+            }
+        }
+        return count;
+    }
+
+    __u64 written() const
+    {
+        return _header->written.load(std::memory_order_acquire);
+    }
+
+    __u32 capacity() const
+    {
+        return _capacity;
+    }
+
+    // seqlock retries so far, a measure of writer contention
+    __u64 retries() const
+    {
+        return _retries;
+    }
+
+private:
+    // copies ring record number index, false if the writer has already reused its slot
+    bool read_slot(__u64 index, LogRecord& record)
+    {
+        const SharedSlot& slot = _slots[index % _capacity];
+        __u64 expected = 2 * index + 2;
+        for (size_t spins = 0;; spins++)
+        {
+            __u64 before = slot.sequence.load(std::memory_order_acquire);
+            if (before > expected || spins == SHARED_SAMPLES_MAX_SPINS)
+                return false;
+            if (before != expected)
+            {
+                if (before + 1 != expected)
+                    return false;
+                _retries++; // being written right now
+                continue;
+            }
+            load_record(slot, record);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == expected)
+                return true;
+            _retries++;
+        }
+    }
+
+    const SharedSamplesHeader* _header;
+    const SharedSlot* _slots;
+    size_t _size;
+    __u32 _capacity;
+    __u64 _retries = 0;
+};
+
+#endif // _SHARED_SAMPLES_
@@ -0,0 +1,74 @@
+import mmap
+import struct
+import datetime
+
+# reader for the shared memory segment published by the logger, see include/shared_samples.cpp
+SHM_PATH = "/dev/shm/temperature_logger"
+MAGIC = 0x504D4153
+VERSION = 3
+HEADER = struct.Struct("<IHHII Q")
+SEQUENCE = struct.Struct("<Q")
+# time_ns, T, H, P, T_analog, T_ext, H_ext, P_ext, ret_code, period_s, reserved, then the derived channels of
+# include/derived_metrics.cpp: q, dew point, absolute humidity and sea level pressure, each interior and exterior
+RECORD = struct.Struct("<q7fifI8f")
+PERIOD = 9
+Q_INTERIOR = 11
+Q_EXTERIOR = 12
+LATEST_OFFSET = 64
+RING_OFFSET = 192
+MAX_SPINS = 10000 # a slot mid-write for longer has lost its writer
+
+class SharedSamples:
+    def __init__(self, path=SHM_PATH):
+        with open(path, "rb") as shm_file:
+            self.map = mmap.mmap(shm_file.fileno(), 0, prot=mmap.PROT_READ)
+        magic, version, channels, self.capacity, self.slot_size, _ = HEADER.unpack_from(self.map, 0)
+        if magic != MAGIC or version != VERSION or channels != 7:
+            self.map.close()
+            raise ValueError(f"{path} has an unknown layout")
+
+    def close(self):
+        self.map.close()
+
+    def written(self):
+        return HEADER.unpack_from(self.map, 0)[5]
+
+    def _read_slot(self, offset, expected=None):
+        # seqlock: retry while the writer is inside the slot, None if the slot holds another record or stays mid-write
+        for _ in range(MAX_SPINS):
+            before = SEQUENCE.unpack_from(self.map, offset)[0]
+            if expected is not None and before != expected:
+                if before + 1 != expected:
+                    return None
+                continue
+            if before == 0:
+                return None
+            if before & 1:
+                continue
+            record = RECORD.unpack_from(self.map, offset + 8)
+            if SEQUENCE.unpack_from(self.map, offset)[0] == before:
+                return record
+        return None
+
+    def latest(self):
+        # (time_ns, T_interior, H_interior, P_interior, T_analog, T_exterior, H_exterior, P_exterior, ret_code, period_s, reserved, derived...) or None
+        return self._read_slot(LATEST_OFFSET)
+
+    def records_since(self, from_time_ns):
+        # ring records stamped at or after from_time_ns, newest first like logs_to_list
+        written = self.written()
+        records = []
+        for index in range(written - 1, max(written - self.capacity, 0) - 1, -1):
+            record = self._read_slot(RING_OFFSET + (index % self.capacity) * self.slot_size, 2 * index + 2)
+            if record is None or record[0] < from_time_ns:
+                break
+            records.append(record)
+        return records
+
+    def oldest_time(self):
+        written = self.written()
+        if written == 0:
+            return None
+        index = max(written - self.capacity, 0)
+        record = self._read_slot(RING_OFFSET + (index % self.capacity) * self.slot_size, 2 * index + 2)
+        return None if record is None else datetime.datetime.fromtimestamp(record[0] / 1e9)
@@ -0,0 +1,143 @@
+#ifndef _SPARKLINE_
+#define _SPARKLINE_
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include "framebuffer.cpp"
+
+// Trend of one channel over the last hours, one framebuffer column per time slot of hours / width.
+// Each column keeps the min and max of its slot and is drawn as a vertical bar joined to its
+// neighbour, so short spikes stay visible. The vertical scale is snapped to round steps and only
+// changes when the data leaves it; while it holds, a finished slot scrolls the plot by one column
+// and only the newest columns are drawn.
+class Sparkline
+{
+public:
+    // plot rectangle of the framebuffer, page aligned: y and height multiples of 8
+    Sparkline(__u8 x, __u8 y, __u8 width, __u8 height, float hours)
+        : _x(x), _y(y), _width(width), _height(height), _slot_ns(static_cast<__s64>(hours * 3600e9 / width)), _min(width, NAN), _max(width, NAN) {}
+
+    // adds a value, slots skipped since the previous one stay empty
+    void add(__s64 time_ns, float value)
+    {
+        __s64 slot = time_ns / _slot_ns;
+        if (_newest_slot == INT64_MIN)
+            _newest_slot = slot;
+        if (slot < _newest_slot)
+            return; // late, its column is gone or drawn
+        for (; _newest_slot < slot; _newest_slot++)
+        {
+            _head = (_head + 1) % _width;
+            _min[_head] = _max[_head] = NAN;
+            _shift++;
+        }
+        if (is_missing(value))
+            return;
+        _min[_head] = is_missing(_min[_head]) || value < _min[_head] ? value : _min[_head];
+        _max[_head] = is_missing(_max[_head]) || value > _max[_head] ? value : _max[_head];
+        _changed = true;
+    }
+
+    // draws the plot: scrolls and draws the newest columns when the scale holds, everything otherwise
+    void draw(Framebuffer& framebuffer, bool full = false)
+    {
+        float low, high;
+        scale(low, high);
+        full |= !_drawn || low != _low || high != _high || _shift >= _width;
+        _low = low;
+        _high = high;
+        __u8 from = 0;
+        if (full)
+            framebuffer.fill_rect(_x, _y, _width, _height, false);
+        else if (_shift > 0)
+        {
+            framebuffer.scroll_left(_x, _width, _y / 8, _height / 8, _shift);
+            from = _width - 1 - _shift; // the column before the new ones is joined to them
+        }
+        else if (_changed)
+            from = _width - 1;
+        else
+            return;
+        for (__u8 column = from; column < _width; column++)
+            draw_column(framebuffer, column);
+        _drawn = true;
+        _changed = false;
+        _shift = 0;
+    }
+
+private:
+    // min and max of the slot shown in column (0 is the oldest)
+    inline void slot(__u8 column, float& low, float& high) const
+    {
+        size_t i = (_head + 1 + column) % _width;
+        low = _min[i];
+        high = _max[i];
+    }
+
+    inline int to_y(float value) const
+    {
+        int y = _y + _height - 1 - static_cast<int>(lroundf((value - _low) / (_high - _low) * (_height - 1)));
+        return std::min(std::max(y, static_cast<int>(_y)), _y + _height - 1);
+    }
+
+    void draw_column(Framebuffer& framebuffer, __u8 column)
+    {
+        int x = _x + column;
+        framebuffer.vline(x, _y, _y + _height - 1, false);
+        float low, high, previous_low, previous_high;
+        slot(column, low, high);
+        if (is_missing(low))
+            return;
+        if (column > 0)
+        {
+            slot(column - 1, previous_low, previous_high);
+            if (!is_missing(previous_low)) // join to the previous bar
+            {
+                low = std::min(low, previous_high);
+                high = std::max(high, previous_low);
+            }
+        }
+        framebuffer.vline(x, to_y(low), to_y(high));
+    }
+
+    // range of the data snapped outwards to a 1, 2 or 5 times a power of ten step, a quarter of the range or so
+    void scale(float& low, float& high) const
+    {
+        low = FLT_MAX;
+        high = -FLT_MAX;
+        for (__u8 i = 0; i < _width; i++)
+        {
+            if (is_missing(_min[i]))
+                continue;
+            low = std::min(low, _min[i]);
+            high = std::max(high, _max[i]);
+        }
+        if (low > high)
+        {
+            low = 0.0f;
+            high = 1.0f;
+            return;
+        }
+        float quarter = std::max((high - low) / 4.0f, 1e-3f);
+        float step = powf(10.0f, floorf(log10f(quarter)));
+        float fraction = quarter / step;
+        step *= fraction > 5.0f ? 10.0f : fraction > 2.0f ? 5.0f : fraction > 1.0f ? 2.0f : 1.0f;
+        low = floorf(low / step) * step;
+        high = ceilf(high / step) * step;
+        if (high <= low)
+            high = low + step;
+    }
+
+    __u8 _x, _y, _width, _height;
+    __s64 _slot_ns;
+    std::vector<float> _min, _max; // ring of slots, _head is the newest
+    size_t _head = 0;
+    __s64 _newest_slot = INT64_MIN;
+    size_t _shift = 0;     // slots started since the last draw
+    bool _changed = false; // the newest slot changed since the last draw
+    bool _drawn = false;
+    float _low = 0.0f, _high = 0.0f;
+};
+
+#endif // _SPARKLINE_
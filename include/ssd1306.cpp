@@ -19,11 +19,13 @@ public:
     {
         _i2c_bus = i2c_bus;
         _device_address = device_address;
+        _i2c_bus->name_device(_device_address, "ssd1306");
         memset(_chars_in_line, 128 / font8x8[0], 8); // 1st time assumes all lines are full
     }
 
     void set_config()
     {
+        auto lock = _i2c_bus->lock();
         // first set device address to ensure correct communication
         _i2c_bus->set_device_address(_device_address);
         // turn on display
@@ -47,6 +49,7 @@ public:
 
     void set_cursor(__u8 x, __u8 y)
     {
+        auto lock = _i2c_bus->lock();
         // first set device address to ensure correct communication
         _i2c_bus->set_device_address(_device_address);
         write8(COMMAND_REG, 0x00 + (x & 0x0F));
@@ -58,6 +61,7 @@ public:
 
     void clear_display()
     {
+        auto lock = _i2c_bus->lock();
         // first set device address to ensure correct communication
         _i2c_bus->set_device_address(_device_address);
         //write8(COMMAND_REG, OFF_CMD);
@@ -77,13 +81,27 @@ public:
 
     void write_col(__u8 byte)
     {
+        auto lock = _i2c_bus->lock();
         // first set device address to ensure correct communication
         _i2c_bus->set_device_address(_device_address);
         write8(DATA_REG, byte);
     }
 
+    // count (up to 128) column bytes of a page from column x on, in one transfer
+    void write_columns(__u8 x, __u8 page, const __u8* data, __u8 count)
+    {
+        auto lock = _i2c_bus->lock();
+        set_cursor(x, page);
+        __u8 buffer[129]; // data register and a full page
+        buffer[0] = DATA_REG;
+        memcpy(buffer + 1, data, count);
+        write_buffer(buffer, __u16(count + 1));
+        _chars_in_line[page] = 128 / font8x8[0]; // clear_display has to clear the whole page now
+    }
+
     void turn_off_display()
     {
+        auto lock = _i2c_bus->lock();
         // first set device address to ensure correct communication
         _i2c_bus->set_device_address(_device_address);
         write8(COMMAND_REG, OFF_CMD);
@@ -91,6 +109,7 @@ public:
 
     void turn_on_display()
     {
+        auto lock = _i2c_bus->lock();
         // first set device address to ensure correct communication
         _i2c_bus->set_device_address(_device_address);
         write8(COMMAND_REG, ON_CMD);
@@ -98,6 +117,7 @@ public:
 
     void put_string(std::string str)
     {
+        auto lock = _i2c_bus->lock();
         // first set device address to ensure correct communication
         _i2c_bus->set_device_address(_device_address);
         for (char & ch : str)
@@ -106,19 +126,13 @@ public:
 
     void put_char(char ch)
     {
+        auto lock = _i2c_bus->lock();
         // first set device address to ensure correct communication
         _i2c_bus->set_device_address(_device_address);
 
-        if (ch < 32 || ch > 127) 
-            ch = ' ';
-        ch -= 32; // Font array starts at 0, ASCII starts at 32, 2 is offset
-
         __u8 buffer[1 + font8x8[0]]; // first is register and then font width
         buffer[0] = DATA_REG;
-        
-        for (__u8 i = 0; i < font8x8[0]; i++) // font8x8[0] is font width
-            buffer[i+1] = font8x8[ch * 8 + 2 + i];
-        
+        memcpy(buffer + 1, FONT_1X.columns[font_glyph(ch)][0], font8x8[0]);
         write_buffer(buffer, __u8(9));
         _chars_in_line[_current_page]++;
     }
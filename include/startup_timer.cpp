@@ -0,0 +1,48 @@
+#ifndef _STARTUP_TIMER_
+#define _STARTUP_TIMER_
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+
+class StartupTimer
+{
+public:
+    StartupTimer() : _start(std::chrono::steady_clock::now()), _last(_start) {}
+
+    // closes the current phase under the given name
+    void mark(const std::string& phase)
+    {
+        auto now = std::chrono::steady_clock::now();
+        _phases.push_back({phase, std::chrono::duration<float, std::milli>(now - _last).count()});
+        _last = now;
+    }
+
+    float total_ms() const
+    {
+        return std::chrono::duration<float, std::milli>(_last - _start).count();
+    }
+
+    void report(std::ostream& out = std::cout) const
+    {
+        out << "Startup timing:\n";
+        for (const Phase& phase : _phases)
+            out << "  " << std::left << std::setw(24) << phase.name << std::right << std::fixed << std::setprecision(1) << std::setw(9) << phase.ms << " ms\n";
+        out << "  " << std::left << std::setw(24) << "total" << std::right << std::fixed << std::setprecision(1) << std::setw(9) << total_ms() << " ms\n";
+        out << std::defaultfloat;
+    }
+
+private:
+    struct Phase
+    {
+        std::string name;
+        float ms;
+    };
+
+    std::chrono::steady_clock::time_point _start, _last;
+    std::vector<Phase> _phases;
+};
+
+#endif // _STARTUP_TIMER_
@@ -2,7 +2,8 @@
 #include <ctime>
 #include <chrono>
 #include <string.h>
-#include <sstream>
+#include <future>
+#include <climits>
 #include "include/i2c_bus.cpp"
 #include "include/ads1115.cpp"
 #include "include/bme280.cpp"
@@ -10,15 +11,61 @@
 #include "include/ssd1306.cpp"
 #include "include/pca9685.cpp"
 #include "include/laser_pointer_inverse_kinematics.cpp"
+#include "include/motion_planner.cpp"
+#include "include/startup_timer.cpp"
+#include "include/log_record.cpp"
+#include "include/gorilla.cpp"
+#include "include/sample_history.cpp"
+#include "include/query_api.cpp"
+#include "include/shared_samples.cpp"
+#include "include/sample_stream.cpp"
+#include "include/metrics.cpp"
+#include "include/device_health.cpp"
+#include "include/journal.cpp"
+#include "include/derived_metrics.cpp"
+#include "include/display_views.cpp"
+#include "include/adaptive_sampler.cpp"
+#include "include/alert_engine.cpp"
+#include "include/push_client.cpp"
+#include "include/sample_pipeline.cpp"
+#include "include/replay_source.cpp"
+#include "include/compactor.cpp"
+#include "include/alloc_counter.cpp"
+#include <memory>
 
-#define SAMPLE_TIME 60000000 // useconds
-#define AVERAGE 60 // number of samples to average over the sampling time
-#define SLEEP_TIME SAMPLE_TIME / AVERAGE
+#define RESTART_DELAY_MIN 500000 // useconds, doubled on every consecutive restart
+#define RESTART_DELAY_MAX 10000000 // useconds
+#define LOG_FILE_NAME "log.txt"
+#define REPLAY_LOG_FILE_NAME "replay_log.txt"
+#define REPLAY_GAP_NS 60000000000ULL    // a recorded sample this late is after a gap, the logger was down
+#define REPLAY_PROGRESS_NS 5000000000ULL // a progress line every 5 s of replay
 
 // options
 __u8 i2c_bus_number = 1;
 bool log_to_console = false;
 bool log_to_display = true;
+bool run_self_test = true;
+timestamp_format log_timestamp_format = TIMESTAMP_CTIME;
+std::string compressed_store_file_name = "";
+__u16 http_port = 0; // 0 disables the query endpoint
+bool publish_shared_samples = false;
+std::string stream_socket_path = "";
+std::string i2c_trace_file_name = "";
+sync_mode log_sync_mode = SYNC_ALWAYS;
+float altitude_m = 0; // of the sensors, for the sea level pressure
+float sparkline_hours = DISPLAY_SPARKLINE_HOURS;
+RateBounds sample_period = {ADAPTIVE_SAMPLE_MIN_S, ADAPTIVE_SAMPLE_MAX_S};
+RateBounds record_period = {ADAPTIVE_RECORD_MIN_S, ADAPTIVE_RECORD_MAX_S};
+std::string alert_config_file_name = "";
+std::string push_host = ""; // empty disables pushing to a collector
+__u16 push_port = PUSH_PORT;
+std::string node_id = "";   // the host name by default
+std::string replay_file_name = ""; // empty runs on the sensors
+float replay_speed = 0.0f;         // 0 replays as fast as possible
+bool alloc_check = false;          // a heap allocation in a steady sampling cycle stops the logger
+std::string archive_directory = "";  // empty disables the compaction of the log
+RetentionPolicy retention;
+DumperHandoff* log_handoff = nullptr; // of the compactor, for the Dumper of log.txt
 
 class Load_TH_To_XY_Parameters
 {
@@ -56,35 +103,107 @@ private:
     std::string _cal_filename;
 };
 
-int start_measuring()
+// appends a timestamped line to error_logs.txt
+void log_error(const std::string& message)
 {
+    Dumper error_dump("error_logs.txt");
+    char timestamp[40];
+    RecordFormatter error_formatter(log_timestamp_format);
+    __s64 time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    error_dump.dump(std::string(timestamp, error_formatter.format_timestamp(timestamp, time_ns)) + " - " + message);
+}
+
+// the options of the log, the store and the sampler, the same for the sensors and the replay
+PipelineOptions pipeline_options(const char* log_file_name)
+{
+    PipelineOptions options;
+    options.log_file_name = log_file_name;
+    options.store_file_name = compressed_store_file_name;
+    options.sync = log_sync_mode;
+    options.format = log_timestamp_format;
+    options.altitude_m = altitude_m;
+    options.sample_period = sample_period;
+    options.record_period = record_period;
+    options.log_to_console = log_to_console;
+    if (strcmp(log_file_name, LOG_FILE_NAME) == 0)
+        options.log_handoff = log_handoff;
+    return options;
+}
+
+// accounts the heap allocations of the sampling cycle that just ended and starts the next one; steady
+// cycles come after the first record, with every device healthy. False when -alloc_check fails
+bool account_allocations(AllocationScope& cycle, bool steady)
+{
+    __u64 count = cycle.count();
+    cycle.restart();
+    if (!steady || count == 0)
+        return true;
+    metrics.loop_allocations.add(count);
+    if (!alloc_check)
+        return true;
+    std::cerr << "Allocation check failed: " << count << " heap allocations in a steady sampling cycle" << std::endl;
+    return false;
+}
+
+int start_measuring(bool self_test, const PipelineSinks& sinks)
+{
+    StartupTimer startup_timer;
+
     // get main i2c bus object
     I2C_BUS i2c_bus = I2C_BUS(i2c_bus_number);
+    startup_timer.mark("i2c bus");
 
-    // get oled display object
+    // get device objects
     SSD1306 display(&i2c_bus, 0x3C);
-    if (log_to_display)
-    {
-    display.set_config();
-        display.clear_display();
-        display.put_string("Inilializing...");
-        usleep(1000000);
-    }
-
-    // get sensor objects
-    BME280 bme280_interior = BME280(&i2c_bus, 0x77);
-    BME280 bme280_exterior = BME280(&i2c_bus, 0x76);
+    BME280 bme280_interior = BME280(&i2c_bus, 0x77, "bme280_interior.cal");
+    BME280 bme280_exterior = BME280(&i2c_bus, 0x76, "bme280_exterior.cal");
     ADS1115 adc = ADS1115(&i2c_bus, 0x48);
-    adc.set_config(1);
 
     // get PWM servo controller object
     PCA9685 pwm = PCA9685(&i2c_bus, 0x40);
 
-    // pwm initialization
-    pwm.turn_off();
-    usleep(10000);
-    pwm.set_PWM_freq(50);
-    pwm.wake_up();
+    // servo motion runs on its own timer thread, both lasers move concurrently
+    MotionPlanner motion;
+
+    // each device fails and recovers on its own, the others keep going (see include/device_health.cpp)
+    auto report = [](const std::string& message) {
+        std::cout << message << std::endl;
+        log_error(message);
+    };
+    DisplayViews display_views(sparkline_hours);
+    display_views.seed(*sinks.history, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    DeviceHealth display_health("ssd1306", [&]() {
+        display.set_config();
+        display.clear_display();
+        display_views.framebuffer().invalidate();
+    }, report);
+    DeviceHealth interior_health("bme280 interior", [&]() { bme280_interior.set_config(); }, report);
+    DeviceHealth exterior_health("bme280 exterior", [&]() { bme280_exterior.set_config(); }, report);
+    DeviceHealth adc_health("ads1115", [&]() { adc.set_config(1); }, report);
+    // the planner already retries the servo writes on every tick, so one reported error is enough to re-initialize
+    DeviceHealth pwm_health("pca9685", [&]() {
+        pwm.turn_off();
+        usleep(10000);
+        pwm.set_PWM_freq(50);
+        pwm.wake_up();
+        motion.resync();
+    }, report, 0);
+
+    // devices are brought up concurrently: the bus lock serializes the transfers while their waits overlap
+    std::future<void> display_init = std::async(std::launch::async, [&]() {
+        if (log_to_display && display_health.init(monotonic_ns()))
+            display_health.run(monotonic_ns(), [&]() { display.put_string("Inilializing..."); });
+    });
+    std::future<void> interior_init = std::async(std::launch::async, [&]() { interior_health.init(monotonic_ns()); });
+    std::future<void> exterior_init = std::async(std::launch::async, [&]() { exterior_health.init(monotonic_ns()); });
+    std::future<void> adc_init = std::async(std::launch::async, [&]() { adc_health.init(monotonic_ns()); });
+    std::future<void> pwm_init = std::async(std::launch::async, [&]() { pwm_health.init(monotonic_ns()); });
+    display_init.get();
+    interior_init.get();
+    exterior_init.get();
+    adc_init.get();
+    pwm_init.get();
+    startup_timer.mark("devices");
 
     // Load TH_To_XY conversion parameters
     Load_TH_To_XY_Parameters red_TH_To_XY("red_TH_to_XY.cal");
@@ -92,6 +211,8 @@ int start_measuring()
     Load_TH_To_XY_Parameters green_TH_To_XY("green_TH_to_XY.cal");
     green_TH_To_XY.load_cal();
 
+    startup_timer.mark("TH to XY calibration");
+
     // initiate inverse kinematics object
     InvKin red_inv_kin = InvKin(&pwm, 14, 15, "red_laser_servo_kin.cal");
     if (!red_inv_kin.load_cal())
@@ -107,135 +228,425 @@ int start_measuring()
         green_inv_kin.save_cal();
     }
 
-    // make visual check squares
-    green_inv_kin.make_xy_square();
-    red_inv_kin.make_xy_square();
+    startup_timer.mark("servo calibration");
+
+    size_t red_laser = motion.add_laser(&red_inv_kin);
+    size_t green_laser = motion.add_laser(&green_inv_kin);
+    motion.start();
+
+    if (self_test)
+    {
+        // make visual check squares, traced in the background while sampling starts
+        motion.queue_square(green_laser);
+        motion.queue_square(red_laser);
+    }
+    startup_timer.mark("lasers");
+
+    PipelineSinks sinks_with_display = sinks;
+    if (log_to_display)
+    {
+        sinks_with_display.display_views = &display_views;
+        sinks_with_display.flush_display = [&]() {
+            display_health.run(monotonic_ns(), [&]() {
+                display_views.framebuffer().flush([&](__u8 x, __u8 page, const __u8* data, __u8 count) { display.write_columns(x, page, data, count); });
+            });
+        };
+    }
 
-    // simple dumper to place logs in
-    Dumper dumper("log.txt");
+    SamplePipeline pipeline(pipeline_options(LOG_FILE_NAME), sinks_with_display);
 
-    display.clear_display();
+    if (log_to_display)
+        display_health.run(monotonic_ns(), [&]() { display.clear_display(); });
+    startup_timer.mark("display clear");
+    bool first_sample = true, first_record = true;
+    __u64 next_sample_ns = 0; // when the sleep after the previous sample should have ended
+    LogRecord sample;
+    AllocationScope cycle;
+    auto device_errors = [&]() { return display_health.errors() + interior_health.errors() + exterior_health.errors() + adc_health.errors() + pwm_health.errors(); };
+    __u32 errors = device_errors();
 
     while (true)
     {
-        float T_int, T_interior, P_interior, H_interior, T_exterior, P_exterior, H_exterior;
-        float average_T_int = 0, average_T_interior = 0, average_H_interior = 0, average_P_interior = 0, average_T_exterior = 0, average_H_exterior = 0, average_P_exterior = 0;
-        int ret_code_sum = 0;
-        for (size_t i = 0; i < AVERAGE; i++)
+        pipeline.begin_record(monotonic_ns());
+        do
         {
-            auto t_start = std::chrono::high_resolution_clock::now();
-
-            T_int = -66.875 + 218.75 * adc.read_voltage() / 3.3;
-            average_T_int += T_int;
-            ret_code_sum += bme280_interior.read_all(T_interior, P_interior, H_interior) + bme280_exterior.read_all(T_exterior, P_exterior, H_exterior);
-            average_T_interior += T_interior;
-            average_H_interior += H_interior;
-            average_P_interior += P_interior;
-            average_T_exterior += T_exterior;
-            average_H_exterior += H_exterior;
-            average_P_exterior += P_exterior;
-            if (log_to_display)
+            __u64 t_start_ns = monotonic_ns();
+            if (next_sample_ns != 0)
+                metrics.loop_lateness.observe_ns(t_start_ns > next_sample_ns ? t_start_ns - next_sample_ns : 0);
+
+            for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+                sample.values[ch] = NAN;
+            int ret_code = 0;
+            adc_health.run(t_start_ns, [&]() { sample.values[CH_T_ANALOG] = -66.875 + 218.75 * adc.read_voltage() / 3.3; });
+            interior_health.run(t_start_ns, [&]() {
+                float T, P, H;
+                int code = bme280_interior.read_all(T, P, H);
+                ret_code += code;
+                if (code != 0)
+                    throw std::runtime_error("bme280 interior returned " + std::to_string(code)); // lost its configuration
+                sample.values[CH_T_INTERIOR] = T;
+                sample.values[CH_P_INTERIOR] = P;
+                sample.values[CH_H_INTERIOR] = H;
+            });
+            exterior_health.run(t_start_ns, [&]() {
+                float T, P, H;
+                int code = bme280_exterior.read_all(T, P, H);
+                ret_code += code;
+                if (code != 0)
+                    throw std::runtime_error("bme280 exterior returned " + std::to_string(code));
+                sample.values[CH_T_EXTERIOR] = T;
+                sample.values[CH_P_EXTERIOR] = P;
+                sample.values[CH_H_EXTERIOR] = H;
+            });
+            sample.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            sample.ret_code = ret_code;
+            next_sample_ns = t_start_ns + pipeline.add_sample(sample, t_start_ns);
+            if (first_sample)
             {
-                if (i % 2 ==0)
-                {
-                    display.clear_display();
-                    display.set_cursor(0, 0);
-                    display.put_string("Interior");
-                    display.set_cursor(0, 1);
-                    display.put_string(to_string(T_interior));
-                    display.set_cursor(0, 2);
-                    display.put_string(to_string(H_interior));
-                    display.set_cursor(0, 3);
-                    display.put_string(to_string(P_interior));
-                    display.set_cursor(0, 4);
-                    display.put_string(to_string(T_int));
-                }
-                else
-                {    
-                    display.clear_display();
-                    display.set_cursor(0, 0);
-                    display.put_string("Exterior");
-                    display.set_cursor(0, 1);
-                    display.put_string(to_string(T_exterior));
-                    display.set_cursor(0, 2);
-                    display.put_string(to_string(H_exterior));
-                    display.set_cursor(0, 3);
-                    display.put_string(to_string(P_exterior));
-                }
+                startup_timer.mark("first sample");
+                startup_timer.report();
+                first_sample = false;
             }
-            auto t_end = std::chrono::high_resolution_clock::now();
-            float elapsed_time_us = std::chrono::duration<float, std::micro>(t_end - t_start).count();
+            __u32 cycle_errors = device_errors();
+            if (!account_allocations(cycle, !first_record && cycle_errors == errors))
+                return 1;
+            errors = cycle_errors;
+
+            __u64 t_end_ns = monotonic_ns();
+            if (t_end_ns < next_sample_ns)
+                usleep((next_sample_ns - t_end_ns) / 1000);
+        } while (!pipeline.record_due(monotonic_ns()));
+        const LogRecord& record = pipeline.finish_record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count(), monotonic_ns());
 
-            usleep(SLEEP_TIME - elapsed_time_us);
+        // a laser whose sensor is down stays where it is
+        pwm_health.run(monotonic_ns(), [&]() {
+            if (pipeline.has_value(CH_T_EXTERIOR))
+                motion.move_to(red_laser, red_TH_To_XY.compute_X(record.values[CH_T_EXTERIOR]), red_TH_To_XY.compute_Y(record.values[CH_H_EXTERIOR]));
+            if (pipeline.has_value(CH_T_INTERIOR))
+                motion.move_to(green_laser, green_TH_To_XY.compute_X(record.values[CH_T_INTERIOR]), green_TH_To_XY.compute_Y(record.values[CH_H_INTERIOR]));
+        });
+        if (first_record)
+        {
+            cycle.restart(); // the first record opened the files and sized the buffers
+            first_record = false;
         }
-        average_T_int /= AVERAGE;
-        average_T_interior /= AVERAGE;
-        average_H_interior /= AVERAGE;
-        average_P_interior /= AVERAGE;
-        average_T_exterior /= AVERAGE;
-        average_H_exterior /= AVERAGE;
-        average_P_exterior /= AVERAGE;
-        auto timenow = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    }
 
-        red_inv_kin.move_xy(red_TH_To_XY.compute_X(average_T_exterior), red_TH_To_XY.compute_Y(average_H_exterior));
-        green_inv_kin.move_xy(green_TH_To_XY.compute_X(average_T_interior), green_TH_To_XY.compute_Y(average_H_interior));
+    return 0;
+}
 
-        std::ostringstream info;
-        info << std::string(strtok(ctime(&timenow), "\n")) << '\t' << average_T_interior << '\t' << average_H_interior << '\t' << average_P_interior << '\t' << average_T_int << '\t' << ret_code_sum << '\t' << average_T_exterior << '\t' << average_H_exterior << '\t' << average_P_exterior;
-        if (log_to_console)
-            std::cout << info.str() << std::endl;
+// Drives the pipeline from a recording instead of the sensors, on a virtual clock that follows the
+// recorded timestamps: as fast as possible, or replay_speed times faster than they were recorded. A
+// sample comes sooner than the sampler wants one is skipped, as the sampling loop would not have taken it.
+// A recorded record stands for the period_s before its time, so the records logged from it span those too.
+int replay_measuring(const PipelineSinks& sinks)
+{
+    std::vector<LogRecord> samples;
+    auto t_load = std::chrono::steady_clock::now();
+    replay_format format = load_replay_samples(replay_file_name, samples);
+    std::cout << "Replay: " << samples.size() << " samples from " << replay_file_name << " (" << REPLAY_FORMAT_NAMES[format] << ") loaded in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - t_load).count() << " s" << std::endl;
+    if (samples.empty())
+        return 0;
 
-        dumper.dump(info.str());
+    DisplayViews display_views(sparkline_hours);
+    __u64 display_bytes = 0;
+    PipelineSinks replay_sinks = sinks;
+    if (log_to_display)
+    {
+        // rendered and diffed like on the screen, the bytes that would go over the bus are counted
+        replay_sinks.display_views = &display_views;
+        replay_sinks.flush_display = [&]() { display_views.framebuffer().flush([&](__u8, __u8, const __u8*, __u8 count) { display_bytes += count; }); };
     }
+    SamplePipeline pipeline(pipeline_options(REPLAY_LOG_FILE_NAME), replay_sinks);
 
+    const __s64 first_ns = samples.front().time_ns;
+    const __u64 base_ns = 86401000000000ULL; // the virtual monotonic clock, 0 means no sample yet to the sampler; a day of room for the first period
+    __u64 next_sample_ns = 0, last_ns = 0, t_start = monotonic_ns(), t_progress = t_start;
+    size_t taken = 0, records = 0;
+    bool open = false;
+    AllocationScope cycle;
+    for (const LogRecord& sample : samples)
+    {
+        __u64 now_ns = base_ns + (sample.time_ns - first_ns);
+        if (now_ns < next_sample_ns)
+            continue;
+        // what the sample stands for before its time, 0 for raw samples, never reaching back past the previous one
+        __u64 period_ns = std::min(static_cast<__u64>(std::max(sample.period_s, 0.0f) * 1e9f), now_ns - last_ns);
+        if (open && pipeline.record_due(now_ns - period_ns))
+        {
+            // a gap in the recording closes the record at its last sample, not after the gap
+            __u64 close_ns = now_ns > next_sample_ns + REPLAY_GAP_NS ? last_ns : now_ns - period_ns;
+            pipeline.finish_record(first_ns + static_cast<__s64>(close_ns - base_ns), close_ns);
+            if (records++ == 0)
+                cycle.restart(); // the first record opened the files and sized the buffers
+            open = false;
+        }
+        if (!open)
+        {
+            pipeline.begin_record(now_ns - period_ns);
+            open = true;
+        }
+        if (replay_speed > 0.0f)
+        {
+            __u64 due_ns = t_start + static_cast<__u64>((now_ns - base_ns) / replay_speed);
+            __u64 t_now = monotonic_ns();
+            if (t_now < due_ns)
+                usleep((due_ns - t_now) / 1000);
+        }
+        next_sample_ns = now_ns + pipeline.add_sample(sample, now_ns);
+        last_ns = now_ns;
+        taken++;
+        if (!account_allocations(cycle, records > 0))
+            return 1;
+
+        if (monotonic_ns() - t_progress > REPLAY_PROGRESS_NS)
+        {
+            t_progress = monotonic_ns();
+            std::cout << "Replay: " << taken << " samples, " << records << " records, " << static_cast<__u64>(taken / ((t_progress - t_start) / 1e9)) << " samples/s" << std::endl;
+        }
+    }
+    if (open)
+    {
+        pipeline.finish_record(first_ns + static_cast<__s64>(last_ns - base_ns), last_ns);
+        records++;
+    }
+
+    double seconds = (monotonic_ns() - t_start) / 1e9;
+    double recorded_seconds = (samples.back().time_ns - first_ns) / 1e9;
+    std::cout << "Replay: " << samples.size() << " samples read, " << taken << " taken (" << samples.size() - taken << " skipped by the sampler), " << records << " records logged to " REPLAY_LOG_FILE_NAME "\n"
+              << "Replay: " << recorded_seconds / 86400.0 << " days in " << seconds << " s, " << static_cast<__u64>(taken / seconds) << " samples/s, " << static_cast<__u64>(recorded_seconds / seconds) << "x real time";
+    if (log_to_display)
+        std::cout << ", " << display_bytes << " display bytes";
+    std::cout << ", " << metrics.loop_allocations.value() << " heap allocations after the first record" << std::endl;
     return 0;
 }
 
+void print_usage()
+{
+    std::cout <<    "This program is used to log the temperature loggings to a log file.\n"
+                    "Usage:\n"
+                    ".\\logger [-help] [-i2c_bus N] [-log_to_console] [-no_screen] [-no_self_test] [-timestamp ctime|iso|epoch_ns] [-store FILE] [-http_port N] [-shm] [-stream SOCKET] [-trace_i2c FILE] [-sync always|batch|none] [-altitude M] [-sparkline_hours H] [-sample_period MIN:MAX] [-record_period MIN:MAX] [-alerts FILE] [-push HOST[:PORT]] [-node NAME] [-replay FILE] [-speed X|max] [-alloc_check] [-compact DIR] [-retain AGES] [-disk_budget SIZE]\nRuntime options available:\n"
+                    "-i2c_bus N         Allows the user to specify the i2c bus number (1 is default);\n"
+                    "-log_to_console    Logging will also be done on console along with file;\n"
+                    "-no_screen         Will disable SSD1306 screen logging;\n"
+                    "-no_self_test      Will skip the laser square traced at startup (restarts always skip it);\n"
+                    "-timestamp F       Timestamp column format: ctime (legacy, default), iso (ISO-8601 with ns) or epoch_ns;\n"
+                    "-store FILE        Also appends the samples to a gorilla compressed store (blocks of 1440 records, the open one journaled in FILE.wal);\n"
+                    "-http_port N       Serves /latest, /range, /rollup and /downsample as JSON, /export as Arrow and /metrics for Prometheus on 127.0.0.1:N;\n"
+                    "-shm               Publishes the latest sample and two weeks of records in shared memory (" SHARED_SAMPLES_NAME ");\n"
+                    "-stream SOCKET     Streams raw samples and averages to subscribers of a unix socket, e.g. " STREAM_SOCKET_PATH ";\n"
+                    "-trace_i2c FILE    Traces every I2C operation, written to FILE as Chrome trace JSON on SIGUSR1, errors and crashes;\n"
+                    "-sync MODE         When the log and the store journal are synced to storage: always (every record, default),\n"
+                    "                   batch (every 16 records or 5 minutes) or none (left to the kernel);\n"
+                    "-altitude M        Altitude of the sensors in m, for the sea level pressure logged with the derived humidity columns (0 is default);\n"
+                    "-sparkline_hours H Hours of records in the trend plots of the screen (6 is default);\n"
+                    "-sample_period B   Seconds between raw samples, MIN:MAX or one fixed value (0.5:10 is default);\n"
+                    "-record_period B   Seconds averaged into a logged record, MIN:MAX or one fixed value (15:300 is default).\n"
+                    "                   Both move from MAX towards MIN while a channel changes quickly and back when it is quiet,\n"
+                    "                   the seconds of each record are logged after the derived columns; 1 and 60 log as before;\n"
+                    "-alerts FILE       Checks the threshold, rate and missing data rules of FILE on every sample and reports to its\n"
+                    "                   file, socket and exec sinks (see include/alert_engine.cpp); alerts come one sample period late at most;\n"
+                    "-push HOST[:PORT]  Pushes every record to a collector (tools/collector.cpp, port 7071 is default), spooled in\n"
+                    "                   " PUSH_SPOOL_FILE " until acknowledged so nothing is lost while it is unreachable;\n"
+                    "-node NAME         Node id of this logger at the collector (the host name is default);\n"
+                    "-replay FILE       Runs the samples of a log.txt, a -store file or a stream capture through the logger instead of\n"
+                    "                   the sensors, logging to " REPLAY_LOG_FILE_NAME "; every other option applies as usual, the screen is rendered but not drawn;\n"
+                    "-speed X           Replays X times faster than recorded, max (default) as fast as possible, reporting samples/s;\n"
+                    "-alloc_check       Stops with an error when the sampling loop allocates heap memory after its first record, cycles\n"
+                    "                   with device errors aside (counted in /metrics either way), e.g. with -replay as a test;\n"
+                    "-compact DIR       Compacts in the background, hourly: old lines of log.txt move to gorilla segments in DIR, older\n"
+                    "                   data to hourly then daily rollups; the query endpoint reads them like the log;\n"
+                    "-retain AGES       Age of the data in each tier, log=8w,raw=90d,hourly=2y is default (any of them, s m h d w y);\n"
+                    "-disk_budget SIZE  Keeps log.txt and DIR under SIZE (64M, 2G...), down to 8 days of log, tiering down and then\n"
+                    "                   dropping the oldest days when over.\n" << std::endl;
+}
+
 int main(int argc, char* argv[])
 {
-    for (__u8 i = 1; i < argc; i++)
+    // a malformed option value stops with its error and the usage, like an unknown option
+    try
     {
-        // Check if the argument starts with "-opt" (option flag)
-        if (argv[i][0] == '-')
+        for (__u8 i = 1; i < argc; i++)
         {
-            if (strcmp(argv[i], "-i2c_bus") == 0)
-                i2c_bus_number = std::atoi(argv[i + 1]);
-            else if (strcmp(argv[i], "-log_to_console") == 0)
-                log_to_console = true;
-            else if (strcmp(argv[i], "-no_screen") == 0)
-                log_to_display = false;
-            else
+            // Check if the argument starts with "-opt" (option flag)
+            if (argv[i][0] == '-')
             {
-                std::cout <<    "This program is used to log the temperature loggings to a log file.\n"
-                                "Usage:\n"
-                                ".\\logger [-help] [-i2c_bus N] [-log_to_console] [-no_screen]\nRuntime options available:\n"
-                                "-i2c_bus N         Allows the user to specify the i2c bus number (1 is default);\n"
-                                "-log_to_console    Logging will also be done on console along with file;\n"
-                                "-no_screen         Will disable SSD1306 screen logging.\n" << std::endl;
-                return 0;
+                if (strcmp(argv[i], "-i2c_bus") == 0)
+                    i2c_bus_number = std::atoi(argv[i + 1]);
+                else if (strcmp(argv[i], "-log_to_console") == 0)
+                    log_to_console = true;
+                else if (strcmp(argv[i], "-no_screen") == 0)
+                    log_to_display = false;
+                else if (strcmp(argv[i], "-no_self_test") == 0)
+                    run_self_test = false;
+                else if (strcmp(argv[i], "-timestamp") == 0 && i + 1 < argc && strcmp(argv[i + 1], "iso") == 0)
+                    log_timestamp_format = TIMESTAMP_ISO8601;
+                else if (strcmp(argv[i], "-timestamp") == 0 && i + 1 < argc && strcmp(argv[i + 1], "epoch_ns") == 0)
+                    log_timestamp_format = TIMESTAMP_EPOCH_NS;
+                else if (strcmp(argv[i], "-timestamp") == 0 && i + 1 < argc && strcmp(argv[i + 1], "ctime") == 0)
+                    log_timestamp_format = TIMESTAMP_CTIME;
+                else if (strcmp(argv[i], "-store") == 0 && i + 1 < argc)
+                    compressed_store_file_name = argv[i + 1];
+                else if (strcmp(argv[i], "-http_port") == 0 && i + 1 < argc)
+                    http_port = std::atoi(argv[i + 1]);
+                else if (strcmp(argv[i], "-shm") == 0)
+                    publish_shared_samples = true;
+                else if (strcmp(argv[i], "-stream") == 0 && i + 1 < argc)
+                    stream_socket_path = argv[i + 1];
+                else if (strcmp(argv[i], "-trace_i2c") == 0 && i + 1 < argc)
+                    i2c_trace_file_name = argv[i + 1];
+                else if (strcmp(argv[i], "-sync") == 0 && i + 1 < argc)
+                    log_sync_mode = SyncPolicy::parse(argv[i + 1]);
+                else if (strcmp(argv[i], "-altitude") == 0 && i + 1 < argc)
+                    altitude_m = std::atof(argv[i + 1]);
+                else if (strcmp(argv[i], "-sparkline_hours") == 0 && i + 1 < argc)
+                    sparkline_hours = std::max(0.1f, static_cast<float>(std::atof(argv[i + 1])));
+                else if (strcmp(argv[i], "-sample_period") == 0 && i + 1 < argc)
+                    sample_period = RateBounds::parse(argv[i + 1]);
+                else if (strcmp(argv[i], "-record_period") == 0 && i + 1 < argc)
+                    record_period = RateBounds::parse(argv[i + 1]);
+                else if (strcmp(argv[i], "-alerts") == 0 && i + 1 < argc)
+                    alert_config_file_name = argv[i + 1];
+                else if (strcmp(argv[i], "-push") == 0 && i + 1 < argc)
+                {
+                    push_host = argv[i + 1];
+                    size_t colon = push_host.rfind(':');
+                    if (colon != std::string::npos && push_host.find(':') == colon)
+                    {
+                        push_port = std::atoi(push_host.c_str() + colon + 1);
+                        push_host.resize(colon);
+                    }
+                }
+                else if (strcmp(argv[i], "-node") == 0 && i + 1 < argc)
+                    node_id = argv[i + 1];
+                else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc)
+                    replay_file_name = argv[i + 1];
+                else if (strcmp(argv[i], "-compact") == 0 && i + 1 < argc)
+                    archive_directory = argv[i + 1];
+                else if (strcmp(argv[i], "-retain") == 0 && i + 1 < argc)
+                    retention = RetentionPolicy::parse(argv[i + 1], retention);
+                else if (strcmp(argv[i], "-disk_budget") == 0 && i + 1 < argc)
+                    retention.disk_budget = RetentionPolicy::parse_size(argv[i + 1]);
+                else if (strcmp(argv[i], "-alloc_check") == 0)
+                    alloc_check = true;
+                else if (strcmp(argv[i], "-speed") == 0 && i + 1 < argc)
+                    replay_speed = strcmp(argv[i + 1], "max") == 0 ? 0.0f : std::max(0.0f, static_cast<float>(std::atof(argv[i + 1])));
+                else
+                {
+                    print_usage();
+                    return 0;
+                }
             }
         }
     }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << e.what() << "\n\n";
+        print_usage();
+        return 1;
+    }
+
+    if (!i2c_trace_file_name.empty())
+        I2cTracer::enable(i2c_trace_file_name);
+
+    // recent samples and the query endpoint live across restarts of the measurement loop
+    SampleHistory history;
+    bool replay = !replay_file_name.empty();
+    // the compaction is about the log of the sensors, a replay leaves it alone
+    std::unique_ptr<Archive> archive;
+    std::unique_ptr<Compactor> compactor;
+    if (!archive_directory.empty() && !replay)
+    {
+        if (retention.log_ns < COMPACT_MIN_LOG_NS)
+            std::cerr << "Warning: the log age is under 8 days, the weekly report and email_updater.py read a week back from log.txt" << std::endl;
+        archive = std::make_unique<Archive>(archive_directory);
+        compactor = std::make_unique<Compactor>(LOG_FILE_NAME, *archive, retention);
+        log_handoff = compactor->handoff();
+        compactor->start();
+    }
+    QueryApi query_api(&history, replay ? REPLAY_LOG_FILE_NAME : LOG_FILE_NAME, altitude_m, archive.get());
+    std::unique_ptr<HttpServer> http_server;
+    if (http_port != 0)
+    {
+        http_server = std::make_unique<HttpServer>(http_port, [&query_api](const HttpRequest& request, HttpResponse& response) {
+            if (request.path == "/metrics")
+            {
+                response.content_type = "text/plain; version=0.0.4";
+                metrics.write_text(response.body);
+            }
+            else
+                query_api.handle(request, response);
+        });
+        http_server->start();
+    }
+    std::unique_ptr<SharedSamplesWriter> shared_samples;
+    if (publish_shared_samples)
+        shared_samples = std::make_unique<SharedSamplesWriter>();
+    std::unique_ptr<SampleStream> stream;
+    if (!stream_socket_path.empty())
+    {
+        stream = std::make_unique<SampleStream>(stream_socket_path);
+        stream->start();
+    }
+
+    // alert state lives across restarts too, a restart neither repeats nor loses an alert
+    std::unique_ptr<AlertEngine> alerts;
+    if (!alert_config_file_name.empty())
+    {
+        alerts = std::make_unique<AlertEngine>(AlertConfig::load(alert_config_file_name), log_timestamp_format);
+        std::cout << "Loaded " << alerts->rules() << " alert rules from " << alert_config_file_name << std::endl;
+    }
 
+    std::unique_ptr<PushClient> push;
+    if (!push_host.empty())
+    {
+        if (node_id.empty())
+        {
+            char host_name[HOST_NAME_MAX + 1] = {};
+            gethostname(host_name, HOST_NAME_MAX);
+            node_id = host_name;
+        }
+        push = std::make_unique<PushClient>(push_host, push_port, node_id, replay ? "replay_" PUSH_SPOOL_FILE : PUSH_SPOOL_FILE, SyncPolicy(log_sync_mode));
+        push->start();
+    }
+
+    PipelineSinks sinks;
+    sinks.history = &history;
+    sinks.shared_samples = shared_samples.get();
+    sinks.stream = stream.get();
+    sinks.alerts = alerts.get();
+    sinks.push = push.get();
+    if (replay)
+        return replay_measuring(sinks);
+
+    bool self_test = run_self_test;
+    __u32 restart_delay = RESTART_DELAY_MIN;
     while (true)
     {
+        auto t_start = std::chrono::steady_clock::now();
         try
         {
-            start_measuring();
+            if (start_measuring(self_test, sinks) != 0)
+                return 1;
         }
         catch (const std::runtime_error& e)
         {
-            // restart measuring after 10 seconds to try to fight error...
+            // a run that lasted a while was a one-off error: restart quickly, back off when errors repeat
+            if (std::chrono::steady_clock::now() - t_start > std::chrono::minutes(10))
+                restart_delay = RESTART_DELAY_MIN;
+            self_test = false;
+            metrics.restarts.add();
+            if (i2c_trace_enabled)
+                I2cTracer::dump_now(); // the bus operations that led up to the error
+
             if (log_to_display)
-            std::cout << std::string("Error occurred, restarting in 10 seconds. Error message:\n") + e.what() + std::string("\n");
+            std::cout << std::string("Error occurred, restarting in ") + std::to_string(restart_delay / 1000) + std::string(" ms. Error message:\n") + e.what() + std::string("\n");
 
-            Dumper error_dump("error_logs.txt");
-            auto timenow = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-            std::ostringstream error_info;
-            error_info << std::string(strtok(ctime(&timenow), "\n")) << " - " << e.what() << std::endl;
-            error_dump.dump(error_info.str());
+            log_error(e.what());
 
-            usleep(10000000);
+            usleep(restart_delay);
+            restart_delay = std::min<__u32>(restart_delay * 2, RESTART_DELAY_MAX);
         }
     }
     return 0;
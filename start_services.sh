@@ -10,7 +10,7 @@ else
 	tmux split-window -h -t temperature_logger
 	
 	# Start the logger (use visudo to make process passwordless)
-	tmux send-keys -t temperature_logger.1 "sudo ./logger -i2c_bus 2" ENTER
+	tmux send-keys -t temperature_logger.1 "sudo ./logger -i2c_bus 2 -http_port 8081 -shm -stream /tmp/temperature_logger.sock" ENTER
 
 	tmux send-keys -t temperature_logger.0 "python webapp.py" ENTER
 	tmux send-keys -t temperature_logger.2 "python email_updater.py" ENTER
@@ -0,0 +1,2190 @@
+// Micro benchmarks for the logger building blocks, none of them needs the i2c hardware.
+// Usage: ./benchmark <name> [args], run without arguments to list the benchmarks.
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <array>
+#include <string.h>
+#include "../include/log_record.cpp"
+#include "../include/gorilla.cpp"
+#include "../include/query_api.cpp"
+#include "../include/shared_samples.cpp"
+#include "../include/sample_stream.cpp"
+#include "../include/metrics.cpp"
+#include "../include/i2c_tracer.cpp"
+#include "../include/device_health.cpp"
+#include "../include/journal.cpp"
+#include "../include/derived_metrics.cpp"
+#include "../include/downsample.cpp"
+#include "../include/display_views.cpp"
+#include "../include/adaptive_sampler.cpp"
+#include "../include/alert_engine.cpp"
+#include "../include/push_client.cpp"
+#include "../include/collector.cpp"
+#include "../include/sample_pipeline.cpp"
+#include "../include/compactor.cpp"
+#include "../include/alloc_counter.cpp"
+
+static double seconds_since(std::chrono::steady_clock::time_point t_start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+}
+
+static LogRecord synthetic_record(size_t i)
+{
+    LogRecord record;
+    record.time_ns = 1760000000000000000LL + static_cast<__s64>(i) * 60000000000LL; // one record per minute
+    record.values[CH_T_INTERIOR] = 21.0f + 0.01f * (i % 300);
+    record.values[CH_H_INTERIOR] = 45.0f + 0.1f * (i % 50);
+    record.values[CH_P_INTERIOR] = 1.01325f + 0.00001f * (i % 100);
+    record.values[CH_T_ANALOG] = 22.5f + 0.02f * (i % 70);
+    record.values[CH_T_EXTERIOR] = 8.0f + 0.01f * (i % 900);
+    record.values[CH_H_EXTERIOR] = 80.0f + 0.1f * (i % 90);
+    record.values[CH_P_EXTERIOR] = 1.01211f + 0.00001f * (i % 100);
+    record.ret_code = 0;
+    return record;
+}
+
+static int bench_format(int argc, char* argv[])
+{
+    size_t n = argc > 0 ? std::stoul(argv[0]) : 1000000;
+    std::vector<LogRecord> records(4096);
+    for (size_t i = 0; i < records.size(); i++)
+        records[i] = synthetic_record(i);
+
+    // legacy path: ostringstream + ctime + strtok, as main.cpp used to do it
+    size_t bytes = 0;
+    auto t_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+    {
+        const LogRecord& r = records[i % records.size()];
+        time_t timenow = r.time_ns / 1000000000;
+        std::ostringstream info;
+        info << std::string(strtok(ctime(&timenow), "\n")) << '\t' << r.values[CH_T_INTERIOR] << '\t' << r.values[CH_H_INTERIOR] << '\t' << r.values[CH_P_INTERIOR] << '\t' << r.values[CH_T_ANALOG] << '\t' << r.ret_code << '\t' << r.values[CH_T_EXTERIOR] << '\t' << r.values[CH_H_EXTERIOR] << '\t' << r.values[CH_P_EXTERIOR];
+        bytes += info.str().size();
+    }
+    double legacy_seconds = seconds_since(t_start);
+    std::cout << std::left << std::setw(22) << "ostringstream+ctime" << std::right << std::setw(14) << std::fixed << std::setprecision(0) << n / legacy_seconds << " records/s\n";
+
+    const char* names[] = {"formatter ctime", "formatter iso", "formatter epoch_ns"};
+    for (__u8 format = TIMESTAMP_CTIME; format <= TIMESTAMP_EPOCH_NS; format++)
+    {
+        RecordFormatter formatter(static_cast<timestamp_format>(format));
+        t_start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++)
+            bytes += formatter.format(records[i % records.size()]).size();
+        double elapsed = seconds_since(t_start);
+        std::cout << std::left << std::setw(22) << names[format] << std::right << std::setw(14) << n / elapsed << " records/s  (x" << std::setprecision(1) << legacy_seconds / elapsed << ")\n" << std::setprecision(0);
+    }
+
+    // check that the compatibility mode is byte identical to the legacy output
+    RecordFormatter formatter(TIMESTAMP_CTIME);
+    size_t mismatches = 0;
+    for (const LogRecord& r : records)
+    {
+        time_t timenow = r.time_ns / 1000000000;
+        std::ostringstream info;
+        info << std::string(strtok(ctime(&timenow), "\n")) << '\t' << r.values[CH_T_INTERIOR] << '\t' << r.values[CH_H_INTERIOR] << '\t' << r.values[CH_P_INTERIOR] << '\t' << r.values[CH_T_ANALOG] << '\t' << r.ret_code << '\t' << r.values[CH_T_EXTERIOR] << '\t' << r.values[CH_H_EXTERIOR] << '\t' << r.values[CH_P_EXTERIOR];
+        if (info.str() != formatter.format(r))
+            mismatches++;
+    }
+    std::cout << "ctime compatibility mismatches: " << mismatches << " of " << records.size() << " (" << bytes << " bytes formatted)\n";
+    return mismatches == 0 ? 0 : 1;
+}
+
+// loads log.txt style records from a file, or makes a year of realistic minute samples when no file is given
+static std::vector<LogRecord> load_or_synthesize(int argc, char* argv[])
+{
+    std::vector<LogRecord> records;
+    LogLineParser parser;
+    LogRecord record;
+    if (argc > 0)
+    {
+        std::ifstream file(argv[0]);
+        if (!file)
+            throw std::runtime_error(std::string("Cannot open ") + argv[0]);
+        std::string line;
+        size_t skipped = 0;
+        while (std::getline(file, line))
+        {
+            if (parser.parse(line, record))
+                records.push_back(record);
+            else
+                skipped++;
+        }
+        std::cout << "Loaded " << records.size() << " records from " << argv[0] << " (" << skipped << " unparsable lines)\n";
+        return records;
+    }
+
+    // slowly drifting values with sensor noise, written and read back as text so the precision matches log.txt
+    std::mt19937 rng(42);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    RecordFormatter formatter;
+    float T_in = 21.0f, H_in = 45.0f, P = 1.013f, T_out = 10.0f, H_out = 80.0f;
+    for (size_t i = 0; i < 365 * 1440; i++)
+    {
+        T_in += 0.002f * noise(rng);
+        H_in += 0.01f * noise(rng);
+        P += 0.00002f * noise(rng);
+        T_out += 0.005f * noise(rng);
+        H_out += 0.02f * noise(rng);
+        LogRecord r;
+        r.time_ns = 1760000000000000000LL + static_cast<__s64>(i) * 60000000000LL + static_cast<__s64>(noise(rng) * 2000000.0f);
+        r.values[CH_T_INTERIOR] = T_in + 0.01f * noise(rng);
+        r.values[CH_H_INTERIOR] = H_in + 0.05f * noise(rng);
+        r.values[CH_P_INTERIOR] = P + 0.000005f * noise(rng);
+        r.values[CH_T_ANALOG] = T_in + 1.0f + 0.2f * noise(rng);
+        r.values[CH_T_EXTERIOR] = T_out + 0.01f * noise(rng);
+        r.values[CH_H_EXTERIOR] = H_out + 0.05f * noise(rng);
+        r.values[CH_P_EXTERIOR] = P - 0.0011f + 0.000005f * noise(rng);
+        r.ret_code = 0;
+        if (parser.parse(formatter.format(r), record))
+        {
+            record.time_ns = r.time_ns;
+            records.push_back(record);
+        }
+    }
+    std::cout << "Synthesized " << records.size() << " minute records (one year)\n";
+    return records;
+}
+
+// round trip of timestamps whose delta of deltas sits on each edge of the encoder's buckets, returns the mismatches
+static size_t gorilla_bucket_edges()
+{
+    const __s64 edges[] = {0, 1, -1, 63, -64, 64, -65, 255, -256, 256, -257, 2047, -2048, 2048, -2049, 1LL << 40, -(1LL << 40)};
+    std::vector<LogRecord> records;
+    LogRecord record = synthetic_record(0);
+    __s64 delta_ms = 60000;
+    for (__s64 dod : edges)
+    {
+        // each edge after a steady delta and back, so every one is seen from both sides
+        for (__s64 step : {dod, -dod, static_cast<__s64>(0)})
+        {
+            delta_ms += step;
+            record.time_ns += delta_ms * GORILLA_TIME_UNIT_NS;
+            records.push_back(record);
+        }
+    }
+    std::vector<__u8> compressed;
+    GorillaBlockEncoder encoder;
+    for (const LogRecord& r : records)
+        encoder.append(r);
+    encoder.finish(compressed);
+    std::vector<LogRecord> decoded;
+    GorillaBlockDecoder::decode(compressed.data(), compressed.size(), decoded);
+    size_t mismatches = decoded.size() == records.size() ? 0 : records.size();
+    for (size_t i = 0; i < decoded.size() && i < records.size(); i++)
+        mismatches += decoded[i].time_ns != records[i].time_ns;
+    return mismatches;
+}
+
+static int bench_gorilla(int argc, char* argv[])
+{
+    std::vector<LogRecord> records = load_or_synthesize(argc, argv);
+    if (records.empty())
+        return 1;
+    size_t edge_mismatches = gorilla_bucket_edges();
+
+    // size of the same data as log.txt text
+    RecordFormatter formatter;
+    size_t text_bytes = 0;
+    for (const LogRecord& record : records)
+        text_bytes += formatter.format(record).size() + 1;
+
+    std::vector<__u8> compressed;
+    GorillaBlockEncoder encoder;
+    auto t_start = std::chrono::steady_clock::now();
+    for (const LogRecord& record : records)
+    {
+        encoder.append(record);
+        if (encoder.count() >= GORILLA_BLOCK_RECORDS)
+            encoder.finish(compressed);
+    }
+    if (encoder.count() > 0)
+        encoder.finish(compressed);
+    double encode_seconds = seconds_since(t_start);
+
+    std::vector<LogRecord> decoded;
+    decoded.reserve(records.size());
+    t_start = std::chrono::steady_clock::now();
+    for (size_t offset = 0; offset < compressed.size();)
+        offset += GorillaBlockDecoder::decode(compressed.data() + offset, compressed.size() - offset, decoded);
+    double decode_seconds = seconds_since(t_start);
+
+    // the same data parsed back from text, for reference
+    std::vector<char> text;
+    text.reserve(text_bytes);
+    for (const LogRecord& record : records)
+    {
+        std::string_view line = formatter.format(record);
+        text.insert(text.end(), line.begin(), line.end());
+        text.push_back('\n');
+    }
+    LogLineParser parser;
+    LogRecord record;
+    size_t parsed = 0;
+    t_start = std::chrono::steady_clock::now();
+    for (size_t begin = 0; begin < text.size();)
+    {
+        size_t end = begin;
+        while (text[end] != '\n')
+            end++;
+        parsed += parser.parse(std::string_view(text.data() + begin, end - begin), record);
+        begin = end + 1;
+    }
+    double parse_seconds = seconds_since(t_start);
+
+    size_t mismatches = decoded.size() == records.size() ? 0 : records.size();
+    for (size_t i = 0; i < decoded.size() && i < records.size(); i++)
+        if (decoded[i].time_ns != records[i].time_ns / GORILLA_TIME_UNIT_NS * GORILLA_TIME_UNIT_NS || decoded[i].ret_code != records[i].ret_code ||
+            memcmp(decoded[i].values, records[i].values, sizeof(records[i].values)) != 0)
+            mismatches++;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "text size         " << text_bytes / 1e6 << " MB\n";
+    std::cout << "compressed size   " << compressed.size() / 1e6 << " MB (" << 8.0 * compressed.size() / records.size() << " bits/record)\n";
+    std::cout << "compression ratio " << static_cast<double>(text_bytes) / compressed.size() << "x\n";
+    std::cout << std::setprecision(0);
+    std::cout << "encode            " << records.size() / encode_seconds << " records/s\n";
+    std::cout << "decode            " << decoded.size() / decode_seconds << " records/s (" << std::setprecision(1) << text_bytes / 1e6 / decode_seconds << " MB/s of text equivalent)\n";
+    std::cout << std::setprecision(0) << "text parse        " << parsed / parse_seconds << " records/s (" << std::setprecision(1) << text_bytes / 1e6 / parse_seconds << " MB/s)\n";
+    std::cout << "round trip mismatches: " << mismatches << ", at the timestamp bucket edges: " << edge_mismatches << "\n";
+    return mismatches + edge_mismatches == 0 ? 0 : 1;
+}
+
+static double percentile(std::vector<double>& samples, double p)
+{
+    if (samples.empty())
+        return 0.0;
+    size_t n = static_cast<size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+    return samples[n];
+}
+
+// blocking keep-alive client, returns the response body size or -1
+static long http_get(int fd, const std::string& target, std::string& buffer)
+{
+    std::string request = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+        return -1;
+    buffer.clear();
+    size_t header_end = std::string::npos, content_length = 0;
+    char chunk[65536];
+    while (header_end == std::string::npos || buffer.size() < header_end + 4 + content_length)
+    {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0)
+            return -1;
+        buffer.append(chunk, n);
+        if (header_end == std::string::npos && (header_end = buffer.find("\r\n\r\n")) != std::string::npos)
+        {
+            size_t p = buffer.find("Content-Length: ");
+            content_length = std::stoul(buffer.substr(p + 16));
+        }
+    }
+    return content_length;
+}
+
+static long buffer_size_hint(const std::string& target, __u16 port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    std::string buffer;
+    long size = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ? -1 : http_get(fd, target, buffer);
+    close(fd);
+    return size;
+}
+
+static int bench_http(int argc, char* argv[])
+{
+    size_t clients = argc > 0 ? std::stoul(argv[0]) : 16;
+    size_t requests = argc > 1 ? std::stoul(argv[1]) : 2000;
+
+    // a year in the log file, the newest HISTORY_CAPACITY records also in memory
+    std::vector<LogRecord> records = load_or_synthesize(0, nullptr);
+    const char* log_file_name = "/tmp/benchmark_http_log.txt";
+    {
+        std::ofstream file(log_file_name, std::ios::trunc);
+        RecordFormatter formatter;
+        for (const LogRecord& record : records)
+            file << formatter.format(record) << '\n';
+    }
+    SampleHistory history;
+    for (size_t i = records.size() - HISTORY_CAPACITY; i < records.size(); i++)
+        history.push(records[i]);
+    QueryApi api(&history, log_file_name);
+    HttpServer server(0, [&api](const HttpRequest& request, HttpResponse& response) { api.handle(request, response); });
+    server.start();
+    std::cout << "Serving on 127.0.0.1:" << server.port() << " with " << clients << " clients x " << requests << " requests\n";
+
+    double last_s = records.back().time_ns / 1e9;
+    std::string targets[] = {
+        "/latest",
+        "/range?from=" + std::to_string(last_s - 3600) + "&to=" + std::to_string(last_s + 1),
+        "/rollup?from=" + std::to_string(last_s - 7 * 86400) + "&to=" + std::to_string(last_s + 1) + "&step=3600",
+        "/rollup?from=" + std::to_string(last_s - 180 * 86400) + "&to=" + std::to_string(last_s - 170 * 86400) + "&step=3600",
+        "/downsample?from=" + std::to_string(last_s - 14 * 86400) + "&to=" + std::to_string(last_s + 1) + "&points=1000",
+    };
+    const char* names[] = {"latest", "range 1 h (memory)", "rollup 7 d (memory)", "rollup 10 d (log file)", "downsample 14 d (memory)"};
+
+    for (size_t t = 0; t < sizeof(names) / sizeof(names[0]); t++)
+    {
+        std::vector<std::vector<double>> latencies(clients);
+        std::vector<std::thread> threads;
+        size_t failures = 0;
+        auto t_start = std::chrono::steady_clock::now();
+        for (size_t c = 0; c < clients; c++)
+        {
+            threads.emplace_back([&, c]() {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                sockaddr_in addr = {};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(server.port());
+                inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+                int yes = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+                {
+                    failures += requests;
+                    return;
+                }
+                std::string buffer;
+                size_t n = t >= 3 ? requests / 20 + 1 : requests; // log file and downsample queries are much heavier
+                for (size_t i = 0; i < n; i++)
+                {
+                    auto t_request = std::chrono::steady_clock::now();
+                    if (http_get(fd, targets[t], buffer) < 0)
+                    {
+                        failures++;
+                        break;
+                    }
+                    latencies[c].push_back(seconds_since(t_request) * 1e6);
+                }
+                close(fd);
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+        double elapsed = seconds_since(t_start);
+        std::vector<double> all;
+        for (const std::vector<double>& l : latencies)
+            all.insert(all.end(), l.begin(), l.end());
+        std::cout << std::left << std::setw(24) << names[t] << std::right << std::fixed << std::setprecision(0) << std::setw(9) << all.size() / elapsed << " req/s"
+                  << "  p50 " << std::setw(7) << percentile(all, 0.5) << " us  p99 " << std::setw(7) << percentile(all, 0.99) << " us  ("
+                  << buffer_size_hint(targets[t], server.port()) << " bytes, " << failures << " failures)\n";
+    }
+
+    // malformed, out of range and oversized requests are turned away before reading anything
+    std::string rejected[] = {
+        "/range?from=12abc",
+        "/range?to=inf",
+        "/range?to=nan",
+        "/range?to=1e300",
+        "/range?from=-1",
+        "/range?from=0&to=" + std::to_string(last_s + 1),
+        "/rollup?from=0&to=" + std::to_string(last_s + 1) + "&step=1e300",
+        "/downsample?step=1e30",
+        "/export?step=5e9",
+    };
+    size_t accepted = 0;
+    for (const std::string& target : rejected)
+    {
+        size_t question = target.find('?');
+        HttpRequest request;
+        request.method = "GET";
+        request.path = std::string_view(target).substr(0, question);
+        request.query = std::string_view(target).substr(question + 1);
+        HttpResponse response;
+        api.handle(request, response);
+        if (response.status != 400)
+        {
+            std::cout << target << " answered " << response.status << "\n";
+            accepted++;
+        }
+    }
+    std::cout << sizeof(rejected) / sizeof(rejected[0]) - accepted << " of " << sizeof(rejected) / sizeof(rejected[0]) << " bad requests rejected\n";
+    server.stop();
+    remove(log_file_name);
+    return accepted == 0 ? 0 : 1;
+}
+
+// every field derived from the sequence number, so a torn read is detectable
+static LogRecord sequence_record(__u64 sequence)
+{
+    LogRecord record;
+    record.time_ns = 1760000000000000000LL + static_cast<__s64>(sequence) * 1000000LL;
+    for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        record.values[ch] = static_cast<float>(sequence % 1000000) + ch;
+    record.ret_code = static_cast<__s32>(sequence);
+    return record;
+}
+
+static bool is_consistent(const LogRecord& record)
+{
+    __u64 sequence = (record.time_ns - 1760000000000000000LL) / 1000000LL;
+    if (record.ret_code != static_cast<__s32>(sequence))
+        return false;
+    for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        if (record.values[ch] != static_cast<float>(sequence % 1000000) + ch)
+            return false;
+    return true;
+}
+
+static int bench_shm(int argc, char* argv[])
+{
+    size_t max_readers = argc > 0 ? std::stoul(argv[0]) : 2 * std::thread::hardware_concurrency();
+    double duration = argc > 1 ? std::stod(argv[1]) : 1.0;
+    const char* name = "/temperature_logger_benchmark";
+
+    SharedSamplesWriter writer(name);
+    // the writer publishes the latest slot flat out and pushes a ring record every 100 samples,
+    // far more than the logger's 10 samples and one record per minute
+    std::cout << "Writer flat out, " << duration << " s per row, seqlock retries per 1000 reads\n";
+    std::cout << "readers   writes/s   write ns   reads/s/reader   retries   ring copies/s   torn\n";
+    for (size_t readers = 0; readers <= max_readers; readers = readers == 0 ? 1 : readers * 2)
+    {
+        std::atomic<bool> running{true};
+        std::atomic<__u64> total_reads{0}, total_retries{0}, total_copies{0}, torn{0};
+        std::vector<std::thread> threads;
+        for (size_t r = 0; r < readers; r++)
+        {
+            threads.emplace_back([&]() {
+                SharedSamplesReader reader(name); // own mapping, as another process would have
+                LogRecord record;
+                std::vector<LogRecord> ring;
+                __u64 reads = 0, copies = 0, bad = 0;
+                while (running.load(std::memory_order_relaxed))
+                {
+                    if (reader.latest(record) && !is_consistent(record))
+                        bad++;
+                    if (++reads % 4096 == 0)
+                    {
+                        ring.clear();
+                        reader.copy_since(record.time_ns - 100 * 1000000LL * 100, ring); // about 100 ring records
+                        for (const LogRecord& r : ring)
+                            bad += !is_consistent(r);
+                        copies++;
+                    }
+                }
+                total_reads += reads;
+                total_retries += reader.retries();
+                total_copies += copies;
+                torn += bad;
+            });
+        }
+
+        __u64 writes = 0;
+        auto t_start = std::chrono::steady_clock::now();
+        while (seconds_since(t_start) < duration)
+        {
+            for (size_t i = 0; i < 1000; i++, writes++)
+            {
+                LogRecord record = sequence_record(writes);
+                writer.publish_latest(record);
+                if (writes % 100 == 0)
+                    writer.push(record);
+            }
+        }
+        double elapsed = seconds_since(t_start);
+        running = false;
+        for (std::thread& thread : threads)
+            thread.join();
+
+        std::cout << std::setw(7) << readers << std::fixed << std::setprecision(0) << std::setw(11) << writes / elapsed << std::setprecision(1) << std::setw(11) << elapsed * 1e9 / writes
+                  << std::setprecision(0) << std::setw(17) << (readers > 0 ? total_reads / elapsed / readers : 0) << std::setprecision(2) << std::setw(10)
+                  << (total_reads > 0 ? 1000.0 * total_retries / total_reads : 0) << std::setprecision(0) << std::setw(16) << total_copies / elapsed << std::setw(7) << torn << "\n";
+        if (readers == max_readers)
+            break;
+    }
+
+    // a logger killed inside publish_latest() leaves the sequence odd: readers give up, a restarted writer repairs it
+    int fd = shm_open(name, O_RDWR, 0);
+    void* data = mmap(nullptr, sizeof(SharedSamplesHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    static_cast<SharedSamplesHeader*>(data)->latest.sequence.fetch_or(1);
+    munmap(data, sizeof(SharedSamplesHeader));
+    SharedSamplesReader reader(name);
+    LogRecord record;
+    auto t_start = std::chrono::steady_clock::now();
+    bool stuck_read = reader.latest(record);
+    double stuck_s = seconds_since(t_start);
+    SharedSamplesWriter restarted(name);
+    bool repaired_read = reader.latest(record);
+    std::cout << "Crashed writer: latest() " << (stuck_read ? "read" : "gave up") << " after " << std::setprecision(3) << stuck_s << " s, after restart "
+              << (repaired_read ? "read" : "gave up") << "\n";
+    writer.unlink();
+    return stuck_read || !repaired_read;
+}
+
+static int stream_connect(const char* path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        throw std::runtime_error("cannot connect to the stream");
+    return fd;
+}
+
+static __s64 wall_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static int bench_stream(int argc, char* argv[])
+{
+    size_t subscribers = argc > 0 ? std::stoul(argv[0]) : 32;
+    double rate = argc > 1 ? std::stod(argv[1]) : 2000;
+    double duration = argc > 2 ? std::stod(argv[2]) : 3.0;
+    const char* path = "/tmp/temperature_logger_benchmark.sock";
+    size_t frames = static_cast<size_t>(rate * duration);
+
+    SampleStream stream(path);
+    stream.start();
+
+    // one subscriber that connects and never reads, it has to be evicted without slowing anyone down
+    int stuck = stream_connect(path);
+    std::vector<std::vector<double>> latencies(subscribers);
+    std::vector<size_t> received(subscribers, 0);
+    std::vector<std::thread> threads;
+    for (size_t s = 0; s < subscribers; s++)
+    {
+        threads.emplace_back([&, s]() {
+            int fd = stream_connect(path);
+            latencies[s].reserve(frames);
+            __u8 buffer[STREAM_FRAME_SIZE * 64];
+            size_t filled = 0;
+            while (true)
+            {
+                ssize_t n = read(fd, buffer + filled, sizeof(buffer) - filled);
+                if (n <= 0)
+                    break;
+                __s64 now = wall_clock_ns();
+                filled += n;
+                size_t whole = filled / STREAM_FRAME_SIZE * STREAM_FRAME_SIZE;
+                for (size_t offset = 0; offset < whole; offset += STREAM_FRAME_SIZE)
+                {
+                    LogRecord record;
+                    memcpy(&record, buffer + offset + 4, sizeof(record));
+                    if (record.ret_code < 0)
+                    {
+                        close(fd);
+                        return; // end marker
+                    }
+                    latencies[s].push_back((now - record.time_ns) / 1e3);
+                    received[s]++;
+                }
+                memmove(buffer, buffer + whole, filled - whole);
+                filled -= whole;
+            }
+            close(fd);
+        });
+    }
+    while (stream.subscribers() < subscribers + 1)
+        usleep(1000);
+
+    // paced like the sampling loop, only much faster
+    std::vector<double> publish_us;
+    publish_us.reserve(frames);
+    LogRecord record = synthetic_record(0);
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    __s64 period_ns = static_cast<__s64>(1e9 / rate);
+    for (size_t i = 0; i < frames; i++)
+    {
+        deadline.tv_nsec += period_ns;
+        while (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+        record.time_ns = wall_clock_ns();
+        record.ret_code = 0;
+        auto t_start = std::chrono::steady_clock::now();
+        stream.publish(i % 60 == 59 ? FRAME_AVERAGE : FRAME_RAW, record);
+        publish_us.push_back(seconds_since(t_start) * 1e6);
+    }
+    record.ret_code = -1;
+    stream.publish(FRAME_RAW, record);
+    for (std::thread& thread : threads)
+        thread.join();
+    close(stuck);
+
+    std::vector<double> all;
+    size_t lost = 0;
+    for (size_t s = 0; s < subscribers; s++)
+    {
+        all.insert(all.end(), latencies[s].begin(), latencies[s].end());
+        lost += frames - received[s];
+    }
+    std::cout << subscribers << " subscribers + 1 stuck, " << frames << " frames at " << rate << " Hz\n" << std::fixed << std::setprecision(1);
+    std::cout << "publish()          p50 " << std::setw(7) << percentile(publish_us, 0.5) << " us  p99 " << std::setw(7) << percentile(publish_us, 0.99) << " us  max " << std::setw(7) << percentile(publish_us, 1.0) << " us\n";
+    std::cout << "delivery latency   p50 " << std::setw(7) << percentile(all, 0.5) << " us  p99 " << std::setw(7) << percentile(all, 0.99) << " us  max " << std::setw(7) << percentile(all, 1.0) << " us\n";
+    std::cout << "frames lost by live subscribers: " << lost << ", evicted subscribers: " << stream.evictions() << "\n";
+    return 0;
+}
+
+static int bench_metrics(int argc, char* argv[])
+{
+    size_t n = argc > 0 ? std::stoul(argv[0]) : 10000000;
+    size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+
+    // what an I2C transfer pays: two clock reads, a histogram observation and a byte counter
+    I2cDeviceMetrics& device = metrics.i2c[0x77];
+    device.name = "bme280";
+    const char* names[] = {"counter add", "histogram observe", "clock + observe + bytes"};
+    std::cout << "CPU ns per operation, all threads hammering the same series\nthreads";
+    for (const char* name : names)
+        std::cout << std::setw(26) << name;
+    std::cout << "\n";
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        std::cout << std::setw(7) << threads;
+        for (__u8 op = 0; op < 3; op++)
+        {
+            std::vector<std::thread> workers;
+            auto t_start = std::chrono::steady_clock::now();
+            for (size_t t = 0; t < threads; t++)
+            {
+                workers.emplace_back([&, op, t]() {
+                    for (size_t i = 0; i < n / threads; i++)
+                    {
+                        if (op == 0)
+                            device.read_bytes.add(1);
+                        else if (op == 1)
+                            device.read_latency.observe_ns((i * 2654435761u + t) % 2000000);
+                        else
+                        {
+                            __u64 t_op = monotonic_ns();
+                            device.write_latency.observe_since(t_op);
+                            device.write_bytes.add(2);
+                        }
+                    }
+                });
+            }
+            for (std::thread& worker : workers)
+                worker.join();
+            std::cout << std::setw(26) << std::fixed << std::setprecision(2) << seconds_since(t_start) * 1e9 * threads / n;
+        }
+        std::cout << "\n";
+    }
+
+    for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        metrics.sensor[ch].set(synthetic_record(0).values[ch]);
+    std::string text;
+    size_t exports = 10000;
+    auto t_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < exports; i++)
+        metrics.write_text(text);
+    std::cout << "export: " << std::setprecision(1) << seconds_since(t_start) * 1e6 / exports << " us for " << text.size() << " bytes of text\n";
+    return 0;
+}
+
+static int bench_trace(int argc, char* argv[])
+{
+    size_t n = argc > 0 ? std::stoul(argv[0]) : 10000000;
+    const char* file_name = argc > 1 ? argv[1] : "/tmp/benchmark_i2c_trace.json";
+
+    // the bus checks the flag on every operation; the timestamps are taken for the metrics anyway
+    auto run = [n](size_t threads) {
+        std::vector<std::thread> workers;
+        auto t_start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < threads; t++)
+        {
+            workers.emplace_back([n, t]() {
+                __u64 now = monotonic_ns();
+                for (size_t i = 0; i < n; i++)
+                {
+                    if (i2c_trace_enabled.load(std::memory_order_relaxed))
+                        I2cTracer::record(static_cast<trace_op>(i % 3), 0x76 + (t & 1), i % 9, now + i * 1000, now + i * 1000 + 300, true);
+                }
+            });
+        }
+        for (std::thread& worker : workers)
+            worker.join();
+        return seconds_since(t_start) * 1e9 / n;
+    };
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "disabled                " << std::setw(8) << run(1) << " ns per operation\n";
+    I2cTracer::enable(file_name);
+    std::cout << "enabled, 1 thread       " << std::setw(8) << run(1) << " ns per operation\n";
+    std::cout << "enabled, 4 threads      " << std::setw(8) << run(4) << " ns per operation and thread\n";
+
+    auto t_start = std::chrono::steady_clock::now();
+    I2cTracer::dump_now();
+    std::ifstream dump(file_name, std::ios::ate);
+    std::cout << "dump of the full rings  " << std::setw(8) << seconds_since(t_start) * 1e3 << " ms, " << dump.tellg() / 1024 << " KiB in " << file_name << "\n";
+    return 0;
+}
+
+static int bench_journal(int argc, char* argv[])
+{
+    size_t n = argc > 0 ? std::stoul(argv[0]) : 2000;
+    std::string file_name = argc > 1 ? argv[1] : "benchmark_journal"; // on the storage to measure, /tmp may be a tmpfs
+
+    std::vector<__u8> bytes(1 << 20);
+    for (size_t i = 0; i < bytes.size(); i++)
+        bytes[i] = static_cast<__u8>(i * 2654435761u >> 13);
+    __u32 check = crc32c("123456789", 9);
+    auto t_start = std::chrono::steady_clock::now();
+    __u32 crc = 0;
+    for (int i = 0; i < 256; i++)
+        crc = crc32c(bytes.data(), bytes.size(), crc);
+    std::cout << std::fixed << std::setprecision(0);
+    std::cout << "crc32c " << (check == 0xE3069283 ? "ok" : "WRONG") << ", " << 256 / seconds_since(t_start) << " MB/s (checksum " << crc << ")\n\n";
+
+    // one LogRecord per append, as the store does once a minute
+    struct Mode
+    {
+        const char* name;
+        SyncPolicy policy;
+    };
+    const Mode modes[] = {
+        {"always", SyncPolicy(SYNC_ALWAYS)},
+        {"batch 16", SyncPolicy(SYNC_BATCH, 16)},
+        {"batch 256", SyncPolicy(SYNC_BATCH, 256)},
+        {"none", SyncPolicy(SYNC_NONE)},
+    };
+    std::cout << "mode          records/s   p50 us   p99 us  max us  lost on power cut\n";
+    for (const Mode& mode : modes)
+    {
+        unlink(file_name.c_str());
+        std::vector<double> latencies;
+        latencies.reserve(n);
+        double total;
+        {
+            Journal journal(file_name, mode.policy);
+            t_start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < n; i++)
+            {
+                LogRecord record = synthetic_record(i);
+                __u64 t_append = monotonic_ns();
+                journal.append(&record, sizeof(record));
+                latencies.push_back((monotonic_ns() - t_append) / 1e3);
+            }
+            total = seconds_since(t_start);
+        }
+        const char* lost = mode.policy.mode() == SYNC_ALWAYS ? "nothing" : mode.policy.mode() == SYNC_BATCH ? "one batch" : "~30 s of writeback";
+        double max = *std::max_element(latencies.begin(), latencies.end());
+        std::cout << std::left << std::setw(12) << mode.name << std::right << std::setw(11) << n / total << std::setprecision(1) << std::setw(9) << percentile(latencies, 0.5)
+                  << std::setw(9) << percentile(latencies, 0.99) << std::setw(8) << std::setprecision(0) << max << "  " << lost << "\n";
+    }
+
+    // recovery after a power cut: a large synced journal with a torn frame at its end
+    size_t big = 1000000;
+    unlink(file_name.c_str());
+    {
+        Journal journal(file_name, SyncPolicy(SYNC_NONE));
+        for (size_t i = 0; i < big; i++)
+        {
+            LogRecord record = synthetic_record(i);
+            journal.append(&record, sizeof(record));
+        }
+        journal.sync();
+        for (size_t i = 0; i < 100; i++)
+        {
+            LogRecord record = synthetic_record(big + i); // unsynced tail
+            journal.append(&record, sizeof(record));
+        }
+    }
+    auto tear = [&file_name]() {
+        int file = open(file_name.c_str(), O_WRONLY | O_APPEND);
+        __u8 half_frame[JOURNAL_FRAME_HEADER + sizeof(LogRecord) / 2] = {sizeof(LogRecord)};
+        bool ok = write(file, half_frame, sizeof(half_frame)) == sizeof(half_frame);
+        close(file);
+        return ok;
+    };
+    auto reopen = [&file_name](const char* name) {
+        auto t_open = std::chrono::steady_clock::now();
+        Journal journal(file_name, SyncPolicy(SYNC_NONE));
+        double seconds = seconds_since(t_open);
+        size_t records = 0;
+        journal.for_each([&records](const __u8*, __u32) { records++; });
+        std::cout << std::left << std::setw(28) << name << std::right << std::setprecision(2) << std::setw(9) << seconds * 1e3 << " ms, scanned " << std::setprecision(1)
+                  << std::setw(7) << journal.recovered_bytes() / 1024.0 << " KiB, cut " << journal.truncated_bytes() << " bytes, " << records << " records left\n";
+    };
+    std::cout << "\nrecovery of " << big << " records (" << big * (JOURNAL_FRAME_HEADER + sizeof(LogRecord)) / 1e6 << " MB) with a torn frame at the end\n";
+    if (!tear())
+        return 1;
+    reopen("from the synced end");
+    if (!tear())
+        return 1;
+    {
+        // without a valid header hint the whole file is scanned, as a plain log would need
+        int file = open(file_name.c_str(), O_WRONLY);
+        __u8 zero[4] = {};
+        bool ok = pwrite(file, zero, 4, 16) == 4;
+        close(file);
+        if (!ok)
+            return 1;
+    }
+    reopen("whole file (bad header crc)");
+
+    // the gorilla store over a crash: two flushed blocks, the open block in its journal and a torn block
+    std::string store_name = file_name + ".gorilla";
+    unlink(store_name.c_str());
+    unlink((store_name + ".wal").c_str());
+    size_t store_records = 2 * 1440 + 500;
+    {
+        GorillaStore store(store_name, 1440, SyncPolicy(SYNC_NONE));
+        for (size_t i = 0; i < store_records; i++)
+            store.append(synthetic_record(i));
+    }
+    {
+        int file = open(store_name.c_str(), O_WRONLY | O_APPEND);
+        bool ok = write(file, "GORB torn", 9) == 9;
+        close(file);
+        if (!ok)
+            return 1;
+    }
+    {
+        GorillaStore store(store_name, 1440, SyncPolicy(SYNC_NONE));
+        store.flush();
+    }
+    std::vector<LogRecord> decoded;
+    GorillaStore::read_all(store_name, decoded);
+    size_t mismatches = decoded.size() == store_records ? 0 : store_records;
+    for (size_t i = 0; i < decoded.size() && i < store_records; i++)
+        if (decoded[i].time_ns != synthetic_record(i).time_ns)
+            mismatches++;
+    std::cout << "\ngorilla store after a crash: " << decoded.size() << " of " << store_records << " records, " << mismatches << " mismatches\n";
+    unlink(file_name.c_str());
+    unlink(store_name.c_str());
+    unlink((store_name + ".wal").c_str());
+    return check == 0xE3069283 && mismatches == 0 ? 0 : 1;
+}
+
+#define RESTART_DELAY_MIN_NS 500000000ULL // RESTART_DELAY_MIN and _MAX of main.cpp
+#define RESTART_DELAY_MAX_NS 10000000000ULL
+
+// fault kinds injected into a simulated device
+enum fault_kind
+{
+    FAULT_NACK,   // one failed transfer
+    FAULT_OUTAGE, // transfers and initialization fail for the duration (unplugged, bus stuck)
+    FAULT_RESET   // brown-out: transfers fail until the device is initialized again
+};
+
+struct SimulatedDevice
+{
+    const char* name;
+    __u8 channels; // logged channels that depend on it
+    __u64 fault_start_ns = UINT64_MAX, fault_end_ns = 0;
+    fault_kind kind = FAULT_NACK;
+    bool needs_init = false;
+
+    void operate(__u64 now_ns)
+    {
+        bool in_fault = now_ns >= fault_start_ns && now_ns < fault_end_ns;
+        if (kind == FAULT_NACK && in_fault)
+        {
+            fault_end_ns = 0; // only the first attempt fails
+            throw std::runtime_error(std::string(name) + ": NACK");
+        }
+        if (kind == FAULT_OUTAGE && in_fault)
+            throw std::runtime_error(std::string(name) + ": no answer");
+        if (kind == FAULT_RESET && now_ns >= fault_start_ns && fault_end_ns != 0)
+        {
+            needs_init = true;
+            fault_end_ns = 0;
+        }
+        if (needs_init)
+            throw std::runtime_error(std::string(name) + ": not configured");
+    }
+
+    void init(__u64 now_ns)
+    {
+        if (kind == FAULT_OUTAGE && now_ns >= fault_start_ns && now_ns < fault_end_ns)
+            throw std::runtime_error(std::string(name) + ": no answer");
+        needs_init = false;
+    }
+};
+
+struct FaultScenario
+{
+    const char* name;
+    __u8 device;
+    fault_kind kind;
+    double duration_s;
+};
+
+static int bench_faults(int argc, char* argv[])
+{
+    double init_s = argc > 0 ? std::stod(argv[0]) : 3.0; // time a full restart spends bringing the devices up
+    const __u64 second = 1000000000ULL, run_ns = 2 * 3600 * second, fault_at = 1800 * second;
+    const FaultScenario scenarios[] = {
+        {"display NACK", 0, FAULT_NACK, 1},
+        {"display unplugged 30 min", 0, FAULT_OUTAGE, 1800},
+        {"exterior sensor NACK", 2, FAULT_NACK, 1},
+        {"exterior sensor out 5 min", 2, FAULT_OUTAGE, 300},
+        {"interior sensor brown-out", 1, FAULT_RESET, 0},
+        {"adc out 20 s", 3, FAULT_OUTAGE, 20},
+        {"servo driver NACK", 4, FAULT_NACK, 1},
+    };
+
+    std::cout << "1 Hz samples for 2 h, fault injected after 30 min, a restart costs " << init_s << " s of initialization\n";
+    std::cout << "channel-seconds lost and loss window in s, per fault:\n";
+    std::cout << std::left << std::setw(28) << "fault" << std::right << std::setw(14) << "health lost" << std::setw(10) << "window" << std::setw(8) << "reinit"
+              << std::setw(14) << "restart lost" << std::setw(10) << "window" << "\n";
+    for (const FaultScenario& scenario : scenarios)
+    {
+        __u64 lost[2] = {0, 0}, first_loss[2] = {UINT64_MAX, UINT64_MAX}, last_loss[2] = {0, 0};
+        __u32 reinits = 0;
+        for (__u8 mode = 0; mode < 2; mode++)
+        {
+            std::vector<SimulatedDevice> devices = {{"ssd1306", 0}, {"bme280 interior", 3}, {"bme280 exterior", 3}, {"ads1115", 1}, {"pca9685", 0}};
+            SimulatedDevice& faulty = devices[scenario.device];
+            faulty.kind = scenario.kind;
+            faulty.fault_start_ns = fault_at;
+            faulty.fault_end_ns = fault_at + static_cast<__u64>(std::max(scenario.duration_s, 1.0) * second);
+
+            auto lose = [&](__u64 now, __u64 channels) {
+                lost[mode] += channels;
+                first_loss[mode] = std::min(first_loss[mode], now);
+                last_loss[mode] = std::max(last_loss[mode], now + second);
+            };
+
+            if (mode == 0)
+            {
+                // per device health, as the logger runs now
+                __u64 now = 0;
+                std::vector<DeviceHealth> health;
+                for (size_t d = 0; d < devices.size(); d++)
+                    health.emplace_back(devices[d].name, [&devices, d, &now]() { devices[d].init(now); }, nullptr, d == 4 ? 0 : DEVICE_RETRIES);
+                for (; now < run_ns; now += second)
+                {
+                    for (size_t d = 0; d < devices.size(); d++)
+                    {
+                        if (!health[d].run(now, [&]() { devices[d].operate(now); }))
+                            lose(now, devices[d].channels);
+                    }
+                }
+                for (const DeviceHealth& h : health)
+                    reinits += h.reinits();
+            }
+            else
+            {
+                // the old behaviour: any exception restarts everything, with the doubling restart delay
+                __u64 restart_delay = RESTART_DELAY_MIN_NS;
+                __u64 last_restart = 0;
+                for (__u64 now = 0; now < run_ns;)
+                {
+                    try
+                    {
+                        for (SimulatedDevice& device : devices)
+                        {
+                            if (scenario.kind == FAULT_RESET && &device == &faulty)
+                            {
+                                // a BME280 that lost its configuration returned a code instead of throwing,
+                                // the sampling loop logged garbage until something else restarted it
+                                try
+                                {
+                                    device.operate(now);
+                                }
+                                catch (const std::runtime_error&)
+                                {
+                                    lose(now, device.channels);
+                                }
+                                continue;
+                            }
+                            device.operate(now);
+                        }
+                        now += second;
+                    }
+                    catch (const std::runtime_error&)
+                    {
+                        if (now - last_restart > 600 * second)
+                            restart_delay = RESTART_DELAY_MIN_NS;
+                        __u64 down = restart_delay + static_cast<__u64>(init_s * second);
+                        for (__u64 t = now; t < now + down && t < run_ns; t += second)
+                            lose(t, LOG_CHANNELS);
+                        now += down;
+                        last_restart = now;
+                        restart_delay = std::min(restart_delay * 2, RESTART_DELAY_MAX_NS);
+                        try
+                        {
+                            for (SimulatedDevice& device : devices)
+                                device.init(now);
+                        }
+                        catch (const std::runtime_error&)
+                        {
+                            // initialization failed too, the next sample attempt restarts again
+                        }
+                    }
+                }
+            }
+        }
+        std::cout << std::left << std::setw(28) << scenario.name << std::right;
+        for (__u8 mode = 0; mode < 2; mode++)
+        {
+            std::cout << std::setw(14) << lost[mode] << std::setw(10) << (lost[mode] > 0 ? (last_loss[mode] - first_loss[mode]) / second : 0);
+            if (mode == 0)
+                std::cout << std::setw(8) << reinits;
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+// the webapp.py formulas in double precision, the reference for the kernel
+static void derive_reference(double T, double H, double P, double altitude_m, double out[4])
+{
+    double magnus = 17.27 * T / (T + 237.3);
+    double vapor = H / 100.0 * 0.0061078 * exp(magnus);
+    double gamma = log(H / 100.0) + magnus;
+    out[0] = 1000.0 * vapor / (1.6078 * P - 0.6078 * vapor);
+    out[1] = 237.3 * gamma / (17.27 - gamma);
+    out[2] = 216.7 * 1000.0 * vapor / (T + 273.15);
+    out[3] = P * pow(1.0 - 0.0065 * altitude_m / (T + 0.0065 * altitude_m + 273.15), -5.257);
+}
+
+static int bench_derived(int argc, char* argv[])
+{
+    size_t n = argc > 0 ? std::stoul(argv[0]) : 1000000;
+    const float altitude_m = 450.0f;
+
+    // accuracy over the range the sensors can report
+    std::vector<float> T, H, P;
+    for (float t = -40.0f; t <= 60.0f; t += 0.25f)
+        for (float h = 1.0f; h <= 100.0f; h += 0.5f)
+            for (float p = 0.8f; p <= 1.1f; p += 0.05f)
+            {
+                T.push_back(t);
+                H.push_back(h);
+                P.push_back(p);
+            }
+    size_t grid = T.size();
+    std::vector<float> out[4];
+    for (std::vector<float>& column : out)
+        column.resize(grid);
+    derive_humidity(T.data(), H.data(), P.data(), grid, altitude_m, out[0].data(), out[1].data(), out[2].data(), out[3].data());
+    const char* names[4] = {"specific humidity", "dew point", "absolute humidity", "sea level pressure"};
+    double max_error[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t i = 0; i < grid; i++)
+    {
+        double reference[4];
+        derive_reference(T[i], H[i], P[i], altitude_m, reference);
+        for (__u8 d = 0; d < 4; d++)
+            max_error[d] = std::max(max_error[d], fabs(out[d][i] - reference[d]) / std::max(1.0, fabs(reference[d])));
+    }
+    bool accurate = true;
+    std::cout << "accuracy over " << grid << " points of T -40..60 degC, H 1..100 %, P 0.8..1.1 bar, relative to max(1, |x|):\n";
+    for (__u8 d = 0; d < 4; d++)
+    {
+        accurate &= max_error[d] < 1e-5;
+        std::cout << "  " << std::left << std::setw(20) << names[d] << std::right << std::scientific << std::setprecision(2) << max_error[d] << "\n";
+    }
+    std::cout << (accurate ? "within" : "NOT within") << " 1e-5\n" << std::fixed;
+
+    // throughput, the kernel on arrays vs the libm formulas one record at a time
+    std::vector<LogRecord> records(n);
+    for (size_t i = 0; i < n; i++)
+        records[i] = synthetic_record(i);
+    std::vector<float> columns[3];
+    for (__u8 c = 0; c < 3; c++)
+    {
+        columns[c].resize(n);
+        for (size_t i = 0; i < n; i++)
+            columns[c][i] = records[i].values[CH_T_INTERIOR + c];
+    }
+    for (std::vector<float>& column : out)
+        column.resize(n);
+    float sink = 0.0f;
+
+    auto t_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+    {
+        float t = columns[0][i], h = columns[1][i], p = columns[2][i];
+        float magnus = 17.27f * t / (t + 237.3f);
+        float vapor = h / 100.0f * 0.0061078f * expf(magnus);
+        float gamma = logf(h / 100.0f) + magnus;
+        out[0][i] = 1000.0f * vapor / (1.6078f * p - 0.6078f * vapor);
+        out[1][i] = 237.3f * gamma / (17.27f - gamma);
+        out[2][i] = 216.7f * 1000.0f * vapor / (t + 273.15f);
+        out[3][i] = p * powf(1.0f - 0.0065f * altitude_m / (t + 0.0065f * altitude_m + 273.15f), -5.257f);
+    }
+    double libm_seconds = seconds_since(t_start);
+    sink += out[0][n / 2];
+
+    t_start = std::chrono::steady_clock::now();
+    derive_humidity(columns[0].data(), columns[1].data(), columns[2].data(), n, altitude_m, out[0].data(), out[1].data(), out[2].data(), out[3].data());
+    double kernel_seconds = seconds_since(t_start);
+    sink += out[0][n / 2];
+
+    t_start = std::chrono::steady_clock::now();
+    DerivedRecord derived;
+    for (size_t i = 0; i < n; i++)
+    {
+        derive(records[i], altitude_m, derived);
+        sink += derived.values[DV_Q_INTERIOR];
+    }
+    double record_seconds = seconds_since(t_start);
+
+    std::cout << std::setprecision(2) << "ns per sample (" << n << " samples, 4 derived values each):\n"
+              << "  libm formulas, scalar    " << std::setw(8) << libm_seconds * 1e9 / n << "\n"
+              << "  batch kernel             " << std::setw(8) << kernel_seconds * 1e9 / n << "\n"
+              << "  derive() per record      " << std::setw(8) << record_seconds * 1e9 / n << "  (interior and exterior)\n"
+              << (sink == 0.0f ? " " : "");
+    return accurate ? 0 : 1;
+}
+
+// mean distance between the raw points and the line through the kept points, and how many of
+// the spikes at spike_times were kept
+static void fidelity(const std::vector<__s64>& time_ns, const std::vector<float>& values, const Series& kept, const std::vector<__s64>& spike_times,
+                     double& mean_error, size_t& spikes_kept)
+{
+    mean_error = 0.0;
+    size_t k = 0;
+    for (size_t i = 0; i < time_ns.size(); i++)
+    {
+        while (k + 2 < kept.time_ns.size() && kept.time_ns[k + 1] <= time_ns[i])
+            k++;
+        double t0 = kept.time_ns[k], t1 = kept.time_ns[k + 1];
+        double line = kept.values[k] + (kept.values[k + 1] - kept.values[k]) * (time_ns[i] - t0) / (t1 - t0);
+        mean_error += fabs(values[i] - line) / time_ns.size();
+    }
+    spikes_kept = 0;
+    for (__s64 spike : spike_times)
+        spikes_kept += std::binary_search(kept.time_ns.begin(), kept.time_ns.end(), spike);
+}
+
+static int bench_downsample(int argc, char* argv[])
+{
+    size_t n = argc > 0 ? std::stoul(argv[0]) : 56 * 1440 * 4; // 56 days at four records a minute
+    size_t points = argc > 1 ? std::stoul(argv[1]) : 1000;
+
+    // a daily cycle with noise and a few one-sample spikes, the case stride subsampling gets wrong
+    std::mt19937 random(42);
+    std::normal_distribution<float> noise(0.0f, 0.05f);
+    std::vector<__s64> time_ns(n);
+    std::vector<float> columns[LOG_CHANNELS];
+    std::vector<__s64> spike_times;
+    for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        columns[ch].resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        time_ns[i] = 1760000000000000000LL + static_cast<__s64>(i) * 15000000000LL;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            columns[ch][i] = 10.0f * (ch + 1) + 5.0f * sinf(6.2831853f * i / 5760.0f + ch) + noise(random);
+    }
+    for (size_t s = 1; s <= 20; s++)
+    {
+        size_t i = n * s / 21 + random() % 97;
+        columns[0][i] += s % 2 == 0 ? 8.0f : -8.0f;
+        spike_times.push_back(time_ns[i]);
+    }
+
+    std::cout << n << " samples per channel down to " << points << " points, fidelity on the first channel:\n"
+              << "method     ms per channel mean line error spikes kept\n";
+    Series kept;
+    const char* names[] = {"stride", "lttb", "minmax"};
+    for (__u8 method = 0; method < 3; method++)
+    {
+        auto t_start = std::chrono::steady_clock::now();
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            if (method == 0)
+            {
+                kept.clear();
+                size_t stride = (n + points - 1) / points;
+                for (size_t i = 0; i < n; i += stride)
+                    kept.add(time_ns[i], columns[ch][i]);
+            }
+            else if (method == 1)
+                lttb(time_ns.data(), columns[ch].data(), n, points, kept);
+            else
+                minmax(time_ns.data(), columns[ch].data(), n, points, kept);
+            if (ch == 0)
+            {
+                double ms = seconds_since(t_start) * 1e3, mean_error;
+                size_t spikes_kept;
+                fidelity(time_ns, columns[0], kept, spike_times, mean_error, spikes_kept);
+                std::cout << std::left << std::setw(11) << names[method] << std::right << std::fixed << std::setprecision(3) << std::setw(14) << ms
+                          << std::setw(16) << mean_error << std::setw(10) << spikes_kept << "/" << spike_times.size() << "\n";
+                t_start = std::chrono::steady_clock::now();
+            }
+        }
+    }
+
+    // the endpoint path: missing values dropped, every channel on its own thread
+    std::vector<const float*> pointers;
+    for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        pointers.push_back(columns[ch].data());
+    std::vector<Series> out;
+    std::cout << "all " << int(LOG_CHANNELS) << " channels, lttb:\n";
+    for (unsigned threads = 1;; threads = std::min(threads * 2, std::max(1u, std::thread::hardware_concurrency())))
+    {
+        auto t_start = std::chrono::steady_clock::now();
+        downsample_columns(time_ns, pointers, points, DOWNSAMPLE_LTTB, threads, out);
+        std::cout << std::setw(3) << threads << " threads  " << std::setw(8) << seconds_since(t_start) * 1e3 << " ms\n";
+        if (threads >= std::thread::hardware_concurrency())
+            break;
+    }
+    return 0;
+}
+
+// I2C bytes of the former screen refresh: clear_display, then set_cursor and put_char per character of each line
+static size_t text_refresh_bytes(const std::vector<std::string>& lines, __u8 chars_in_line[8])
+{
+    size_t bytes = 0;
+    for (__u8 page = 0; page < 8; page++)
+    {
+        bytes += 6 + chars_in_line[page] * 8 + 1;
+        chars_in_line[page] = 0;
+    }
+    bytes += 6;
+    for (size_t line = 0; line < lines.size(); line++)
+    {
+        bytes += 6 + lines[line].size() * 9;
+        chars_in_line[line] = lines[line].size();
+    }
+    return bytes;
+}
+
+static int bench_display(int argc, char* argv[])
+{
+    size_t hours = argc > 0 ? std::stoul(argv[0]) : 12;
+
+    DisplayViews views;
+    LogRecord sample;
+    __u8 chars_in_line[8];
+    memset(chars_in_line, 16, 8);
+    size_t seconds = hours * 3600, old_bytes = 0, new_bytes = 0, runs = 0;
+    double render_seconds = 0.0;
+    for (size_t s = 0; s < seconds; s++)
+    {
+        sample = synthetic_record(s / 60);
+        sample.time_ns += (s % 60) * 1000000000LL;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            sample.values[ch] += 0.5f * sinf(s / 2000.0f + ch) + 0.01f * (s % 7);
+        if (s % 60 == 59)
+            views.add_record(sample);
+
+        auto t_render = std::chrono::steady_clock::now();
+        views.render(sample, sample.time_ns);
+        new_bytes += views.framebuffer().flush([&](__u8, __u8, const __u8*, __u8) { runs++; });
+        render_seconds += seconds_since(t_render);
+
+        std::vector<std::string> lines = {s % 2 == 0 ? "Interior" : "Exterior"};
+        for (__u8 ch = s % 2 == 0 ? CH_T_INTERIOR : CH_T_EXTERIOR; ch < (s % 2 == 0 ? CH_T_EXTERIOR : LOG_CHANNELS); ch++)
+            lines.push_back(std::to_string(sample.values[ch]));
+        old_bytes += text_refresh_bytes(lines, chars_in_line);
+    }
+    new_bytes += runs * 7; // data register and three two byte cursor commands per run
+    std::cout << std::fixed << std::setprecision(1) << hours << " h of 1 s refreshes, bytes on the bus per refresh (ms at 400 kHz):\n"
+              << "  text pages, redrawn    " << std::setw(8) << double(old_bytes) / seconds << "  (" << old_bytes * 9 / 400.0 / seconds << " ms)\n"
+              << "  framebuffer, diffed    " << std::setw(8) << double(new_bytes) / seconds << "  (" << new_bytes * 9 / 400.0 / seconds << " ms, "
+              << double(runs) / seconds << " runs)\n"
+              << std::setprecision(2) << "render and diff: " << render_seconds * 1e6 / seconds << " us per refresh\n";
+    return 0;
+}
+
+static int bench_font(int argc, char* argv[])
+{
+    size_t n = argc > 0 ? std::stoul(argv[0]) : 1000000;
+    const char* strings[] = {"21.53C", "-4.07C", "45.2%", "1013.2hPa", "Interior"};
+    size_t chars = 0;
+    for (size_t i = 0; i < n; i++)
+        chars += strlen(strings[i % 5]);
+
+    // what put_char did per character: a byte loop from the mutable table into a stack buffer
+    static unsigned char legacy_font[sizeof(font8x8)];
+    memcpy(legacy_font, font8x8, sizeof(font8x8));
+    volatile __u8 sink = 0;
+    auto t_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+    {
+        for (const char* c = strings[i % 5]; *c != '\0'; c++)
+        {
+            char ch = *c < 32 || *c > 127 ? ' ' : *c;
+            ch -= 32;
+            __u8 buffer[1 + 8];
+            buffer[0] = 0x40;
+            for (__u8 b = 0; b < legacy_font[0]; b++)
+                buffer[b + 1] = legacy_font[ch * 8 + 2 + b];
+            sink = sink + buffer[1 + (i & 7)];
+        }
+    }
+    double legacy_seconds = seconds_since(t_start);
+    std::cout << "ns per character, " << n << " strings of " << double(chars) / n << " characters:\n"
+              << std::fixed << std::setprecision(2) << "  byte loop, 8x8 (put_char)     " << std::setw(7) << legacy_seconds * 1e9 / chars << "\n";
+
+    Framebuffer framebuffer;
+    for (__u8 scale = 1; scale <= 3; scale++)
+    {
+        for (int proportional = 0; proportional < 2; proportional++)
+        {
+            t_start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < n; i++)
+                framebuffer.text(0, (i & 3) * (scale == 3 ? 1 : 2), strings[i % 5], scale, proportional);
+            double seconds = seconds_since(t_start);
+            std::cout << "  framebuffer, " << int(scale) << "x " << (proportional ? "proportional " : "fixed        ") << "   " << std::setw(7)
+                      << seconds * 1e9 / chars << "  (" << Framebuffer::text_width("21.53C", scale, proportional) << " px for 21.53C)\n";
+        }
+    }
+    std::cout << (sink == 0xFF ? " " : "");
+    return 0;
+}
+
+// noise free values of a trace at t seconds from its start
+using Trace = std::function<void(double t, float values[LOG_CHANNELS])>;
+
+// a week with quiet nights, daily cycles and a few fast events: a window opened every morning,
+// a shower, a cold rain shower outside and a storm front
+static void synthetic_trace(double t, float values[LOG_CHANNELS])
+{
+    double day = fmod(t, 86400.0), cycle = sin(6.2831853 * day / 86400.0 - 2.0);
+    int d = static_cast<int>(t / 86400.0);
+    auto event = [day](double start, double rise_s, double decay_s) {
+        if (day < start)
+            return 0.0;
+        return day < start + rise_s ? (day - start) / rise_s : exp(-(day - start - rise_s) / decay_s);
+    };
+    values[CH_T_INTERIOR] = 21.0f + 0.5f * cycle - 3.0f * event(8 * 3600 + (d * 3 % 10) * 3600, 600, 1800);
+    values[CH_H_INTERIOR] = 45.0f + 2.0f * cycle + 20.0f * event(7 * 3600 + d * 1000, 300, 1200);
+    values[CH_P_INTERIOR] = 1.013f + 0.002f * sin(6.2831853 * t / (5 * 86400.0)) - 0.0025f * (1.0 + tanh((t - 3.5 * 86400.0) / 3600.0));
+    values[CH_T_ANALOG] = values[CH_T_INTERIOR] + 1.0f;
+    values[CH_T_EXTERIOR] = 10.0f + 5.0f * cycle - (d % 2 == 1 ? 4.0f * event(15 * 3600, 1200, 3600) : 0.0f);
+    values[CH_H_EXTERIOR] = 80.0f - 15.0f * cycle + (d % 2 == 1 ? 15.0f * event(15 * 3600, 1200, 3600) : 0.0f);
+    values[CH_P_EXTERIOR] = values[CH_P_INTERIOR] - 0.0011f;
+}
+
+struct SamplingCost
+{
+    size_t samples = 0, records = 0, log_bytes = 0;
+    double active_s = 0.0;                          // time at a level over one half
+    double mean_error[LOG_CHANNELS] = {}, max_error[LOG_CHANNELS] = {};
+};
+
+// Runs the acquisition loop of main.cpp on a virtual clock over a trace with sensor noise: samples
+// averaged into records whose length the sampler chooses. The fidelity is the distance between the
+// noise free trace and the line through the records, each placed at the middle of its samples.
+static SamplingCost simulate_sampling(const Trace& trace, double seconds, RateBounds sample_period, RateBounds record_period)
+{
+    static const float NOISE[LOG_CHANNELS] = {0.01f, 0.05f, 0.000005f, 0.2f, 0.01f, 0.05f, 0.000005f}; // BME280 at the logger settings
+    std::mt19937 random(42);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    AdaptiveSampler sampler(sample_period, record_period);
+    RecordFormatter formatter(TIMESTAMP_CTIME);
+    SamplingCost cost;
+    std::vector<double> centers;
+    std::vector<std::array<float, LOG_CHANNELS>> means;
+    LogRecord sample, record;
+    DerivedRecord derived;
+    float extra[DERIVED_CHANNELS + 1];
+    const __u64 start_ns = 1000000000ULL; // the sampler takes 0 for no sample yet
+    __u64 now_ns = start_ns, end_ns = start_ns + static_cast<__u64>(seconds * 1e9);
+    while (now_ns < end_ns)
+    {
+        double sums[LOG_CHANNELS] = {}, first_s = (now_ns - start_ns) * 1e-9, last_s = first_s;
+        size_t count = 0;
+        __u64 record_start_ns = now_ns;
+        do
+        {
+            last_s = (now_ns - start_ns) * 1e-9;
+            trace(last_s, sample.values);
+            for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            {
+                sample.values[ch] += NOISE[ch] * noise(random);
+                sums[ch] += sample.values[ch];
+            }
+            count++;
+            sampler.observe(sample, now_ns);
+            cost.active_s += sampler.level() > 0.5f ? sampler.sample_period_ns() * 1e-9 : 0.0;
+            now_ns += sampler.sample_period_ns();
+        } while (now_ns - record_start_ns < sampler.record_period_ns());
+        cost.samples += count;
+        cost.records++;
+        std::array<float, LOG_CHANNELS> mean;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            record.values[ch] = mean[ch] = sums[ch] / count;
+        record.time_ns = 1760000000000000000LL + static_cast<__s64>(now_ns - start_ns);
+        record.ret_code = 0;
+        derive(record, 0.0f, derived);
+        memcpy(extra, derived.values, sizeof(derived.values));
+        extra[DERIVED_CHANNELS] = roundf((now_ns - record_start_ns) / 1e8f) / 10.0f;
+        cost.log_bytes += formatter.format(record, extra, DERIVED_CHANNELS + 1).size() + 1;
+        centers.push_back((first_s + last_s) / 2.0);
+        means.push_back(mean);
+    }
+
+    float truth[LOG_CHANNELS];
+    size_t k = 0, points = 0;
+    for (double t = centers.front(); t <= centers.back(); t += 1.0)
+    {
+        while (k + 2 < centers.size() && centers[k + 1] <= t)
+            k++;
+        double w = (t - centers[k]) / (centers[k + 1] - centers[k]);
+        trace(t, truth);
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        {
+            double error = fabs(means[k][ch] + w * (means[k + 1][ch] - means[k][ch]) - truth[ch]);
+            cost.mean_error[ch] += error;
+            cost.max_error[ch] = std::max(cost.max_error[ch], error);
+        }
+        points++;
+    }
+    for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        cost.mean_error[ch] /= points;
+    return cost;
+}
+
+// records with periods from 0.5 s to 5 min through log.txt lines, a gorilla block and an archive segment,
+// and in the older layouts that have none: returns the records whose period does not come back
+static size_t period_round_trips()
+{
+    std::vector<LogRecord> records(3000);
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        synthetic_trace(60.0 * i, records[i].values);
+        records[i].time_ns = 1760000000000000000LL + static_cast<__s64>(i) * 60000000000LL;
+        records[i].ret_code = 0;
+        records[i].period_s = 0.5f + 0.1f * static_cast<float>(i % 2996);
+        records[i].period_s = roundf(records[i].period_s * 10.0f) / 10.0f;
+    }
+    size_t mismatches = 0;
+    RecordFormatter formatter(TIMESTAMP_EPOCH_NS);
+    LogLineParser parser;
+    DerivedRecord derived;
+    float extra[DERIVED_CHANNELS + 1];
+    for (const LogRecord& record : records)
+    {
+        derive(record, 0.0f, derived);
+        memcpy(extra, derived.values, sizeof(derived.values));
+        extra[DERIVED_CHANNELS] = record.period_s;
+        LogRecord parsed;
+        // logged with 6 digits, which is all of a period in tenths of a second but not always all of its float
+        mismatches += !parser.parse(formatter.format(record, extra, DERIVED_CHANNELS + 1), parsed) || fabsf(parsed.period_s - record.period_s) > 1e-5f * record.period_s;
+        // rows logged before the period, with and without the derived channels
+        mismatches += !parser.parse(formatter.format(record, extra, DERIVED_CHANNELS), parsed) || parsed.period_s != 0.0f;
+        mismatches += !parser.parse(formatter.format(record), parsed) || parsed.period_s != 0.0f;
+        __u8 v1[LOG_RECORD_V1_SIZE];
+        memcpy(v1, &record, sizeof(v1));
+        mismatches += !read_record(v1, sizeof(v1), parsed) || parsed.period_s != 0.0f || parsed.values[CH_P_EXTERIOR] != record.values[CH_P_EXTERIOR];
+    }
+
+    GorillaBlockEncoder encoder;
+    encoder.reserve(records.size());
+    for (const LogRecord& record : records)
+        encoder.append(record);
+    std::vector<__u8> block;
+    encoder.finish(block);
+    std::vector<LogRecord> decoded;
+    GorillaBlockDecoder::decode(block.data(), block.size(), decoded);
+    for (size_t i = 0; i < records.size(); i++)
+        mismatches += i >= decoded.size() || decoded[i].period_s != records[i].period_s;
+
+    const std::string directory = "/tmp/benchmark_period_archive";
+    std::system(("rm -rf " + directory).c_str());
+    {
+        Archive archive(directory);
+        archive.add_segment(records);
+        decoded.clear();
+        archive.read_range(records.front().time_ns, records.back().time_ns + 1, decoded);
+        for (size_t i = 0; i < records.size(); i++)
+            mismatches += i >= decoded.size() || decoded[i].period_s != records[i].period_s;
+    }
+    std::system(("rm -rf " + directory).c_str());
+    return mismatches;
+}
+
+static int bench_adaptive(int argc, char* argv[])
+{
+    // two BME280 read_all (register and address bytes of three reads each) and one ADS1115 conversion read
+    const size_t BUS_BYTES_PER_SAMPLE = 37;
+    double days = argc > 1 ? std::stod(argv[1]) : 7.0;
+    Trace trace = synthetic_trace;
+    std::vector<LogRecord> records;
+    if (argc > 0 && strcmp(argv[0], "-") != 0)
+    {
+        // a recorded trace, its last days interpolated between the logged records
+        records = load_or_synthesize(1, argv);
+        if (records.size() < 2)
+            throw std::runtime_error("Not enough records in " + std::string(argv[0]));
+        size_t first = records.size() - 1;
+        while (first > 0 && records.back().time_ns - records[first - 1].time_ns <= days * 86400e9)
+            first--;
+        records.erase(records.begin(), records.begin() + first);
+        days = (records.back().time_ns - records.front().time_ns) / 86400e9;
+        trace = [&records](double t, float values[LOG_CHANNELS]) {
+            __s64 time_ns = records.front().time_ns + static_cast<__s64>(t * 1e9);
+            auto next = std::upper_bound(records.begin(), records.end(), time_ns, [](__s64 time, const LogRecord& r) { return time < r.time_ns; });
+            if (next == records.end())
+                next--;
+            auto previous = next == records.begin() ? next : next - 1;
+            float w = previous == next ? 0.0f : static_cast<float>(time_ns - previous->time_ns) / (next->time_ns - previous->time_ns);
+            for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            {
+                float a = previous->values[ch], b = next->values[ch];
+                values[ch] = is_missing(a) ? b : (is_missing(b) ? a : a + w * (b - a));
+                values[ch] = is_missing(values[ch]) ? 0.0f : values[ch];
+            }
+        };
+    }
+    RateBounds sample_period = argc > 2 ? RateBounds::parse(argv[2]) : RateBounds{ADAPTIVE_SAMPLE_MIN_S, ADAPTIVE_SAMPLE_MAX_S};
+    RateBounds record_period = argc > 3 ? RateBounds::parse(argv[3]) : RateBounds{ADAPTIVE_RECORD_MIN_S, ADAPTIVE_RECORD_MAX_S};
+
+    auto t_start = std::chrono::steady_clock::now();
+    SamplingCost fixed = simulate_sampling(trace, days * 86400.0, {1.0f, 1.0f}, {60.0f, 60.0f});
+    SamplingCost adaptive = simulate_sampling(trace, days * 86400.0, sample_period, record_period);
+    std::cout << std::fixed << std::setprecision(1) << days << " days of " << (records.empty() ? "a synthetic week with events" : argv[0]) << ", simulated in "
+              << seconds_since(t_start) << " s\n";
+    std::cout << "sampling             samples  bus MB records  log MB  active\n";
+    auto row = [&](const char* name, const SamplingCost& cost) {
+        std::cout << std::left << std::setw(19) << name << std::right << std::setw(10) << cost.samples << std::setw(8) << std::setprecision(2)
+                  << cost.samples * BUS_BYTES_PER_SAMPLE / 1e6 << std::setw(8) << cost.records << std::setw(8) << cost.log_bytes / 1e6 << std::setw(7)
+                  << std::setprecision(1) << 100.0 * cost.active_s / (days * 86400.0) << "%\n";
+    };
+    row("fixed 1 s / 60 s", fixed);
+    std::ostringstream name;
+    name << std::setprecision(3) << sample_period.min_s << "-" << sample_period.max_s << " / " << record_period.min_s << "-" << record_period.max_s;
+    row(name.str().c_str(), adaptive);
+    std::cout << std::setprecision(1) << "savings: bus x" << double(fixed.samples) / adaptive.samples << ", storage x" << double(fixed.log_bytes) / adaptive.log_bytes << "\n"
+              << "error of the logged line vs the trace, mean / max:\n";
+    for (__u8 ch : {CH_T_INTERIOR, CH_H_INTERIOR, CH_P_INTERIOR, CH_T_EXTERIOR, CH_H_EXTERIOR})
+    {
+        int precision = ch == CH_P_INTERIOR ? 6 : 3;
+        std::cout << "  " << std::left << std::setw(11) << CHANNEL_NAMES[ch] << std::right << std::setprecision(precision) << " fixed " << fixed.mean_error[ch]
+                  << " / " << fixed.max_error[ch] << "   adaptive " << adaptive.mean_error[ch] << " / " << adaptive.max_error[ch] << "\n";
+    }
+    size_t mismatches = period_round_trips();
+    std::cout << "record periods lost through log.txt, the store, the archive and the older layouts: " << mismatches << "\n";
+    return mismatches == 0 ? 0 : 1;
+}
+
+// Hundreds of rules with thresholds around the values of the synthetic week, so that some of them
+// fire and clear, evaluated on a week of 1 s samples like the sampling loop does
+static int bench_alerts(int argc, char* argv[])
+{
+    size_t n_rules = argc > 0 ? std::stoul(argv[0]) : 500;
+    size_t n_samples = argc > 1 ? std::stoul(argv[1]) : 7 * 86400;
+    static const float SPREAD[ALERT_CHANNELS] = {3.0f, 10.0f, 0.005f, 3.0f, 6.0f, 15.0f, 0.005f, 2.0f, 2.0f, 3.0f, 3.0f, 2.0f, 2.0f, 0.005f, 0.005f};
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    AlertConfig config;
+    float values[LOG_CHANNELS];
+    LogRecord sample;
+    DerivedRecord derived;
+    for (size_t i = 0; i < n_rules; i++)
+    {
+        synthetic_trace(86400.0 * (uniform(random) + 1.0f) * 3.5, sample.values);
+        derive(sample, 0.0f, derived);
+        AlertRule rule;
+        rule.name = "rule" + std::to_string(i);
+        rule.channel = random() % ALERT_CHANNELS;
+        rule.condition = alert_condition(random() % 4);
+        float value = rule.channel < LOG_CHANNELS ? sample.values[rule.channel] : derived.values[rule.channel - LOG_CHANNELS];
+        float spread = SPREAD[rule.channel];
+        rule.threshold = rule.condition == ALERT_RATE ? spread * (0.05f + 0.05f * uniform(random)) : (rule.condition == ALERT_MISSING ? 60.0f : value + spread * 0.5f * uniform(random));
+        rule.hysteresis = spread * 0.05f;
+        rule.hold_s = random() % 3 == 0 ? 30.0f : 0.0f;
+        config.rules.push_back(rule);
+    }
+    AlertEngine engine(config);
+
+    static const float NOISE[LOG_CHANNELS] = {0.01f, 0.05f, 0.000005f, 0.2f, 0.01f, 0.05f, 0.000005f};
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::vector<double> evaluate_ns, derive_ns;
+    evaluate_ns.reserve(n_samples);
+    derive_ns.reserve(n_samples);
+    size_t events = 0, max_active = 0;
+    const __u64 start_ns = 1000000000ULL;
+    for (size_t i = 0; i < n_samples; i++)
+    {
+        synthetic_trace(static_cast<double>(i), values);
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            sample.values[ch] = values[ch] + NOISE[ch] * noise(random);
+        if (i % 43200 > 43000)
+            sample.values[CH_T_EXTERIOR] = sample.values[CH_H_EXTERIOR] = sample.values[CH_P_EXTERIOR] = NAN; // the exterior sensor down for a few minutes twice a day
+        sample.time_ns = 1760000000000000000LL + static_cast<__s64>(i) * 1000000000LL;
+        auto t_start = std::chrono::steady_clock::now();
+        derive(sample, 0.0f, derived);
+        auto t_derived = std::chrono::steady_clock::now();
+        events += engine.evaluate(sample, &derived, start_ns + i * 1000000000ULL);
+        derive_ns.push_back(std::chrono::duration<double, std::nano>(t_derived - t_start).count());
+        evaluate_ns.push_back(seconds_since(t_derived) * 1e9);
+        max_active = std::max(max_active, engine.active());
+    }
+    double total = 0.0;
+    for (double ns : evaluate_ns)
+        total += ns;
+    std::cout << n_rules << " rules on " << n_samples << " samples, " << events << " events raised, up to " << max_active << " firing at once\n" << std::fixed << std::setprecision(0);
+    std::cout << "evaluate()   mean " << std::setw(7) << total / n_samples << " ns  p50 " << std::setw(7) << percentile(evaluate_ns, 0.5) << " ns  p99 " << std::setw(7)
+              << percentile(evaluate_ns, 0.99) << " ns  max " << std::setw(7) << percentile(evaluate_ns, 1.0) << " ns  (" << std::setprecision(1) << total / n_samples / n_rules
+              << " ns per rule)\n" << std::setprecision(0);
+    std::cout << "derive()     p50 " << std::setw(7) << percentile(derive_ns, 0.5) << " ns\n";
+
+    // from the sample to the event line read from a socket sink
+    std::string path = "/tmp/temperature_logger_alerts_bench.sock";
+    int receiver = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    unlink(path.c_str());
+    if (bind(receiver, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        throw std::runtime_error("Cannot bind " + path);
+    AlertConfig socket_config;
+    socket_config.rules.push_back(AlertRule::parse("warm T_interior above 30 hysteresis 1"));
+    socket_config.sinks.push_back(AlertSink::parse("socket " + path));
+    std::vector<double> delivery_us;
+    {
+        AlertEngine socket_engine(socket_config);
+        char line[256];
+        for (size_t i = 0; i < 1000; i++)
+        {
+            for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+                sample.values[ch] = NAN;
+            sample.values[CH_T_INTERIOR] = i % 2 == 0 ? 35.0f : 20.0f;
+            sample.time_ns = wall_clock_ns();
+            auto t_start = std::chrono::steady_clock::now();
+            socket_engine.evaluate(sample, nullptr, start_ns + i * 1000000000ULL);
+            if (recv(receiver, line, sizeof(line), 0) > 0)
+                delivery_us.push_back(seconds_since(t_start) * 1e6);
+        }
+    }
+    close(receiver);
+    unlink(path.c_str());
+    std::cout << std::setprecision(1) << "sample to socket sink  p50 " << std::setw(7) << percentile(delivery_us, 0.5) << " us  p99 " << std::setw(7) << percentile(delivery_us, 0.99)
+              << " us  max " << std::setw(7) << percentile(delivery_us, 1.0) << " us  (" << delivery_us.size() << " of 1000 events received)\n";
+    return 0;
+}
+
+// Simulated nodes push over loopback to an in-process collector: first while it is up, then into
+// their spools while it is down, replayed once it is back, then the nodes restart on their emptied spools
+// with the clock set back a day. Every store must end up with every record once.
+static int bench_push(int argc, char* argv[])
+{
+    size_t n_nodes = argc > 0 ? std::stoul(argv[0]) : 16;
+    size_t n_records = argc > 1 ? std::stoul(argv[1]) : 200000; // per node
+    bool sync = !(argc > 2 && strcmp(argv[2], "no_sync") == 0);
+    std::string directory = "/tmp/benchmark_collector";
+    for (size_t n = 0; n < n_nodes; n++)
+    {
+        std::string node = "node" + std::to_string(n);
+        unlink((directory + "/" + node + ".gorilla").c_str());
+        unlink((directory + "/" + node + ".gorilla.wal").c_str());
+        unlink((directory + "/" + node + ".spool").c_str());
+        unlink((directory + "/" + node + ".seq").c_str());
+    }
+
+    auto collector = std::make_unique<Collector>(directory, 0, "127.0.0.1", sync);
+    __u16 port = collector->port();
+    collector->start();
+    std::vector<std::unique_ptr<PushClient>> nodes;
+    for (size_t n = 0; n < n_nodes; n++)
+    {
+        std::string node = "node" + std::to_string(n);
+        nodes.push_back(std::make_unique<PushClient>("127.0.0.1", port, node, directory + "/" + node + ".spool", SyncPolicy(SYNC_NONE)));
+        nodes.back()->start();
+    }
+    // every node pushes its half of the records as fast as it can, a minute apart in time
+    auto push_half = [&](size_t half) {
+        std::vector<std::thread> threads;
+        for (size_t n = 0; n < n_nodes; n++)
+            threads.emplace_back([&, n]() {
+                for (size_t i = half * n_records / 2; i < (half + 1) * n_records / 2; i++)
+                {
+                    LogRecord record = synthetic_record(i);
+                    record.values[CH_T_INTERIOR] += n;
+                    nodes[n]->push(record);
+                }
+            });
+        for (std::thread& thread : threads)
+            thread.join();
+    };
+    auto drain = [&]() {
+        for (auto& node : nodes)
+            while (node->pending() > 0)
+                usleep(1000);
+    };
+
+    auto t_live = std::chrono::steady_clock::now();
+    push_half(0);
+    drain();
+    double live_seconds = seconds_since(t_live);
+    __u64 live_batches = collector->batches();
+
+    collector.reset(); // the outage: the nodes spool and reconnect with backoff
+    auto t_spool = std::chrono::steady_clock::now();
+    push_half(1);
+    double spool_seconds = seconds_since(t_spool);
+    collector = std::make_unique<Collector>(directory, port, "127.0.0.1", sync);
+    auto t_replay = std::chrono::steady_clock::now();
+    collector->start();
+    drain();
+    double replay_seconds = seconds_since(t_replay);
+    size_t reconnects = 0;
+    for (auto& node : nodes)
+    {
+        reconnects += node->reconnects();
+        node->stop();
+    }
+    __u64 replay_records = collector->records();
+
+    // records older than the ones stored are new as long as their sequence is
+    const size_t n_late = 100;
+    for (size_t n = 0; n < n_nodes; n++)
+    {
+        std::string node = "node" + std::to_string(n);
+        nodes[n] = std::make_unique<PushClient>("127.0.0.1", port, node, directory + "/" + node + ".spool", SyncPolicy(SYNC_NONE));
+        nodes[n]->start();
+        for (size_t i = 0; i < n_late; i++)
+        {
+            LogRecord record = synthetic_record(i);
+            record.time_ns -= ARCHIVE_DAY_NS;
+            record.values[CH_T_INTERIOR] += n;
+            nodes[n]->push(record);
+        }
+    }
+    drain();
+    for (auto& node : nodes)
+        node->stop();
+    __u64 duplicates = collector->duplicates();
+    collector.reset();
+
+    size_t stored = 0, wrong = 0;
+    for (size_t n = 0; n < n_nodes; n++)
+    {
+        std::vector<LogRecord> records;
+        GorillaStore::read_all(directory + "/node" + std::to_string(n) + ".gorilla", records);
+        stored += records.size();
+        for (size_t i = 0; i < records.size(); i++)
+        {
+            size_t expected = i < n_records ? i : i - n_records;
+            if (i >= n_records + n_late || fabsf(records[i].values[CH_T_INTERIOR] - (synthetic_record(expected).values[CH_T_INTERIOR] + n)) > 0.01f)
+                wrong++;
+        }
+    }
+    std::cout << n_nodes << " nodes x " << n_records << " records over loopback, " << (sync ? "synced" : "not synced") << " before the ack\n" << std::fixed << std::setprecision(0);
+    std::cout << "live ingest     " << std::setw(10) << n_nodes * (n_records / 2) / live_seconds << " records/s  (" << std::setprecision(1)
+              << n_nodes * (n_records / 2) / double(live_batches) << " records per batch)\n" << std::setprecision(0);
+    std::cout << "spooling        " << std::setw(10) << n_nodes * (n_records - n_records / 2) / spool_seconds << " records/s while the collector is down\n";
+    std::cout << "replay          " << std::setw(10) << replay_records / replay_seconds << " records/s, including the reconnect backoff (" << reconnects << " reconnects)\n";
+    std::cout << "stored " << stored << " of " << n_nodes * (n_records + n_late) << " records (" << n_late << " a node stamped before the others after a restart), "
+              << wrong << " wrong or out of order, " << duplicates << " duplicates dropped\n";
+    return stored == n_nodes * (n_records + n_late) && wrong == 0 ? 0 : 1;
+}
+
+// the sampling loop of main.cpp over synthetic days with more and more sinks attached, counting the heap
+// allocations of the sampling thread once warmed up: fails if there are any
+static int bench_alloc(int argc, char* argv[])
+{
+    size_t days = argc > 0 ? std::stoul(argv[0]) : 3;
+    const std::string log_name = "/tmp/benchmark_alloc_log.txt", store_name = "/tmp/benchmark_alloc.gorilla", spool_name = "/tmp/benchmark_alloc.spool";
+    const char* stream_path = "/tmp/temperature_logger_benchmark_alloc.sock";
+    unlink(store_name.c_str());
+    unlink((store_name + ".wal").c_str());
+    unlink(spool_name.c_str());
+
+    SampleHistory history;
+    SharedSamplesWriter shared_samples("/temperature_logger_benchmark_alloc");
+    SampleStream stream(stream_path);
+    stream.start();
+    int subscriber = stream_connect(stream_path);
+    __u8 mask = (1 << (FRAME_RAW - 1)) | (1 << (FRAME_AVERAGE - 1));
+    if (write(subscriber, &mask, 1) != 1)
+        throw std::runtime_error("cannot subscribe to the stream");
+    std::thread reader([subscriber]() {
+        char buffer[4096];
+        while (read(subscriber, buffer, sizeof(buffer)) > 0)
+            ;
+    });
+    AlertConfig config;
+    config.rules.push_back(AlertRule::parse("warm T_interior above 21.2 hysteresis 0.1"));
+    config.rules.push_back(AlertRule::parse("humid H_interior rate 5 for 30"));
+    config.rules.push_back(AlertRule::parse("dew dew_exterior below 6 hysteresis 0.2"));
+    config.sinks.push_back(AlertSink::parse("file /tmp/benchmark_alloc_alerts.txt"));
+    AlertEngine alerts(config);
+    Collector collector("/tmp/benchmark_alloc_collector", 0, "127.0.0.1", false);
+    collector.start();
+    PushClient push("127.0.0.1", collector.port(), "alloc", spool_name, SyncPolicy(SYNC_NONE));
+    push.start();
+    DisplayViews display_views;
+    __u64 display_bytes = 0;
+
+    struct Stage
+    {
+        const char* name;
+        std::function<void(PipelineOptions&, PipelineSinks&)> add;
+    };
+    const Stage stages[] = {
+        {"log", [](PipelineOptions&, PipelineSinks&) {}},
+        {"+ gorilla store", [&](PipelineOptions& options, PipelineSinks&) { options.store_file_name = store_name; }},
+        {"+ history, shm, stream", [&](PipelineOptions&, PipelineSinks& sinks) {
+             sinks.history = &history;
+             sinks.shared_samples = &shared_samples;
+             sinks.stream = &stream;
+         }},
+        {"+ alerts", [&](PipelineOptions&, PipelineSinks& sinks) { sinks.alerts = &alerts; }},
+        {"+ push", [&](PipelineOptions&, PipelineSinks& sinks) { sinks.push = &push; }},
+        {"+ display", [&](PipelineOptions&, PipelineSinks& sinks) {
+             sinks.display_views = &display_views;
+             sinks.flush_display = [&]() { display_views.framebuffer().flush([&](__u8, __u8, const __u8*, __u8 count) { display_bytes += count; }); };
+         }},
+    };
+
+    PipelineOptions options;
+    options.log_file_name = log_name;
+    options.sync = SYNC_NONE;
+    PipelineSinks sinks;
+    bool clean = true;
+    std::cout << std::left << std::setw(26) << "sinks" << std::right << std::setw(10) << "samples" << std::setw(10) << "records" << std::setw(14) << "allocations"
+              << std::setw(16) << "alloc/1k cycles" << "\n";
+    for (const Stage& stage : stages)
+    {
+        stage.add(options, sinks);
+        unlink(log_name.c_str());
+        SamplePipeline pipeline(options, sinks);
+        // the first day warms up: buffers reach their size, the store seals a block, the sinks open their files
+        const __u64 start_ns = 1000000000ULL, warm_ns = start_ns + 86400000000000ULL, end_ns = start_ns + days * 86400000000000ULL;
+        LogRecord sample;
+        size_t samples = 0, records = 0;
+        AllocationScope allocations;
+        pipeline.begin_record(start_ns);
+        for (__u64 now_ns = start_ns, next_ns; now_ns < end_ns; now_ns = next_ns)
+        {
+            if (now_ns >= warm_ns && samples == 0)
+                allocations.restart();
+            synthetic_trace((now_ns - start_ns) / 1e9, sample.values);
+            sample.time_ns = 1760000000000000000LL + static_cast<__s64>(now_ns - start_ns);
+            sample.ret_code = 0;
+            next_ns = now_ns + pipeline.add_sample(sample, now_ns);
+            if (now_ns >= warm_ns)
+                samples++;
+            if (pipeline.record_due(next_ns))
+            {
+                pipeline.finish_record(sample.time_ns, next_ns);
+                pipeline.begin_record(next_ns);
+                records += now_ns >= warm_ns;
+            }
+        }
+        __u64 count = allocations.count();
+        clean = clean && count == 0;
+        std::cout << std::left << std::setw(26) << stage.name << std::right << std::setw(10) << samples << std::setw(10) << records << std::setw(14) << count
+                  << std::setw(16) << std::fixed << std::setprecision(2) << 1000.0 * count / std::max<size_t>(samples, 1) << std::defaultfloat << "\n";
+    }
+    std::cout << (clean ? "No allocations in the steady state.\n" : "FAILED: the sampling loop allocates.\n");
+
+    push.stop();
+    collector.stop();
+    stream.stop();
+    reader.join();
+    close(subscriber);
+    shared_samples.unlink();
+    unlink(log_name.c_str());
+    unlink(store_name.c_str());
+    unlink((store_name + ".wal").c_str());
+    unlink(spool_name.c_str());
+    unlink("/tmp/benchmark_alloc_alerts.txt");
+    return clean ? 0 : 1;
+}
+
+static __u64 file_bytes(const std::string& file_name)
+{
+    struct stat status;
+    return stat(file_name.c_str(), &status) == 0 ? status.st_size : 0;
+}
+
+static int bench_compact(int argc, char* argv[])
+{
+    size_t days = argc > 0 ? std::stoul(argv[0]) : 800;
+    RetentionPolicy policy;
+    if (argc > 1)
+        policy.disk_budget = RetentionPolicy::parse_size(argv[1]);
+    const std::string directory = "/tmp/benchmark_compact", log_name = directory + "/log.txt", archive_name = directory + "/archive";
+    std::system(("rm -rf " + directory).c_str());
+    mkdir(directory.c_str(), 0755);
+
+    // a record per minute for days, up to now
+    const __s64 minute_ns = 60000000000LL, now_ns = 1760000000000000000LL + static_cast<__s64>(days) * ARCHIVE_DAY_NS;
+    const __s64 start_ns = now_ns - static_cast<__s64>(days) * ARCHIVE_DAY_NS;
+    {
+        std::ofstream file(log_name, std::ios::trunc);
+        RecordFormatter formatter;
+        LogRecord record;
+        record.ret_code = 0;
+        for (__s64 t = start_ns; t < now_ns; t += minute_ns)
+        {
+            synthetic_trace((t - start_ns) / 1e9, record.values);
+            record.time_ns = t;
+            file << formatter.format(record) << '\n';
+        }
+    }
+
+    Archive archive(archive_name);
+    Compactor compactor(log_name, archive, policy);
+    SampleHistory history;
+    QueryApi api(&history, log_name, 0.0f, &archive);
+    struct Query
+    {
+        const char* name;
+        __s64 from_ns, to_ns;
+    };
+    const Query queries[] = {
+        {"whole history", start_ns, now_ns},
+        {"a day 200 days ago", now_ns - 200 * ARCHIVE_DAY_NS, now_ns - 199 * ARCHIVE_DAY_NS},
+        {"last 2 days", now_ns - 2 * ARCHIVE_DAY_NS, now_ns},
+    };
+    auto run_queries = [&](double seconds[], size_t counts[]) {
+        std::vector<LogRecord> records;
+        for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++)
+        {
+            records.clear();
+            auto t_start = std::chrono::steady_clock::now();
+            api.collect(queries[q].from_ns, queries[q].to_ns, records);
+            seconds[q] = seconds_since(t_start);
+            counts[q] = records.size();
+        }
+    };
+    auto recent_raw = [&]() {
+        std::vector<LogRecord> records;
+        api.collect(now_ns - policy.raw_ns, now_ns, records);
+        return records;
+    };
+    auto report_storage = [&](const char* when) {
+        __u64 segment_bytes = 0;
+        for (const ArchiveSegment& segment : archive.segments())
+            segment_bytes += segment.bytes;
+        std::cout << std::left << std::setw(8) << when << std::right << "log.txt " << std::setw(10) << file_bytes(log_name) << "  raw " << std::setw(9) << segment_bytes
+                  << " (" << archive.segments().size() << " segments)  hourly " << std::setw(8) << file_bytes(archive_name + "/hourly.rollup") << "  daily "
+                  << std::setw(7) << file_bytes(archive_name + "/daily.rollup") << "  total " << std::setw(10) << compactor.storage_bytes() << " bytes\n";
+    };
+
+    const size_t query_count = sizeof(queries) / sizeof(queries[0]);
+    double before_s[query_count], after_s[query_count];
+    size_t before_count[query_count], after_count[query_count];
+    std::cout << days << " days of minute records, retention log " << policy.log_ns / ARCHIVE_DAY_NS << " d, raw " << policy.raw_ns / ARCHIVE_DAY_NS << " d, hourly "
+              << policy.hourly_ns / ARCHIVE_DAY_NS << " d, disk budget " << policy.disk_budget << " bytes\n";
+    report_storage("before");
+    run_queries(before_s, before_count);
+    std::vector<LogRecord> recent_before = recent_raw();
+
+    // the sampling loop keeps appending to the log through the compaction, a line every 10 ms
+    std::atomic<bool> acquiring{true};
+    double max_dump_us = 0.0;
+    size_t lines = 0;
+    std::thread acquisition([&]() {
+        Dumper dumper(log_name, compactor.handoff());
+        RecordFormatter formatter;
+        LogRecord record;
+        record.ret_code = 0;
+        for (__s64 t = now_ns; acquiring; t += minute_ns, lines++)
+        {
+            synthetic_trace((t - start_ns) / 1e9, record.values);
+            record.time_ns = t;
+            auto t_start = std::chrono::steady_clock::now();
+            dumper.dump(formatter.format(record));
+            if (lines > 0) // the first one opens the file
+                max_dump_us = std::max(max_dump_us, seconds_since(t_start) * 1e6);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+    CompactionReport report = compactor.run_once(now_ns);
+    acquiring = false;
+    acquisition.join();
+
+    report_storage("after");
+    run_queries(after_s, after_count);
+    std::vector<LogRecord> recent_after = recent_raw();
+    std::cout << "compaction " << std::fixed << std::setprecision(2) << report.seconds << " s: " << report.log_records << " log records archived, "
+              << report.merged_segments << " segments merged, " << report.raw_records << " raw records and " << report.hourly_rollups << " hourly rollups tiered down, "
+              << report.dropped_days << " days dropped, " << static_cast<__s64>(report.bytes_before - report.bytes_after) << " bytes reclaimed\n";
+    std::cout << lines << " lines dumped meanwhile, slowest dump " << max_dump_us << " us\n";
+    for (size_t q = 0; q < query_count; q++)
+        std::cout << std::left << std::setw(22) << queries[q].name << std::right << std::setw(10) << before_s[q] * 1e3 << " ms (" << std::setw(7) << before_count[q]
+                  << " records) -> " << std::setw(8) << after_s[q] * 1e3 << " ms (" << std::setw(7) << after_count[q] << " records)\n";
+    std::cout << std::defaultfloat;
+
+    bool identical = recent_before.size() == recent_after.size();
+    for (size_t i = 0; identical && i < recent_before.size(); i++)
+        identical = recent_before[i].time_ns == recent_after[i].time_ns && memcmp(recent_before[i].values, recent_after[i].values, sizeof(recent_before[i].values)) == 0;
+    // a disk budget may tier the recent records down too
+    std::cout << "last " << policy.raw_ns / ARCHIVE_DAY_NS << " days: " << recent_after.size() << " records "
+              << (identical ? "identical" : (policy.disk_budget > 0 ? "tiered down for the disk budget" : "DIFFER")) << "\n";
+    identical = identical || policy.disk_budget > 0;
+
+    // nothing left to do right after
+    CompactionReport again = compactor.run_once(now_ns);
+    bool idempotent = again.log_records + again.merged_segments + again.raw_records + again.hourly_rollups + again.dropped_days == 0;
+    std::cout << "second run: " << (idempotent ? "nothing to do" : "FAILED, found work again") << "\n";
+    bool within_budget = policy.disk_budget == 0 || compactor.storage_bytes() <= policy.disk_budget;
+    if (!within_budget)
+        std::cout << "FAILED: over the disk budget\n";
+
+    std::system(("rm -rf " + directory).c_str());
+    return identical && idempotent && within_budget ? 0 : 1;
+}
+
+static int bench_arrow(int argc, char* argv[])
+{
+    std::vector<LogRecord> records = load_or_synthesize(argc, argv);
+    size_t rows = records.size();
+    if (rows < HISTORY_CAPACITY)
+        throw std::runtime_error("arrow needs more records than the in-memory history holds");
+
+    // the columns of the query API: the channels and the derived channels
+    std::vector<__s64> times(rows);
+    std::vector<std::vector<float>> columns(QUERY_SERIES, std::vector<float>(rows));
+    for (size_t i = 0; i < rows; i++)
+    {
+        times[i] = records[i].time_ns;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            columns[ch][i] = records[i].values[ch];
+    }
+    std::vector<float*> derived;
+    for (__u8 d = 0; d < DERIVED_CHANNELS; d++)
+        derived.push_back(columns[LOG_CHANNELS + d].data());
+    derive_humidity(columns[CH_T_INTERIOR].data(), columns[CH_H_INTERIOR].data(), columns[CH_P_INTERIOR].data(), rows, 0.0f, derived[DV_Q_INTERIOR],
+                    derived[DV_DEW_POINT_INTERIOR], derived[DV_ABS_HUMIDITY_INTERIOR], derived[DV_P_SEA_LEVEL_INTERIOR]);
+    derive_humidity(columns[CH_T_EXTERIOR].data(), columns[CH_H_EXTERIOR].data(), columns[CH_P_EXTERIOR].data(), rows, 0.0f, derived[DV_Q_EXTERIOR],
+                    derived[DV_DEW_POINT_EXTERIOR], derived[DV_ABS_HUMIDITY_EXTERIOR], derived[DV_P_SEA_LEVEL_EXTERIOR]);
+    std::vector<ArrowField> fields = {{"time", ARROW_TIMESTAMP_NS, false}};
+    for (__u8 s = 0; s < QUERY_SERIES; s++)
+        fields.push_back({s < LOG_CHANNELS ? CHANNEL_NAMES[s] : DERIVED_NAMES[s - LOG_CHANNELS], ARROW_FLOAT32, true});
+
+    // the writer alone, validity bitmaps included, into memory and into a file
+    const char* arrow_file_name = "/tmp/benchmark_arrow.arrow";
+    std::vector<std::vector<__u8>> validity(QUERY_SERIES);
+    std::string out;
+    out.reserve(rows * (sizeof(__s64) + QUERY_SERIES * sizeof(float)) + (QUERY_SERIES + 1) * 1024 + rows * QUERY_SERIES / 8);
+    for (int target = 0; target < 2; target++)
+    {
+        double best_s = 1e9;
+        __u64 bytes = 0;
+        for (int run = 0; run < 5; run++)
+        {
+            out.clear();
+            int file = target == 0 ? -1 : open(arrow_file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            auto t_start = std::chrono::steady_clock::now();
+            std::vector<ArrowArray> arrays = {{times.data()}};
+            for (__u8 s = 0; s < QUERY_SERIES; s++)
+            {
+                size_t null_count = arrow_validity(columns[s].data(), rows, validity[s]);
+                arrays.push_back({columns[s].data(), validity[s].data(), null_count});
+            }
+            ArrowWriter writer(target == 0 ? ARROW_STREAM : ARROW_FILE, fields, [&](const void* data, size_t size) {
+                if (file < 0)
+                    out.append(static_cast<const char*>(data), size);
+                else if (write(file, data, size) != static_cast<ssize_t>(size))
+                    throw std::runtime_error("cannot write the arrow file");
+            });
+            writer.write_batch(rows, arrays.data());
+            writer.finish();
+            best_s = std::min(best_s, seconds_since(t_start));
+            bytes = writer.bytes();
+            if (file >= 0)
+                close(file);
+        }
+        std::cout << std::left << std::setw(26) << (target == 0 ? "writer, stream to memory" : "writer, file to page cache") << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(8) << best_s * 1e3 << " ms  " << std::setw(6) << bytes / best_s / 1e9 << " GB/s  " << std::setw(6) << rows / best_s / 1e6 << " M rows/s  ("
+                  << bytes / 1e6 << " MB, " << 1.0 * bytes / rows << " bytes per row)\n";
+    }
+
+    // the endpoint, the newest HISTORY_CAPACITY records in memory and the rest in a log file
+    const char* log_file_name = "/tmp/benchmark_arrow_log.txt";
+    __u64 log_bytes = 0;
+    {
+        std::ofstream file(log_file_name, std::ios::trunc);
+        RecordFormatter formatter;
+        for (const LogRecord& record : records)
+        {
+            std::string_view line = formatter.format(record);
+            file << line << '\n';
+            log_bytes += line.size() + 1;
+        }
+    }
+    SampleHistory history;
+    for (size_t i = rows - HISTORY_CAPACITY; i < rows; i++)
+        history.push(records[i]);
+    QueryApi api(&history, log_file_name);
+    double last_s = records.back().time_ns / 1e9 + 1, first_s = records.front().time_ns / 1e9;
+    std::string days_10 = "from=" + std::to_string(last_s - 10 * 86400) + "&to=" + std::to_string(last_s);
+    std::string days_90 = "from=" + std::to_string(last_s - 90 * 86400) + "&to=" + std::to_string(last_s);
+    std::string all = "from=" + std::to_string(first_s) + "&to=" + std::to_string(last_s);
+    std::pair<const char*, std::string> requests[] = {
+        {"/range 10 d (json)", "/range?" + days_10},
+        {"/export 10 d", "/export?" + days_10},
+        {"/export 90 d", "/export?" + days_90},
+        {"/export 90 d, 3 channels", "/export?" + days_90 + "&channels=T_interior,T_exterior,dew_exterior"},
+        {"/export all", "/export?" + all + "&format=file"},
+        {"/export all, hourly", "/export?" + all + "&step=3600"},
+    };
+    std::cout << "log.txt of " << log_bytes / 1e6 << " MB, " << rows << " records\n";
+    for (const auto& [name, target] : requests)
+    {
+        size_t question = target.find('?');
+        HttpRequest request;
+        request.method = "GET";
+        request.path = std::string_view(target).substr(0, question);
+        request.query = std::string_view(target).substr(question + 1);
+        HttpResponse response;
+        double best_s = 1e9;
+        for (int run = 0; run < 3; run++)
+        {
+            auto t_start = std::chrono::steady_clock::now();
+            api.handle(request, response);
+            best_s = std::min(best_s, seconds_since(t_start));
+        }
+        std::cout << std::left << std::setw(26) << name << std::right << std::setw(8) << best_s * 1e3 << " ms  " << std::setw(8) << response.body.size() / 1e6 << " MB  "
+                  << response.content_type << (response.status == 200 ? "" : "  FAILED") << "\n";
+    }
+    std::cout << std::defaultfloat;
+    remove(log_file_name);
+    remove(arrow_file_name);
+    return 0;
+}
+
+struct Benchmark
+{
+    const char* name;
+    const char* usage;
+    int (*run)(int argc, char* argv[]);
+};
+
+static const Benchmark benchmarks[] = {
+    {"format", "format [records]            log record formatting throughput", bench_format},
+    {"gorilla", "gorilla [log.txt]           compression ratio and decode throughput of the gorilla store", bench_gorilla},
+    {"http", "http [clients] [requests]   query endpoint latency and throughput over loopback", bench_http},
+    {"shm", "shm [readers] [seconds]     seqlock writer and reader throughput with concurrent readers", bench_shm},
+    {"stream", "stream [subs] [Hz] [seconds] fan-out latency of the unix socket stream, with one stuck subscriber", bench_stream},
+    {"metrics", "metrics [n] [threads]       cost of recording counters and histograms, and of the /metrics export", bench_metrics},
+    {"trace", "trace [n] [file.json]       cost of the I2C tracer when disabled and enabled, and of a dump", bench_trace},
+    {"faults", "faults [restart_init_s]     data lost per injected device fault, health tracking vs full restarts", bench_faults},
+    {"journal", "journal [records] [file]    append cost per sync mode, recovery scan time and crash round trip of the store", bench_journal},
+    {"derived", "derived [samples]           accuracy of the derived humidity kernel and its cost vs the libm formulas", bench_derived},
+    {"downsample", "downsample [n] [points]     lttb and min/max vs stride subsampling: cost, line error and spikes kept", bench_downsample},
+    {"font", "font [strings]              glyph rendering cost per character at 1x, 2x and 3x, fixed and proportional", bench_font},
+    {"display", "display [hours]             I2C bytes per screen refresh, text redraw vs diffed framebuffer with sparklines", bench_display},
+    {"adaptive", "adaptive [log.txt|-] [days] [sample MIN:MAX] [record MIN:MAX]  bus and storage savings of adaptive sampling and its error on a trace", bench_adaptive},
+    {"alerts", "alerts [rules] [samples]    alert rule evaluation cost per sample and the latency from a sample to a socket sink", bench_alerts},
+    {"push", "push [nodes] [records] [no_sync]  collector ingest over loopback, then spooling and replay across a collector outage", bench_push},
+    {"alloc", "alloc [days]                heap allocations of the sampling loop once warmed up, per sink; fails if any", bench_alloc},
+    {"compact", "compact [days] [budget]     retention pass over a log of minute records: bytes reclaimed, read times, dump latency", bench_compact},
+    {"arrow", "arrow [log.txt]             Arrow IPC export: writer throughput, and /export against /range over the log", bench_arrow},
+};
+
+int main(int argc, char* argv[])
+{
+    for (const Benchmark& benchmark : benchmarks)
+        if (argc > 1 && strcmp(argv[1], benchmark.name) == 0)
+            return benchmark.run(argc - 2, argv + 2);
+
+    std::cout << "Usage: ./benchmark <name> [args]\nBenchmarks available:\n";
+    for (const Benchmark& benchmark : benchmarks)
+        std::cout << "  " << benchmark.usage << "\n";
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Central collector daemon for several loggers started with -push HOST[:PORT]. Stores the records of
+// every node in its own gorilla store under DIR (see include/collector.cpp), prints a line of ingest
+// statistics every minute and stops cleanly on SIGINT or SIGTERM.
+// Usage: ./collector [-port N] [-address A] [-dir DIR] [-no_sync]
+#include <iostream>
+#include <string>
+#include <ctime>
+#include <csignal>
+#include <string.h>
+#include "../include/collector.cpp"
+
+int main(int argc, char* argv[])
+{
+    __u16 port = PUSH_PORT;
+    std::string address = "0.0.0.0", directory = "nodes";
+    bool sync = true, usage = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-port") == 0 && i + 1 < argc)
+            port = std::atoi(argv[++i]);
+        else if (strcmp(argv[i], "-address") == 0 && i + 1 < argc)
+            address = argv[++i];
+        else if (strcmp(argv[i], "-dir") == 0 && i + 1 < argc)
+            directory = argv[++i];
+        else if (strcmp(argv[i], "-no_sync") == 0)
+            sync = false;
+        else
+            usage = true;
+    }
+    if (usage)
+    {
+        std::cout << "Collects the records pushed by loggers started with -push HOST[:PORT], one gorilla store per node.\n"
+                     "Usage:\n"
+                     "./collector [-port N] [-address A] [-dir DIR] [-no_sync]\n"
+                     "-port N        TCP port to listen on (" << PUSH_PORT << " is default);\n"
+                     "-address A     IPv4 address to listen on (0.0.0.0 is default);\n"
+                     "-dir DIR       directory of the stores, DIR/NODE.gorilla (nodes is default);\n"
+                     "-no_sync       acknowledges batches before they are synced to storage, faster but a power cut loses them.\n";
+        return 0;
+    }
+
+    // the signals are taken synchronously by the main thread, the others never see them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try
+    {
+        Collector collector(directory, port, address.c_str(), sync);
+        collector.start();
+        std::cout << "Collector: listening on " << address << ":" << collector.port() << ", stores in " << directory << "/\n";
+        __u64 records = 0;
+        timespec minute = {60, 0};
+        while (sigtimedwait(&signals, nullptr, &minute) < 0)
+        {
+            __u64 total = collector.records();
+            std::cout << "Collector: " << collector.nodes() << " nodes, " << total - records << " records in the last minute, " << total << " in total, "
+                      << collector.duplicates() << " duplicates dropped\n";
+            records = total;
+        }
+        std::cout << "Collector: stopping.\n";
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,430 @@
+// Converts a log.txt style file, legacy 5 column rows and current 9 column rows mixed, into a
+// binary columnar file. The log is memory mapped and split at line boundaries into one chunk per
+// thread; every thread parses its chunk with the allocation-free LogLineParser into its own
+// columns, then copies them at its row offset into the memory mapped output.
+//
+// Columnar file layout (native endian):
+//   64 byte header: u32 magic "TLCF", u16 version, u16 column count, u64 rows
+//   column directory, 32 bytes per column: char name[16], u8 type, u8 value width, 6 bytes padding, u64 offset
+//   column data, rows * width bytes per column, each column starting 64 byte aligned
+// Columns: time_ns (s64), the LOG_CHANNELS values (f32, nan when missing), ret_code (s32, 0 when missing),
+// missing (u8 per row: bit c set when value column c has no value, bit 7 for ret_code), then the
+// DERIVED_CHANNELS (f32, nan when an input is missing), recomputed from the values with the batch kernel
+// of include/derived_metrics.cpp so that legacy rows get them too.
+// With -arrow or -arrow_stream the output is an Arrow IPC file (Feather v2) or stream instead
+// (include/arrow_ipc.cpp): a time column (timestamp ns UTC), then the channels, ret_code and the derived
+// channels, or the ones given with -channels, missing values as nulls. Every thread's columns go out as
+// one record batch, as they are. -from and -to restrict either output to a time range, found by bisection.
+// Usage: ./log_converter [-threads N] [-scaling] [-altitude M] [-from S] [-to S] [-arrow|-arrow_stream] [-channels A,B] LOG OUT
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../include/log_file.cpp"
+#include "../include/derived_metrics.cpp"
+#include "../include/arrow_ipc.cpp"
+
+#define COLUMNAR_MAGIC 0x46434C54 // "TLCF"
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_HEADER_SIZE 64
+#define COLUMNAR_ENTRY_SIZE 32
+#define COLUMNAR_ALIGN 64
+#define MISSING_RET_CODE 7
+#define EXPORT_RET_CODE LOG_CHANNELS                    // export columns: the channels, ret_code, the derived channels
+#define EXPORT_COLUMNS (LOG_CHANNELS + 1 + DERIVED_CHANNELS)
+
+enum column_type
+{
+    COLUMN_S64 = 1,
+    COLUMN_F32,
+    COLUMN_S32,
+    COLUMN_U8
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point t_start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+}
+
+// the rows parsed by one thread
+struct Chunk
+{
+    size_t begin, end; // byte range in the log
+    std::vector<__s64> time_ns;
+    std::vector<float> values[LOG_CHANNELS];
+    std::vector<__s32> ret_code;
+    std::vector<__u8> missing;
+    std::vector<float> derived[DERIVED_CHANNELS];
+    size_t skipped = 0; // lines that do not parse
+    size_t first_row = 0;
+
+    void parse(const char* data)
+    {
+        size_t expected = (end - begin) / 48 + 16; // about 50 bytes per line
+        time_ns.reserve(expected);
+        for (std::vector<float>& column : values)
+            column.reserve(expected);
+        ret_code.reserve(expected);
+        missing.reserve(expected);
+
+        LogLineParser parser;
+        LogRecord record;
+        for (size_t line = begin; line < end;)
+        {
+            const char* newline = static_cast<const char*>(memchr(data + line, '\n', end - line));
+            size_t next = newline == nullptr ? end : newline - data + 1;
+            std::string_view text(data + line, next - line - (newline != nullptr));
+            line = next;
+            if (!parser.parse(text, record))
+            {
+                skipped += !text.empty();
+                continue;
+            }
+            __u8 mask = parser.columns() > 4 ? 0 : 1 << MISSING_RET_CODE;
+            time_ns.push_back(record.time_ns);
+            for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            {
+                values[ch].push_back(record.values[ch]);
+                mask |= is_missing(record.values[ch]) << ch;
+            }
+            ret_code.push_back(record.ret_code);
+            missing.push_back(mask);
+        }
+    }
+
+    // the derived channels of all the parsed rows, interior and exterior as two batches
+    void derive(float altitude_m)
+    {
+        for (std::vector<float>& column : derived)
+            column.resize(rows());
+        derive_humidity(values[CH_T_INTERIOR].data(), values[CH_H_INTERIOR].data(), values[CH_P_INTERIOR].data(), rows(), altitude_m,
+                        derived[DV_Q_INTERIOR].data(), derived[DV_DEW_POINT_INTERIOR].data(), derived[DV_ABS_HUMIDITY_INTERIOR].data(),
+                        derived[DV_P_SEA_LEVEL_INTERIOR].data());
+        derive_humidity(values[CH_T_EXTERIOR].data(), values[CH_H_EXTERIOR].data(), values[CH_P_EXTERIOR].data(), rows(), altitude_m,
+                        derived[DV_Q_EXTERIOR].data(), derived[DV_DEW_POINT_EXTERIOR].data(), derived[DV_ABS_HUMIDITY_EXTERIOR].data(),
+                        derived[DV_P_SEA_LEVEL_EXTERIOR].data());
+    }
+
+    size_t rows() const
+    {
+        return time_ns.size();
+    }
+};
+
+// splits [from, to) of the log at line boundaries into parts chunks and parses them in parallel
+static void parse_log(const LogFile& log_file, size_t from, size_t to, unsigned parts, float altitude_m, std::vector<Chunk>& chunks)
+{
+    chunks.assign(parts, Chunk());
+    size_t begin = from;
+    for (unsigned t = 0; t < parts; t++)
+    {
+        size_t end = t + 1 == parts ? to : std::max(begin, std::min(to, log_file.line_start(from + (to - from) * (t + 1) / parts)));
+        chunks[t].begin = begin;
+        chunks[t].end = end;
+        begin = end;
+    }
+    std::vector<std::thread> workers;
+    for (Chunk& chunk : chunks)
+        workers.emplace_back([&chunk, &log_file, altitude_m]() {
+            chunk.parse(log_file.data());
+            chunk.derive(altitude_m);
+        });
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+static size_t align(size_t offset)
+{
+    return (offset + COLUMNAR_ALIGN - 1) / COLUMNAR_ALIGN * COLUMNAR_ALIGN;
+}
+
+// writes the chunks as one columnar file, each thread copying its rows into every column
+static void write_columnar(const std::string& file_name, std::vector<Chunk>& chunks)
+{
+    size_t rows = 0;
+    for (Chunk& chunk : chunks)
+    {
+        chunk.first_row = rows;
+        rows += chunk.rows();
+    }
+
+    struct Column
+    {
+        const char* name;
+        column_type type;
+        __u8 width;
+        size_t offset;
+    };
+    std::vector<Column> columns = {{"time_ns", COLUMN_S64, 8, 0}};
+    for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+        columns.push_back({CHANNEL_NAMES[ch], COLUMN_F32, 4, 0});
+    columns.push_back({"ret_code", COLUMN_S32, 4, 0});
+    columns.push_back({"missing", COLUMN_U8, 1, 0});
+    for (__u8 d = 0; d < DERIVED_CHANNELS; d++)
+        columns.push_back({DERIVED_NAMES[d], COLUMN_F32, 4, 0});
+    size_t size = align(COLUMNAR_HEADER_SIZE + COLUMNAR_ENTRY_SIZE * columns.size());
+    for (Column& column : columns)
+    {
+        column.offset = size;
+        size = align(size + rows * column.width);
+    }
+
+    int file = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file < 0)
+        throw std::runtime_error("Error opening " + file_name);
+    if (ftruncate(file, size) < 0)
+    {
+        close(file);
+        throw std::runtime_error("Error sizing " + file_name);
+    }
+    __u8* out = static_cast<__u8*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0));
+    close(file);
+    if (out == MAP_FAILED)
+        throw std::runtime_error("Error mapping " + file_name);
+
+    __u32 magic = COLUMNAR_MAGIC;
+    __u16 version = COLUMNAR_VERSION, count = columns.size();
+    __u64 row_count = rows;
+    memcpy(out, &magic, 4);
+    memcpy(out + 4, &version, 2);
+    memcpy(out + 6, &count, 2);
+    memcpy(out + 8, &row_count, 8);
+    for (size_t c = 0; c < columns.size(); c++)
+    {
+        __u8* entry = out + COLUMNAR_HEADER_SIZE + COLUMNAR_ENTRY_SIZE * c;
+        strncpy(reinterpret_cast<char*>(entry), columns[c].name, 15);
+        entry[16] = columns[c].type;
+        entry[17] = columns[c].width;
+        __u64 offset = columns[c].offset;
+        memcpy(entry + 24, &offset, 8);
+    }
+
+    std::vector<std::thread> workers;
+    for (const Chunk& chunk : chunks)
+    {
+        workers.emplace_back([&chunk, &columns, out]() {
+            auto copy = [&](size_t c, const void* data) {
+                memcpy(out + columns[c].offset + chunk.first_row * columns[c].width, data, chunk.rows() * columns[c].width);
+            };
+            copy(0, chunk.time_ns.data());
+            for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+                copy(ch + 1, chunk.values[ch].data());
+            copy(LOG_CHANNELS + 1, chunk.ret_code.data());
+            copy(LOG_CHANNELS + 2, chunk.missing.data());
+            for (__u8 d = 0; d < DERIVED_CHANNELS; d++)
+                copy(LOG_CHANNELS + 3 + d, chunk.derived[d].data());
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    munmap(out, size);
+}
+
+static const char* export_name(size_t c)
+{
+    return c < LOG_CHANNELS ? CHANNEL_NAMES[c] : (c == EXPORT_RET_CODE ? "ret_code" : DERIVED_NAMES[c - EXPORT_RET_CODE - 1]);
+}
+
+// the export columns named in a comma separated list, all of them when the list is empty
+static bool select_columns(std::string_view list, std::vector<size_t>& selected)
+{
+    for (size_t c = 0; list.empty() && c < EXPORT_COLUMNS; c++)
+        selected.push_back(c);
+    while (!list.empty())
+    {
+        size_t comma = list.find(','), c = 0;
+        while (c < EXPORT_COLUMNS && list.substr(0, comma) != export_name(c))
+            c++;
+        if (c == EXPORT_COLUMNS)
+            return false;
+        selected.push_back(c);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+    }
+    return true;
+}
+
+// writes the chunks as an Arrow file or stream, one record batch each, to file_name or to stdout for "-"
+static void write_arrow(const std::string& file_name, arrow_format format, const std::vector<size_t>& selected, std::vector<Chunk>& chunks)
+{
+    // validity bitmaps of every selected column of every chunk, a thread per chunk
+    std::vector<std::vector<std::vector<__u8>>> validity(chunks.size(), std::vector<std::vector<__u8>>(selected.size()));
+    std::vector<std::vector<size_t>> null_counts(chunks.size(), std::vector<size_t>(selected.size()));
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < chunks.size(); t++)
+    {
+        workers.emplace_back([&, t]() {
+            const Chunk& chunk = chunks[t];
+            for (size_t i = 0; i < selected.size(); i++)
+            {
+                size_t c = selected[i];
+                if (c != EXPORT_RET_CODE)
+                {
+                    null_counts[t][i] = arrow_validity(c < LOG_CHANNELS ? chunk.values[c].data() : chunk.derived[c - EXPORT_RET_CODE - 1].data(), chunk.rows(), validity[t][i]);
+                    continue;
+                }
+                // legacy rows have no ret_code
+                validity[t][i].assign((chunk.rows() + 7) / 8, 0);
+                for (size_t row = 0; row < chunk.rows(); row++)
+                {
+                    __u8 valid = !(chunk.missing[row] >> MISSING_RET_CODE & 1);
+                    validity[t][i][row / 8] |= valid << (row % 8);
+                    null_counts[t][i] += !valid;
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+
+    int file = file_name == "-" ? STDOUT_FILENO : open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file < 0)
+        throw std::runtime_error("Error opening " + file_name);
+    bool failed = false;
+    auto output = [file, &failed](const void* data, size_t size) {
+        for (const char* p = static_cast<const char*>(data); !failed && size > 0;)
+        {
+            ssize_t n = write(file, p, size);
+            failed = n <= 0;
+            p += n;
+            size -= n;
+        }
+    };
+    std::vector<ArrowField> fields = {{"time", ARROW_TIMESTAMP_NS, false}};
+    for (size_t c : selected)
+        fields.push_back({export_name(c), c == EXPORT_RET_CODE ? ARROW_INT32 : ARROW_FLOAT32, true});
+    ArrowWriter writer(format, fields, output);
+    std::vector<ArrowArray> arrays(fields.size());
+    for (size_t t = 0; t < chunks.size(); t++)
+    {
+        const Chunk& chunk = chunks[t];
+        if (chunk.rows() == 0)
+            continue;
+        arrays[0] = {chunk.time_ns.data()};
+        for (size_t i = 0; i < selected.size(); i++)
+        {
+            size_t c = selected[i];
+            const void* values = c < LOG_CHANNELS ? static_cast<const void*>(chunk.values[c].data())
+                                                  : (c == EXPORT_RET_CODE ? static_cast<const void*>(chunk.ret_code.data()) : chunk.derived[c - EXPORT_RET_CODE - 1].data());
+            arrays[i + 1] = {values, validity[t][i].data(), null_counts[t][i]};
+        }
+        writer.write_batch(chunk.rows(), arrays.data());
+    }
+    writer.finish();
+    if (file != STDOUT_FILENO)
+        close(file);
+    if (failed)
+        throw std::runtime_error("Error writing " + file_name);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    float altitude_m = 0.0f;
+    bool scaling = false, usage = false, arrow = false;
+    arrow_format format = ARROW_FILE;
+    double from_s = -1e10, to_s = 1e10;
+    std::string_view channels;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            threads = std::max(1, std::atoi(argv[++i]));
+        else if (strcmp(argv[i], "-scaling") == 0)
+            scaling = true;
+        else if (strcmp(argv[i], "-altitude") == 0 && i + 1 < argc)
+            altitude_m = std::atof(argv[++i]);
+        else if (strcmp(argv[i], "-from") == 0 && i + 1 < argc)
+            from_s = std::atof(argv[++i]);
+        else if (strcmp(argv[i], "-to") == 0 && i + 1 < argc)
+            to_s = std::atof(argv[++i]);
+        else if (strcmp(argv[i], "-arrow") == 0 || strcmp(argv[i], "-arrow_stream") == 0)
+        {
+            arrow = true;
+            format = strcmp(argv[i], "-arrow") == 0 ? ARROW_FILE : ARROW_STREAM;
+        }
+        else if (strcmp(argv[i], "-channels") == 0 && i + 1 < argc)
+            channels = argv[++i];
+        else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)
+            files.push_back(argv[i]);
+        else
+            usage = true;
+    }
+    std::vector<size_t> selected;
+    if (!select_columns(channels, selected) || (!channels.empty() && !arrow))
+        usage = true;
+    if (usage || files.size() != 2 || (strcmp(files[1], "-") == 0 && !arrow))
+    {
+        std::cout << "Converts a log.txt style file into a binary columnar file with a per-row missing bitmap.\n"
+                     "Usage:\n"
+                     "./log_converter [-threads N] [-scaling] [-altitude M] [-from S] [-to S] [-arrow|-arrow_stream] [-channels A,B] LOG OUT\n"
+                     "-threads N     worker threads (all cores is default);\n"
+                     "-scaling       also times the parse with 1, 2, 4... threads up to N;\n"
+                     "-altitude M    altitude of the sensors in m, for the derived sea level pressure (0 is default);\n"
+                     "-from S, -to S only the records in [from, to), epoch seconds;\n"
+                     "-arrow         writes an Arrow IPC file (Feather v2), for pyarrow.feather.read_table(OUT) and the like;\n"
+                     "-arrow_stream  writes an Arrow IPC stream, OUT may be - for stdout;\n"
+                     "-channels A,B  the Arrow columns after time, of T_interior... P_exterior, ret_code, q_interior... P_sea_exterior.\n"
+                     "Check the result against the Python parser with: python tools/verify_columnar.py LOG OUT\n";
+        return 0;
+    }
+
+    try
+    {
+        LogFile log_file(files[0]);
+        size_t from = from_s > -1e10 ? log_file.find_time(static_cast<__s64>(from_s * 1e9)) : 0;
+        size_t to = std::max(from, to_s < 1e10 ? log_file.find_time(static_cast<__s64>(to_s * 1e9)) : log_file.size());
+        // the report goes to stderr when the output is stdout
+        std::ostream& report = strcmp(files[1], "-") == 0 ? std::cerr : std::cout;
+        report << std::fixed << std::setprecision(2);
+        if (scaling)
+        {
+            for (unsigned t = 1;; t = std::min(t * 2, threads))
+            {
+                std::vector<Chunk> chunks;
+                auto t_parse = std::chrono::steady_clock::now();
+                parse_log(log_file, from, to, t, altitude_m, chunks);
+                double seconds = seconds_since(t_parse);
+                report << "parse, " << std::setw(3) << t << " threads  " << std::setw(7) << (to - from) / seconds / 1e9 << " GB/s\n";
+                if (t == threads)
+                    break;
+            }
+        }
+
+        std::vector<Chunk> chunks;
+        auto t_start = std::chrono::steady_clock::now();
+        parse_log(log_file, from, to, threads, altitude_m, chunks);
+        double parse_seconds = seconds_since(t_start);
+        auto t_write = std::chrono::steady_clock::now();
+        if (arrow)
+            write_arrow(files[1], format, selected, chunks);
+        else
+            write_columnar(files[1], chunks);
+        double write_seconds = seconds_since(t_write);
+
+        size_t rows = 0, skipped = 0, legacy = 0;
+        for (const Chunk& chunk : chunks)
+        {
+            rows += chunk.rows();
+            skipped += chunk.skipped;
+            for (__u8 mask : chunk.missing)
+                legacy += (mask >> MISSING_RET_CODE) & 1;
+        }
+        report << files[0] << ": " << (to - from) / 1e6 << " MB, " << rows << " rows (" << legacy << " legacy), " << skipped << " lines skipped\n";
+        report << "parse   " << std::setw(8) << parse_seconds * 1e3 << " ms  " << std::setw(6) << (to - from) / parse_seconds / 1e9 << " GB/s with " << threads << " threads\n";
+        report << "write   " << std::setw(8) << write_seconds * 1e3 << " ms\n";
+        report << "total   " << std::setw(8) << seconds_since(t_start) * 1e3 << " ms  " << std::setw(6) << (to - from) / seconds_since(t_start) / 1e9 << " GB/s\n";
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << "log_converter: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,348 @@
+// Statistics for the weekly report in one pass over the log or the compressed store.
+// The file is memory mapped once, the requested days are found by bisection and split across
+// worker threads, each keeping per-day min/max/mean/stddev of every channel and of the derived
+// humidity metrics. The result is printed as JSON for email_updater.py.
+// Usage: ./report_aggregator [-log FILE] [-store FILE] [-to YYYY-MM-DD] [-days N] [-threads N] [-altitude M]
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <charconv>
+#include <string.h>
+#include "../include/log_file.cpp"
+#include "../include/gorilla.cpp"
+#include "../include/derived_metrics.cpp"
+
+#define REPORT_DEFAULT_DAYS 7
+#define REPORT_MAX_DAYS 3660
+#define REPORT_SERIES (LOG_CHANNELS + DERIVED_CHANNELS)
+
+// altitude of the sensors in m for the sea level pressure, -altitude
+static float altitude_m = 0.0f;
+
+struct SeriesStats
+{
+    __u32 count = 0;
+    float min = FLT_MAX, max = -FLT_MAX;
+    double sum = 0.0, sum_squares = 0.0;
+
+    inline void add(float value)
+    {
+        if (is_missing(value))
+            return;
+        count++;
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        sum += value;
+        sum_squares += static_cast<double>(value) * value;
+    }
+
+    void merge(const SeriesStats& other)
+    {
+        count += other.count;
+        min = other.min < min ? other.min : min;
+        max = other.max > max ? other.max : max;
+        sum += other.sum;
+        sum_squares += other.sum_squares;
+    }
+};
+
+struct DayStats
+{
+    __u32 records = 0;
+    SeriesStats series[REPORT_SERIES];
+
+    inline void add(const LogRecord& record)
+    {
+        records++;
+        for (__u8 ch = 0; ch < LOG_CHANNELS; ch++)
+            series[ch].add(record.values[ch]);
+        DerivedRecord derived;
+        derive(record, altitude_m, derived);
+        for (__u8 d = 0; d < DERIVED_CHANNELS; d++)
+            series[LOG_CHANNELS + d].add(derived.values[d]);
+    }
+
+    void merge(const DayStats& other)
+    {
+        records += other.records;
+        for (__u8 s = 0; s < REPORT_SERIES; s++)
+            series[s].merge(other.series[s]);
+    }
+};
+
+// per-thread statistics of the days delimited by bounds, records outside [bounds.front(), bounds.back()) are ignored
+class DayAggregator
+{
+public:
+    DayAggregator(const std::vector<__s64>* bounds) : _bounds(bounds), _days(bounds->size() - 1) {}
+
+    inline void add(const LogRecord& record)
+    {
+        const std::vector<__s64>& bounds = *_bounds;
+        // records come in time order, so the day rarely changes
+        if (record.time_ns < bounds[_day] || record.time_ns >= bounds[_day + 1])
+        {
+            if (record.time_ns < bounds.front() || record.time_ns >= bounds.back())
+                return;
+            _day = std::upper_bound(bounds.begin(), bounds.end(), record.time_ns) - bounds.begin() - 1;
+        }
+        _days[_day].add(record);
+    }
+
+    void merge_into(std::vector<DayStats>& days) const
+    {
+        for (size_t d = 0; d < days.size(); d++)
+            days[d].merge(_days[d]);
+    }
+
+private:
+    const std::vector<__s64>* _bounds;
+    std::vector<DayStats> _days;
+    size_t _day = 0;
+};
+
+// local midnights from days before to_date up to to_date, so a DST change gives a 23 or 25 h day
+static bool day_bounds(const char* to_date, int days, std::vector<__s64>& bounds, std::vector<std::string>& names)
+{
+    struct tm day = {};
+    if (to_date == nullptr)
+    {
+        time_t now = time(nullptr);
+        localtime_r(&now, &day);
+    }
+    else if (strptime(to_date, "%Y-%m-%d", &day) == nullptr)
+        return false;
+    for (int i = -days; i <= 0; i++)
+    {
+        struct tm midnight = day;
+        midnight.tm_mday += i;
+        midnight.tm_hour = midnight.tm_min = midnight.tm_sec = 0;
+        midnight.tm_isdst = -1;
+        time_t t = mktime(&midnight);
+        bounds.push_back(static_cast<__s64>(t) * 1000000000LL);
+        char name[16];
+        strftime(name, sizeof(name), "%Y-%m-%d", &midnight);
+        names.push_back(name);
+    }
+    return true;
+}
+
+// text log: the byte range of the days is split at line boundaries, one chunk per thread
+static size_t aggregate_log(const std::string& file_name, const std::vector<__s64>& bounds, unsigned threads, std::vector<DayStats>& days)
+{
+    LogFile log_file(file_name);
+    size_t begin = log_file.find_time(bounds.front());
+    size_t end = log_file.find_time(bounds.back());
+    std::vector<size_t> cuts = {begin};
+    for (unsigned t = 1; t < threads; t++)
+        cuts.push_back(std::max(cuts.back(), std::min(end, log_file.line_start(begin + (end - begin) * t / threads))));
+    cuts.push_back(end);
+
+    std::vector<DayAggregator> aggregators(threads, DayAggregator(&bounds));
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]() {
+            LogLineParser parser;
+            LogRecord record;
+            const char* data = log_file.data();
+            for (size_t line = cuts[t]; line < cuts[t + 1];)
+            {
+                const char* newline = static_cast<const char*>(memchr(data + line, '\n', cuts[t + 1] - line));
+                size_t next = newline == nullptr ? cuts[t + 1] : newline - data + 1;
+                if (parser.parse(std::string_view(data + line, next - line - (newline != nullptr)), record))
+                    aggregators[t].add(record);
+                line = next;
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    for (const DayAggregator& aggregator : aggregators)
+        aggregator.merge_into(days);
+    return end - begin;
+}
+
+// compressed store: the blocks overlapping the days are decoded in parallel, then the open block from the journal
+static size_t aggregate_store(const std::string& file_name, const std::vector<__s64>& bounds, unsigned threads, std::vector<DayStats>& days)
+{
+    LogFile store(file_name); // only for the read-only map
+    std::vector<size_t> blocks;
+    size_t bytes = 0;
+    GorillaBlockHeader last;
+    for (size_t offset = 0; offset < store.size();)
+    {
+        GorillaBlockHeader header = GorillaBlockDecoder::read_header(reinterpret_cast<const __u8*>(store.data()) + offset, store.size() - offset);
+        if (header.t_last_ns >= bounds.front() && header.t_first_ns < bounds.back())
+        {
+            blocks.push_back(offset);
+            bytes += header.size;
+        }
+        last = header;
+        offset += header.size;
+    }
+
+    std::vector<DayAggregator> aggregators(threads, DayAggregator(&bounds));
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]() {
+            std::vector<LogRecord> records;
+            for (size_t b = t; b < blocks.size(); b += threads)
+            {
+                records.clear();
+                GorillaBlockDecoder::decode(reinterpret_cast<const __u8*>(store.data()) + blocks[b], store.size() - blocks[b], records);
+                for (const LogRecord& record : records)
+                    aggregators[t].add(record);
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    for (const DayAggregator& aggregator : aggregators)
+        aggregator.merge_into(days);
+
+    std::vector<LogRecord> open_block;
+    GorillaStore::read_open_block(file_name, last, open_block);
+    DayAggregator tail(&bounds);
+    for (const LogRecord& record : open_block)
+        tail.add(record);
+    tail.merge_into(days);
+    return bytes + open_block.size() * (sizeof(LogRecord) + JOURNAL_FRAME_HEADER);
+}
+
+static void append(std::string& out, float value)
+{
+    char buffer[32];
+    out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+static void append(std::string& out, double value)
+{
+    char buffer[32];
+    out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+static void append_stats(std::string& out, const DayStats& day)
+{
+    out += "\"records\":";
+    append(out, static_cast<double>(day.records));
+    for (__u8 s = 0; s < REPORT_SERIES; s++)
+    {
+        const SeriesStats& series = day.series[s];
+        out += ",\"";
+        out += s < LOG_CHANNELS ? CHANNEL_NAMES[s] : DERIVED_NAMES[s - LOG_CHANNELS];
+        out += "\":{\"count\":";
+        append(out, static_cast<double>(series.count));
+        if (series.count == 0)
+            out += ",\"min\":null,\"max\":null,\"mean\":null,\"stddev\":null}";
+        else
+        {
+            double mean = series.sum / series.count;
+            double variance = series.sum_squares / series.count - mean * mean;
+            out += ",\"min\":";
+            append(out, series.min);
+            out += ",\"max\":";
+            append(out, series.max);
+            out += ",\"mean\":";
+            append(out, static_cast<float>(mean));
+            out += ",\"stddev\":";
+            append(out, static_cast<float>(variance > 0.0 ? sqrt(variance) : 0.0));
+            out += '}';
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string log_file_name = "log.txt";
+    std::string store_file_name = "";
+    const char* to_date = nullptr;
+    int days = REPORT_DEFAULT_DAYS;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-log") == 0 && i + 1 < argc)
+            log_file_name = argv[++i];
+        else if (strcmp(argv[i], "-store") == 0 && i + 1 < argc)
+            store_file_name = argv[++i];
+        else if (strcmp(argv[i], "-to") == 0 && i + 1 < argc)
+            to_date = argv[++i];
+        else if (strcmp(argv[i], "-days") == 0 && i + 1 < argc)
+            days = std::atoi(argv[++i]);
+        else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            threads = std::max(1, std::atoi(argv[++i]));
+        else if (strcmp(argv[i], "-altitude") == 0 && i + 1 < argc)
+            altitude_m = std::atof(argv[++i]);
+        else
+        {
+            std::cout << "Per-day and whole-period statistics of the logged channels as JSON, in one pass.\n"
+                         "Usage:\n"
+                         "./report_aggregator [-log FILE] [-store FILE] [-to YYYY-MM-DD] [-days N] [-threads N] [-altitude M]\n"
+                         "-log FILE      log.txt style file to read (log.txt is default);\n"
+                         "-store FILE    reads a gorilla compressed store (-store of the logger) instead of the log;\n"
+                         "-to DATE       the period ends at the local midnight starting DATE (today is default);\n"
+                         "-days N        number of days before DATE (7 is default);\n"
+                         "-threads N     worker threads (all cores is default);\n"
+                         "-altitude M    altitude of the sensors in m, for the sea level pressure (0 is default).\n";
+            return 0;
+        }
+    }
+    if (days < 1 || days > REPORT_MAX_DAYS)
+    {
+        std::cerr << "report_aggregator: -days must be 1 to " << REPORT_MAX_DAYS << "\n";
+        return 1;
+    }
+
+    std::vector<__s64> bounds;
+    std::vector<std::string> names;
+    if (!day_bounds(to_date, days, bounds, names))
+    {
+        std::cerr << "report_aggregator: -to must be YYYY-MM-DD\n";
+        return 1;
+    }
+
+    auto t_start = std::chrono::steady_clock::now();
+    std::vector<DayStats> day_stats(days);
+    size_t bytes;
+    try
+    {
+        bytes = store_file_name.empty() ? aggregate_log(log_file_name, bounds, threads, day_stats) : aggregate_store(store_file_name, bounds, threads, day_stats);
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << "report_aggregator: " << e.what() << "\n";
+        return 1;
+    }
+    DayStats total;
+    for (const DayStats& day : day_stats)
+        total.merge(day);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+
+    std::string out = "{\"from\":\"" + names.front() + "\",\"to\":\"" + names.back() + "\",\"days\":[";
+    for (int d = 0; d < days; d++)
+    {
+        out += d == 0 ? "\n{\"date\":\"" : ",\n{\"date\":\"";
+        out += names[d];
+        out += "\",";
+        append_stats(out, day_stats[d]);
+        out += '}';
+    }
+    out += "],\n\"total\":{";
+    append_stats(out, total);
+    out += "},\n\"scanned_bytes\":";
+    append(out, static_cast<double>(bytes));
+    out += ",\"threads\":";
+    append(out, static_cast<double>(threads));
+    out += ",\"seconds\":";
+    append(out, seconds);
+    out += "}\n";
+    std::cout << out;
+    return 0;
+}
@@ -0,0 +1,126 @@
+import sys
+import struct
+import math
+from array import array
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+from include.print_logs import parse_timestamp
+
+# reader for the columnar files of tools/log_converter.cpp, and a check of one (or of an Arrow file of
+# log_converter -arrow, read with pyarrow) against the Python parser
+MAGIC = 0x46434C54
+HEADER = struct.Struct("<IHHQ")
+ENTRY = struct.Struct("<16sBB6xQ")
+TYPECODES = {1: "q", 2: "f", 3: "i", 4: "B"}
+
+def read_columnar(path):
+    # returns {column name: array}
+    data = Path(path).read_bytes()
+    magic, version, count, rows = HEADER.unpack_from(data)
+    if magic != MAGIC or version != 1:
+        raise ValueError(f"{path} is not a columnar log")
+    columns = {}
+    for c in range(count):
+        name, column_type, width, offset = ENTRY.unpack_from(data, 64 + ENTRY.size * c)
+        column = array(TYPECODES[column_type])
+        column.frombytes(data[offset:offset + rows * width])
+        columns[name.rstrip(b"\0").decode()] = column
+    return columns
+
+def read_arrow(path):
+    # the same columns from an Arrow file with all the columns, nulls back to nan and missing bits
+    import pyarrow
+    import pyarrow.feather
+    table = pyarrow.feather.read_table(path)
+    names = table.column_names
+    columns = {"time_ns": array("q", table.column("time").cast(pyarrow.int64()).to_pylist())}
+    missing = array("B", bytes(table.num_rows))
+    for c, name in enumerate(names[1:8] + ["ret_code"]):
+        values = table.column(name).to_pylist()
+        bit = 7 if name == "ret_code" else c
+        for row, value in enumerate(values):
+            if value is None:
+                missing[row] |= 1 << bit
+        columns[name] = array("i" if name == "ret_code" else "f", [(0 if name == "ret_code" else math.nan) if value is None else value for value in values])
+    columns["missing"] = missing
+    for name in names[9:]:
+        columns[name] = array("f", [math.nan if value is None else value for value in table.column(name).to_pylist()])
+    return columns
+
+def parse_lines(path):
+    # the split('\t') logic of webapp.py and email_updater.py, lines it cannot parse are skipped
+    with open(path) as log_file:
+        for line in log_file:
+            fields = line.rstrip("\r\n").split("\t")
+            try:
+                time = parse_timestamp(fields[0])
+                values = [float(field) for field in fields[1:5]]
+                if len(fields) > 6:
+                    yield time, values[:4] + [float(field) for field in fields[6:9]], int(fields[5]), True
+                else:
+                    yield time, values + [math.nan] * 3, 0, False
+            except (ValueError, IndexError):
+                continue
+
+def specific_humidity(T, H, P):
+    # webapp.py, g/kg
+    saturation_press = 0.0061078 * math.exp((17.27 * T) / (T + 237.3))
+    vapor_press = H / 100 * saturation_press
+    return 1000 * vapor_press / (1.6078 * P - 0.6078 * vapor_press)
+
+def dew_point(T, H):
+    if H <= 0:
+        return math.nan
+    gamma = math.log(H / 100) + 17.27 * T / (T + 237.3)
+    return 237.3 * gamma / (17.27 - gamma)
+
+def derived_differs(stored, expected):
+    # the logger computes in float with approximated exp and log
+    if math.isnan(expected) or math.isnan(stored):
+        return math.isnan(expected) != math.isnan(stored)
+    return abs(stored - expected) > 1e-4 * max(1.0, abs(expected))
+
+def as_float32(value):
+    return struct.unpack("<f", struct.pack("<f", value))[0]
+
+def verify(log_path, columnar_path):
+    with open(columnar_path, "rb") as columnar_file:
+        arrow = columnar_file.read(6) == b"ARROW1"
+    columns = read_arrow(columnar_path) if arrow else read_columnar(columnar_path)
+    names = list(columns)[1:8]
+    rows = len(columns["time_ns"])
+    row = mismatches = 0
+    for time, values, ret_code, has_ret_code in parse_lines(log_path):
+        if row >= rows:
+            row += 1
+            continue
+        problems = []
+        if abs(columns["time_ns"][row] - round(time.timestamp() * 1e9)) > 1000: # iso timestamps lose ns in a datetime
+            problems.append("time")
+        missing = columns["missing"][row]
+        for c, (name, value) in enumerate(zip(names, values)):
+            stored = columns[name][row]
+            if math.isnan(value) != bool(missing >> c & 1) or (not math.isnan(value) and stored != as_float32(value)):
+                problems.append(name)
+        if "q_interior" in columns:
+            T, H, P = [as_float32(value) for value in values[0:3]]
+            T_ext, H_ext, P_ext = [as_float32(value) for value in values[4:7]]
+            expected = {"q_interior": specific_humidity(T, H, P), "q_exterior": specific_humidity(T_ext, H_ext, P_ext),
+                        "dew_interior": dew_point(T, H), "dew_exterior": dew_point(T_ext, H_ext)}
+            problems += [name for name, value in expected.items() if derived_differs(columns[name][row], value)]
+        if columns["ret_code"][row] != ret_code or bool(missing >> 7 & 1) == has_ret_code:
+            problems.append("ret_code")
+        if problems:
+            mismatches += 1
+            if mismatches <= 10:
+                print(f"row {row}: {', '.join(problems)} differ")
+        row += 1
+    print(f"{row} rows parsed by Python, {rows} rows converted, {mismatches} mismatches")
+    return row == rows and mismatches == 0
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print("Usage: python tools/verify_columnar.py LOG COLUMNAR|ARROW")
+        sys.exit(2)
+    sys.exit(0 if verify(sys.argv[1], sys.argv[2]) else 1)
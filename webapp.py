@@ -1,16 +1,22 @@
 import dash
 from dash import dcc, html, dash_table
 import plotly.graph_objects as go
-from include.print_logs import logs_to_list
+from include.print_logs import logs_to_list, parse_timestamp
+from include.shared_samples import SharedSamples, Q_INTERIOR, Q_EXTERIOR
 import dash_bootstrap_components as dbc
 import datetime
 import os
 from dotenv import load_dotenv # pip install python-dotenv
 from pathlib import Path
 import math
+import json
+import urllib.request
 
 DATE_FORMAT = "%a %b %d %H:%M:%S %Y"
 MARKS_TO_DAYS = (1, 2, 3, 4, 5, 6, 7, 14, 28, 56) # converts from slider mark idx to respective days
+PLOT_POINTS = 1000 # per line, picked by the logger's /downsample
+SCATTER_POINTS = 500 # bucket means in the 3D scatter
+LINE_CHANNELS = ('T_interior', 'H_interior', 'P_interior', 'T_analog', 'T_exterior', 'H_exterior', 'P_exterior', 'q_interior', 'q_exterior')
 
 app = dash.Dash(__name__, external_stylesheets=[dbc.themes.QUARTZ])
 app.title = 'The Weather Dash'
@@ -20,6 +26,7 @@ curr_dir = Path(__file__).resolve().parent if "__file__" in locals() else Path.c
 envars = curr_dir / ".env"
 load_dotenv(envars)
 NEWSLETTER_LINK = os.getenv("FORM_LINK")
+LOGGER_URL = os.getenv("LOGGER_URL", "http://127.0.0.1:8081") # the logger's -http_port
 
 @app.callback(
     [dash.Output('3d-scatter-graph', 'figure'),
@@ -32,17 +39,19 @@ NEWSLETTER_LINK = os.getenv("FORM_LINK")
     [dash.Input('slider', 'value')]
 )
 def update_figures(slider_value):
-    time_stamp_list, T_interior_list, H_interior_list, P_interior_list, Tint_list, T_exterior_list, H_exterior_list, P_exterior_list = get_latest_log_data(days_before=MARKS_TO_DAYS[slider_value])
-    
+    # lines as {channel: (times, values)}, the 3D scatter as aligned lists
+    lines, (time_stamp_list, T_interior_list, H_interior_list, P_interior_list, T_exterior_list, H_exterior_list, P_exterior_list) = get_plot_data(days_before=MARKS_TO_DAYS[slider_value])
+
+    # the logger publishes every raw sample, fall back to the newest plotted point when it is not running
+    latest = get_latest_sample()
+    if latest is None:
+        latest = (None, *(newest(lines[channel]) for channel in LINE_CHANNELS[:7]))
     info_data = [
-        {'Latest Value': 'Temperature', 'Interior': f'{T_interior_list[0]:.2f} \u2103', 'Exterior': f'{T_exterior_list[0]:.2f} \u2103'},
-        {'Latest Value': 'Humidity', 'Interior': f'{H_interior_list[0]:.1f} %', 'Exterior': f'{H_exterior_list[0]:.1f} %'},
-        {'Latest Value': 'Pressure', 'Interior': f'{P_interior_list[0]:.3f} bar', 'Exterior': f'{P_exterior_list[0]:.3f} bar'}
+        {'Latest Value': 'Temperature', 'Interior': f'{latest[1]:.2f} \u2103', 'Exterior': f'{latest[5]:.2f} \u2103'},
+        {'Latest Value': 'Humidity', 'Interior': f'{latest[2]:.1f} %', 'Exterior': f'{latest[6]:.1f} %'},
+        {'Latest Value': 'Pressure', 'Interior': f'{latest[3]:.3f} bar', 'Exterior': f'{latest[7]:.3f} bar'}
     ]
 
-    specific_humidity_interior_list = compute_specific_humidity(T_interior_list, H_interior_list, P_interior_list)
-    specific_humidity_exterior_list = compute_specific_humidity(T_exterior_list, H_exterior_list, P_exterior_list)
-
     threed_fig = go.Figure(data=[
         go.Scatter3d(
             x=T_interior_list,
@@ -68,18 +77,18 @@ def update_figures(slider_value):
             name='Exterior')
     ])
     temperature_fig = go.Figure(data=[
-        go.Scatter(x=time_stamp_list, y=T_interior_list, mode='lines+markers', name='Interior'), go.Scatter(x=time_stamp_list, y=T_exterior_list, mode='lines+markers', name='Exterior')
+        go.Scatter(x=lines['T_interior'][0], y=lines['T_interior'][1], mode='lines+markers', name='Interior'), go.Scatter(x=lines['T_exterior'][0], y=lines['T_exterior'][1], mode='lines+markers', name='Exterior')
         ])
     humidity_fig = go.Figure(data=[
-        go.Scatter(x=time_stamp_list, y=H_interior_list, mode='lines+markers', name='Interior'), go.Scatter(x=time_stamp_list, y=H_exterior_list, mode='lines+markers', name='Exterior')
+        go.Scatter(x=lines['H_interior'][0], y=lines['H_interior'][1], mode='lines+markers', name='Interior'), go.Scatter(x=lines['H_exterior'][0], y=lines['H_exterior'][1], mode='lines+markers', name='Exterior')
         ])
     pressure_fig = go.Figure(data=[
-        go.Scatter(x=time_stamp_list, y=P_interior_list, mode='lines+markers', name='Interior'), go.Scatter(x=time_stamp_list, y=P_exterior_list, mode='lines+markers', name='Exterior')
+        go.Scatter(x=lines['P_interior'][0], y=lines['P_interior'][1], mode='lines+markers', name='Interior'), go.Scatter(x=lines['P_exterior'][0], y=lines['P_exterior'][1], mode='lines+markers', name='Exterior')
         ])
     specific_humidity_fig = go.Figure(data=[
-        go.Scatter(x=time_stamp_list, y=specific_humidity_interior_list, mode='lines+markers', name='Interior'), go.Scatter(x=time_stamp_list, y=specific_humidity_exterior_list, mode='lines+markers', name='Exterior')
+        go.Scatter(x=lines['q_interior'][0], y=lines['q_interior'][1], mode='lines+markers', name='Interior'), go.Scatter(x=lines['q_exterior'][0], y=lines['q_exterior'][1], mode='lines+markers', name='Exterior')
         ])
-    analog_temperature_fig = go.Figure(data=[go.Scatter(x=time_stamp_list, y=Tint_list, mode='markers+text')])
+    analog_temperature_fig = go.Figure(data=[go.Scatter(x=lines['T_analog'][0], y=lines['T_analog'][1], mode='markers+text')])
     
     # Customize the plot appearance
     tick_format = '%H:%M'
@@ -98,8 +107,8 @@ def update_figures(slider_value):
             annotations=[
                 {'x': T_interior_list[0], 'y': H_interior_list[0], 'z': P_interior_list[0], 'text': time_stamp_list[0].strftime('Interior - %d/%m %H:%M')},
                 {'x': T_interior_list[-1], 'y': H_interior_list[-1], 'z': P_interior_list[-1], 'text': time_stamp_list[-1].strftime('Interior -%d/%m %H:%M')},
-                {'x': next(x for x in T_exterior_list if not math.isnan(x)), 'y': next(y for y in H_exterior_list if not math.isnan(y)), 'z': next(z for z in P_exterior_list if not math.isnan(z)), 'text': time_stamp_list[0].strftime('Exterior - %d/%m %H:%M')},
-                {'x': next(x for x in reversed(T_exterior_list) if not math.isnan(x)), 'y': next(y for y in reversed(H_exterior_list) if not math.isnan(y)), 'z': next(z for z in reversed(P_exterior_list) if not math.isnan(z)), 'text': time_stamp_list[-1].strftime('Exterior - %d/%m %H:%M')}
+                {'x': next(x for x in T_exterior_list if present(x)), 'y': next(y for y in H_exterior_list if present(y)), 'z': next(z for z in P_exterior_list if present(z)), 'text': time_stamp_list[0].strftime('Exterior - %d/%m %H:%M')},
+                {'x': next(x for x in reversed(T_exterior_list) if present(x)), 'y': next(y for y in reversed(H_exterior_list) if present(y)), 'z': next(z for z in reversed(P_exterior_list) if present(z)), 'text': time_stamp_list[-1].strftime('Exterior - %d/%m %H:%M')}
             ]
         ),
         height=800,
@@ -154,9 +163,79 @@ def update_figures(slider_value):
     return threed_fig, temperature_fig, humidity_fig, pressure_fig, specific_humidity_fig, analog_temperature_fig, info_data
 
 
+def present(value):
+    return value is not None and not math.isnan(value) # the logger sends missing values as null
+
+def newest(line):
+    times, values = line
+    return max(((t, v) for t, v in zip(times, values) if present(v)), default=(None, math.nan))[1]
+
+def get_logger_json(target):
+    try:
+        with urllib.request.urlopen(LOGGER_URL + target, timeout=5) as response:
+            return json.load(response)
+    except (OSError, ValueError):
+        return None # logger not running or started without -http_port
+
+def get_downsampled_data(from_date, to_date):
+    # LTTB picked points of every line and bucket means for the 3D scatter, None when the logger does not answer
+    from_s, to_s = from_date.timestamp(), to_date.timestamp()
+    downsampled = get_logger_json(f'/downsample?from={from_s:.0f}&to={to_s:.0f}&points={PLOT_POINTS}&channels={",".join(LINE_CHANNELS)}')
+    rollup = get_logger_json(f'/rollup?from={from_s:.0f}&to={to_s:.0f}&step={max(60, (to_s - from_s) / SCATTER_POINTS):.0f}')
+    if downsampled is None or rollup is None or not rollup['start']:
+        return None
+    lines = {channel: ([datetime.datetime.fromtimestamp(t / 1e3) for t in series['time']], series['values']) for channel, series in downsampled['series'].items()}
+    scatter = ([datetime.datetime.fromtimestamp(t / 1e3) for t in rollup['start']], *(rollup[channel]['mean'] for channel in ('T_interior', 'H_interior', 'P_interior', 'T_exterior', 'H_exterior', 'P_exterior')))
+    return lines, scatter
+
+def get_plot_data(days_before = 1):
+    to_date = datetime.datetime.now()
+    from_date = to_date - datetime.timedelta(days = days_before)
+    downsampled = get_downsampled_data(from_date, to_date)
+    if downsampled is not None:
+        print(f'Webpage refreshed at {to_date} from the logger.')
+        return downsampled
+    # every days_before-th record from shared memory or the log file, the same points in every figure
+    time_stamp_list, *channels = get_latest_log_data(days_before)
+    lines = {channel: (time_stamp_list, values) for channel, values in zip(LINE_CHANNELS, channels)}
+    return lines, (time_stamp_list, *channels[0:3], *channels[4:7])
+
+def open_shared_samples():
+    try:
+        return SharedSamples()
+    except (OSError, ValueError):
+        return None # logger not running or started without -shm
+
+def get_latest_sample():
+    shared = open_shared_samples()
+    if shared is None:
+        return None
+    latest = shared.latest()
+    shared.close()
+    return latest
+
+def get_shared_log_data(from_date, subsample):
+    # the last days straight from the logger's memory, None when the ring does not reach back to from_date
+    shared = open_shared_samples()
+    if shared is None:
+        return None
+    oldest = shared.oldest_time()
+    records = shared.records_since(int(from_date.timestamp() * 1e9)) if oldest is not None and oldest <= from_date else None
+    shared.close()
+    if not records:
+        return None
+    records = records[::subsample]
+    # the logger derives the specific humidity at ingest, the Q_INTERIOR and Q_EXTERIOR fields of a record
+    return [datetime.datetime.fromtimestamp(r[0] / 1e9) for r in records], *([r[ch] for r in records] for ch in range(1, 8)), \
+        [r[Q_INTERIOR] for r in records], [r[Q_EXTERIOR] for r in records]
+
 def get_latest_log_data(days_before = 1):
     to_date = datetime.datetime.now()
     from_date = to_date - datetime.timedelta(days = days_before) # checks for last N days
+    shared_data = get_shared_log_data(from_date, days_before)
+    if shared_data is not None:
+        print(f'Webpage refreshed at {to_date} from shared memory.')
+        return shared_data
     logs_list = logs_to_list(from_date, to_date, subsample=days_before)
     time_stamp_list = []
     T_interior_list = []
@@ -166,9 +245,11 @@ def get_latest_log_data(days_before = 1):
     T_exterior_list = []
     H_exterior_list = []
     P_exterior_list = []
+    specific_humidity_interior_list = []
+    specific_humidity_exterior_list = []
     for log in logs_list:
         split_line = log.split('\t')
-        time_stamp_list.append(datetime.datetime.strptime(split_line[0], DATE_FORMAT))
+        time_stamp_list.append(parse_timestamp(split_line[0]))
         T_interior_list.append(float(split_line[1]))
         H_interior_list.append(float(split_line[2]))
         P_interior_list.append(float(split_line[3]))
@@ -181,21 +262,25 @@ def get_latest_log_data(days_before = 1):
             T_exterior_list.append(float('nan'))
             H_exterior_list.append(float('nan'))
             P_exterior_list.append(float('nan'))
+        if len(split_line) > 10: # logged with the derived columns
+            specific_humidity_interior_list.append(float(split_line[9]))
+            specific_humidity_exterior_list.append(float(split_line[10]))
+        else:
+            specific_humidity_interior_list.append(specific_humidity(T_interior_list[-1], H_interior_list[-1], P_interior_list[-1]))
+            specific_humidity_exterior_list.append(specific_humidity(T_exterior_list[-1], H_exterior_list[-1], P_exterior_list[-1]))
 
     print(f'Webpage refreshed at {to_date}.')
 
-    return time_stamp_list, T_interior_list, H_interior_list, P_interior_list, Tint_list, T_exterior_list, H_exterior_list, P_exterior_list
+    return time_stamp_list, T_interior_list, H_interior_list, P_interior_list, Tint_list, T_exterior_list, H_exterior_list, P_exterior_list, specific_humidity_interior_list, specific_humidity_exterior_list
 
-def compute_specific_humidity(T_interior_list, H_interior_list, P_interior_list):
-    # T_interior_list in degC
-    # H_interior_list in percentage
-    # P_interior_list in bar
-    specific_humidity_list = []
-    for i in range(len(T_interior_list)):
-        saturation_press = 0.0061078 * math.exp((17.27 * T_interior_list[i]) / (T_interior_list[i] + 237.3)) # bar
-        vapor_press = H_interior_list[i] / 100 * saturation_press
-        specific_humidity_list.append(1000 * vapor_press / (1.6078 * P_interior_list[i] - 0.6078 * vapor_press))
-    return specific_humidity_list # g H2O per Kg of humid air
+def specific_humidity(T, H, P):
+    # for rows logged before the logger derived it (include/derived_metrics.cpp)
+    # T in degC
+    # H in percentage
+    # P in bar
+    saturation_press = 0.0061078 * math.exp((17.27 * T) / (T + 237.3)) # bar
+    vapor_press = H / 100 * saturation_press
+    return 1000 * vapor_press / (1.6078 * P - 0.6078 * vapor_press) # g H2O per Kg of humid air
 
 
 app.layout = dbc.Container([